@@ -27,6 +27,7 @@
 #include "usbd_ioreq.h"
 #include "usbd_req.h"
 #include "usbd_desc.h"
+#include "usbd_audio_fifo.h"
 
 
 
@@ -45,16 +46,85 @@
   * @{
   */ 
 
-/* AudioFreq * DataSize (2 bytes) * NumChannels (Stereo: 2) */
-#define AUDIO_OUT_PACKET                              (uint32_t)(((USBD_AUDIO_FREQ * 2 * 2) /1000)) 
-
-/* Number of sub-packets in the audio transfer buffer. You can modify this value but always make sure
+/* The streaming formats and sampling rates are read from the alternate
+   settings of the AudioStreaming interface in the configuration descriptor.
+   The buffers are sized at compile time for the largest of them: the
+   highest sampling rate, and the largest sample frame (DataSize * NumChannels):
+   24 bits stereo by default, which usbd_audio_out_if converts for the codec. */
+#ifndef USBD_AUDIO_MAX_FREQ
+#define USBD_AUDIO_MAX_FREQ                           USBD_AUDIO_FREQ
+#endif
+#ifndef AUDIO_MAX_FRAME_SIZE
+#define AUDIO_MAX_FRAME_SIZE                          6
+#endif
+
+/* Interface number of the AudioStreaming interface */
+#ifndef AUDIO_STREAMING_IF
+#define AUDIO_STREAMING_IF                            1
+#endif
+
+/* Largest nominal packet: AudioFreq * DataSize * NumChannels */
+#define AUDIO_OUT_PACKET                              (uint32_t)((USBD_AUDIO_MAX_FREQ / 1000) * AUDIO_MAX_FRAME_SIZE)
+
+/* The host adjusts its packet sizes to the feedback it gets, by at most one
+   sample per frame. This is also the case for 44.1kHz, sent as 44 or 45 samples. */
+#define AUDIO_OUT_MAX_PACKET                          (AUDIO_OUT_PACKET + AUDIO_MAX_FRAME_SIZE)
+
+/* Size of the audio FIFO, in nominal packets (ie. in ms). You can modify this value but always make sure
   that it is an even number and higher than 3 */
-#define OUT_PACKET_NUM                                   4
-/* Total size of the audio transfer buffer */
+#ifndef OUT_PACKET_NUM
+#define OUT_PACKET_NUM                                   8
+#endif
+/* Storage of the audio FIFO; the part of it in use depends on the current format */
 #define TOTAL_OUT_BUF_SIZE                           ((uint32_t)(AUDIO_OUT_PACKET * OUT_PACKET_NUM))
 
-#define AUDIO_CONFIG_DESC_SIZE                        109
+/* Largest transfer handed to the codec DMA at once, in nominal packets.
+   Playback starts once half of the FIFO is filled. */
+#ifndef AUDIO_OUT_DMA_PACKETS
+#define AUDIO_OUT_DMA_PACKETS                        2
+#endif
+
+/* Capture (audio IN) stream, enabled with USBD_AUDIO_IN_ENABLED. The codec
+   DMA fills a ring of IN_PACKET_NUM nominal packets in circular mode, and
+   one frame worth of samples is sent from it at each SOF. */
+#ifndef AUDIO_STREAMING_IN_IF
+#define AUDIO_STREAMING_IN_IF                         2
+#endif
+#ifndef USBD_AUDIO_IN_MAX_FREQ
+#define USBD_AUDIO_IN_MAX_FREQ                        USBD_AUDIO_FREQ
+#endif
+#ifndef AUDIO_IN_MAX_FRAME_SIZE
+#define AUDIO_IN_MAX_FRAME_SIZE                       4
+#endif
+#ifndef IN_PACKET_NUM
+#define IN_PACKET_NUM                                 8
+#endif
+#define AUDIO_IN_PACKET                               (uint32_t)((USBD_AUDIO_IN_MAX_FREQ / 1000) * AUDIO_IN_MAX_FRAME_SIZE)
+#define AUDIO_IN_MAX_PACKET                           (AUDIO_IN_PACKET + AUDIO_IN_MAX_FRAME_SIZE)
+#define TOTAL_IN_BUF_SIZE                             ((uint32_t)(AUDIO_IN_PACKET * IN_PACKET_NUM))
+/* Rate matching: a sample frame is added to, or removed from, a packet when
+   the ring fill level strays from its middle by more than this, in frames */
+#ifndef AUDIO_IN_RATE_THRESHOLD
+#define AUDIO_IN_RATE_THRESHOLD                       4
+#endif
+
+/* Explicit feedback endpoint value: 10.14 on 3 bytes */
+#define AUDIO_FEEDBACK_PACKET                         3
+
+/* Gains of the PI controller computing the feedback value out of the buffer
+   fill level, expressed as right shifts: an error of 1 sample changes the
+   feedback by 1/2^AUDIO_FB_KP_SHIFT sample per frame right away, and by
+   1/2^AUDIO_FB_KI_SHIFT sample per frame per refresh period after that. */
+#ifndef AUDIO_FB_KP_SHIFT
+#define AUDIO_FB_KP_SHIFT                             6
+#endif
+#ifndef AUDIO_FB_KI_SHIFT
+#define AUDIO_FB_KI_SHIFT                             12
+#endif
+#define AUDIO_FB_INTEGRAL_MAX                         (1 << (AUDIO_FB_KI_SHIFT - 2))
+/* The feedback never strays further than this from the nominal rate (16.16) */
+#define AUDIO_FB_MAX_DEVIATION                        (1 << 14)
+
 #define AUDIO_INTERFACE_DESC_SIZE                     9
 #define USB_AUDIO_DESC_SIZ                            0x09
 #define AUDIO_STANDARD_ENDPOINT_DESC_SIZE             0x09
@@ -88,11 +158,16 @@
 #define AUDIO_FORMAT_TYPE_III                         0x03
 
 #define USB_ENDPOINT_TYPE_ISOCHRONOUS                 0x01
+#define USB_ENDPOINT_SYNC_ASYNCHRONOUS                0x04
+#define USB_ENDPOINT_USAGE_FEEDBACK                   0x10
 #define AUDIO_ENDPOINT_GENERAL                        0x01
 
 #define AUDIO_REQ_GET_CUR                             0x81
 #define AUDIO_REQ_SET_CUR                             0x01
 
+/* Endpoint control selectors */
+#define AUDIO_SAMPLING_FREQ_CONTROL                   0x01
+
 #define AUDIO_OUT_STREAMING_CTRL                      0x02
 
 /**
@@ -112,7 +187,41 @@ typedef struct _Audio_Fops
     uint8_t  (*MuteCtl)      (uint8_t cmd);
     uint8_t  (*PeriodicTC)   (uint8_t cmd);
     uint8_t  (*GetState)     (void);
+    /* Optional: called when the host selects another format or sampling rate */
+    uint8_t  (*SetFormat)    (uint32_t AudioFreq, uint8_t Channels, uint8_t SubFrame, uint8_t Resolution);
+    /* Capture: offset, in bytes, the circular DMA is about to write to.
+       Playback, optional: bytes of the chunk of the last AUDIO_CMD_PLAY
+       the codec played already; without it the feedback only sees the
+       buffer level move at the end of each chunk */
+    uint32_t (*GetPosition)  (void);
 }AUDIO_FOPS_TypeDef;
+
+/* Streaming parameters of one alternate setting, as found in the
+   configuration descriptor */
+typedef struct _Audio_Stream
+{
+  uint8_t  ep;             /* data endpoint address */
+  uint8_t  feedback_ep;    /* explicit feedback endpoint address, 0 if none */
+  uint8_t  refresh;        /* feedback refresh period, as a power of 2 */
+  uint8_t  channels;       /* bNrChannels */
+  uint8_t  subframe;       /* bSubFrameSize, in bytes */
+  uint8_t  resolution;     /* bBitResolution */
+  uint8_t  num_rates;      /* bSamFreqType; 0 for a continuous range */
+  const uint8_t *rates;    /* tSamFreq, 3 bytes each, within the descriptor */
+  uint16_t max_packet;     /* wMaxPacketSize of the data endpoint */
+}
+AUDIO_Stream_TypeDef;
+
+/* Capture stream counters */
+typedef struct _Audio_In_Stats
+{
+  uint32_t packets;        /* packets sent to the host */
+  uint32_t dropped;        /* packets the host didn't pick up in their frame */
+  uint32_t underruns;      /* packets padded with silence, the ring being short */
+  uint32_t overruns;       /* times the DMA caught up with the read pointer */
+  uint32_t adjusted;       /* packets one frame longer or shorter than nominal */
+}
+AUDIO_In_Stats_TypeDef;
 /**
   * @}
   */ 
@@ -122,9 +231,6 @@ typedef struct _Audio_Fops
 /** @defgroup USBD_CORE_Exported_Macros
   * @{
   */ 
-#define AUDIO_PACKET_SZE(frq)          (uint8_t)(((frq * 2 * 2)/1000) & 0xFF), \
-                                       (uint8_t)((((frq * 2 * 2)/1000) >> 8) & 0xFF)
-#define SAMPLE_FREQ(frq)               (uint8_t)(frq), (uint8_t)((frq >> 8)), (uint8_t)((frq >> 16))
 /**
   * @}
   */ 
@@ -134,6 +240,9 @@ typedef struct _Audio_Fops
   */ 
 
 extern USBD_Class_cb_TypeDef  AUDIO_cb;
+#ifdef USBD_AUDIO_IN_ENABLED
+extern AUDIO_In_Stats_TypeDef USBD_AUDIO_IN_Stats;
+#endif
 
 /**
   * @}
@@ -142,6 +251,16 @@ extern USBD_Class_cb_TypeDef  AUDIO_cb;
 /** @defgroup USB_CORE_Exported_Functions
   * @{
   */
+/* Current feedback value sent to the host, in samples per frame (16.16) */
+uint32_t USBD_AUDIO_GetFeedback (void);
+/* Current sampling rate, in Hz */
+uint32_t USBD_AUDIO_GetFrequency (void);
+#ifdef USBD_AUDIO_IN_ENABLED
+/* Current capture sampling rate, in Hz */
+uint32_t USBD_AUDIO_IN_GetFrequency (void);
+#endif
+/* To be called by the codec layer when a transfer started by AudioCmd is over */
+void     USBD_AUDIO_OUT_TransferComplete (void);
 /**
   * @}
   */ 
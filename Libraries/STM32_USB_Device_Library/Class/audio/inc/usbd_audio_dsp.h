@@ -0,0 +1,58 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_dsp.h
+  * @brief   header file for the usbd_audio_dsp.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USB_AUDIO_DSP_H_
+#define __USB_AUDIO_DSP_H_
+
+#include "usbd_ioreq.h"
+
+/* Unity gain, in 16.16 */
+#define AUDIO_DSP_UNITY                 0x10000
+
+/* Largest gain change between two consecutive sample frames: a full scale
+   change then takes 256 frames, ie. about 5ms at 48kHz, which is short
+   enough to feel immediate and long enough not to click */
+#ifndef AUDIO_DSP_RAMP_STEP
+#define AUDIO_DSP_RAMP_STEP             (AUDIO_DSP_UNITY / 256)
+#endif
+
+/* Channel map entry standing for the average of input channels 0 and 1 */
+#define AUDIO_DSP_MIX                   0xFF
+
+/* Software volume and mute, applied to interleaved stereo frames. The gain
+   moves towards its target by AUDIO_DSP_RAMP_STEP per frame. */
+typedef struct _Audio_Dsp_Gain
+{
+  uint32_t current;        /* gain applied to the next frame, 16.16 */
+  uint32_t target;         /* gain to ramp to, 16.16 */
+  uint32_t volume;         /* gain to go back to when unmuted, 16.16 */
+  uint8_t  mute;
+}
+AUDIO_DSP_Gain_TypeDef;
+
+/* Conversion from the USB stream format to the codec one, which is always
+   stereo, with 16 bits samples or 32 bits left justified ones */
+typedef struct _Audio_Dsp_Format
+{
+  uint8_t  in_channels;    /* 1 or 2 */
+  uint8_t  in_bytes;       /* 2, 3 or 4, little endian, left justified */
+  uint8_t  out_bytes;      /* 2 or 4 */
+  uint8_t  map[2];         /* input channel of each output channel, or AUDIO_DSP_MIX */
+}
+AUDIO_DSP_Format_TypeDef;
+
+void      AUDIO_DSP_GainInit      (AUDIO_DSP_Gain_TypeDef *gain, uint8_t vol);
+void      AUDIO_DSP_SetVolume     (AUDIO_DSP_Gain_TypeDef *gain, uint8_t vol);
+void      AUDIO_DSP_SetMute       (AUDIO_DSP_Gain_TypeDef *gain, uint8_t mute);
+void      AUDIO_DSP_Gain16        (AUDIO_DSP_Gain_TypeDef *gain, int16_t *buf, uint32_t frames);
+void      AUDIO_DSP_Gain32        (AUDIO_DSP_Gain_TypeDef *gain, int32_t *buf, uint32_t frames);
+
+uint8_t   AUDIO_DSP_FormatInit    (AUDIO_DSP_Format_TypeDef *fmt, uint8_t channels, uint8_t subframe, uint8_t resolution, uint8_t out_bytes);
+uint8_t   AUDIO_DSP_IsPassThrough (const AUDIO_DSP_Format_TypeDef *fmt);
+uint32_t  AUDIO_DSP_Convert       (const AUDIO_DSP_Format_TypeDef *fmt, const uint8_t *in, uint8_t *out, uint32_t frames);
+
+#endif  /* __USB_AUDIO_DSP_H_ */
@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_fifo.h
+  * @brief   header file for the usbd_audio_fifo.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USB_AUDIO_FIFO_H_
+#define __USB_AUDIO_FIFO_H_
+
+#include "usbd_ioreq.h"
+
+/* Byte-granular FIFO between the isochronous endpoint and the codec DMA.
+   There is a single producer and a single consumer, which may run from
+   different interrupts: the producer only moves wr, the consumer only
+   moves rd. One byte is always left unused, so wr == rd means empty.
+   Writes only ever append whole sample frames of align bytes, and the size
+   is a multiple of it, so an overflow drops frames, never part of one. */
+typedef struct _Audio_Fifo
+{
+  uint8_t       *buf;
+  uint32_t      size;
+  uint32_t      align;
+  __IO uint32_t wr;
+  __IO uint32_t rd;
+}
+AUDIO_FIFO_TypeDef;
+
+void      AUDIO_FIFO_Init         (AUDIO_FIFO_TypeDef *fifo, uint8_t *buf, uint32_t size, uint32_t align);
+void      AUDIO_FIFO_Reset        (AUDIO_FIFO_TypeDef *fifo);
+uint32_t  AUDIO_FIFO_Fill         (const AUDIO_FIFO_TypeDef *fifo);
+uint32_t  AUDIO_FIFO_Room         (const AUDIO_FIFO_TypeDef *fifo);
+
+/* Producer side */
+uint32_t  AUDIO_FIFO_Write        (AUDIO_FIFO_TypeDef *fifo, const uint8_t *data, uint32_t len);
+uint32_t  AUDIO_FIFO_WriteSilence (AUDIO_FIFO_TypeDef *fifo, uint32_t len);
+
+/* Consumer side */
+uint8_t * AUDIO_FIFO_Peek         (const AUDIO_FIFO_TypeDef *fifo, uint32_t maxlen, uint32_t align, uint32_t *len);
+void      AUDIO_FIFO_Consume      (AUDIO_FIFO_TypeDef *fifo, uint32_t len);
+
+#endif  /* __USB_AUDIO_FIFO_H_ */
@@ -0,0 +1,22 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_in_if_template.h
+  * @brief   Header for usbd_audio_in_if_template.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USBD_AUDIO_IN_IF_TEMPLATE_H
+#define __USBD_AUDIO_IN_IF_TEMPLATE_H
+
+#include "usbd_conf.h"
+#include "usbd_audio_core.h"
+#include "usbd_audio_out_if.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+
+extern AUDIO_FOPS_TypeDef  AUDIO_IN_fops;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+#endif /* __USBD_AUDIO_IN_IF_TEMPLATE_H */
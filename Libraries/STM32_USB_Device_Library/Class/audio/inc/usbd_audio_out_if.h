@@ -59,6 +59,22 @@ typedef enum
 #define AUDIO_OK                        0x00
 #define AUDIO_FAIL                      0xFF
 
+/* Sample size the codec is fed with, in bytes: 2 for 16 bits, 4 for 24 or
+   32 bits left justified. The stream is converted to it when different. */
+#ifndef AUDIO_OUT_CODEC_BYTES
+#define AUDIO_OUT_CODEC_BYTES           2
+#endif
+
+/* DMA stream the codec driver plays the chunks with, for the playback
+   position the feedback needs */
+#ifndef AUDIO_OUT_DMA_STREAM
+#define AUDIO_OUT_DMA_STREAM            AUDIO_I2S_DMA_STREAM
+#endif
+
+/* Define AUDIO_OUT_SOFT_VOLUME to apply the volume and mute to the samples,
+   for codecs without these controls; the codec then stays at full volume.
+   Define AUDIO_OUT_SWAP_CHANNELS to swap the left and right channels. */
+
 /* Audio Machine States */
 #define AUDIO_STATE_INACTIVE            0x00
 #define AUDIO_STATE_ACTIVE              0x01
@@ -23,15 +23,26 @@
   *             - Device descriptor management
   *             - Configuration descriptor management
   *             - Standard AC Interface Descriptor management
-  *             - 1 Audio Streaming Interface (with single channel, PCM, Stereo mode)
-  *             - 1 Audio Streaming Endpoint
+  *             - 1 Audio Streaming Interface, with PCM alternate settings of any
+  *               channel count, sample size and sampling rates, as declared by
+  *               the USB::Audio templates of the configuration descriptor
+  *             - 1 Audio Streaming Endpoint, opened only for the active alternate setting
   *             - 1 Audio Terminal Input (1 channel)
   *             - Audio Class-Specific AC Interfaces
   *             - Audio Class-Specific AS Interfaces
   *             - AudioControl Requests: only SET_CUR and GET_CUR requests are supported (for Mute)
+  *             - Endpoint Requests: SET_CUR and GET_CUR for the sampling frequency
   *             - Audio Feature Unit (limited to Mute control)
-  *             - Audio Synchronization type: Asynchronous
-  *             - Single fixed audio sampling rate (configurable in usbd_conf.h file)
+  *             - Audio Synchronization type: Asynchronous, with an explicit feedback
+  *               endpoint driven by the fill level of the audio FIFO
+  *             - Variable packet sizes, lost packets replaced by silence, and the
+  *               codec DMA fed from the FIFO in chunks of up to AUDIO_OUT_DMA_CHUNK
+  *             - Optional capture stream (USBD_AUDIO_IN_ENABLED), on a second Audio
+  *               Streaming Interface: the codec DMA fills a ring in circular mode,
+  *               and each SOF sends one frame worth of samples to the host, one
+  *               sample frame more or less when the codec clock drifts (asynchronous)
+  *             - Multiple sampling rates, switched without reallocating the buffers
+  *               (sized for USBD_AUDIO_MAX_FREQ and AUDIO_MAX_FRAME_SIZE in usbd_conf.h file)
   *          
   *           @note
   *            The Audio Class 1.0 is based on USB Specification 1.0 and thus supports only
@@ -51,8 +62,6 @@
   *             - MIDI interfaces and modules
   *             - Mixer/Selector/Processing/Extension Units (Feature unit is limited to Mute control)
   *             - Any other application-specific modules
-  *             - Multiple and Variable audio sampling rates
-  *             - Out Streaming Endpoint/Interface (microphone)
   *      
   *  @endverbatim
   *                                  
@@ -75,6 +84,8 @@
 #include "usbd_audio_core.h"
 #include "usbd_audio_out_if.h"
 
+#include <string.h>
+
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
   * @{
   */
@@ -123,6 +134,7 @@ static uint8_t  usbd_audio_EP0_RxReady(void *pdev);
 static uint8_t  usbd_audio_DataIn     (void *pdev, uint8_t epnum);
 static uint8_t  usbd_audio_DataOut    (void *pdev, uint8_t epnum);
 static uint8_t  usbd_audio_SOF        (void *pdev);
+static uint8_t  usbd_audio_IN_Incplt  (void  *pdev);
 static uint8_t  usbd_audio_OUT_Incplt (void  *pdev);
 
 /*********************************************
@@ -130,7 +142,24 @@ static uint8_t  usbd_audio_OUT_Incplt (void  *pdev);
  *********************************************/
 static void AUDIO_Req_GetCurrent(void *pdev, USB_SETUP_REQ *req);
 static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req);
+static void AUDIO_Feedback_Update(void);
+static void AUDIO_OUT_Play(void);
+static uint8_t  AUDIO_Stream_Parse   (uint8_t itf, uint8_t alt, AUDIO_Stream_TypeDef *stream);
+static uint8_t  AUDIO_Stream_HasRate (const AUDIO_Stream_TypeDef *stream, uint32_t freq);
+static uint8_t  AUDIO_Stream_Start   (void *pdev, uint8_t alt);
+static void     AUDIO_Stream_Stop    (void *pdev);
+static uint8_t  AUDIO_SetFrequency   (uint32_t freq);
+#ifdef USBD_AUDIO_IN_ENABLED
+static uint8_t  AUDIO_IN_Start       (void *pdev, uint8_t alt);
+static void     AUDIO_IN_Stop        (void *pdev);
+static uint8_t  AUDIO_IN_SetFrequency(uint32_t freq);
+static void     AUDIO_IN_SOF         (void *pdev);
+
+extern AUDIO_FOPS_TypeDef  AUDIO_IN_fops;
+#endif
 static uint8_t  *USBD_audio_GetCfgDesc (uint8_t speed, uint16_t *length);
+
+const uint8_t * get_USB_configuration_descriptor(int index);
 /**
   * @}
   */ 
@@ -138,21 +167,55 @@ static uint8_t  *USBD_audio_GetCfgDesc (uint8_t speed, uint16_t *length);
 /** @defgroup usbd_audio_Private_Variables
   * @{
   */ 
-/* Main Buffer for Audio Data Out transfers and its relative pointers */
-uint8_t  IsocOutBuff [TOTAL_OUT_BUF_SIZE * 2];
-uint8_t* IsocOutWrPtr = IsocOutBuff;
-uint8_t* IsocOutRdPtr = IsocOutBuff;
+/* Reception buffer for Audio Data Out transfers, and the FIFO its content
+   is appended to. The codec DMA reads straight from the FIFO storage. */
+uint8_t  IsocOutBuff [AUDIO_OUT_MAX_PACKET];
+static uint8_t AudioOutFifoBuff [TOTAL_OUT_BUF_SIZE];
+static AUDIO_FIFO_TypeDef AudioOutFifo;
+static __IO uint32_t AudioOutInFlight = 0;
+
+/* Explicit feedback, in 16.16 samples per frame, and its 10.14 encoding */
+static uint32_t FeedbackNominal = 0;
+static uint32_t FeedbackValue = 0;
+static int32_t  FeedbackIntegral = 0;
+static uint32_t FeedbackFrames = 0;
+static __IO uint8_t FeedbackBusy = 0;
+static uint8_t  FeedbackBuff[AUDIO_FEEDBACK_PACKET];
 
 /* Main Buffer for Audio Control Rrequests transfers and its relative variables */
 uint8_t  AudioCtl[64];
 uint8_t  AudioCtlCmd = 0;
 uint32_t AudioCtlLen = 0;
 uint8_t  AudioCtlUnit = 0;
+uint8_t  AudioCtlEp = 0;        /* endpoint addressed by the request, 0 for units */
+uint8_t  AudioCtlSelector = 0;
 
-static uint32_t PlayFlag = 0;
+static __IO uint32_t PlayFlag = 0;
 
+/* Active alternate setting, and the current format */
 static __IO uint32_t  usbd_audio_AltSet = 0;
-static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE];
+static AUDIO_Stream_TypeDef AudioStream;
+static uint32_t AudioFreq = USBD_AUDIO_FREQ;
+static uint32_t AudioFrameSize = 4;
+static uint32_t AudioOutPacket = 0;     /* nominal packet size, in bytes */
+
+#ifdef USBD_AUDIO_IN_ENABLED
+/* Capture ring, written by the codec DMA in circular mode, and the
+   transmission buffer one packet is copied into at each SOF */
+static uint8_t  AudioInRing [TOTAL_IN_BUF_SIZE];
+uint8_t  IsocInBuff [AUDIO_IN_MAX_PACKET];
+static uint32_t AudioInRingSize = 0;
+static uint32_t AudioInRd = 0;
+static __IO uint8_t AudioInBusy = 0;
+static uint8_t  AudioInStarted = 0;     /* ring half filled once */
+static __IO uint32_t  usbd_audio_InAltSet = 0;
+static AUDIO_Stream_TypeDef AudioInStream;
+static uint32_t AudioInFreq = USBD_AUDIO_FREQ;
+static uint32_t AudioInFrameSize = 4;
+static uint32_t AudioInNominal = 0;     /* 16.16 sample frames per USB frame */
+static uint32_t AudioInAccum = 0;       /* fractional part of the above */
+AUDIO_In_Stats_TypeDef USBD_AUDIO_IN_Stats;
+#endif
 
 /* AUDIO interface class callbacks structure */
 USBD_Class_cb_TypeDef  AUDIO_cb = 
@@ -165,7 +228,7 @@ USBD_Class_cb_TypeDef  AUDIO_cb =
   usbd_audio_DataIn,
   usbd_audio_DataOut,
   usbd_audio_SOF,
-  NULL,
+  usbd_audio_IN_Incplt,
   usbd_audio_OUT_Incplt,   
   USBD_audio_GetCfgDesc,
 #ifdef USB_OTG_HS_CORE  
@@ -173,154 +236,6 @@ USBD_Class_cb_TypeDef  AUDIO_cb =
 #endif    
 };
 
-/* USB AUDIO device Configuration Descriptor */
-static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
-{
-  /* Configuration 1 */
-  0x09,                                 /* bLength */
-  USB_CONFIGURATION_DESCRIPTOR_TYPE,    /* bDescriptorType */
-  LOBYTE(AUDIO_CONFIG_DESC_SIZE),       /* wTotalLength  109 bytes*/
-  HIBYTE(AUDIO_CONFIG_DESC_SIZE),      
-  0x02,                                 /* bNumInterfaces */
-  0x01,                                 /* bConfigurationValue */
-  0x00,                                 /* iConfiguration */
-  0xC0,                                 /* bmAttributes  BUS Powred*/
-  0x32,                                 /* bMaxPower = 100 mA*/
-  /* 09 byte*/
-  
-  /* USB Speaker Standard interface descriptor */
-  AUDIO_INTERFACE_DESC_SIZE,            /* bLength */
-  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
-  0x00,                                 /* bInterfaceNumber */
-  0x00,                                 /* bAlternateSetting */
-  0x00,                                 /* bNumEndpoints */
-  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
-  AUDIO_SUBCLASS_AUDIOCONTROL,          /* bInterfaceSubClass */
-  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
-  0x00,                                 /* iInterface */
-  /* 09 byte*/
-  
-  /* USB Speaker Class-specific AC Interface Descriptor */
-  AUDIO_INTERFACE_DESC_SIZE,            /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_CONTROL_HEADER,                 /* bDescriptorSubtype */
-  0x00,          /* 1.00 */             /* bcdADC */
-  0x01,
-  0x27,                                 /* wTotalLength = 39*/
-  0x00,
-  0x01,                                 /* bInCollection */
-  0x01,                                 /* baInterfaceNr */
-  /* 09 byte*/
-  
-  /* USB Speaker Input Terminal Descriptor */
-  AUDIO_INPUT_TERMINAL_DESC_SIZE,       /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_CONTROL_INPUT_TERMINAL,         /* bDescriptorSubtype */
-  0x01,                                 /* bTerminalID */
-  0x01,                                 /* wTerminalType AUDIO_TERMINAL_USB_STREAMING   0x0101 */
-  0x01,
-  0x00,                                 /* bAssocTerminal */
-  0x01,                                 /* bNrChannels */
-  0x00,                                 /* wChannelConfig 0x0000  Mono */
-  0x00,
-  0x00,                                 /* iChannelNames */
-  0x00,                                 /* iTerminal */
-  /* 12 byte*/
-  
-  /* USB Speaker Audio Feature Unit Descriptor */
-  0x09,                                 /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_CONTROL_FEATURE_UNIT,           /* bDescriptorSubtype */
-  AUDIO_OUT_STREAMING_CTRL,             /* bUnitID */
-  0x01,                                 /* bSourceID */
-  0x01,                                 /* bControlSize */
-  AUDIO_CONTROL_MUTE,                   /* bmaControls(0) */
-  0x00,                                 /* bmaControls(1) */
-  0x00,                                 /* iTerminal */
-  /* 09 byte*/
-  
-  /*USB Speaker Output Terminal Descriptor */
-  0x09,      /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_CONTROL_OUTPUT_TERMINAL,        /* bDescriptorSubtype */
-  0x03,                                 /* bTerminalID */
-  0x01,                                 /* wTerminalType  0x0301*/
-  0x03,
-  0x00,                                 /* bAssocTerminal */
-  0x02,                                 /* bSourceID */
-  0x00,                                 /* iTerminal */
-  /* 09 byte*/
-  
-  /* USB Speaker Standard AS Interface Descriptor - Audio Streaming Zero Bandwith */
-  /* Interface 1, Alternate Setting 0                                             */
-  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
-  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
-  0x01,                                 /* bInterfaceNumber */
-  0x00,                                 /* bAlternateSetting */
-  0x00,                                 /* bNumEndpoints */
-  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
-  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
-  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
-  0x00,                                 /* iInterface */
-  /* 09 byte*/
-  
-  /* USB Speaker Standard AS Interface Descriptor - Audio Streaming Operational */
-  /* Interface 1, Alternate Setting 1                                           */
-  AUDIO_INTERFACE_DESC_SIZE,  /* bLength */
-  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */
-  0x01,                                 /* bInterfaceNumber */
-  0x01,                                 /* bAlternateSetting */
-  0x01,                                 /* bNumEndpoints */
-  USB_DEVICE_CLASS_AUDIO,               /* bInterfaceClass */
-  AUDIO_SUBCLASS_AUDIOSTREAMING,        /* bInterfaceSubClass */
-  AUDIO_PROTOCOL_UNDEFINED,             /* bInterfaceProtocol */
-  0x00,                                 /* iInterface */
-  /* 09 byte*/
-  
-  /* USB Speaker Audio Streaming Interface Descriptor */
-  AUDIO_STREAMING_INTERFACE_DESC_SIZE,  /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_STREAMING_GENERAL,              /* bDescriptorSubtype */
-  0x01,                                 /* bTerminalLink */
-  0x01,                                 /* bDelay */
-  0x01,                                 /* wFormatTag AUDIO_FORMAT_PCM  0x0001*/
-  0x00,
-  /* 07 byte*/
-  
-  /* USB Speaker Audio Type III Format Interface Descriptor */
-  0x0B,                                 /* bLength */
-  AUDIO_INTERFACE_DESCRIPTOR_TYPE,      /* bDescriptorType */
-  AUDIO_STREAMING_FORMAT_TYPE,          /* bDescriptorSubtype */
-  AUDIO_FORMAT_TYPE_III,                /* bFormatType */ 
-  0x02,                                 /* bNrChannels */
-  0x02,                                 /* bSubFrameSize :  2 Bytes per frame (16bits) */
-  16,                                   /* bBitResolution (16-bits per sample) */ 
-  0x01,                                 /* bSamFreqType only one frequency supported */ 
-  SAMPLE_FREQ(USBD_AUDIO_FREQ),         /* Audio sampling frequency coded on 3 bytes */
-  /* 11 byte*/
-  
-  /* Endpoint 1 - Standard Descriptor */
-  AUDIO_STANDARD_ENDPOINT_DESC_SIZE,    /* bLength */
-  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */
-  AUDIO_OUT_EP,                         /* bEndpointAddress 1 out endpoint*/
-  USB_ENDPOINT_TYPE_ISOCHRONOUS,        /* bmAttributes */
-  AUDIO_PACKET_SZE(USBD_AUDIO_FREQ),    /* wMaxPacketSize in Bytes (Freq(Samples)*2(Stereo)*2(HalfWord)) */
-  0x01,                                 /* bInterval */
-  0x00,                                 /* bRefresh */
-  0x00,                                 /* bSynchAddress */
-  /* 09 byte*/
-  
-  /* Endpoint - Audio Streaming Descriptor*/
-  AUDIO_STREAMING_ENDPOINT_DESC_SIZE,   /* bLength */
-  AUDIO_ENDPOINT_DESCRIPTOR_TYPE,       /* bDescriptorType */
-  AUDIO_ENDPOINT_GENERAL,               /* bDescriptor */
-  0x00,                                 /* bmAttributes */
-  0x00,                                 /* bLockDelayUnits */
-  0x00,                                 /* wLockDelay */
-  0x00,
-  /* 07 byte*/
-} ;
-
 /**
   * @}
   */ 
@@ -339,23 +254,34 @@ static uint8_t usbd_audio_CfgDesc[AUDIO_CONFIG_DESC_SIZE] =
 static uint8_t  usbd_audio_Init (void  *pdev, 
                                  uint8_t cfgidx)
 {  
-  /* Open EP OUT */
-  DCD_EP_Open(pdev,
-              AUDIO_OUT_EP,
-              AUDIO_OUT_PACKET,
-              USB_OTG_EP_ISOC);
+  /* The streaming endpoints are only opened, and their bandwidth reserved,
+     when the host selects an operational alternate setting */
+  usbd_audio_AltSet = 0;
+  AudioStream.ep = 0;
+  AudioStream.feedback_ep = 0;
+  AudioFreq = USBD_AUDIO_FREQ;
+  AUDIO_FIFO_Init(&AudioOutFifo, AudioOutFifoBuff, TOTAL_OUT_BUF_SIZE, AudioFrameSize);
+  AudioOutInFlight = 0;
+  PlayFlag = 0;
 
   /* Initialize the Audio output Hardware layer */
   if (AUDIO_OUT_fops.Init(USBD_AUDIO_FREQ, DEFAULT_VOLUME, 0) != USBD_OK)
   {
     return USBD_FAIL;
   }
-    
-  /* Prepare Out endpoint to receive audio data */
-  DCD_EP_PrepareRx(pdev,
-                   AUDIO_OUT_EP,
-                   (uint8_t*)IsocOutBuff,                        
-                   AUDIO_OUT_PACKET);  
+
+#ifdef USBD_AUDIO_IN_ENABLED
+  usbd_audio_InAltSet = 0;
+  AudioInStream.ep = 0;
+  AudioInFreq = USBD_AUDIO_FREQ;
+  AudioInBusy = 0;
+
+  /* Initialize the Audio input Hardware layer */
+  if (AUDIO_IN_fops.Init(USBD_AUDIO_FREQ, 0, 0) != USBD_OK)
+  {
+    return USBD_FAIL;
+  }
+#endif
   
   return USBD_OK;
 }
@@ -370,13 +296,25 @@ static uint8_t  usbd_audio_Init (void  *pdev,
 static uint8_t  usbd_audio_DeInit (void  *pdev, 
                                    uint8_t cfgidx)
 { 
-  DCD_EP_Close (pdev , AUDIO_OUT_EP);
+  AUDIO_Stream_Stop(pdev);
+  usbd_audio_AltSet = 0;
   
   /* DeInitialize the Audio output Hardware layer */
   if (AUDIO_OUT_fops.DeInit(0) != USBD_OK)
   {
     return USBD_FAIL;
   }
+
+#ifdef USBD_AUDIO_IN_ENABLED
+  AUDIO_IN_Stop(pdev);
+  usbd_audio_InAltSet = 0;
+
+  /* DeInitialize the Audio input Hardware layer */
+  if (AUDIO_IN_fops.DeInit(0) != USBD_OK)
+  {
+    return USBD_FAIL;
+  }
+#endif
   
   return USBD_OK;
 }
@@ -391,8 +329,7 @@ static uint8_t  usbd_audio_DeInit (void  *pdev,
 static uint8_t  usbd_audio_Setup (void  *pdev, 
                                   USB_SETUP_REQ *req)
 {
-  uint16_t len;
-  uint8_t  *pbuf;
+  static uint8_t  ctl_altset = 0;
   
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
@@ -418,37 +355,59 @@ static uint8_t  usbd_audio_Setup (void  *pdev,
   case USB_REQ_TYPE_STANDARD:
     switch (req->bRequest)
     {
-    case USB_REQ_GET_DESCRIPTOR: 
-      if( (req->wValue >> 8) == AUDIO_DESCRIPTOR_TYPE)
+    case USB_REQ_GET_INTERFACE :
+#ifdef USBD_AUDIO_IN_ENABLED
+      if (LOBYTE(req->wIndex) == AUDIO_STREAMING_IN_IF)
       {
-#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
-        pbuf = usbd_audio_Desc;   
-#else
-        pbuf = usbd_audio_CfgDesc + 18;
-#endif 
-        len = MIN(USB_AUDIO_DESC_SIZ , req->wLength);
+        USBD_CtlSendData (pdev,
+                          (uint8_t *)&usbd_audio_InAltSet,
+                          1);
+        break;
       }
-      
-      USBD_CtlSendData (pdev, 
-                        pbuf,
-                        len);
-      break;
-      
-    case USB_REQ_GET_INTERFACE :
+#endif
       USBD_CtlSendData (pdev,
-                        (uint8_t *)&usbd_audio_AltSet,
+                        (LOBYTE(req->wIndex) == AUDIO_STREAMING_IF) ?
+                          (uint8_t *)&usbd_audio_AltSet : &ctl_altset,
                         1);
       break;
       
     case USB_REQ_SET_INTERFACE :
-      if ((uint8_t)(req->wValue) < AUDIO_TOTAL_IF_NUM)
+#ifdef USBD_AUDIO_IN_ENABLED
+      if (LOBYTE(req->wIndex) == AUDIO_STREAMING_IN_IF)
       {
-        usbd_audio_AltSet = (uint8_t)(req->wValue);
+        if ((uint8_t)(req->wValue) != usbd_audio_InAltSet)
+        {
+          AUDIO_IN_Stop(pdev);
+          usbd_audio_InAltSet = 0;
+
+          if (((uint8_t)(req->wValue) != 0) &&
+              (AUDIO_IN_Start(pdev, (uint8_t)(req->wValue)) != USBD_OK))
+          {
+            USBD_CtlError (pdev, req);
+          }
+        }
+        break;
       }
-      else
+#endif
+      if (LOBYTE(req->wIndex) != AUDIO_STREAMING_IF)
       {
-        /* Call the error management function (command will be nacked */
-        USBD_CtlError (pdev, req);
+        /* The AudioControl interface only has its alternate setting 0 */
+        if ((uint8_t)(req->wValue) != 0)
+        {
+          USBD_CtlError (pdev, req);
+        }
+      }
+      else if ((uint8_t)(req->wValue) != usbd_audio_AltSet)
+      {
+        AUDIO_Stream_Stop(pdev);
+        usbd_audio_AltSet = 0;
+
+        if (((uint8_t)(req->wValue) != 0) &&
+            (AUDIO_Stream_Start(pdev, (uint8_t)(req->wValue)) != USBD_OK))
+        {
+          /* Call the error management function (command will be nacked */
+          USBD_CtlError (pdev, req);
+        }
       }
       break;
     }
@@ -467,8 +426,26 @@ static uint8_t  usbd_audio_EP0_RxReady (void  *pdev)
   /* Check if an AudioControl request has been issued */
   if (AudioCtlCmd == AUDIO_REQ_SET_CUR)
   {/* In this driver, to simplify code, only SET_CUR request is managed */
+    if (AudioCtlEp != 0)
+    {
+      /* Sampling frequency of the streaming endpoint, on 3 bytes */
+      if ((AudioCtlSelector == AUDIO_SAMPLING_FREQ_CONTROL) && (AudioCtlLen >= 3))
+      {
+#ifdef USBD_AUDIO_IN_ENABLED
+        if (AudioCtlEp & 0x80)
+        {
+          AUDIO_IN_SetFrequency(AudioCtl[0] | (AudioCtl[1] << 8) | (AudioCtl[2] << 16));
+        }
+        else
+#endif
+        AUDIO_SetFrequency(AudioCtl[0] | (AudioCtl[1] << 8) | (AudioCtl[2] << 16));
+      }
+      AudioCtlCmd = 0;
+      AudioCtlLen = 0;
+      AudioCtlEp = 0;
+    }
     /* Check for which addressed unit the AudioControl request has been issued */
-    if (AudioCtlUnit == AUDIO_OUT_STREAMING_CTRL)
+    else if (AudioCtlUnit == AUDIO_OUT_STREAMING_CTRL)
     {/* In this driver, to simplify code, only one unit is manage */
       /* Call the audio interface mute function */
       AUDIO_OUT_fops.MuteCtl(AudioCtl[0]);
@@ -491,6 +468,20 @@ static uint8_t  usbd_audio_EP0_RxReady (void  *pdev)
   */
 static uint8_t  usbd_audio_DataIn (void *pdev, uint8_t epnum)
 {
+  if ((AudioStream.feedback_ep != 0) && (epnum == (AudioStream.feedback_ep & 0x7F)))
+  {
+    /* The host picked the feedback value up; a new one goes out at next SOF */
+    FeedbackBusy = 0;
+  }
+#ifdef USBD_AUDIO_IN_ENABLED
+  else if ((AudioInStream.ep != 0) && (epnum == (AudioInStream.ep & 0x7F)))
+  {
+    /* The packet went out in its frame; the next one is built at next SOF */
+    AudioInBusy = 0;
+    USBD_AUDIO_IN_Stats.packets++;
+  }
+#endif
+
   return USBD_OK;
 }
 
@@ -503,17 +494,17 @@ static uint8_t  usbd_audio_DataIn (void *pdev, uint8_t epnum)
   */
 static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
 {     
-  if (epnum == AUDIO_OUT_EP)
+  uint16_t count;
+
+  if ((AudioStream.ep != 0) && (epnum == (AudioStream.ep & 0x7F)))
   {    
-    /* Increment the Buffer pointer or roll it back when all buffers are full */
-    if (IsocOutWrPtr >= (IsocOutBuff + (AUDIO_OUT_PACKET * OUT_PACKET_NUM)))
-    {/* All buffers are full: roll back */
-      IsocOutWrPtr = IsocOutBuff;
-    }
-    else
-    {/* Increment the buffer pointer */
-      IsocOutWrPtr += AUDIO_OUT_PACKET;
-    }
+    /* Packets may be shorter or longer than AudioOutPacket, depending on
+       the feedback the host got, so go with what was actually received */
+    count = ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count;
+
+    /* Whatever doesn't fit is dropped, in whole sample frames so that the
+       channels stay in place; the feedback is supposed to avoid that. */
+    AUDIO_FIFO_Write(&AudioOutFifo, IsocOutBuff, count);
     
     /* Toggle the frame index */  
     ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].even_odd_frame = 
@@ -521,15 +512,16 @@ static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
       
     /* Prepare Out endpoint to receive next audio packet */
     DCD_EP_PrepareRx(pdev,
-                     AUDIO_OUT_EP,
-                     (uint8_t*)(IsocOutWrPtr),
-                     AUDIO_OUT_PACKET);
+                     AudioStream.ep,
+                     (uint8_t*)(IsocOutBuff),
+                     AudioStream.max_packet);
       
     /* Trigger the start of streaming only when half buffer is full */
-    if ((PlayFlag == 0) && (IsocOutWrPtr >= (IsocOutBuff + ((AUDIO_OUT_PACKET * OUT_PACKET_NUM) / 2))))
+    if ((PlayFlag == 0) && (AUDIO_FIFO_Fill(&AudioOutFifo) >= (AudioOutFifo.size / 2)))
     {
       /* Enable start of Streaming */
       PlayFlag = 1;
+      AUDIO_OUT_Play();
     }
   }
   
@@ -538,53 +530,69 @@ static uint8_t  usbd_audio_DataOut (void *pdev, uint8_t epnum)
 
 /**
   * @brief  usbd_audio_SOF
-  *         Handles the SOF event (data buffer update and synchronization).
+  *         Handles the SOF event (synchronization). Playback itself is paced
+  *         by the codec, through USBD_AUDIO_OUT_TransferComplete.
   * @param  pdev: instance
   * @param  epnum: endpoint number
   * @retval status
   */
 static uint8_t  usbd_audio_SOF (void *pdev)
 {     
-  /* Check if there are available data in stream buffer.
-    In this function, a single variable (PlayFlag) is used to avoid software delays.
-    The play operation must be executed as soon as possible after the SOF detection. */
-  if (PlayFlag)
-  {      
-    /* Start playing received packet */
-    AUDIO_OUT_fops.AudioCmd((uint8_t*)(IsocOutRdPtr),  /* Samples buffer pointer */
-                            AUDIO_OUT_PACKET,          /* Number of samples in Bytes */
-                            AUDIO_CMD_PLAY);           /* Command to be processed */
-    
-    /* Increment the Buffer pointer or roll it back when all buffers all full */  
-    if (IsocOutRdPtr >= (IsocOutBuff + (AUDIO_OUT_PACKET * OUT_PACKET_NUM)))
-    {/* Roll back to the start of buffer */
-      IsocOutRdPtr = IsocOutBuff;
-    }
-    else
-    {/* Increment to the next sub-buffer */
-      IsocOutRdPtr += AUDIO_OUT_PACKET;
+  /* Send the feedback value, computed once per refresh period */
+  if (usbd_audio_AltSet && AudioStream.feedback_ep)
+  {
+    if ((FeedbackFrames++ & ((1 << AudioStream.refresh) - 1)) == 0)
+    {
+      AUDIO_Feedback_Update();
     }
-    
-    /* If all available buffers have been consumed, stop playing */
-    if (IsocOutRdPtr == IsocOutWrPtr)
-    {    
-      /* Pause the audio stream */
-      AUDIO_OUT_fops.AudioCmd((uint8_t*)(IsocOutBuff),   /* Samples buffer pointer */
-                              AUDIO_OUT_PACKET,          /* Number of samples in Bytes */
-                              AUDIO_CMD_PAUSE);          /* Command to be processed */
-      
-      /* Stop entering play loop */
-      PlayFlag = 0;
-      
-      /* Reset buffer pointers */
-      IsocOutRdPtr = IsocOutBuff;
-      IsocOutWrPtr = IsocOutBuff;
+
+    if (!FeedbackBusy)
+    {
+      FeedbackBusy = 1;
+      DCD_EP_Tx (pdev, AudioStream.feedback_ep, FeedbackBuff, AUDIO_FEEDBACK_PACKET);
     }
   }
+
+#ifdef USBD_AUDIO_IN_ENABLED
+  if (usbd_audio_InAltSet)
+  {
+    AUDIO_IN_SOF(pdev);
+  }
+#endif
   
   return USBD_OK;
 }
 
+/**
+  * @brief  usbd_audio_IN_Incplt
+  *         Handles the iso in incomplete event: the host didn't poll the
+  *         feedback endpoint during this frame.
+  * @param  pdev: instance
+  * @retval status
+  */
+static uint8_t  usbd_audio_IN_Incplt (void  *pdev)
+{
+  /* Drop the stale value; a fresh one will be armed at next SOF */
+  if (AudioStream.feedback_ep)
+  {
+    DCD_EP_Flush (pdev, AudioStream.feedback_ep);
+    FeedbackBusy = 0;
+  }
+
+#ifdef USBD_AUDIO_IN_ENABLED
+  /* Same for the capture packet: its samples are lost, but the next packet
+     is built from where the ring read pointer is, so no drift accumulates */
+  if (AudioInBusy)
+  {
+    DCD_EP_Flush (pdev, AudioInStream.ep);
+    AudioInBusy = 0;
+    USBD_AUDIO_IN_Stats.dropped++;
+  }
+#endif
+
+  return USBD_OK;
+}
+
 /**
   * @brief  usbd_audio_OUT_Incplt
   *         Handles the iso out incomplete event.
@@ -593,6 +601,12 @@ static uint8_t  usbd_audio_SOF (void *pdev)
   */
 static uint8_t  usbd_audio_OUT_Incplt (void  *pdev)
 {
+  /* A packet got lost: keep the stream timing by replacing it with silence */
+  if (usbd_audio_AltSet)
+  {
+    AUDIO_FIFO_WriteSilence(&AudioOutFifo, AudioOutPacket);
+  }
+
   return USBD_OK;
 }
 
@@ -608,6 +622,25 @@ static uint8_t  usbd_audio_OUT_Incplt (void  *pdev)
   */
 static void AUDIO_Req_GetCurrent(void *pdev, USB_SETUP_REQ *req)
 {  
+  if ((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT)
+  {
+    /* Send the current sampling frequency */
+    uint32_t freq = AudioFreq;
+#ifdef USBD_AUDIO_IN_ENABLED
+    if (LOBYTE(req->wIndex) & 0x80)
+    {
+      freq = AudioInFreq;
+    }
+#endif
+    AudioCtl[0] = (uint8_t)(freq);
+    AudioCtl[1] = (uint8_t)(freq >> 8);
+    AudioCtl[2] = (uint8_t)(freq >> 16);
+    USBD_CtlSendData (pdev, 
+                      AudioCtl,
+                      MIN(req->wLength, 3));
+    return;
+  }
+
   /* Send the current mute state */
   USBD_CtlSendData (pdev, 
                     AudioCtl,
@@ -634,8 +667,635 @@ static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req)
     to the function usbd_audio_EP0_RxReady() which will process the request */
     AudioCtlCmd = AUDIO_REQ_SET_CUR;     /* Set the request value */
     AudioCtlLen = req->wLength;          /* Set the request data length */
-    AudioCtlUnit = HIBYTE(req->wIndex);  /* Set the request target unit */
+    if ((req->bmRequest & USB_REQ_RECIPIENT_MASK) == USB_REQ_RECIPIENT_ENDPOINT)
+    {
+      AudioCtlEp = LOBYTE(req->wIndex);    /* Set the request target endpoint */
+      AudioCtlUnit = 0;
+    }
+    else
+    {
+      AudioCtlEp = 0;
+      AudioCtlUnit = HIBYTE(req->wIndex);  /* Set the request target unit */
+    }
+    AudioCtlSelector = HIBYTE(req->wValue);
+  }
+}
+
+/**
+  * @brief  AUDIO_Feedback_Update
+  *         Computes the feedback value out of the fill level of the audio
+  *         buffer, using a PI controller targeting AUDIO_FB_TARGET_FILL.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_Feedback_Update(void)
+{
+  int32_t error;
+  int32_t correction;
+  uint32_t fill;
+  uint32_t fb;
+
+  if (!PlayFlag)
+  {
+    /* Not playing yet: ask for the nominal rate, and start from scratch */
+    FeedbackIntegral = 0;
+    fb = FeedbackNominal;
+  }
+  else
+  {
+    /* The chunk the codec is playing only leaves the FIFO once played in
+       full: without the part of it played already, the level would move by
+       whole chunks, and the controller would swing from one bound to the
+       other */
+    fill = AUDIO_FIFO_Fill(&AudioOutFifo);
+    if (AUDIO_OUT_fops.GetPosition != NULL)
+    {
+      fill -= MIN(AUDIO_OUT_fops.GetPosition(), AudioOutInFlight);
+    }
+
+    /* Positive when the buffer is running low, ie. when the host has to
+       speed up; in samples */
+    error = ((int32_t)(AudioOutFifo.size / 2) - (int32_t)fill) / (int32_t)AudioFrameSize;
+
+    FeedbackIntegral += error;
+    if (FeedbackIntegral > AUDIO_FB_INTEGRAL_MAX)
+    {
+      FeedbackIntegral = AUDIO_FB_INTEGRAL_MAX;
+    }
+    else if (FeedbackIntegral < -AUDIO_FB_INTEGRAL_MAX)
+    {
+      FeedbackIntegral = -AUDIO_FB_INTEGRAL_MAX;
+    }
+
+    correction = error * (65536 >> AUDIO_FB_KP_SHIFT) +
+                 (FeedbackIntegral * 65536) / (1 << AUDIO_FB_KI_SHIFT);
+    if (correction > AUDIO_FB_MAX_DEVIATION)
+    {
+      correction = AUDIO_FB_MAX_DEVIATION;
+    }
+    else if (correction < -AUDIO_FB_MAX_DEVIATION)
+    {
+      correction = -AUDIO_FB_MAX_DEVIATION;
+    }
+    fb = FeedbackNominal + correction;
+  }
+
+  FeedbackValue = fb;
+
+  /* Full speed feedback is 10.14, on 3 bytes */
+  fb >>= 2;
+  FeedbackBuff[0] = fb & 0xFF;
+  FeedbackBuff[1] = (fb >> 8) & 0xFF;
+  FeedbackBuff[2] = (fb >> 16) & 0xFF;
+}
+
+/**
+  * @brief  AUDIO_OUT_Play
+  *         Hands the next contiguous chunk of the FIFO to the codec, or
+  *         pauses it if the FIFO ran dry.
+  * @param  None
+  * @retval None
+  */
+static void AUDIO_OUT_Play(void)
+{
+  uint32_t len;
+  uint8_t *pbuf = AUDIO_FIFO_Peek(&AudioOutFifo, AudioOutPacket * AUDIO_OUT_DMA_PACKETS, AudioFrameSize, &len);
+
+  if (len)
+  {
+    AudioOutInFlight = len;
+    AUDIO_OUT_fops.AudioCmd(pbuf,                      /* Samples buffer pointer */
+                            len,                       /* Number of samples in Bytes */
+                            AUDIO_CMD_PLAY);           /* Command to be processed */
+  }
+  else
+  {
+    /* Underrun: pause the audio stream until half of the FIFO is filled again */
+    AudioOutInFlight = 0;
+    PlayFlag = 0;
+    AUDIO_OUT_fops.AudioCmd((uint8_t*)(AudioOutFifoBuff), /* Samples buffer pointer */
+                            AudioOutPacket,            /* Number of samples in Bytes */
+                            AUDIO_CMD_PAUSE);          /* Command to be processed */
+  }
+}
+
+/**
+  * @brief  USBD_AUDIO_OUT_TransferComplete
+  *         Releases the chunk the codec just played, and starts the next one.
+  *         To be called from the codec DMA transfer complete interrupt.
+  * @param  None
+  * @retval None
+  */
+void USBD_AUDIO_OUT_TransferComplete (void)
+{
+  if (PlayFlag)
+  {
+    AUDIO_FIFO_Consume(&AudioOutFifo, AudioOutInFlight);
+    AUDIO_OUT_Play();
+  }
+}
+
+/**
+  * @brief  AUDIO_Stream_Parse
+  *         Looks an alternate setting of an AudioStreaming interface up in
+  *         the configuration descriptor, and gets its streaming parameters.
+  * @param  itf: interface number
+  * @param  alt: alternate setting
+  * @param  stream: parameters found
+  * @retval USBD_OK if the alternate setting is a PCM stream, USBD_FAIL else
+  */
+static uint8_t AUDIO_Stream_Parse (uint8_t itf, uint8_t alt, AUDIO_Stream_TypeDef *stream)
+{
+  const uint8_t *pdesc = get_USB_configuration_descriptor(1);
+  const uint8_t *d;
+  uint16_t total;
+  uint16_t pos;
+  uint8_t  found = 0;
+
+  stream->ep = 0;
+  stream->feedback_ep = 0;
+  stream->refresh = 1;
+  stream->channels = 0;
+  stream->subframe = 0;
+  stream->resolution = 0;
+  stream->num_rates = 0;
+  stream->rates = NULL;
+  stream->max_packet = 0;
+
+  if (pdesc == NULL)
+  {
+    return USBD_FAIL;
+  }
+
+  total = pdesc[2] | (pdesc[3] << 8);
+  for (pos = pdesc[0]; (pos + 2 <= total) && (pdesc[pos] >= 2); pos += pdesc[pos])
+  {
+    d = pdesc + pos;
+
+    if (d[1] == USB_INTERFACE_DESCRIPTOR_TYPE)
+    {
+      if (found)
+      {
+        /* Next interface or alternate setting: done */
+        break;
+      }
+      found = (d[2] == itf) && (d[3] == alt) &&
+              (d[5] == USB_DEVICE_CLASS_AUDIO) && (d[6] == AUDIO_SUBCLASS_AUDIOSTREAMING);
+    }
+    else if (!found)
+    {
+      continue;
+    }
+    else if ((d[1] == AUDIO_INTERFACE_DESCRIPTOR_TYPE) && (d[0] >= 8) &&
+             (d[2] == AUDIO_STREAMING_FORMAT_TYPE) && (d[3] == AUDIO_FORMAT_TYPE_I))
+    {
+      stream->channels = d[4];
+      stream->subframe = d[5];
+      stream->resolution = d[6];
+      stream->num_rates = d[7];
+      stream->rates = d + 8;
+    }
+    else if ((d[1] == USB_ENDPOINT_DESCRIPTOR_TYPE) && (d[0] >= 7))
+    {
+      if ((d[3] & 0x30) == USB_ENDPOINT_USAGE_FEEDBACK)
+      {
+        if ((d[0] >= 9) && (d[7] != 0))
+        {
+          stream->refresh = d[7];
+        }
+      }
+      else
+      {
+        stream->ep = d[2];
+        stream->max_packet = d[4] | (d[5] << 8);
+        stream->feedback_ep = (d[0] >= 9) ? d[8] : 0;
+      }
+    }
+  }
+
+  if ((stream->ep == 0) || (stream->rates == NULL) ||
+      (stream->channels * stream->subframe == 0))
+  {
+    return USBD_FAIL;
+  }
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_Stream_HasRate
+  *         Checks a sampling rate against the ones of a stream.
+  * @param  stream: stream parameters
+  * @param  freq: sampling rate, in Hz
+  * @retval 1 if supported, 0 else
+  */
+static uint8_t AUDIO_Stream_HasRate (const AUDIO_Stream_TypeDef *stream, uint32_t freq)
+{
+  const uint8_t *r = stream->rates;
+  uint32_t lo, hi;
+  uint8_t  i;
+
+  if ((r == NULL) || (freq == 0))
+  {
+    return 0;
+  }
+
+  if (stream->num_rates == 0)
+  {
+    /* Continuous range */
+    lo = r[0] | (r[1] << 8) | (r[2] << 16);
+    hi = r[3] | (r[4] << 8) | (r[5] << 16);
+    return (freq >= lo) && (freq <= hi);
+  }
+  for (i = 0; i < stream->num_rates; i++, r += 3)
+  {
+    if (freq == (uint32_t)(r[0] | (r[1] << 8) | (r[2] << 16)))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  AUDIO_Stream_Start
+  *         Opens the endpoints of an alternate setting and starts streaming.
+  * @param  pdev: instance
+  * @param  alt: alternate setting
+  * @retval status
+  */
+static uint8_t AUDIO_Stream_Start (void *pdev, uint8_t alt)
+{
+  uint32_t freq;
+
+  if ((AUDIO_Stream_Parse(AUDIO_STREAMING_IF, alt, &AudioStream) != USBD_OK) ||
+      (AudioStream.ep & 0x80) ||
+      (AudioStream.channels * AudioStream.subframe > AUDIO_MAX_FRAME_SIZE) ||
+      (AudioStream.max_packet > AUDIO_OUT_MAX_PACKET))
+  {
+    /* Not a speaker stream, or too large for the buffers */
+    AudioStream.ep = 0;
+    AudioStream.feedback_ep = 0;
+    return USBD_FAIL;
+  }
+
+  /* Keep the current rate if this format supports it, otherwise take its first one */
+  freq = AudioFreq;
+  if (AUDIO_SetFrequency(freq) != USBD_OK)
+  {
+    freq = AudioStream.rates[0] | (AudioStream.rates[1] << 8) | (AudioStream.rates[2] << 16);
+    if (AUDIO_SetFrequency(freq) != USBD_OK)
+    {
+      AudioStream.ep = 0;
+      AudioStream.feedback_ep = 0;
+      return USBD_FAIL;
+    }
+  }
+
+  /* Open EP OUT */
+  DCD_EP_Open(pdev,
+              AudioStream.ep,
+              AudioStream.max_packet,
+              USB_OTG_EP_ISOC);
+
+  /* Open the feedback EP IN */
+  if (AudioStream.feedback_ep)
+  {
+    DCD_EP_Open(pdev,
+                AudioStream.feedback_ep,
+                AUDIO_FEEDBACK_PACKET,
+                USB_OTG_EP_ISOC);
+  }
+  FeedbackFrames = 0;
+  FeedbackBusy = 0;
+
+  usbd_audio_AltSet = alt;
+
+  /* Prepare Out endpoint to receive audio data */
+  DCD_EP_PrepareRx(pdev,
+                   AudioStream.ep,
+                   (uint8_t*)IsocOutBuff,                        
+                   AudioStream.max_packet);  
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_Stream_Stop
+  *         Stops streaming and closes the endpoints, releasing their bandwidth.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void AUDIO_Stream_Stop (void *pdev)
+{
+  if (PlayFlag)
+  {
+    PlayFlag = 0;
+    AUDIO_OUT_fops.AudioCmd((uint8_t*)(AudioOutFifoBuff), /* Samples buffer pointer */
+                            AudioOutPacket,            /* Number of samples in Bytes */
+                            AUDIO_CMD_PAUSE);          /* Command to be processed */
+  }
+  AudioOutInFlight = 0;
+  AUDIO_FIFO_Reset(&AudioOutFifo);
+
+  if (AudioStream.ep)
+  {
+    DCD_EP_Close (pdev , AudioStream.ep);
+  }
+  if (AudioStream.feedback_ep)
+  {
+    DCD_EP_Close (pdev , AudioStream.feedback_ep);
+  }
+  AudioStream.ep = 0;
+  AudioStream.feedback_ep = 0;
+  FeedbackBusy = 0;
+}
+
+/**
+  * @brief  AUDIO_SetFrequency
+  *         Switches the streaming engine to another sampling rate of the
+  *         current alternate setting. The buffers are not reallocated: only
+  *         the part of the FIFO in use, the packet size and the nominal
+  *         feedback change.
+  * @param  freq: sampling rate, in Hz
+  * @retval USBD_OK if the rate is supported by the current alternate setting
+  */
+static uint8_t AUDIO_SetFrequency (uint32_t freq)
+{
+  if ((freq > USBD_AUDIO_MAX_FREQ) || !AUDIO_Stream_HasRate(&AudioStream, freq))
+  {
+    return USBD_FAIL;
+  }
+
+  /* Stop the codec before shrinking or growing the FIFO under its feet */
+  if (PlayFlag)
+  {
+    PlayFlag = 0;
+    AUDIO_OUT_fops.AudioCmd((uint8_t*)(AudioOutFifoBuff), /* Samples buffer pointer */
+                            AudioOutPacket,            /* Number of samples in Bytes */
+                            AUDIO_CMD_PAUSE);          /* Command to be processed */
+  }
+  AudioOutInFlight = 0;
+
+  AudioFreq = freq;
+  AudioFrameSize = AudioStream.channels * AudioStream.subframe;
+  AudioOutPacket = (freq / 1000) * AudioFrameSize;
+  AUDIO_FIFO_Init(&AudioOutFifo, AudioOutFifoBuff, AudioOutPacket * OUT_PACKET_NUM, AudioFrameSize);
+
+  /* Nominal rate, in 16.16 samples per frame */
+  FeedbackNominal = ((freq / 1000) << 16) + (((freq % 1000) << 16) / 1000);
+  FeedbackIntegral = 0;
+  AUDIO_Feedback_Update();
+
+  if (AUDIO_OUT_fops.SetFormat != NULL)
+  {
+    AUDIO_OUT_fops.SetFormat(freq, AudioStream.channels, AudioStream.subframe, AudioStream.resolution);
   }
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_AUDIO_GetFrequency
+  *         Returns the current sampling rate.
+  * @param  None
+  * @retval sampling rate, in Hz
+  */
+uint32_t USBD_AUDIO_GetFrequency (void)
+{
+  return AudioFreq;
+}
+
+#ifdef USBD_AUDIO_IN_ENABLED
+/**
+  * @brief  AUDIO_IN_Start
+  *         Opens the capture endpoint of an alternate setting, and starts
+  *         the codec DMA.
+  * @param  pdev: instance
+  * @param  alt: alternate setting
+  * @retval status
+  */
+static uint8_t AUDIO_IN_Start (void *pdev, uint8_t alt)
+{
+  uint32_t freq;
+
+  if ((AUDIO_Stream_Parse(AUDIO_STREAMING_IN_IF, alt, &AudioInStream) != USBD_OK) ||
+      !(AudioInStream.ep & 0x80) ||
+      (AudioInStream.channels * AudioInStream.subframe > AUDIO_IN_MAX_FRAME_SIZE) ||
+      (AudioInStream.max_packet > AUDIO_IN_MAX_PACKET))
+  {
+    /* Not a capture stream, or too large for the buffers */
+    AudioInStream.ep = 0;
+    return USBD_FAIL;
+  }
+
+  /* Keep the current rate if this format supports it, otherwise take its first one */
+  freq = AudioInFreq;
+  if (!AUDIO_Stream_HasRate(&AudioInStream, freq))
+  {
+    freq = AudioInStream.rates[0] | (AudioInStream.rates[1] << 8) | (AudioInStream.rates[2] << 16);
+  }
+  if (AUDIO_IN_SetFrequency(freq) != USBD_OK)
+  {
+    AudioInStream.ep = 0;
+    return USBD_FAIL;
+  }
+
+  /* Open EP IN */
+  DCD_EP_Open(pdev,
+              AudioInStream.ep,
+              AudioInStream.max_packet,
+              USB_OTG_EP_ISOC);
+  AudioInBusy = 0;
+
+  usbd_audio_InAltSet = alt;
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_IN_Stop
+  *         Stops the codec DMA and closes the capture endpoint.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void AUDIO_IN_Stop (void *pdev)
+{
+  if (AudioInStream.ep)
+  {
+    AUDIO_IN_fops.AudioCmd(AudioInRing, AudioInRingSize, AUDIO_CMD_STOP);
+    DCD_EP_Close (pdev , AudioInStream.ep);
+  }
+  AudioInStream.ep = 0;
+  AudioInBusy = 0;
+}
+
+/**
+  * @brief  AUDIO_IN_SetFrequency
+  *         Switches the capture engine to another sampling rate of the
+  *         current alternate setting, and restarts the codec DMA over the
+  *         part of the ring this rate needs.
+  * @param  freq: sampling rate, in Hz
+  * @retval USBD_OK if the rate is supported by the current alternate setting
+  */
+static uint8_t AUDIO_IN_SetFrequency (uint32_t freq)
+{
+  if ((freq > USBD_AUDIO_IN_MAX_FREQ) || !AUDIO_Stream_HasRate(&AudioInStream, freq))
+  {
+    return USBD_FAIL;
+  }
+
+  if (AudioInRingSize)
+  {
+    AUDIO_IN_fops.AudioCmd(AudioInRing, AudioInRingSize, AUDIO_CMD_STOP);
+  }
+
+  AudioInFreq = freq;
+  AudioInFrameSize = AudioInStream.channels * AudioInStream.subframe;
+  AudioInRingSize = (freq / 1000) * AudioInFrameSize * IN_PACKET_NUM;
+  AudioInRd = 0;
+  AudioInStarted = 0;
+
+  /* Nominal rate, in 16.16 sample frames per USB frame */
+  AudioInNominal = ((freq / 1000) << 16) + (((freq % 1000) << 16) / 1000);
+  AudioInAccum = 0;
+
+  if (AUDIO_IN_fops.SetFormat != NULL)
+  {
+    AUDIO_IN_fops.SetFormat(freq, AudioInStream.channels, AudioInStream.subframe, AudioInStream.resolution);
+  }
+
+  /* The codec DMA runs in circular mode over the ring from now on */
+  memset(AudioInRing, 0, AudioInRingSize);
+  AUDIO_IN_fops.AudioCmd(AudioInRing, AudioInRingSize, AUDIO_CMD_PLAY);
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_IN_SOF
+  *         Sends one frame worth of captured samples. The fractional part
+  *         of the rate is carried from frame to frame (44.1kHz goes out as
+  *         44 or 45 samples), and one sample frame is added or removed when
+  *         the ring fill level shows the codec clock drifting from the
+  *         USB one.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void AUDIO_IN_SOF (void *pdev)
+{
+  uint32_t wr;
+  uint32_t fill;
+  uint32_t frames;
+  uint32_t len;
+  uint32_t avail;
+  uint32_t first;
+  uint32_t target;
+
+  if (AudioInBusy)
+  {
+    /* Still waiting for the host, or for the incomplete IN event */
+    return;
+  }
+
+  /* Where the DMA is writing, rounded down to a whole sample frame */
+  wr = AUDIO_IN_fops.GetPosition();
+  wr -= wr % AudioInFrameSize;
+  if (wr >= AudioInRingSize)
+  {
+    wr = 0;
+  }
+  fill = (wr >= AudioInRd) ? (wr - AudioInRd) : (AudioInRingSize - AudioInRd + wr);
+  fill /= AudioInFrameSize;
+  target = AudioInRingSize / AudioInFrameSize / 2;
+
+  AudioInAccum += AudioInNominal;
+  frames = AudioInAccum >> 16;
+  AudioInAccum &= 0xFFFF;
+
+  if (!AudioInStarted)
+  {
+    /* Let the ring fill up to its middle first, sending silence meanwhile */
+    if (fill >= target)
+    {
+      AudioInStarted = 1;
+      AudioInRd = (wr + AudioInRingSize - target * AudioInFrameSize) % AudioInRingSize;
+      fill = target;
+    }
+    else
+    {
+      fill = 0;
+    }
+  }
+  else if (fill > target + AUDIO_IN_RATE_THRESHOLD)
+  {
+    /* The codec runs faster than the host pulls */
+    frames++;
+    USBD_AUDIO_IN_Stats.adjusted++;
+  }
+  else if ((fill + AUDIO_IN_RATE_THRESHOLD < target) && (frames > 1))
+  {
+    frames--;
+    USBD_AUDIO_IN_Stats.adjusted++;
+  }
+
+  len = MIN(frames * AudioInFrameSize, AudioInStream.max_packet);
+  avail = MIN(len, fill * AudioInFrameSize);
+
+  if (AudioInStarted && (fill >= (AudioInRingSize / AudioInFrameSize) - AUDIO_IN_RATE_THRESHOLD))
+  {
+    /* The DMA is about to catch up with us, ie. the host stopped pulling
+       for a while: skip ahead to the middle of the ring */
+    AudioInRd = (wr + AudioInRingSize - target * AudioInFrameSize) % AudioInRingSize;
+    USBD_AUDIO_IN_Stats.overruns++;
+  }
+
+  /* Copy out of the ring, in up to two parts */
+  first = MIN(avail, AudioInRingSize - AudioInRd);
+  memcpy(IsocInBuff, AudioInRing + AudioInRd, first);
+  memcpy(IsocInBuff + first, AudioInRing, avail - first);
+  AudioInRd += avail;
+  if (AudioInRd >= AudioInRingSize)
+  {
+    AudioInRd -= AudioInRingSize;
+  }
+
+  if (avail < len)
+  {
+    /* Not enough samples: pad with silence, so the packet keeps its size */
+    memset(IsocInBuff + avail, 0, len - avail);
+    if (AudioInStarted)
+    {
+      USBD_AUDIO_IN_Stats.underruns++;
+    }
+  }
+
+  AudioInBusy = 1;
+  DCD_EP_Tx (pdev, AudioInStream.ep, IsocInBuff, len);
+}
+
+/**
+  * @brief  USBD_AUDIO_IN_GetFrequency
+  *         Returns the current capture sampling rate.
+  * @param  None
+  * @retval sampling rate, in Hz
+  */
+uint32_t USBD_AUDIO_IN_GetFrequency (void)
+{
+  return AudioInFreq;
+}
+#endif
+
+/**
+  * @brief  USBD_AUDIO_GetFeedback
+  *         Returns the current feedback value.
+  * @param  None
+  * @retval samples per frame, in 16.16
+  */
+uint32_t USBD_AUDIO_GetFeedback (void)
+{
+  return FeedbackValue;
 }
 
 /**
@@ -647,8 +1307,10 @@ static void AUDIO_Req_SetCurrent(void *pdev, USB_SETUP_REQ *req)
   */
 static uint8_t  *USBD_audio_GetCfgDesc (uint8_t speed, uint16_t *length)
 {
-  *length = sizeof (usbd_audio_CfgDesc);
-  return usbd_audio_CfgDesc;
+  uint8_t *pbuf = (uint8_t *)get_USB_configuration_descriptor(1);
+
+  *length = (((uint16_t) pbuf[3]) << 8) + pbuf[2];
+  return pbuf;
 }
 /**
   * @}
@@ -0,0 +1,415 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_dsp.c
+  * @brief   Sample processing between the audio FIFO and the codec, for the
+  *          codecs lacking the matching hardware features:
+  *           - volume and mute, with gain ramps so changes don't click
+  *           - sample format conversion, 2, 3 or 4 bytes subframes to 16
+  *             or 32 bits
+  *           - channel remapping: swap, mono to stereo, stereo downmix
+  *
+  *          The inner loops use the Cortex-M4 DSP instructions when the
+  *          compiler targets them (__ARM_FEATURE_DSP), and portable C
+  *          versions with the same results otherwise. 16 bits stereo frames
+  *          are handled a word at a time, both samples at once.
+  *
+  *          tools/audio-dsp.cc checks the results against a floating point
+  *          model.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_audio_dsp.h"
+
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && defined(__GNUC__)
+/* (a * bottom half of b) >> 16, ie. a 16.16 gain applied to a 16 bits sample */
+static __inline int32_t AUDIO_DSP_SMULWB (int32_t a, int32_t b)
+{
+  int32_t r;
+  __asm ("smulwb %0, %1, %2" : "=r" (r) : "r" (a), "r" (b));
+  return r;
+}
+
+/* Saturation to 16 bits */
+static __inline int32_t AUDIO_DSP_SSAT16 (int32_t a)
+{
+  int32_t r;
+  __asm ("ssat %0, #16, %1" : "=r" (r) : "r" (a));
+  return r;
+}
+
+/* (a * top half of b) >> 16 */
+static __inline int32_t AUDIO_DSP_SMULWT (int32_t a, int32_t b)
+{
+  int32_t r;
+  __asm ("smulwt %0, %1, %2" : "=r" (r) : "r" (a), "r" (b));
+  return r;
+}
+
+/* Bottom half of a, then b in the top half: packs a stereo frame */
+static __inline uint32_t AUDIO_DSP_PKHBT (int32_t a, int32_t b)
+{
+  uint32_t r;
+  __asm ("pkhbt %0, %1, %2, lsl #16" : "=r" (r) : "r" (a), "r" (b));
+  return r;
+}
+
+/* Sum of the products of the halves of a and b, plus c */
+static __inline int32_t AUDIO_DSP_SMLAD (uint32_t a, uint32_t b, int32_t c)
+{
+  int32_t r;
+  __asm ("smlad %0, %1, %2, %3" : "=r" (r) : "r" (a), "r" (b), "r" (c));
+  return r;
+}
+
+/* Top 32 bits of a * b, rounded: a 0.32 gain applied to a 32 bits sample */
+static __inline int32_t AUDIO_DSP_SMMULR (int32_t a, int32_t b)
+{
+  int32_t r;
+  __asm ("smmulr %0, %1, %2" : "=r" (r) : "r" (a), "r" (b));
+  return r;
+}
+#else
+static __inline int32_t AUDIO_DSP_SMULWB (int32_t a, int32_t b)
+{
+  return (int32_t)(((int64_t)a * (int16_t)b) >> 16);
+}
+
+static __inline int32_t AUDIO_DSP_SMULWT (int32_t a, int32_t b)
+{
+  return (int32_t)(((int64_t)a * (int16_t)((uint32_t)b >> 16)) >> 16);
+}
+
+static __inline uint32_t AUDIO_DSP_PKHBT (int32_t a, int32_t b)
+{
+  return ((uint32_t)a & 0xFFFF) | ((uint32_t)b << 16);
+}
+
+static __inline int32_t AUDIO_DSP_SMLAD (uint32_t a, uint32_t b, int32_t c)
+{
+  return c + (int16_t)a * (int16_t)b + (int16_t)(a >> 16) * (int16_t)(b >> 16);
+}
+
+static __inline int32_t AUDIO_DSP_SSAT16 (int32_t a)
+{
+  return (a > 32767) ? 32767 : ((a < -32768) ? -32768 : a);
+}
+
+static __inline int32_t AUDIO_DSP_SMMULR (int32_t a, int32_t b)
+{
+  return (int32_t)(((int64_t)a * b + 0x80000000LL) >> 32);
+}
+#endif
+
+/* A 16.16 gain applied to both samples of a 16 bits stereo frame */
+static __inline uint32_t AUDIO_DSP_Gain16x2 (int32_t g, uint32_t frame)
+{
+  return AUDIO_DSP_PKHBT(AUDIO_DSP_SMULWB(g, (int32_t)frame), AUDIO_DSP_SMULWT(g, (int32_t)frame));
+}
+
+/**
+  * @brief  AUDIO_DSP_VolumeToGain
+  *         Volume percentage to gain. The curve is quadratic, which is
+  *         closer to the perceived loudness than a linear one.
+  * @param  vol: volume, 0 to 100
+  * @retval gain, 16.16
+  */
+static uint32_t AUDIO_DSP_VolumeToGain (uint8_t vol)
+{
+  if (vol >= 100)
+  {
+    return AUDIO_DSP_UNITY;
+  }
+
+  return ((uint32_t)vol * vol * AUDIO_DSP_UNITY) / 10000;
+}
+
+/**
+  * @brief  AUDIO_DSP_GainStep
+  *         Moves the gain one frame closer to its target.
+  * @param  gain: gain state
+  * @retval None
+  */
+static __inline void AUDIO_DSP_GainStep (AUDIO_DSP_Gain_TypeDef *gain)
+{
+  if (gain->current < gain->target)
+  {
+    gain->current = MIN(gain->current + AUDIO_DSP_RAMP_STEP, gain->target);
+  }
+  else
+  {
+    gain->current = (gain->current - gain->target > AUDIO_DSP_RAMP_STEP) ?
+                    (gain->current - AUDIO_DSP_RAMP_STEP) : gain->target;
+  }
+}
+
+/**
+  * @brief  AUDIO_DSP_GainInit
+  *         Initializes a gain state, without ramping to the volume.
+  * @param  gain: gain state
+  * @param  vol: volume, 0 to 100
+  * @retval None
+  */
+void AUDIO_DSP_GainInit (AUDIO_DSP_Gain_TypeDef *gain, uint8_t vol)
+{
+  gain->volume = AUDIO_DSP_VolumeToGain(vol);
+  gain->target = gain->volume;
+  gain->current = gain->volume;
+  gain->mute = 0;
+}
+
+/**
+  * @brief  AUDIO_DSP_SetVolume
+  *         Changes the volume; the gain ramps to it over the next frames.
+  * @param  gain: gain state
+  * @param  vol: volume, 0 to 100
+  * @retval None
+  */
+void AUDIO_DSP_SetVolume (AUDIO_DSP_Gain_TypeDef *gain, uint8_t vol)
+{
+  gain->volume = AUDIO_DSP_VolumeToGain(vol);
+  if (!gain->mute)
+  {
+    gain->target = gain->volume;
+  }
+}
+
+/**
+  * @brief  AUDIO_DSP_SetMute
+  *         Mutes or unmutes; the gain ramps down to 0 or back to the volume.
+  * @param  gain: gain state
+  * @param  mute: 1 to mute, 0 to unmute
+  * @retval None
+  */
+void AUDIO_DSP_SetMute (AUDIO_DSP_Gain_TypeDef *gain, uint8_t mute)
+{
+  gain->mute = mute ? 1 : 0;
+  gain->target = gain->mute ? 0 : gain->volume;
+}
+
+/**
+  * @brief  AUDIO_DSP_Gain16
+  *         Applies the gain, in place, to 16 bits stereo frames.
+  * @param  gain: gain state
+  * @param  buf: samples, word aligned
+  * @param  frames: number of stereo frames
+  * @retval None
+  */
+void AUDIO_DSP_Gain16 (AUDIO_DSP_Gain_TypeDef *gain, int16_t *buf, uint32_t frames)
+{
+  uint32_t *frame = (uint32_t *)buf;
+  int32_t g;
+
+  /* Ramp, one frame at a time */
+  while (frames && (gain->current != gain->target))
+  {
+    AUDIO_DSP_GainStep(gain);
+    *frame = AUDIO_DSP_Gain16x2((int32_t)gain->current, *frame);
+    frame++;
+    frames--;
+  }
+
+  /* Steady gain */
+  g = (int32_t)gain->current;
+  if ((frames == 0) || (g == AUDIO_DSP_UNITY))
+  {
+    return;
+  }
+  if (g == 0)
+  {
+    memset(frame, 0, frames * 4);
+    return;
+  }
+  while (frames--)
+  {
+    *frame = AUDIO_DSP_Gain16x2(g, *frame);
+    frame++;
+  }
+}
+
+/**
+  * @brief  AUDIO_DSP_Gain32
+  *         Applies the gain, in place, to 32 bits stereo frames.
+  * @param  gain: gain state
+  * @param  buf: samples
+  * @param  frames: number of stereo frames
+  * @retval None
+  */
+void AUDIO_DSP_Gain32 (AUDIO_DSP_Gain_TypeDef *gain, int32_t *buf, uint32_t frames)
+{
+  int32_t g;
+
+  /* The gain is at most unity, so as 0.32 it would overflow: use 0.31
+     and let the samples lose their lowest bit, well below the codec noise */
+  while (frames && (gain->current != gain->target))
+  {
+    AUDIO_DSP_GainStep(gain);
+    g = (int32_t)MIN(gain->current << 15, 0x7FFFFFFF);
+    buf[0] = AUDIO_DSP_SMMULR(g, buf[0]) << 1;
+    buf[1] = AUDIO_DSP_SMMULR(g, buf[1]) << 1;
+    buf += 2;
+    frames--;
+  }
+
+  if ((frames == 0) || (gain->current == AUDIO_DSP_UNITY))
+  {
+    return;
+  }
+  if (gain->current == 0)
+  {
+    memset(buf, 0, frames * 8);
+    return;
+  }
+  g = (int32_t)(gain->current << 15);
+  while (frames--)
+  {
+    buf[0] = AUDIO_DSP_SMMULR(g, buf[0]) << 1;
+    buf[1] = AUDIO_DSP_SMMULR(g, buf[1]) << 1;
+    buf += 2;
+  }
+}
+
+/**
+  * @brief  AUDIO_DSP_FormatInit
+  *         Sets a conversion up, from a USB stream format to the codec one,
+  *         with the default channel map. The samples are left justified in
+  *         their subframes, as the Type I formats have them: the unused low
+  *         bits are 0, and are carried through.
+  * @param  fmt: conversion
+  * @param  channels: number of channels of the stream
+  * @param  subframe: bytes per sample of the stream, bSubFrameSize
+  * @param  resolution: bits used in a subframe, bBitResolution
+  * @param  out_bytes: 2 for a 16 bits codec, 4 for a 32 bits one
+  * @retval USBD_OK if the conversion is supported, USBD_FAIL else
+  */
+uint8_t AUDIO_DSP_FormatInit (AUDIO_DSP_Format_TypeDef *fmt, uint8_t channels, uint8_t subframe, uint8_t resolution, uint8_t out_bytes)
+{
+  if ((channels < 1) || (channels > 2) || (subframe < 2) || (subframe > 4) ||
+      (resolution > subframe * 8) || ((out_bytes != 2) && (out_bytes != 4)))
+  {
+    return USBD_FAIL;
+  }
+
+  fmt->in_channels = channels;
+  fmt->in_bytes = subframe;
+  fmt->out_bytes = out_bytes;
+  fmt->map[0] = 0;
+  fmt->map[1] = channels - 1;
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  AUDIO_DSP_IsPassThrough
+  *         Tells whether a conversion leaves the samples untouched, so it
+  *         can be skipped altogether.
+  * @param  fmt: conversion
+  * @retval 1 if so, 0 else
+  */
+uint8_t AUDIO_DSP_IsPassThrough (const AUDIO_DSP_Format_TypeDef *fmt)
+{
+  return (fmt->in_channels == 2) && (fmt->in_bytes == 2) && (fmt->out_bytes == 2) &&
+         (fmt->map[0] == 0) && (fmt->map[1] == 1);
+}
+
+/**
+  * @brief  AUDIO_DSP_Read
+  *         Reads one sample, left justified on 32 bits.
+  * @param  p: sample
+  * @param  bytes: 2, 3 or 4
+  * @retval sample
+  */
+static __inline int32_t AUDIO_DSP_Read (const uint8_t *p, uint8_t bytes)
+{
+  if (bytes == 2)
+  {
+    return (int32_t)(((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 24));
+  }
+  if (bytes == 3)
+  {
+    return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+  }
+  return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/**
+  * @brief  AUDIO_DSP_Convert
+  *         Converts frames to the codec format. out may be the same buffer
+  *         as in, as long as the output frames aren't larger than the input
+  *         ones.
+  * @param  fmt: conversion
+  * @param  in: frames in the stream format, word aligned for 16 bits
+  *         stereo
+  * @param  out: frames in the codec format, word aligned
+  * @param  frames: number of frames
+  * @retval number of bytes written to out
+  */
+uint32_t AUDIO_DSP_Convert (const AUDIO_DSP_Format_TypeDef *fmt, const uint8_t *in, uint8_t *out, uint32_t frames)
+{
+  uint32_t in_frame = fmt->in_channels * fmt->in_bytes;
+  uint32_t n = frames;
+  int32_t  s[2];
+  int32_t  v;
+  uint8_t  c;
+
+  if ((fmt->in_bytes == 2) && (fmt->out_bytes == 2) && (fmt->in_channels == 2))
+  {
+    /* 16 bits stereo, a frame per word: each output channel takes the
+       bottom half of the word, of the word shifted, or of the downmix,
+       (L + R) / 2 with SMLAD, which can't overflow */
+    const uint32_t *i32 = (const uint32_t *)in;
+    uint32_t *o32 = (uint32_t *)out;
+    uint8_t  sel0 = (fmt->map[0] == AUDIO_DSP_MIX) ? 2 : fmt->map[0];
+    uint8_t  sel1 = (fmt->map[1] == AUDIO_DSP_MIX) ? 2 : fmt->map[1];
+    int32_t  w[3];
+
+    while (n--)
+    {
+      w[0] = (int32_t)*i32++;
+      w[1] = (int32_t)((uint32_t)w[0] >> 16);
+      w[2] = AUDIO_DSP_SMLAD((uint32_t)w[0], 0x00010001, 0) >> 1;
+      *o32++ = AUDIO_DSP_PKHBT(w[sel0], w[sel1]);
+    }
+    return frames * 4;
+  }
+
+  if ((fmt->in_bytes == 2) && (fmt->out_bytes == 2))
+  {
+    /* 16 bits mono to 16 bits: the sample on both channels, whatever
+       the map */
+    const int16_t *i16 = (const int16_t *)in;
+    uint32_t *o32 = (uint32_t *)out;
+
+    while (n--)
+    {
+      *o32++ = AUDIO_DSP_PKHBT(*i16, *i16);
+      i16++;
+    }
+    return frames * 4;
+  }
+
+  while (n--)
+  {
+    s[0] = AUDIO_DSP_Read(in, fmt->in_bytes);
+    s[1] = AUDIO_DSP_Read(in + in_frame - fmt->in_bytes, fmt->in_bytes);
+    for (c = 0; c < 2; c++)
+    {
+      v = (fmt->map[c] == AUDIO_DSP_MIX) ? ((s[0] >> 1) + (s[1] >> 1)) : s[fmt->map[c]];
+      if (fmt->out_bytes == 4)
+      {
+        ((int32_t *)out)[c] = v;
+      }
+      else
+      {
+        /* Round to 16 bits; rounding up full scale would overflow */
+        ((int16_t *)out)[c] = (int16_t)AUDIO_DSP_SSAT16(((v >> 15) + 1) >> 1);
+      }
+    }
+    in += in_frame;
+    out += 2 * fmt->out_bytes;
+  }
+
+  return frames * 2 * fmt->out_bytes;
+}
@@ -0,0 +1,172 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_fifo.c
+  * @brief   Byte-granular FIFO used by the audio class to decouple the USB
+  *          frame rate from the codec DMA transfers:
+  *           - writes of any size, as received from the isochronous endpoint
+  *           - silence insertion for lost packets
+  *           - contiguous reads, so the codec DMA gets large transfers
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_audio_fifo.h"
+
+#include <string.h>
+
+/**
+  * @brief  AUDIO_FIFO_Init
+  *         Initializes an empty FIFO over a buffer.
+  * @param  fifo: FIFO instance
+  * @param  buf: storage
+  * @param  size: size of the storage, in bytes; only a whole number of
+  *         sample frames of it is used
+  * @param  align: size of a sample frame, in bytes
+  * @retval None
+  */
+void AUDIO_FIFO_Init (AUDIO_FIFO_TypeDef *fifo, uint8_t *buf, uint32_t size, uint32_t align)
+{
+  fifo->buf = buf;
+  fifo->size = size - (size % align);
+  fifo->align = align;
+  fifo->wr = 0;
+  fifo->rd = 0;
+}
+
+/**
+  * @brief  AUDIO_FIFO_Reset
+  *         Empties the FIFO. Neither side must be running.
+  * @param  fifo: FIFO instance
+  * @retval None
+  */
+void AUDIO_FIFO_Reset (AUDIO_FIFO_TypeDef *fifo)
+{
+  fifo->wr = 0;
+  fifo->rd = 0;
+}
+
+/**
+  * @brief  AUDIO_FIFO_Fill
+  *         Number of bytes waiting to be read.
+  * @param  fifo: FIFO instance
+  * @retval fill level, in bytes
+  */
+uint32_t AUDIO_FIFO_Fill (const AUDIO_FIFO_TypeDef *fifo)
+{
+  uint32_t wr = fifo->wr;
+  uint32_t rd = fifo->rd;
+
+  return (wr >= rd) ? (wr - rd) : (fifo->size - rd + wr);
+}
+
+/**
+  * @brief  AUDIO_FIFO_Room
+  *         Number of bytes that can be written, in whole sample frames.
+  * @param  fifo: FIFO instance
+  * @retval free space, in bytes
+  */
+uint32_t AUDIO_FIFO_Room (const AUDIO_FIFO_TypeDef *fifo)
+{
+  uint32_t room = fifo->size - 1 - AUDIO_FIFO_Fill(fifo);
+
+  return room - (room % fifo->align);
+}
+
+/**
+  * @brief  AUDIO_FIFO_Write
+  *         Appends data, as many whole sample frames as there is room for.
+  * @param  fifo: FIFO instance
+  * @param  data: bytes to append
+  * @param  len: number of bytes to append
+  * @retval number of bytes actually appended
+  */
+uint32_t AUDIO_FIFO_Write (AUDIO_FIFO_TypeDef *fifo, const uint8_t *data, uint32_t len)
+{
+  uint32_t wr = fifo->wr;
+  uint32_t first;
+
+  len = MIN(len - (len % fifo->align), AUDIO_FIFO_Room(fifo));
+  first = MIN(len, fifo->size - wr);
+
+  memcpy(fifo->buf + wr, data, first);
+  memcpy(fifo->buf, data + first, len - first);
+
+  wr += len;
+  if (wr >= fifo->size)
+  {
+    wr -= fifo->size;
+  }
+  fifo->wr = wr;
+
+  return len;
+}
+
+/**
+  * @brief  AUDIO_FIFO_WriteSilence
+  *         Appends zeroed samples, as many whole sample frames as there is
+  *         room for.
+  * @param  fifo: FIFO instance
+  * @param  len: number of bytes to append
+  * @retval number of bytes actually appended
+  */
+uint32_t AUDIO_FIFO_WriteSilence (AUDIO_FIFO_TypeDef *fifo, uint32_t len)
+{
+  uint32_t wr = fifo->wr;
+  uint32_t first;
+
+  len = MIN(len - (len % fifo->align), AUDIO_FIFO_Room(fifo));
+  first = MIN(len, fifo->size - wr);
+
+  memset(fifo->buf + wr, 0, first);
+  memset(fifo->buf, 0, len - first);
+
+  wr += len;
+  if (wr >= fifo->size)
+  {
+    wr -= fifo->size;
+  }
+  fifo->wr = wr;
+
+  return len;
+}
+
+/**
+  * @brief  AUDIO_FIFO_Peek
+  *         Gets the largest contiguous block of data that can be read,
+  *         without consuming it.
+  * @param  fifo: FIFO instance
+  * @param  maxlen: maximum size of the block
+  * @param  align: the size of the block is rounded down to a multiple of
+  *         this, typically the size of a sample frame
+  * @param  len: size of the block
+  * @retval pointer to the block
+  */
+uint8_t * AUDIO_FIFO_Peek (const AUDIO_FIFO_TypeDef *fifo, uint32_t maxlen, uint32_t align, uint32_t *len)
+{
+  uint32_t wr = fifo->wr;
+  uint32_t rd = fifo->rd;
+  uint32_t avail = (wr >= rd) ? (wr - rd) : (fifo->size - rd);
+
+  avail = MIN(avail, maxlen);
+  *len = avail - (avail % align);
+
+  return fifo->buf + rd;
+}
+
+/**
+  * @brief  AUDIO_FIFO_Consume
+  *         Releases data previously obtained through AUDIO_FIFO_Peek.
+  * @param  fifo: FIFO instance
+  * @param  len: number of bytes to release
+  * @retval None
+  */
+void AUDIO_FIFO_Consume (AUDIO_FIFO_TypeDef *fifo, uint32_t len)
+{
+  uint32_t rd = fifo->rd + MIN(len, AUDIO_FIFO_Fill(fifo));
+
+  if (rd >= fifo->size)
+  {
+    rd -= fifo->size;
+  }
+  fifo->rd = rd;
+}
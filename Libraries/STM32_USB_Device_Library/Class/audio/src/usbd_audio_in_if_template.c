@@ -0,0 +1,205 @@
+/**
+  ******************************************************************************
+  * @file    usbd_audio_in_if_template.c
+  * @brief   Capture media access layer template, to be copied and adapted to
+  *          the microphone hardware (I2S or ADC).
+  *
+  *          The audio core hands a ring buffer over with AUDIO_CMD_PLAY: the
+  *          DMA stream of the I2S or ADC peripheral must fill it in circular
+  *          mode (both halves, back to back, with no interrupt required), and
+  *          GetPosition must return the offset it is about to write to. The
+  *          core reads the ring behind it at each SOF, so the DMA never has
+  *          to be restarted, whatever the CPU load.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_audio_in_if_template.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t  Init         (uint32_t AudioFreq, uint32_t Volume, uint32_t options);
+static uint8_t  DeInit       (uint32_t options);
+static uint8_t  AudioCmd     (uint8_t* pbuf, uint32_t size, uint8_t cmd);
+static uint8_t  VolumeCtl    (uint8_t vol);
+static uint8_t  MuteCtl      (uint8_t cmd);
+static uint8_t  PeriodicTC   (uint8_t cmd);
+static uint8_t  GetState     (void);
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint8_t Channels, uint8_t SubFrame, uint8_t Resolution);
+static uint32_t GetPosition  (void);
+
+/* Private variables ---------------------------------------------------------*/
+AUDIO_FOPS_TypeDef  AUDIO_IN_fops =
+{
+  Init,
+  DeInit,
+  AudioCmd,
+  VolumeCtl,
+  MuteCtl,
+  PeriodicTC,
+  GetState,
+  SetFormat,
+  GetPosition
+};
+
+static uint8_t  AudioState = AUDIO_STATE_INACTIVE;
+static uint32_t AudioSize = 0;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Init
+  *         Initializes the capture hardware: clocks, pins, and the I2S or ADC
+  *         peripheral, with its DMA stream in circular, peripheral to memory
+  *         mode.
+  * @param  AudioFreq: sampling frequency
+  * @param  Volume: unused
+  * @param  options: reserved for future use
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  Init         (uint32_t AudioFreq,
+                              uint32_t Volume,
+                              uint32_t options)
+{
+  /*
+     Add your initialization code here
+  */
+  AudioState = AUDIO_STATE_ACTIVE;
+  return USBD_OK;
+}
+
+/**
+  * @brief  DeInit
+  *         Frees the capture hardware.
+  * @param  options: reserved for future use
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  DeInit       (uint32_t options)
+{
+  /*
+     Add your deinitialization code here
+  */
+  AudioState = AUDIO_STATE_INACTIVE;
+  return USBD_OK;
+}
+
+/**
+  * @brief  AudioCmd
+  *         Starts or stops capturing.
+  * @param  pbuf: ring buffer the DMA must fill
+  * @param  size: size of the ring buffer, in bytes
+  * @param  cmd: AUDIO_CMD_PLAY to start capturing into the ring, in circular
+  *              mode, or AUDIO_CMD_STOP.
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  AudioCmd(uint8_t* pbuf,
+                         uint32_t size,
+                         uint8_t cmd)
+{
+  switch (cmd)
+  {
+  case AUDIO_CMD_PLAY:
+    /*
+       Program the DMA stream with pbuf as memory address and size, in
+       peripheral data units, as number of data, then enable it
+    */
+    AudioSize = size;
+    AudioState = AUDIO_STATE_PLAYING;
+    break;
+
+  case AUDIO_CMD_STOP:
+    /*
+       Disable the DMA stream
+    */
+    AudioState = AUDIO_STATE_STOPPED;
+    break;
+
+  default:
+    return AUDIO_FAIL;
+  }
+
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  VolumeCtl
+  *         Sets the capture gain.
+  * @param  vol: gain level (0..100)
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  VolumeCtl    (uint8_t vol)
+{
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  MuteCtl
+  *         Mutes or unmutes the capture.
+  * @param  cmd: 1 to mute, 0 to unmute
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  MuteCtl      (uint8_t cmd)
+{
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  PeriodicTC
+  *         Not used for capture: the DMA runs in circular mode.
+  * @param  cmd:
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  PeriodicTC   (uint8_t cmd)
+{
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  GetState
+  *         Returns the current state of the capture.
+  * @param  None
+  * @retval Current state
+  */
+static uint8_t  GetState   (void)
+{
+  return AudioState;
+}
+
+/**
+  * @brief  SetFormat
+  *         Reconfigures the I2S or ADC sampling rate. The core stops the
+  *         capture before and restarts it afterwards.
+  * @param  AudioFreq: sampling frequency
+  * @param  Channels: number of channels
+  * @param  SubFrame: bytes per sample
+  * @param  Resolution: bits used in a sample
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint8_t Channels, uint8_t SubFrame, uint8_t Resolution)
+{
+  /*
+     Add your code here
+  */
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  GetPosition
+  *         Returns the ring offset the DMA is about to write to.
+  * @param  None
+  * @retval offset, in bytes
+  */
+static uint32_t GetPosition  (void)
+{
+  if (AudioState != AUDIO_STATE_PLAYING)
+  {
+    return 0;
+  }
+  /*
+     The DMA counts the remaining data units down, eg. with 16 bits units:
+     return AudioSize - DMA_GetCurrDataCounter(DMAx_Streamy) * 2;
+  */
+  return AudioSize;
+}
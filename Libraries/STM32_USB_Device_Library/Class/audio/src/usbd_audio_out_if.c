@@ -22,6 +22,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "usbd_audio_core.h"
 #include "usbd_audio_out_if.h"
+#include "usbd_audio_dsp.h"
 
 
 
@@ -47,6 +48,8 @@
 /** @defgroup usbd_audio_out_if_Private_Defines
   * @{
   */ 
+/* Largest number of frames the core hands over at once */
+#define AUDIO_OUT_CHUNK_FRAMES          ((USBD_AUDIO_MAX_FREQ / 1000) * AUDIO_OUT_DMA_PACKETS)
 /**
   * @}
   */ 
@@ -70,6 +73,9 @@ static uint8_t  VolumeCtl    (uint8_t vol);
 static uint8_t  MuteCtl      (uint8_t cmd);
 static uint8_t  PeriodicTC   (uint8_t cmd);
 static uint8_t  GetState     (void);
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint8_t Channels, uint8_t SubFrame, uint8_t Resolution);
+static uint8_t  *Process     (uint8_t* pbuf, uint32_t *size);
+static uint32_t GetPosition  (void);
 
 /**
   * @}
@@ -86,10 +92,24 @@ AUDIO_FOPS_TypeDef  AUDIO_OUT_fops =
   VolumeCtl,
   MuteCtl,
   PeriodicTC,
-  GetState
+  GetState,
+  SetFormat,
+  GetPosition
 };
 
 static uint8_t AudioState = AUDIO_STATE_INACTIVE;
+static uint32_t AudioVolume = DEFAULT_VOLUME;
+static uint32_t AudioFrequency = 0;
+
+/* Conversion of the stream to the codec format, and software volume */
+static AUDIO_DSP_Format_TypeDef AudioFormat;
+static uint32_t AudioInFrame = 4;       /* size of a stream frame, in bytes */
+static uint32_t AudioPlayFrames = 0;    /* frames of the chunk being played */
+#ifdef AUDIO_OUT_SOFT_VOLUME
+static AUDIO_DSP_Gain_TypeDef AudioGain;
+#endif
+/* Converted samples, when the codec format differs from the stream one */
+static uint32_t PlayBuff[AUDIO_OUT_CHUNK_FRAMES * 2 * AUDIO_OUT_CODEC_BYTES / 4];
 
 /**
   * @}
@@ -116,6 +136,13 @@ static uint8_t  Init         (uint32_t AudioFreq,
   /* Check if the low layer has already been initialized */
   if (Initialized == 0)
   {
+    AUDIO_DSP_FormatInit(&AudioFormat, 2, 2, 16, AUDIO_OUT_CODEC_BYTES);
+    AudioInFrame = 4;
+#ifdef AUDIO_OUT_SOFT_VOLUME
+    AUDIO_DSP_GainInit(&AudioGain, Volume);
+    Volume = 100;
+#endif
+
     /* Call low layer function */
     if (EVAL_AUDIO_Init(OUTPUT_DEVICE_AUTO, Volume, AudioFreq) != 0)
     {
@@ -125,6 +152,8 @@ static uint8_t  Init         (uint32_t AudioFreq,
     
     /* Set the Initialization flag to prevent reinitializing the interface again */
     Initialized = 1;
+    AudioFrequency = AudioFreq;
+    AudioVolume = Volume;
   }
   
   /* Update the Audio state machine */
@@ -171,6 +200,8 @@ static uint8_t  AudioCmd(uint8_t* pbuf,
   {
     /* Process the PLAY command ----------------------------*/
   case AUDIO_CMD_PLAY:
+    pbuf = Process(pbuf, &size);
+
     /* If current state is Active or Stopped */
     if ((AudioState == AUDIO_STATE_ACTIVE) || \
        (AudioState == AUDIO_STATE_STOPPED) || \
@@ -249,12 +280,17 @@ static uint8_t  AudioCmd(uint8_t* pbuf,
   */
 static uint8_t  VolumeCtl    (uint8_t vol)
 {
+#ifdef AUDIO_OUT_SOFT_VOLUME
+  AUDIO_DSP_SetVolume(&AudioGain, vol);
+#else
   /* Call low layer volume setting function */  
   if (EVAL_AUDIO_VolumeCtl(vol) != 0)
   {
     AudioState = AUDIO_STATE_ERROR;
     return AUDIO_FAIL;
   }
+#endif
+  AudioVolume = vol;
   
   return AUDIO_OK;
 }
@@ -267,12 +303,16 @@ static uint8_t  VolumeCtl    (uint8_t vol)
   */
 static uint8_t  MuteCtl      (uint8_t cmd)
 {
+#ifdef AUDIO_OUT_SOFT_VOLUME
+  AUDIO_DSP_SetMute(&AudioGain, cmd);
+#else
   /* Call low layer mute setting function */  
   if (EVAL_AUDIO_Mute(cmd) != 0)
   {
     AudioState = AUDIO_STATE_ERROR;
     return AUDIO_FAIL;
   }
+#endif
   
   return AUDIO_OK;
 }
@@ -292,6 +332,122 @@ static uint8_t  PeriodicTC   (uint8_t cmd)
 }
 
 
+/**
+  * @brief  EVAL_AUDIO_TransferComplete_CallBack
+  *         Called by the codec driver at the end of each DMA transfer
+  *         started by Audio_MAL_Play.
+  * @param  pBuffer: buffer that was played
+  * @param  Size: size of the buffer, in samples
+  * @retval None
+  */
+void EVAL_AUDIO_TransferComplete_CallBack(uint32_t pBuffer, uint32_t Size)
+{
+  USBD_AUDIO_OUT_TransferComplete();
+}
+
+/**
+  * @brief  SetFormat
+  *         Reconfigures the codec for another sampling rate, and the sample
+  *         conversion for another format. The core has paused the playback
+  *         beforehand.
+  * @param  AudioFreq: new sampling rate
+  * @param  Channels: number of channels
+  * @param  SubFrame: bytes per sample
+  * @param  Resolution: bits used in a sample
+  * @retval AUDIO_OK if all operations succeed, AUDIO_FAIL else.
+  */
+static uint8_t  SetFormat    (uint32_t AudioFreq, uint8_t Channels, uint8_t SubFrame, uint8_t Resolution)
+{
+  /* The codec is driven with stereo frames of AUDIO_OUT_CODEC_BYTES
+     samples; mono streams, and 2, 3 or 4 bytes samples are converted to
+     that */
+  if (AUDIO_DSP_FormatInit(&AudioFormat, Channels, SubFrame, Resolution, AUDIO_OUT_CODEC_BYTES) != USBD_OK)
+  {
+    return AUDIO_FAIL;
+  }
+#ifdef AUDIO_OUT_SWAP_CHANNELS
+  AudioFormat.map[0] = Channels - 1;
+  AudioFormat.map[1] = 0;
+#endif
+  AudioInFrame = AudioFormat.in_channels * AudioFormat.in_bytes;
+
+  if (AudioFreq == AudioFrequency)
+  {
+    return AUDIO_OK;
+  }
+
+  /* Call low layer function: reprograms the I2S clock */
+#ifdef AUDIO_OUT_SOFT_VOLUME
+  if (EVAL_AUDIO_Init(OUTPUT_DEVICE_AUTO, 100, AudioFreq) != 0)
+#else
+  if (EVAL_AUDIO_Init(OUTPUT_DEVICE_AUTO, AudioVolume, AudioFreq) != 0)
+#endif
+  {
+    AudioState = AUDIO_STATE_ERROR;
+    return AUDIO_FAIL;
+  }
+  AudioFrequency = AudioFreq;
+  AudioState = AUDIO_STATE_ACTIVE;
+
+  return AUDIO_OK;
+}
+
+/**
+  * @brief  Process
+  *         Converts a chunk about to be played to the codec format, and
+  *         applies the software volume. Samples in the codec format already
+  *         are processed in place, in the FIFO.
+  * @param  pbuf: samples, in the stream format
+  * @param  size: size of the samples in bytes; updated to the size of
+  *         the samples to play
+  * @retval samples to play
+  */
+static uint8_t  *Process     (uint8_t* pbuf, uint32_t *size)
+{
+  uint32_t frames = MIN(*size / AudioInFrame, AUDIO_OUT_CHUNK_FRAMES);
+
+  AudioPlayFrames = frames;
+  if (!AUDIO_DSP_IsPassThrough(&AudioFormat))
+  {
+    *size = AUDIO_DSP_Convert(&AudioFormat, pbuf, (uint8_t *)PlayBuff, frames);
+    pbuf = (uint8_t *)PlayBuff;
+  }
+
+#ifdef AUDIO_OUT_SOFT_VOLUME
+  if (AudioFormat.out_bytes == 2)
+  {
+    AUDIO_DSP_Gain16(&AudioGain, (int16_t *)pbuf, frames);
+  }
+  else
+  {
+    AUDIO_DSP_Gain32(&AudioGain, (int32_t *)pbuf, frames);
+  }
+#endif
+
+  return pbuf;
+}
+
+/**
+  * @brief  GetPosition
+  *         Returns how much of the chunk being played the codec sent out.
+  * @param  None
+  * @retval played part of the chunk, in bytes of the stream format
+  */
+static uint32_t GetPosition  (void)
+{
+  uint32_t left;
+
+  if (AudioState != AUDIO_STATE_PLAYING)
+  {
+    return 0;
+  }
+  /* The DMA counts the 16 bits units left down; a codec frame has
+     AUDIO_OUT_CODEC_BYTES of them */
+  left = DMA_GetCurrDataCounter(AUDIO_OUT_DMA_STREAM) / AUDIO_OUT_CODEC_BYTES;
+
+  return (AudioPlayFrames - MIN(left, AudioPlayFrames)) * AudioInFrame;
+}
+
 /**
   * @brief  GetState
   *         Return the current state of the audio machine
@@ -57,6 +57,65 @@
 #define SEND_BREAK                              0x23
 #define NO_CMD                                  0xFF
 
+/* Notifications sent over CDC_CMD_EP */
+#define SERIAL_STATE                            0x20
+
+/* SERIAL_STATE bits. DCD and DSR are steady states; the other ones report
+   events, and are cleared once they have been sent to the host. */
+#define CDC_SERIAL_STATE_DCD                    0x0001
+#define CDC_SERIAL_STATE_DSR                    0x0002
+#define CDC_SERIAL_STATE_BREAK                  0x0004
+#define CDC_SERIAL_STATE_RING                   0x0008
+#define CDC_SERIAL_STATE_FRAMING                0x0010
+#define CDC_SERIAL_STATE_PARITY                 0x0020
+#define CDC_SERIAL_STATE_OVERRUN                0x0040
+#define CDC_SERIAL_STATE_EVENTS                 0x007C
+
+/* Bits returned by USBD_CDC_GetLineState() */
+#define CDC_LINE_STATE_DTR                      0x0001
+#define CDC_LINE_STATE_RTS                      0x0002
+#define CDC_LINE_STATE_BREAK                    0x0004
+
+/* Data received from the host that the application didn't consume right
+   away in pIf_DataRx is kept in a queue of CDC_RX_QUEUE_SIZE bytes. Once
+   it holds more than CDC_RX_HIGH_WATERMARK bytes, the OUT endpoint is no
+   longer re-armed, and the host gets NAKed until USBD_CDC_Read() brings it
+   back down to CDC_RX_LOW_WATERMARK. */
+#ifndef CDC_RX_QUEUE_SIZE
+#define CDC_RX_QUEUE_SIZE                       1024
+#endif
+#ifndef CDC_RX_HIGH_WATERMARK
+#define CDC_RX_HIGH_WATERMARK                   (CDC_RX_QUEUE_SIZE - 1 - CDC_DATA_MAX_PACKET_SIZE)
+#endif
+#ifndef CDC_RX_LOW_WATERMARK
+#define CDC_RX_LOW_WATERMARK                    (CDC_RX_QUEUE_SIZE / 2)
+#endif
+
+/* When set, USBD_CDC_Write() refuses data while the host hasn't asserted
+   DTR, ie. while no program has the port open. */
+#ifndef CDC_TX_REQUIRES_DTR
+#define CDC_TX_REQUIRES_DTR                     1
+#endif
+
+/* Terminal programs tend to send SET_LINE_CODING and SET_CONTROL_LINE_STATE
+   in bursts. The line configuration is only handed to the application once
+   it has been left alone for that many frames (ms). */
+#ifndef CDC_LINE_CONFIG_DEBOUNCE
+#define CDC_LINE_CONFIG_DEBOUNCE                10
+#endif
+
+#define CDC_LINE_CODING_SIZE                    7
+
+
+typedef struct _CDC_LINE_CODING
+{
+  uint32_t bitrate;
+  uint8_t  format;
+  uint8_t  paritytype;
+  uint8_t  datatype;
+}
+CDC_LineCoding_TypeDef;
+
 
 typedef struct _CDC_IF_PROP
 {
@@ -64,13 +123,29 @@ typedef struct _CDC_IF_PROP
   uint16_t (*pIf_DeInit)   (void);
   uint16_t (*pIf_Ctrl)     (uint32_t Cmd, uint8_t* Buf, uint32_t Len);
   uint16_t (*pIf_DataTx)   (uint8_t* Buf, uint32_t Len);
+  /* Takes all the data received; returns USBD_OK or USBD_FAIL */
   uint16_t (*pIf_DataRx)   (uint8_t* Buf, uint32_t Len);
+  /* Debounced line configuration change. When NULL, pIf_Ctrl gets called
+     instead with SET_LINE_CODING and/or SET_CONTROL_LINE_STATE. */
+  uint16_t (*pIf_LineConfig) (const CDC_LineCoding_TypeDef *Coding, uint16_t LineState);
+  /* Used instead of pIf_DataRx when set: returns the number of bytes
+     consumed, the rest is queued for USBD_CDC_Read(). When both are NULL,
+     everything is queued. */
+  uint16_t (*pIf_DataRxPartial) (uint8_t* Buf, uint32_t Len);
 }
 CDC_IF_Prop_TypeDef;
 
 
 extern USBD_Class_cb_TypeDef  USBD_CDC_cb;
 
+/* Producer / consumer API */
+uint32_t  USBD_CDC_Write          (const uint8_t *buf, uint32_t len);
+uint32_t  USBD_CDC_Read           (void *pdev, uint8_t *buf, uint32_t len);
+uint32_t  USBD_CDC_RxAvailable    (void);
+uint16_t  USBD_CDC_GetLineState   (void);
+void      USBD_CDC_GetLineCoding  (CDC_LineCoding_TypeDef *coding);
+void      USBD_CDC_SetSerialState (void *pdev, uint16_t state);
+
 #endif
 
 /******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
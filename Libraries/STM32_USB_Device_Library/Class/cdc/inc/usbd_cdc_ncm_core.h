@@ -0,0 +1,138 @@
+/**
+  ******************************************************************************
+  * @file    usbd_cdc_ncm_core.h
+  * @brief   header file for the usbd_cdc_ncm_core.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USB_CDC_NCM_CORE_H_
+#define __USB_CDC_NCM_CORE_H_
+
+#include  "usbd_ioreq.h"
+
+/* Endpoints and sizes. These can be overridden from usbd_conf.h. */
+#ifndef NCM_IN_EP
+#define NCM_IN_EP                               0x81
+#endif
+#ifndef NCM_OUT_EP
+#define NCM_OUT_EP                              0x01
+#endif
+#ifndef NCM_NOTIFY_EP
+#define NCM_NOTIFY_EP                           0x82
+#endif
+
+#ifndef NCM_DATA_MAX_PACKET_SIZE
+#define NCM_DATA_MAX_PACKET_SIZE                64
+#endif
+#define NCM_NOTIFY_PACKET_SIZE                  16
+
+/* Maximum size of a single NTB, in both directions. The host is told about
+   these through GET_NTB_PARAMETERS, and may lower the IN one afterwards
+   with SET_NTB_INPUT_SIZE. */
+#ifndef NCM_NTB_IN_MAX_SIZE
+#define NCM_NTB_IN_MAX_SIZE                     2048
+#endif
+#ifndef NCM_NTB_OUT_MAX_SIZE
+#define NCM_NTB_OUT_MAX_SIZE                    2048
+#endif
+
+/* How many datagrams we are willing to pack into one IN NTB, and to keep
+   queued for the application from OUT NTBs. */
+#ifndef NCM_MAX_IN_DATAGRAMS
+#define NCM_MAX_IN_DATAGRAMS                    16
+#endif
+#ifndef NCM_MAX_OUT_DATAGRAMS
+#define NCM_MAX_OUT_DATAGRAMS                   16
+#endif
+
+/* Number of SOF frames a partially filled IN NTB is allowed to wait for
+   more datagrams before being flushed to the host. */
+#ifndef NCM_IN_FLUSH_FRAMES
+#define NCM_IN_FLUSH_FRAMES                     1
+#endif
+
+#define NCM_MAX_SEGMENT_SIZE                    1514
+
+/* NTB16 layout */
+#define NCM_NTH16_SIGNATURE                     0x484D434E  /* "NCMH" */
+#define NCM_NDP16_NOCRC_SIGNATURE               0x304D434E  /* "NCM0" */
+#define NCM_NTH16_SIZE                          12
+#define NCM_NDP16_HEADER_SIZE                   8
+#define NCM_NDP16_ENTRY_SIZE                    4
+#define NCM_NDP16_SIZE(n)                       (NCM_NDP16_HEADER_SIZE + NCM_NDP16_ENTRY_SIZE * ((n) + 1))
+
+/* Returned by NCM_NTB_Parse for malformed NTBs */
+#define NCM_NTB_INVALID                         0xFFFF
+
+/* Alignment constraints we report in GET_NTB_PARAMETERS */
+#define NCM_NDP_IN_DIVISOR                      4
+#define NCM_NDP_IN_PAYLOAD_REMAINDER            0
+#define NCM_NDP_IN_ALIGNMENT                    4
+
+/* NCM class specific requests */
+#define NCM_SET_ETHERNET_MULTICAST_FILTERS      0x40
+#define NCM_SET_ETHERNET_PACKET_FILTER          0x43
+#define NCM_GET_ETHERNET_STATISTIC              0x44
+#define NCM_GET_NTB_PARAMETERS                  0x80
+#define NCM_GET_NET_ADDRESS                     0x81
+#define NCM_SET_NET_ADDRESS                     0x82
+#define NCM_GET_NTB_FORMAT                      0x83
+#define NCM_SET_NTB_FORMAT                      0x84
+#define NCM_GET_NTB_INPUT_SIZE                  0x85
+#define NCM_SET_NTB_INPUT_SIZE                  0x86
+#define NCM_GET_MAX_DATAGRAM_SIZE               0x87
+#define NCM_SET_MAX_DATAGRAM_SIZE               0x88
+#define NCM_GET_CRC_MODE                        0x89
+#define NCM_SET_CRC_MODE                        0x8A
+
+/* Notifications sent over NCM_NOTIFY_EP */
+#define NCM_NOTIFY_NETWORK_CONNECTION           0x00
+#define NCM_NOTIFY_CONNECTION_SPEED_CHANGE      0x2A
+
+#define NCM_NTB_PARAMETERS_SIZE                 28
+
+
+typedef struct _NCM_IF_PROP
+{
+  uint16_t (*pIf_Init)     (void);
+  uint16_t (*pIf_DeInit)   (void);
+  /* Called from the USB interrupt when it has queued new datagrams, to be
+     read with USBD_NCM_PeekDatagram(). Typically used to wake up the IP
+     stack task. */
+  uint16_t (*pIf_RxReady)  (void);
+  /* Called from the USB interrupt when an IN NTB has been sent and room is
+     available again for USBD_NCM_SendDatagram(). */
+  uint16_t (*pIf_TxReady)  (void);
+}
+NCM_IF_Prop_TypeDef;
+
+typedef struct _NCM_Stats
+{
+  uint32_t ntb_in;          /* NTBs sent to the host */
+  uint32_t datagrams_in;    /* datagrams carried by these NTBs */
+  uint32_t ntb_out;         /* NTBs received from the host */
+  uint32_t datagrams_out;   /* datagrams carried by these NTBs */
+  uint32_t ntb_out_errors;  /* malformed NTBs dropped */
+}
+NCM_Stats_TypeDef;
+
+
+extern USBD_Class_cb_TypeDef  USBD_NCM_cb;
+extern NCM_Stats_TypeDef      USBD_NCM_Stats;
+
+/* Datagram queue API, to be used by the IP stack. */
+uint8_t   USBD_NCM_SendDatagram    (void *pdev, const uint8_t *buf, uint16_t len);
+void      USBD_NCM_Flush           (void *pdev);
+uint8_t * USBD_NCM_PeekDatagram    (uint16_t *len);
+void      USBD_NCM_ReleaseDatagram (void *pdev);
+void      USBD_NCM_SetLinkState    (void *pdev, uint8_t up, uint32_t bitrate);
+
+/* NTB16 helpers. They don't touch the hardware, and operate on plain buffers. */
+uint16_t  NCM_NTB_Begin            (uint8_t *ntb, uint16_t seq);
+uint16_t  NCM_NTB_Append           (uint8_t *ntb, uint16_t pos, uint16_t maxlen, uint16_t count,
+                                    uint16_t *entries, const uint8_t *buf, uint16_t len);
+uint16_t  NCM_NTB_Finalize         (uint8_t *ntb, uint16_t pos, uint16_t count, const uint16_t *entries);
+uint16_t  NCM_NTB_Parse            (const uint8_t *ntb, uint16_t len, uint16_t maxcount, uint16_t *entries);
+
+#endif
+
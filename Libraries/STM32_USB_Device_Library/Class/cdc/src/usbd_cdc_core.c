@@ -28,6 +28,12 @@
   *             - Abstract Control Model compliant
   *             - Union Functional collection (using 1 IN endpoint for control)
   *             - Data interface class
+  *             - SERIAL_STATE notifications over the command endpoint
+  *             - Flow control: the OUT endpoint is NAKed while the reception
+  *               queue is above CDC_RX_HIGH_WATERMARK
+  *             - Line coding and control line state are shadowed in the core:
+  *               GET_LINE_CODING is answered from the shadow, and changes are
+  *               reported to the application once, after CDC_LINE_CONFIG_DEBOUNCE
 
   *           @note
   *             For the Abstract Control Model, this core allows only transmitting the requests to
@@ -62,6 +68,8 @@
 #include "usbd_desc.h"
 #include "usbd_req.h"
 
+#include <string.h>
+
 
 /*********************************************
    CDC Device library callbacks
@@ -78,6 +86,11 @@ static uint8_t  usbd_cdc_SOF         (void *pdev);
    CDC specific management functions
  *********************************************/
 static void Handle_USBAsynchXfer  (void *pdev);
+static void CDC_SendSerialState   (void *pdev);
+static void CDC_Rx_Resume         (void *pdev);
+static void CDC_LineConfigChanged (void);
+static void CDC_LineConfigNotify  (void);
+static uint8_t CDC_FrameStart     (void *pdev);
 static uint8_t  *USBD_cdc_GetCfgDesc (uint8_t speed, uint16_t *length);
 #ifdef USE_USB_OTG_HS
 static uint8_t  *USBD_cdc_GetOtherCfgDesc (uint8_t speed, uint16_t *length);
@@ -98,12 +111,49 @@ __ALIGN_BEGIN uint8_t CmdBuff[CDC_CMD_PACKET_SZE] __ALIGN_END ;
 uint32_t APP_Rx_ptr_in  = 0;
 uint32_t APP_Rx_ptr_out = 0;
 uint32_t APP_Rx_length  = 0;
+/* Start of the packet in flight on the IN endpoint, APP_Rx_ptr_out when
+   there is none: the endpoint reads from APP_Rx_Buffer until the transfer
+   completes, so USBD_CDC_Write may only fill up to there */
+static __IO uint32_t APP_Rx_ptr_tx = 0;
 
 uint8_t  USB_Tx_State = 0;
 
 static uint32_t cdcCmd = 0xFF;
 static uint32_t cdcLen = 0;
 
+#if CDC_RX_HIGH_WATERMARK > (CDC_RX_QUEUE_SIZE - 1 - CDC_DATA_MAX_PACKET_SIZE)
+#error CDC_RX_HIGH_WATERMARK leaves no room for a full packet in the reception queue
+#endif
+
+/* Reception queue, filled from the OUT endpoint, drained by USBD_CDC_Read() */
+__ALIGN_BEGIN static uint8_t CDC_Rx_Queue [CDC_RX_QUEUE_SIZE] __ALIGN_END ;
+static __IO uint32_t CDC_Rx_ptr_in  = 0;
+static __IO uint32_t CDC_Rx_ptr_out = 0;
+static __IO uint8_t  CDC_Rx_Stalled = 0;
+
+/* The serial state can be set out of the USB interrupt, which sends it
+   too once the previous notification is done */
+#define CDC_LOCK(state)               do { (state) = __get_PRIMASK(); __disable_irq(); } while (0)
+#define CDC_UNLOCK(state)             __set_PRIMASK(state)
+
+/* Control line state, as set by the host, and serial state reported back */
+__ALIGN_BEGIN static uint8_t CDC_NotifyBuff [10] __ALIGN_END ;
+static __IO uint16_t CDC_LineState    = 0;
+static __IO uint16_t CDC_BreakTimer   = 0;
+static __IO uint16_t CDC_SerialState  = 0;
+static __IO uint16_t CDC_SerialEvents = 0;
+static __IO uint16_t CDC_SerialSent   = 0xFFFF;
+static __IO uint8_t  CDC_NotifyBusy   = 0;
+
+/* Line configuration shadow: what the host set last, and what the
+   application was told about last. Defaults to 115200 8N1. */
+static const uint8_t CDC_LineCodingDefault[CDC_LINE_CODING_SIZE] = { 0x00, 0xC2, 0x01, 0x00, 0x00, 0x00, 0x08 };
+__ALIGN_BEGIN static uint8_t CDC_LineCoding [CDC_LINE_CODING_SIZE] __ALIGN_END ;
+static uint8_t       CDC_LineCodingApplied[CDC_LINE_CODING_SIZE];
+static uint16_t      CDC_LineStateApplied = 0;
+static __IO uint16_t CDC_LineConfigQuiet  = 0;
+static __IO uint8_t  CDC_LineConfigPending = 0;
+
 /* CDC interface class callbacks structure */
 USBD_Class_cb_TypeDef  USBD_CDC_cb =
 {
@@ -319,6 +369,18 @@ static uint8_t  usbd_cdc_Init (void  *pdev, uint8_t cfgidx)
   pbuf[4] = DEVICE_CLASS_CDC;
   pbuf[5] = DEVICE_SUBCLASS_CDC;
 
+  CDC_Rx_ptr_in = CDC_Rx_ptr_out = 0;
+  CDC_Rx_Stalled = 0;
+  CDC_LineState = 0;
+  CDC_BreakTimer = 0;
+  CDC_SerialState = CDC_SerialEvents = 0;
+  CDC_SerialSent = 0xFFFF;
+  CDC_NotifyBusy = 0;
+  memcpy(CDC_LineCoding, CDC_LineCodingDefault, CDC_LINE_CODING_SIZE);
+  memcpy(CDC_LineCodingApplied, CDC_LineCodingDefault, CDC_LINE_CODING_SIZE);
+  CDC_LineStateApplied = 0;
+  CDC_LineConfigPending = 0;
+
   /* Initialize the Interface physical components */
   APP_FOPS.pIf_Init();
 
@@ -353,12 +415,21 @@ static uint8_t  usbd_cdc_DeInit (void  *pdev, uint8_t cfgidx)
 static uint8_t  usbd_cdc_Setup (void  *pdev, USB_SETUP_REQ *req)
 {
   uint16_t len;
+  uint16_t state;
   uint8_t  *pbuf;
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
     /* CDC Class Requests -------------------------------*/
   case USB_REQ_TYPE_CLASS :
+      /* The line coding is answered from the shadow, without bothering
+         the interface layer */
+      if (req->bRequest == GET_LINE_CODING)
+      {
+        USBD_CtlSendData (pdev, CDC_LineCoding, MIN(CDC_LINE_CODING_SIZE, req->wLength));
+        return USBD_OK;
+      }
+
       /* Check if the request is a data setup packet */
       if (req->wLength)
       {
@@ -385,8 +456,39 @@ static uint8_t  usbd_cdc_Setup (void  *pdev, USB_SETUP_REQ *req)
       }
       else /* No Data request */
       {
-        /* Transfer the command to the interface layer */
-        APP_FOPS.pIf_Ctrl(req->bRequest, NULL, 0);
+        switch (req->bRequest)
+        {
+        case SET_CONTROL_LINE_STATE:
+          state = (CDC_LineState & CDC_LINE_STATE_BREAK) |
+                  (req->wValue & (CDC_LINE_STATE_DTR | CDC_LINE_STATE_RTS));
+          if (state != CDC_LineState)
+          {
+            CDC_LineState = state;
+            /* Mirror DTR as the modem lines; the application can still
+               override them with USBD_CDC_SetSerialState() */
+            USBD_CDC_SetSerialState(pdev, (req->wValue & CDC_LINE_STATE_DTR) ?
+                                          (CDC_SERIAL_STATE_DCD | CDC_SERIAL_STATE_DSR) : 0);
+            CDC_LineConfigChanged();
+          }
+          /* The interface layer gets it through the debounced event */
+          return USBD_OK;
+
+        case SEND_BREAK:
+          /* 0xFFFF means until the next SEND_BREAK, else a duration in ms */
+          CDC_BreakTimer = req->wValue;
+          if (req->wValue)
+          {
+            CDC_LineState |= CDC_LINE_STATE_BREAK;
+          }
+          else
+          {
+            CDC_LineState &= ~CDC_LINE_STATE_BREAK;
+          }
+          break;
+        }
+
+        /* Transfer the command to the interface layer, along with wValue */
+        APP_FOPS.pIf_Ctrl(req->bRequest, (uint8_t *)&req->wValue, sizeof(req->wValue));
       }
 
       return USBD_OK;
@@ -441,7 +543,17 @@ static uint8_t  usbd_cdc_Setup (void  *pdev, USB_SETUP_REQ *req)
   */
 static uint8_t  usbd_cdc_EP0_RxReady (void  *pdev)
 {
-  if (cdcCmd != NO_CMD)
+  if (cdcCmd == SET_LINE_CODING)
+  {
+    /* Redundant settings are simply dropped */
+    if ((cdcLen >= CDC_LINE_CODING_SIZE) && memcmp(CDC_LineCoding, CmdBuff, CDC_LINE_CODING_SIZE))
+    {
+      memcpy(CDC_LineCoding, CmdBuff, CDC_LINE_CODING_SIZE);
+      CDC_LineConfigChanged();
+    }
+    cdcCmd = NO_CMD;
+  }
+  else if (cdcCmd != NO_CMD)
   {
     /* Process the data */
     APP_FOPS.pIf_Ctrl(cdcCmd, CmdBuff, cdcLen);
@@ -465,14 +577,23 @@ static uint8_t  usbd_cdc_DataIn (void *pdev, uint8_t epnum)
   uint16_t USB_Tx_ptr;
   uint16_t USB_Tx_length;
 
+  if (epnum == (CDC_CMD_EP & 0x7F))
+  {
+    CDC_NotifyBusy = 0;
+    CDC_SendSerialState(pdev);
+    return USBD_OK;
+  }
+
   if (USB_Tx_State == 1)
   {
     if (APP_Rx_length == 0)
     {
       USB_Tx_State = 0;
+      APP_Rx_ptr_tx = APP_Rx_ptr_out;
     }
     else
     {
+      APP_Rx_ptr_tx = APP_Rx_ptr_out;
       if (APP_Rx_length > CDC_DATA_IN_PACKET_SIZE){
         USB_Tx_ptr = APP_Rx_ptr_out;
         USB_Tx_length = CDC_DATA_IN_PACKET_SIZE;
@@ -507,16 +628,51 @@ static uint8_t  usbd_cdc_DataIn (void *pdev, uint8_t epnum)
 static uint8_t  usbd_cdc_DataOut (void *pdev, uint8_t epnum)
 {
   uint16_t USB_Rx_Cnt;
+  uint16_t i = 0;
+  uint32_t ptr_in = CDC_Rx_ptr_in;
 
   /* Get the received data buffer and update the counter */
   USB_Rx_Cnt = ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count;
 
-  /* USB data will be immediately processed, this allow next USB traffic being
-     NAKed till the end of the application Xfer */
-  APP_FOPS.pIf_DataRx(USB_Rx_Buffer, USB_Rx_Cnt);
+  if (APP_FOPS.pIf_DataRxPartial)
+  {
+    /* Let the application consume what it can right away, as long as
+       nothing older is still waiting in the queue */
+    if (CDC_Rx_ptr_out == ptr_in)
+    {
+      i = APP_FOPS.pIf_DataRxPartial(USB_Rx_Buffer, USB_Rx_Cnt);
+      i = MIN(i, USB_Rx_Cnt);
+    }
+  }
+  else if (APP_FOPS.pIf_DataRx)
+  {
+    /* The application takes everything, nothing is queued */
+    APP_FOPS.pIf_DataRx(USB_Rx_Buffer, USB_Rx_Cnt);
+    i = USB_Rx_Cnt;
+  }
 
-  /* Prepare Out endpoint to receive next packet */
-  DCD_EP_PrepareRx(pdev, CDC_OUT_EP, (uint8_t*)(USB_Rx_Buffer), CDC_DATA_OUT_PACKET_SIZE);
+  /* The endpoint is only armed when there is room for a full packet, so
+     the rest always fits */
+  for (; i < USB_Rx_Cnt; i++)
+  {
+    CDC_Rx_Queue[ptr_in] = USB_Rx_Buffer[i];
+    if (++ptr_in == CDC_RX_QUEUE_SIZE)
+    {
+      ptr_in = 0;
+    }
+  }
+  CDC_Rx_ptr_in = ptr_in;
+
+  if (USBD_CDC_RxAvailable() > CDC_RX_HIGH_WATERMARK)
+  {
+    /* Leave the endpoint NAKing until the consumer catches up */
+    CDC_Rx_Stalled = 1;
+  }
+  else
+  {
+    /* Prepare Out endpoint to receive next packet */
+    DCD_EP_PrepareRx(pdev, CDC_OUT_EP, (uint8_t*)(USB_Rx_Buffer), CDC_DATA_OUT_PACKET_SIZE);
+  }
 
   return USBD_OK;
 }
@@ -531,6 +687,23 @@ static uint8_t  usbd_cdc_DataOut (void *pdev, uint8_t epnum)
 static uint8_t  usbd_cdc_SOF (void *pdev)
 {
   static uint32_t FrameCount = 0;
+  static const uint16_t NoBreak = 0;
+
+  /* Timed breaks and the debounce are counted in frames, ie. in ms */
+  if (CDC_FrameStart(pdev))
+  {
+    if (CDC_BreakTimer && (CDC_BreakTimer != 0xFFFF) && (--CDC_BreakTimer == 0))
+    {
+      CDC_LineState &= ~CDC_LINE_STATE_BREAK;
+      APP_FOPS.pIf_Ctrl(SEND_BREAK, (uint8_t *)&NoBreak, sizeof(NoBreak));
+    }
+
+    if (CDC_LineConfigPending && (++CDC_LineConfigQuiet >= CDC_LINE_CONFIG_DEBOUNCE))
+    {
+      CDC_LineConfigPending = 0;
+      CDC_LineConfigNotify();
+    }
+  }
 
   if (FrameCount++ == CDC_IN_FRAME_INTERVAL)
   {
@@ -544,6 +717,27 @@ static uint8_t  usbd_cdc_SOF (void *pdev)
   return USBD_OK;
 }
 
+/**
+  * @brief  CDC_FrameStart
+  *         Tells whether a SOF starts a 1 ms frame. At high speed, one comes
+  *         with each of the 8 microframes, whose number DSTS.SOFFN holds in
+  *         its low 3 bits.
+  * @param  pdev: instance
+  * @retval 1 for the first SOF of a frame, 0 else
+  */
+static uint8_t CDC_FrameStart (void *pdev)
+{
+  USB_OTG_CORE_HANDLE *otg = (USB_OTG_CORE_HANDLE *)pdev;
+  USB_OTG_DSTS_TypeDef dsts;
+
+  if (otg->cfg.speed != USB_OTG_SPEED_HIGH)
+  {
+    return 1;
+  }
+  dsts.d32 = USB_OTG_READ_REG32(&otg->regs.DREGS->DSTS);
+  return (dsts.b.soffn & 7) == 0;
+}
+
 /**
   * @brief  Handle_USBAsynchXfer
   *         Send data to USB
@@ -565,6 +759,7 @@ static void Handle_USBAsynchXfer (void *pdev)
     if(APP_Rx_ptr_out == APP_Rx_ptr_in)
     {
       USB_Tx_State = 0;
+      APP_Rx_ptr_tx = APP_Rx_ptr_out;
       return;
     }
 
@@ -599,12 +794,251 @@ static void Handle_USBAsynchXfer (void *pdev)
       APP_Rx_length = 0;
     }
     USB_Tx_State = 1;
+    APP_Rx_ptr_tx = USB_Tx_ptr;
 
     DCD_EP_Tx (pdev, CDC_IN_EP, (uint8_t*)&APP_Rx_Buffer[USB_Tx_ptr], USB_Tx_length);
   }
 
 }
 
+/**
+  * @brief  CDC_SendSerialState
+  *         Send the serial state to the host, if it changed or if events
+  *         are pending, and if the command endpoint is idle. Called from
+  *         the USB interrupt, or with it masked.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void CDC_SendSerialState (void *pdev)
+{
+  uint16_t state;
+
+  if (CDC_NotifyBusy)
+  {
+    return;
+  }
+
+  state = CDC_SerialState | CDC_SerialEvents;
+  if ((state == CDC_SerialSent) && !CDC_SerialEvents)
+  {
+    return;
+  }
+  CDC_SerialEvents = 0;
+  CDC_SerialSent = state & ~CDC_SERIAL_STATE_EVENTS;
+
+  CDC_NotifyBuff[0] = 0xA1;
+  CDC_NotifyBuff[1] = SERIAL_STATE;
+  CDC_NotifyBuff[2] = 0;
+  CDC_NotifyBuff[3] = 0;
+  CDC_NotifyBuff[4] = 0;       /* wIndex: communication interface */
+  CDC_NotifyBuff[5] = 0;
+  CDC_NotifyBuff[6] = 2;       /* wLength */
+  CDC_NotifyBuff[7] = 0;
+  CDC_NotifyBuff[8] = LOBYTE(state);
+  CDC_NotifyBuff[9] = HIBYTE(state);
+
+  CDC_NotifyBusy = 1;
+  DCD_EP_Tx (pdev, CDC_CMD_EP, CDC_NotifyBuff, sizeof(CDC_NotifyBuff));
+}
+
+/**
+  * @brief  CDC_LineConfigChanged
+  *         Restart the debounce period of the line configuration.
+  * @param  None
+  * @retval None
+  */
+static void CDC_LineConfigChanged (void)
+{
+  CDC_LineConfigQuiet = 0;
+  CDC_LineConfigPending = 1;
+}
+
+/**
+  * @brief  CDC_LineConfigNotify
+  *         Tell the interface layer about the line configuration, if it
+  *         really differs from what it was told last.
+  * @param  None
+  * @retval None
+  */
+static void CDC_LineConfigNotify (void)
+{
+  CDC_LineCoding_TypeDef coding;
+  uint16_t state = CDC_LineState & (CDC_LINE_STATE_DTR | CDC_LINE_STATE_RTS);
+  uint8_t codingChanged = memcmp(CDC_LineCodingApplied, CDC_LineCoding, CDC_LINE_CODING_SIZE) != 0;
+  uint8_t stateChanged = state != CDC_LineStateApplied;
+
+  if (!codingChanged && !stateChanged)
+  {
+    return;
+  }
+
+  memcpy(CDC_LineCodingApplied, CDC_LineCoding, CDC_LINE_CODING_SIZE);
+  CDC_LineStateApplied = state;
+
+  if (APP_FOPS.pIf_LineConfig)
+  {
+    USBD_CDC_GetLineCoding(&coding);
+    APP_FOPS.pIf_LineConfig(&coding, state);
+    return;
+  }
+
+  if (codingChanged)
+  {
+    APP_FOPS.pIf_Ctrl(SET_LINE_CODING, CDC_LineCodingApplied, CDC_LINE_CODING_SIZE);
+  }
+  if (stateChanged)
+  {
+    APP_FOPS.pIf_Ctrl(SET_CONTROL_LINE_STATE, (uint8_t *)&CDC_LineStateApplied, sizeof(CDC_LineStateApplied));
+  }
+}
+
+/**
+  * @brief  CDC_Rx_Resume
+  *         Re-arm the OUT endpoint if it was left NAKing, and the reception
+  *         queue went back under the low watermark.
+  * @param  pdev: instance
+  * @retval None
+  */
+static void CDC_Rx_Resume (void *pdev)
+{
+  if (CDC_Rx_Stalled && (USBD_CDC_RxAvailable() <= CDC_RX_LOW_WATERMARK))
+  {
+    CDC_Rx_Stalled = 0;
+    DCD_EP_PrepareRx(pdev, CDC_OUT_EP, (uint8_t*)(USB_Rx_Buffer), CDC_DATA_OUT_PACKET_SIZE);
+  }
+}
+
+/**
+  * @brief  USBD_CDC_Write
+  *         Queue data to be sent to the host. This is the producer side of
+  *         APP_Rx_Buffer: data is never overwritten, not even the packet
+  *         being sent, the caller gets told how much was accepted instead.
+  * @param  buf: data to send
+  * @param  len: length of the data
+  * @retval number of bytes queued
+  */
+uint32_t USBD_CDC_Write (const uint8_t *buf, uint32_t len)
+{
+  uint32_t ptr_in = APP_Rx_ptr_in;
+  uint32_t ptr_out = APP_Rx_ptr_tx;
+  uint32_t room;
+  uint32_t i;
+
+  if (CDC_TX_REQUIRES_DTR && !(CDC_LineState & CDC_LINE_STATE_DTR))
+  {
+    return 0;
+  }
+
+  if (ptr_out == APP_RX_DATA_SIZE)
+  {
+    ptr_out = 0;
+  }
+  room = APP_RX_DATA_SIZE - 1 - ((ptr_in + APP_RX_DATA_SIZE - ptr_out) % APP_RX_DATA_SIZE);
+  len = MIN(len, room);
+
+  for (i = 0; i < len; i++)
+  {
+    APP_Rx_Buffer[ptr_in] = buf[i];
+    if (++ptr_in == APP_RX_DATA_SIZE)
+    {
+      ptr_in = 0;
+    }
+  }
+  APP_Rx_ptr_in = ptr_in;
+
+  return len;
+}
+
+/**
+  * @brief  USBD_CDC_Read
+  *         Get data received from the host and not consumed by
+  *         pIf_DataRxPartial.
+  * @param  pdev: instance
+  * @param  buf: destination buffer
+  * @param  len: size of the destination buffer
+  * @retval number of bytes read
+  */
+uint32_t USBD_CDC_Read (void *pdev, uint8_t *buf, uint32_t len)
+{
+  uint32_t ptr_out = CDC_Rx_ptr_out;
+  uint32_t i;
+
+  len = MIN(len, USBD_CDC_RxAvailable());
+  for (i = 0; i < len; i++)
+  {
+    buf[i] = CDC_Rx_Queue[ptr_out];
+    if (++ptr_out == CDC_RX_QUEUE_SIZE)
+    {
+      ptr_out = 0;
+    }
+  }
+  CDC_Rx_ptr_out = ptr_out;
+
+  CDC_Rx_Resume(pdev);
+
+  return len;
+}
+
+/**
+  * @brief  USBD_CDC_RxAvailable
+  *         Number of bytes waiting in the reception queue.
+  * @param  None
+  * @retval number of bytes
+  */
+uint32_t USBD_CDC_RxAvailable (void)
+{
+  return (CDC_Rx_ptr_in + CDC_RX_QUEUE_SIZE - CDC_Rx_ptr_out) % CDC_RX_QUEUE_SIZE;
+}
+
+/**
+  * @brief  USBD_CDC_GetLineState
+  *         Control line state set by the host.
+  * @param  None
+  * @retval combination of CDC_LINE_STATE_DTR, CDC_LINE_STATE_RTS and
+  *         CDC_LINE_STATE_BREAK
+  */
+uint16_t USBD_CDC_GetLineState (void)
+{
+  return CDC_LineState;
+}
+
+/**
+  * @brief  USBD_CDC_GetLineCoding
+  *         Line coding set by the host, as of the last debounced event.
+  * @param  coding: filled with the line coding
+  * @retval None
+  */
+void USBD_CDC_GetLineCoding (CDC_LineCoding_TypeDef *coding)
+{
+  coding->bitrate = CDC_LineCodingApplied[0] | (CDC_LineCodingApplied[1] << 8) |
+                    (CDC_LineCodingApplied[2] << 16) | ((uint32_t)CDC_LineCodingApplied[3] << 24);
+  coding->format = CDC_LineCodingApplied[4];
+  coding->paritytype = CDC_LineCodingApplied[5];
+  coding->datatype = CDC_LineCodingApplied[6];
+}
+
+/**
+  * @brief  USBD_CDC_SetSerialState
+  *         Report the serial state to the host. DCD and DSR are kept until
+  *         changed; event bits (break, ring, framing, parity, overrun) are
+  *         sent once.
+  * @param  pdev: instance
+  * @param  state: combination of CDC_SERIAL_STATE_xxx bits
+  * @retval None
+  */
+void USBD_CDC_SetSerialState (void *pdev, uint16_t state)
+{
+  uint32_t primask;
+
+  /* The DataIn interrupt of the command endpoint clears the events and
+     sends the next notification: keep it out until this one is queued */
+  CDC_LOCK(primask);
+  CDC_SerialState = state & ~CDC_SERIAL_STATE_EVENTS;
+  CDC_SerialEvents |= state & CDC_SERIAL_STATE_EVENTS;
+  CDC_SendSerialState(pdev);
+  CDC_UNLOCK(primask);
+}
+
 /**
   * @brief  USBD_cdc_GetCfgDesc
   *         Return configuration descriptor
@@ -53,7 +53,9 @@ CDC_IF_Prop_TypeDef TEMPLATE_fops =
   TEMPLATE_DeInit,
   TEMPLATE_Ctrl,
   TEMPLATE_DataTx,
-  TEMPLATE_DataRx
+  TEMPLATE_DataRx,
+  NULL,              /* pIf_LineConfig: pIf_Ctrl gets the line configuration */
+  NULL               /* pIf_DataRxPartial: TEMPLATE_DataRx takes everything */
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -120,15 +122,16 @@ static uint16_t TEMPLATE_Ctrl (uint32_t Cmd, uint8_t* Buf, uint32_t Len)
     break;
 
   case SET_LINE_CODING:
-    /* Add your code here */
+    /* Only called once the host is done changing the line coding, and
+       only if it actually changed. Not called if pIf_LineConfig is set. */
     break;
 
   case GET_LINE_CODING:
-    /* Add your code here */
+    /* Answered by the CDC core from its line coding shadow */
     break;
 
   case SET_CONTROL_LINE_STATE:
-    /* Add your code here */
+    /* Debounced the same way as SET_LINE_CODING */
     break;
 
   case SEND_BREAK:
@@ -181,6 +184,10 @@ static uint16_t TEMPLATE_DataTx (uint8_t* Buf, uint32_t Len)
   *         untill exiting this function. If you exit this function before transfer
   *         is complete on CDC interface (ie. using DMA controller) it will result
   *         in receiving more data while previous ones are still not sent.
+  *         An interface that can't always take everything sets
+  *         pIf_DataRxPartial instead: what it doesn't consume is kept in the
+  *         CDC core reception queue, for USBD_CDC_Read(), and the host is
+  *         NAKed while that queue is above CDC_RX_HIGH_WATERMARK.
   *
   * @param  Buf: Buffer of data to be received
   * @param  Len: Number of data received (in bytes)
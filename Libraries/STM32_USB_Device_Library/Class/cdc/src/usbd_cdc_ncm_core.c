@@ -0,0 +1,1020 @@
+/**
+  ******************************************************************************
+  * @file    usbd_cdc_ncm_core.c
+  * @brief   This file provides the high layer firmware functions to manage the
+  *          following functionalities of the USB CDC-NCM Class:
+  *           - Initialization and Configuration of high and low layer
+  *           - NTB16 aggregation of outgoing datagrams (IN endpoint)
+  *           - NTB16 parsing of incoming datagrams (OUT endpoint)
+  *           - NCM class requests management
+  *           - Network connection notifications
+  *
+  *  @verbatim
+  *
+  *          ===================================================================
+  *                                CDC-NCM Class Driver Description
+  *          ===================================================================
+  *           This driver manages the "Universal Serial Bus Communications Class
+  *           Subclass Specification for Network Control Model Devices Revision 1.0
+  *           November 24, 2010".
+  *
+  *           Contrary to CDC-ACM, which carries a byte stream in packets of at
+  *           most CDC_DATA_MAX_PACKET_SIZE bytes, NCM carries Ethernet frames
+  *           packed into NCM Transfer Blocks (NTB). Each NTB is sent as a single
+  *           bulk transfer, and can hold many datagrams, so small frames such as
+  *           TCP acks no longer cost one transfer each.
+  *
+  *           The configuration descriptor is expected to look like this, and can
+  *           be written with the CDC::FunctionalDescriptor templates:
+  *             - Interface 0: class 0x02, subclass 0x0D, protocol 0x00
+  *                 - Header, Union, Ethernet Networking and NCM functional descriptors
+  *                 - Interrupt IN endpoint NCM_NOTIFY_EP
+  *             - Interface 1, alternate 0: class 0x0A, protocol 0x01, no endpoint
+  *             - Interface 1, alternate 1: class 0x0A, protocol 0x01
+  *                 - Bulk IN endpoint NCM_IN_EP, bulk OUT endpoint NCM_OUT_EP
+  *
+  *           The data endpoints are only opened when the host selects the
+  *           alternate setting 1 of the data interface, as mandated by the
+  *           specification. Only the NTB16 format is supported, without CRC.
+  *
+  *           Application side, datagrams are pushed with USBD_NCM_SendDatagram()
+  *           and pulled with USBD_NCM_PeekDatagram() / USBD_NCM_ReleaseDatagram().
+  *           While received datagrams are still held by the application, the OUT
+  *           endpoint isn't re-armed, so the host gets NAKed instead of having
+  *           its data dropped.
+  *
+  *  @endverbatim
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_cdc_ncm_core.h"
+#include "usbd_desc.h"
+#include "usbd_req.h"
+
+#include <string.h>
+
+
+/*********************************************
+   CDC-NCM Device library callbacks
+ *********************************************/
+static uint8_t  usbd_ncm_Init        (void  *pdev, uint8_t cfgidx);
+static uint8_t  usbd_ncm_DeInit      (void  *pdev, uint8_t cfgidx);
+static uint8_t  usbd_ncm_Setup       (void  *pdev, USB_SETUP_REQ *req);
+static uint8_t  usbd_ncm_EP0_RxReady (void *pdev);
+static uint8_t  usbd_ncm_DataIn      (void *pdev, uint8_t epnum);
+static uint8_t  usbd_ncm_DataOut     (void *pdev, uint8_t epnum);
+static uint8_t  usbd_ncm_SOF         (void *pdev);
+
+/*********************************************
+   CDC-NCM specific management functions
+ *********************************************/
+static void     NCM_DataOpen         (void *pdev);
+static void     NCM_DataClose        (void *pdev);
+static void     NCM_InSchedule       (void *pdev);
+static void     NCM_InSwap           (void);
+static void     NCM_Notify           (void *pdev);
+static uint8_t  *USBD_ncm_GetCfgDesc (uint8_t speed, uint16_t *length);
+
+const uint8_t * get_USB_configuration_descriptor(int index);
+
+extern NCM_IF_Prop_TypeDef  NCM_APP_FOPS;
+
+#ifndef NCM_DATA_INTERFACE
+#define NCM_DATA_INTERFACE              1
+#endif
+#ifndef NCM_COMM_INTERFACE
+#define NCM_COMM_INTERFACE              0
+#endif
+
+#define NCM_NO_CMD                      0xFF
+
+/* States of the IN NTB buffers */
+#define NCM_NTB_FILLING                 0
+#define NCM_NTB_READY                   1
+#define NCM_NTB_SENDING                 2
+
+/* Pending notifications */
+#define NCM_NOTIFY_SPEED                0x01
+#define NCM_NOTIFY_CONNECTION           0x02
+
+#define NCM_ALIGN(x, a)                 (((x) + ((a) - 1)) & ~((a) - 1))
+
+__ALIGN_BEGIN static uint8_t NCM_InNTB [2][NCM_NTB_IN_MAX_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN static uint8_t NCM_OutNTB[2][NCM_NTB_OUT_MAX_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN static uint8_t NCM_CmdBuff[NCM_NTB_PARAMETERS_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN static uint8_t NCM_NotifyBuff[NCM_NOTIFY_PACKET_SIZE] __ALIGN_END ;
+__ALIGN_BEGIN static __IO uint32_t usbd_ncm_AltSet __ALIGN_END = 0;
+
+/* IN side: one NTB being filled by the application, the other one being
+   sent or waiting to be sent. */
+static uint16_t          NCM_InEntries[2 * NCM_MAX_IN_DATAGRAMS];
+static __IO uint8_t      NCM_InState[2];
+static __IO uint16_t     NCM_InLen[2];
+static __IO uint8_t      NCM_InFill = 0;
+static __IO uint16_t     NCM_InPos = 0;
+static __IO uint16_t     NCM_InCount = 0;
+static __IO uint8_t      NCM_InAge = 0;
+static __IO uint8_t      NCM_InLock = 0;
+static __IO uint8_t      NCM_InZlp = 0;
+static uint16_t          NCM_InSequence = 0;
+static uint32_t          NCM_InMaxSize = NCM_NTB_IN_MAX_SIZE;
+
+/* OUT side: one NTB armed on the endpoint, the other one being consumed. */
+static uint16_t          NCM_OutEntries[2][2 * NCM_MAX_OUT_DATAGRAMS];
+static __IO uint16_t     NCM_OutCount[2];
+static __IO uint16_t     NCM_OutNext[2];
+static __IO int8_t       NCM_OutArmed = -1;
+static __IO uint8_t      NCM_OutRead = 0;
+
+static __IO uint8_t      NCM_NotifyPending = 0;
+static __IO uint8_t      NCM_NotifyBusy = 0;
+static uint8_t           NCM_LinkUp = 0;
+static uint32_t          NCM_Bitrate = 0;
+static uint32_t          ncmCmd = NCM_NO_CMD;
+
+NCM_Stats_TypeDef        USBD_NCM_Stats;
+
+/* CDC-NCM interface class callbacks structure */
+USBD_Class_cb_TypeDef  USBD_NCM_cb =
+{
+  usbd_ncm_Init,
+  usbd_ncm_DeInit,
+  usbd_ncm_Setup,
+  NULL,                 /* EP0_TxSent, */
+  usbd_ncm_EP0_RxReady,
+  usbd_ncm_DataIn,
+  usbd_ncm_DataOut,
+  usbd_ncm_SOF,
+  NULL,
+  NULL,
+  USBD_ncm_GetCfgDesc,
+#ifdef USE_USB_OTG_HS
+  USBD_ncm_GetCfgDesc, /* use same config as per FS */
+#endif /* USE_USB_OTG_HS  */
+};
+
+
+/*********************************************
+   NTB16 helpers
+ *********************************************/
+static void NCM_Put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static void NCM_Put32(uint8_t *p, uint32_t v)
+{
+  NCM_Put16(p, v & 0xFFFF);
+  NCM_Put16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+static uint16_t NCM_Get16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t NCM_Get32(const uint8_t *p)
+{
+  return NCM_Get16(p) | ((uint32_t)NCM_Get16(p + 2) << 16);
+}
+
+/**
+  * @brief  NCM_NTB_Begin
+  *         Start a new NTB16 into a buffer.
+  * @param  ntb: buffer of at least NCM_NTH16_SIZE bytes
+  * @param  seq: sequence number of the NTB
+  * @retval position at which the first datagram can be appended
+  */
+uint16_t NCM_NTB_Begin(uint8_t *ntb, uint16_t seq)
+{
+  NCM_Put32(ntb, NCM_NTH16_SIGNATURE);
+  NCM_Put16(ntb + 4, NCM_NTH16_SIZE);
+  NCM_Put16(ntb + 6, seq);
+  /* wBlockLength and wNdpIndex are filled by NCM_NTB_Finalize */
+  NCM_Put16(ntb + 8, 0);
+  NCM_Put16(ntb + 10, 0);
+
+  return NCM_NTH16_SIZE;
+}
+
+/**
+  * @brief  NCM_NTB_Append
+  *         Copy a datagram into an NTB being built, making sure there is
+  *         still enough room for the final NDP16.
+  * @param  ntb: NTB being built
+  * @param  pos: current end of the NTB payload
+  * @param  maxlen: maximum size of the NTB
+  * @param  count: number of datagrams already in the NTB
+  * @param  entries: (index, length) pairs of the datagrams already in the NTB
+  * @param  buf: datagram to append
+  * @param  len: length of the datagram
+  * @retval new end of the NTB payload, or 0 if the datagram doesn't fit
+  */
+uint16_t NCM_NTB_Append(uint8_t *ntb, uint16_t pos, uint16_t maxlen, uint16_t count,
+                        uint16_t *entries, const uint8_t *buf, uint16_t len)
+{
+  uint32_t start = NCM_ALIGN(pos - NCM_NDP_IN_PAYLOAD_REMAINDER, NCM_NDP_IN_DIVISOR) + NCM_NDP_IN_PAYLOAD_REMAINDER;
+  uint32_t end = start + len;
+
+  if ((len == 0) ||
+      (NCM_ALIGN(end, NCM_NDP_IN_ALIGNMENT) + NCM_NDP16_SIZE(count + 1) > maxlen))
+  {
+    return 0;
+  }
+
+  /* Zero the padding, so we don't leak stale data to the host */
+  memset(ntb + pos, 0, start - pos);
+  memcpy(ntb + start, buf, len);
+  entries[2 * count] = start;
+  entries[2 * count + 1] = len;
+
+  return end;
+}
+
+/**
+  * @brief  NCM_NTB_Finalize
+  *         Write the NDP16 at the end of an NTB and complete its header.
+  * @param  ntb: NTB being built
+  * @param  pos: current end of the NTB payload
+  * @param  count: number of datagrams in the NTB
+  * @param  entries: (index, length) pairs of the datagrams in the NTB
+  * @retval total length of the NTB, to be sent as a single transfer
+  */
+uint16_t NCM_NTB_Finalize(uint8_t *ntb, uint16_t pos, uint16_t count, const uint16_t *entries)
+{
+  uint16_t ndp = NCM_ALIGN(pos, NCM_NDP_IN_ALIGNMENT);
+  uint16_t len = ndp + NCM_NDP16_SIZE(count);
+  uint8_t *p = ntb + ndp;
+  uint16_t i;
+
+  memset(ntb + pos, 0, ndp - pos);
+
+  NCM_Put32(p, NCM_NDP16_NOCRC_SIGNATURE);
+  NCM_Put16(p + 4, NCM_NDP16_SIZE(count));
+  NCM_Put16(p + 6, 0);
+  p += NCM_NDP16_HEADER_SIZE;
+
+  for (i = 0; i < count; i++)
+  {
+    NCM_Put16(p, entries[2 * i]);
+    NCM_Put16(p + 2, entries[2 * i + 1]);
+    p += NCM_NDP16_ENTRY_SIZE;
+  }
+  /* Terminating null entry */
+  NCM_Put32(p, 0);
+
+  NCM_Put16(ntb + 8, len);
+  NCM_Put16(ntb + 10, ndp);
+
+  return len;
+}
+
+/**
+  * @brief  NCM_NTB_Parse
+  *         Validate a received NTB16 and extract its datagrams, following
+  *         the whole NDP16 chain.
+  * @param  ntb: received NTB
+  * @param  len: number of bytes received
+  * @param  maxcount: maximum number of datagrams to extract
+  * @param  entries: (index, length) pairs of the extracted datagrams
+  * @retval number of datagrams, or NCM_NTB_INVALID if the NTB is malformed
+  */
+uint16_t NCM_NTB_Parse(const uint8_t *ntb, uint16_t len, uint16_t maxcount, uint16_t *entries)
+{
+  uint16_t block, ndp, ndplen, index, dlen;
+  uint16_t count = 0;
+  uint16_t hops = 0;
+  const uint8_t *p;
+
+  if ((len < NCM_NTH16_SIZE) ||
+      (NCM_Get32(ntb) != NCM_NTH16_SIGNATURE) ||
+      (NCM_Get16(ntb + 4) != NCM_NTH16_SIZE))
+  {
+    return NCM_NTB_INVALID;
+  }
+
+  block = NCM_Get16(ntb + 8);
+  ndp = NCM_Get16(ntb + 10);
+
+  /* A zero wBlockLength means "up to the short packet" */
+  if (block == 0)
+  {
+    block = len;
+  }
+  if (block > len)
+  {
+    return NCM_NTB_INVALID;
+  }
+
+  while (ndp)
+  {
+    if ((ndp & 3) || (ndp < NCM_NTH16_SIZE) || (ndp + NCM_NDP16_SIZE(0) > block) || (++hops > maxcount))
+    {
+      return NCM_NTB_INVALID;
+    }
+    p = ntb + ndp;
+    /* Both "NCM0" and "NCM1" are accepted; the CRC isn't checked */
+    if ((NCM_Get32(p) & ~0x01000000) != NCM_NDP16_NOCRC_SIGNATURE)
+    {
+      return NCM_NTB_INVALID;
+    }
+    ndplen = NCM_Get16(p + 4);
+    if ((ndplen < NCM_NDP16_SIZE(0)) || (ndp + ndplen > block))
+    {
+      return NCM_NTB_INVALID;
+    }
+
+    for (p += NCM_NDP16_HEADER_SIZE; p + NCM_NDP16_ENTRY_SIZE <= ntb + ndp + ndplen; p += NCM_NDP16_ENTRY_SIZE)
+    {
+      index = NCM_Get16(p);
+      dlen = NCM_Get16(p + 2);
+      if ((index == 0) || (dlen == 0))
+      {
+        break;
+      }
+      if (((uint32_t)index + dlen > block) || (count == maxcount))
+      {
+        return NCM_NTB_INVALID;
+      }
+      entries[2 * count] = index;
+      entries[2 * count + 1] = dlen;
+      count++;
+    }
+
+    ndp = NCM_Get16(ntb + ndp + 6);
+  }
+
+  return count;
+}
+
+
+/*********************************************
+   CDC-NCM Device library callbacks
+ *********************************************/
+
+/**
+  * @brief  usbd_ncm_Init
+  *         Initialize the NCM interface. The data endpoints will only be
+  *         opened when the host selects the alternate setting 1.
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  usbd_ncm_Init (void  *pdev, uint8_t cfgidx)
+{
+  /* Open Notification IN EP */
+  DCD_EP_Open(pdev, NCM_NOTIFY_EP, NCM_NOTIFY_PACKET_SIZE, USB_OTG_EP_INT);
+
+  usbd_ncm_AltSet = 0;
+  NCM_InMaxSize = NCM_NTB_IN_MAX_SIZE;
+  NCM_NotifyPending = 0;
+  NCM_NotifyBusy = 0;
+  memset(&USBD_NCM_Stats, 0, sizeof(USBD_NCM_Stats));
+
+  /* Initialize the Interface physical components */
+  NCM_APP_FOPS.pIf_Init();
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_DeInit
+  *         DeInitialize the NCM layer
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t  usbd_ncm_DeInit (void  *pdev, uint8_t cfgidx)
+{
+  NCM_DataClose(pdev);
+  DCD_EP_Close(pdev, NCM_NOTIFY_EP);
+
+  /* Restore default state of the Interface physical components */
+  NCM_APP_FOPS.pIf_DeInit();
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_Setup
+  *         Handle the NCM specific requests
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t  usbd_ncm_Setup (void  *pdev, USB_SETUP_REQ *req)
+{
+  uint16_t len = 0;
+
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+    /* NCM Class Requests -------------------------------*/
+  case USB_REQ_TYPE_CLASS :
+    switch (req->bRequest)
+    {
+    case NCM_GET_NTB_PARAMETERS:
+      NCM_Put16(NCM_CmdBuff + 0, NCM_NTB_PARAMETERS_SIZE);
+      NCM_Put16(NCM_CmdBuff + 2, 0x0001);                 /* bmNtbFormatsSupported: NTB16 only */
+      NCM_Put32(NCM_CmdBuff + 4, NCM_NTB_IN_MAX_SIZE);
+      NCM_Put16(NCM_CmdBuff + 8, NCM_NDP_IN_DIVISOR);
+      NCM_Put16(NCM_CmdBuff + 10, NCM_NDP_IN_PAYLOAD_REMAINDER);
+      NCM_Put16(NCM_CmdBuff + 12, NCM_NDP_IN_ALIGNMENT);
+      NCM_Put16(NCM_CmdBuff + 14, 0);
+      NCM_Put32(NCM_CmdBuff + 16, NCM_NTB_OUT_MAX_SIZE);
+      NCM_Put16(NCM_CmdBuff + 20, 4);                     /* wNdpOutDivisor */
+      NCM_Put16(NCM_CmdBuff + 22, 0);                     /* wNdpOutPayloadRemainder */
+      NCM_Put16(NCM_CmdBuff + 24, 4);                     /* wNdpOutAlignment */
+      NCM_Put16(NCM_CmdBuff + 26, NCM_MAX_OUT_DATAGRAMS);
+      len = NCM_NTB_PARAMETERS_SIZE;
+      break;
+
+    case NCM_GET_NTB_INPUT_SIZE:
+      NCM_Put32(NCM_CmdBuff, NCM_InMaxSize);
+      len = 4;
+      break;
+
+    case NCM_SET_NTB_INPUT_SIZE:
+      if ((req->wLength != 4) && (req->wLength != 8))
+      {
+        USBD_CtlError (pdev, req);
+        return USBD_FAIL;
+      }
+      ncmCmd = req->bRequest;
+      USBD_CtlPrepareRx (pdev, NCM_CmdBuff, req->wLength);
+      return USBD_OK;
+
+    case NCM_GET_NTB_FORMAT:
+    case NCM_GET_CRC_MODE:
+      NCM_Put16(NCM_CmdBuff, 0);
+      len = 2;
+      break;
+
+    case NCM_GET_MAX_DATAGRAM_SIZE:
+      NCM_Put16(NCM_CmdBuff, NCM_MAX_SEGMENT_SIZE);
+      len = 2;
+      break;
+
+    case NCM_SET_NTB_FORMAT:
+    case NCM_SET_CRC_MODE:
+      /* Only NTB16 without CRC is supported */
+      if (req->wValue != 0)
+      {
+        USBD_CtlError (pdev, req);
+        return USBD_FAIL;
+      }
+      return USBD_OK;
+
+    case NCM_SET_ETHERNET_PACKET_FILTER:
+    case NCM_SET_MAX_DATAGRAM_SIZE:
+    case NCM_SET_ETHERNET_MULTICAST_FILTERS:
+      /* Nothing to filter on our side: everything goes to the IP stack */
+      if (req->wLength)
+      {
+        ncmCmd = NCM_NO_CMD;
+        USBD_CtlPrepareRx (pdev, NCM_CmdBuff, MIN(req->wLength, sizeof(NCM_CmdBuff)));
+      }
+      return USBD_OK;
+
+    default:
+      USBD_CtlError (pdev, req);
+      return USBD_FAIL;
+    }
+
+    USBD_CtlSendData (pdev, NCM_CmdBuff, MIN(len, req->wLength));
+    return USBD_OK;
+
+    /* Standard Requests -------------------------------*/
+  case USB_REQ_TYPE_STANDARD:
+    switch (req->bRequest)
+    {
+    case USB_REQ_GET_INTERFACE :
+      USBD_CtlSendData (pdev, (uint8_t *)&usbd_ncm_AltSet, 1);
+      break;
+
+    case USB_REQ_SET_INTERFACE :
+      if ((uint8_t)(req->wIndex) != NCM_DATA_INTERFACE)
+      {
+        break;
+      }
+      if ((uint8_t)(req->wValue) > 1)
+      {
+        /* Call the error management function (command will be nacked */
+        USBD_CtlError (pdev, req);
+        break;
+      }
+      /* Selecting an alternate setting resets the data interface, even
+         when the setting doesn't change. */
+      NCM_DataClose(pdev);
+      usbd_ncm_AltSet = (uint8_t)(req->wValue);
+      if (usbd_ncm_AltSet)
+      {
+        NCM_DataOpen(pdev);
+      }
+      break;
+    }
+    break;
+
+  default:
+    USBD_CtlError (pdev, req);
+    return USBD_FAIL;
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_EP0_RxReady
+  *         Data received on control endpoint
+  * @param  pdev: device device instance
+  * @retval status
+  */
+static uint8_t  usbd_ncm_EP0_RxReady (void  *pdev)
+{
+  uint32_t size;
+
+  if (ncmCmd == NCM_SET_NTB_INPUT_SIZE)
+  {
+    size = NCM_Get32(NCM_CmdBuff);
+    /* The NTB being filled may already be larger than the new size,
+       but the host has to accept it until the next one. */
+    if ((size >= NCM_NTH16_SIZE + NCM_NDP16_SIZE(1)) && (size <= NCM_NTB_IN_MAX_SIZE))
+    {
+      NCM_InMaxSize = size;
+    }
+  }
+  ncmCmd = NCM_NO_CMD;
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_DataIn
+  *         Data sent on non-control IN endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t  usbd_ncm_DataIn (void *pdev, uint8_t epnum)
+{
+  uint8_t i;
+
+  if (epnum == (NCM_NOTIFY_EP & 0x7F))
+  {
+    NCM_NotifyBusy = 0;
+    NCM_Notify(pdev);
+    return USBD_OK;
+  }
+
+  if (epnum != (NCM_IN_EP & 0x7F))
+  {
+    return USBD_OK;
+  }
+
+  /* An NTB that isn't a multiple of the packet size is terminated by its
+     last short packet; otherwise we need to send a ZLP. */
+  if (NCM_InZlp)
+  {
+    NCM_InZlp = 0;
+    DCD_EP_Tx (pdev, NCM_IN_EP, NULL, 0);
+    return USBD_OK;
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    if (NCM_InState[i] == NCM_NTB_SENDING)
+    {
+      NCM_InState[i] = NCM_NTB_FILLING;
+      NCM_InLen[i] = 0;
+    }
+  }
+
+  NCM_InSchedule(pdev);
+  NCM_APP_FOPS.pIf_TxReady();
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_DataOut
+  *         Data received on non-control Out endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t  usbd_ncm_DataOut (void *pdev, uint8_t epnum)
+{
+  uint16_t count;
+  int8_t buf = NCM_OutArmed;
+
+  if ((epnum != NCM_OUT_EP) || (buf < 0))
+  {
+    return USBD_OK;
+  }
+
+  count = NCM_NTB_Parse(NCM_OutNTB[buf],
+                        ((USB_OTG_CORE_HANDLE*)pdev)->dev.out_ep[epnum].xfer_count,
+                        NCM_MAX_OUT_DATAGRAMS,
+                        NCM_OutEntries[buf]);
+
+  if ((count == NCM_NTB_INVALID) || (count == 0))
+  {
+    if (count == NCM_NTB_INVALID)
+    {
+      USBD_NCM_Stats.ntb_out_errors++;
+    }
+    /* Nothing for the application: re-use the same buffer */
+    DCD_EP_PrepareRx(pdev, NCM_OUT_EP, NCM_OutNTB[buf], NCM_NTB_OUT_MAX_SIZE);
+    return USBD_OK;
+  }
+
+  USBD_NCM_Stats.ntb_out++;
+  USBD_NCM_Stats.datagrams_out += count;
+
+  NCM_OutNext[buf] = 0;
+  NCM_OutCount[buf] = count;
+
+  /* Keep receiving in the other buffer if the application is done with it,
+     otherwise leave the endpoint NAKing until it is. */
+  buf ^= 1;
+  if (NCM_OutCount[buf] == 0)
+  {
+    NCM_OutArmed = buf;
+    DCD_EP_PrepareRx(pdev, NCM_OUT_EP, NCM_OutNTB[buf], NCM_NTB_OUT_MAX_SIZE);
+  }
+  else
+  {
+    NCM_OutArmed = -1;
+  }
+
+  NCM_APP_FOPS.pIf_RxReady();
+
+  return USBD_OK;
+}
+
+/**
+  * @brief  usbd_ncm_SOF
+  *         Start Of Frame event management: sends the notifications posted
+  *         by USBD_NCM_SetLinkState, and flushes partially filled NTBs
+  *         after NCM_IN_FLUSH_FRAMES frames.
+  * @param  pdev: instance
+  * @retval status
+  */
+static uint8_t  usbd_ncm_SOF (void *pdev)
+{
+  uint8_t fill;
+
+  if (usbd_ncm_AltSet == 0)
+  {
+    return USBD_OK;
+  }
+
+  NCM_Notify(pdev);
+
+  if (NCM_InLock)
+  {
+    return USBD_OK;
+  }
+
+  fill = NCM_InFill;
+  if ((NCM_InState[fill] == NCM_NTB_FILLING) && NCM_InCount && (++NCM_InAge >= NCM_IN_FLUSH_FRAMES))
+  {
+    NCM_InLen[fill] = NCM_NTB_Finalize(NCM_InNTB[fill], NCM_InPos, NCM_InCount, NCM_InEntries);
+    NCM_InState[fill] = NCM_NTB_READY;
+    NCM_InSwap();
+  }
+
+  NCM_InSchedule(pdev);
+
+  return USBD_OK;
+}
+
+
+/*********************************************
+   CDC-NCM specific management functions
+ *********************************************/
+
+/**
+  * @brief  NCM_DataOpen
+  *         Open the data endpoints and reset the NTB machinery.
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void NCM_DataOpen (void *pdev)
+{
+  DCD_EP_Open(pdev, NCM_IN_EP, NCM_DATA_MAX_PACKET_SIZE, USB_OTG_EP_BULK);
+  DCD_EP_Open(pdev, NCM_OUT_EP, NCM_DATA_MAX_PACKET_SIZE, USB_OTG_EP_BULK);
+
+  NCM_InState[0] = NCM_InState[1] = NCM_NTB_FILLING;
+  NCM_InLen[0] = NCM_InLen[1] = 0;
+  NCM_InFill = 0;
+  NCM_InZlp = 0;
+  NCM_InSequence = 0;
+  NCM_InCount = 0;
+  NCM_InAge = 0;
+  NCM_InPos = NCM_NTB_Begin(NCM_InNTB[0], NCM_InSequence++);
+
+  NCM_OutCount[0] = NCM_OutCount[1] = 0;
+  NCM_OutRead = 0;
+  NCM_OutArmed = 0;
+  DCD_EP_PrepareRx(pdev, NCM_OUT_EP, NCM_OutNTB[0], NCM_NTB_OUT_MAX_SIZE);
+
+  /* The host expects to be told about the link as soon as it
+     selects the data interface. */
+  NCM_NotifyPending = NCM_NOTIFY_SPEED | NCM_NOTIFY_CONNECTION;
+  NCM_Notify(pdev);
+}
+
+/**
+  * @brief  NCM_DataClose
+  *         Close the data endpoints, dropping whatever was queued.
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void NCM_DataClose (void *pdev)
+{
+  DCD_EP_Close(pdev, NCM_IN_EP);
+  DCD_EP_Close(pdev, NCM_OUT_EP);
+
+  NCM_OutArmed = -1;
+  NCM_OutCount[0] = NCM_OutCount[1] = 0;
+  NCM_InCount = 0;
+}
+
+/**
+  * @brief  NCM_InSwap
+  *         Start filling the other NTB buffer, if the current one has been
+  *         closed and the other one is free. Must not run concurrently with
+  *         USBD_NCM_SendDatagram.
+  * @retval None
+  */
+static void NCM_InSwap (void)
+{
+  uint8_t fill = NCM_InFill;
+
+  if ((NCM_InState[fill] != NCM_NTB_FILLING) && (NCM_InState[fill ^ 1] == NCM_NTB_FILLING))
+  {
+    fill ^= 1;
+    NCM_InCount = 0;
+    NCM_InAge = 0;
+    NCM_InPos = NCM_NTB_Begin(NCM_InNTB[fill], NCM_InSequence++);
+    NCM_InFill = fill;
+  }
+}
+
+/**
+  * @brief  NCM_InSchedule
+  *         Send the next ready NTB if the IN endpoint is idle.
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void NCM_InSchedule (void *pdev)
+{
+  uint8_t i, next;
+  uint16_t len;
+
+  if ((NCM_InState[0] == NCM_NTB_SENDING) || (NCM_InState[1] == NCM_NTB_SENDING) || NCM_InZlp)
+  {
+    return;
+  }
+
+  if (!NCM_InLock)
+  {
+    NCM_InSwap();
+  }
+
+  /* The buffer that isn't being filled is the oldest one */
+  next = NCM_InFill ^ 1;
+  for (i = 0; i < 2; i++, next ^= 1)
+  {
+    if (NCM_InState[next] == NCM_NTB_READY)
+    {
+      len = NCM_InLen[next];
+      NCM_InState[next] = NCM_NTB_SENDING;
+      NCM_InZlp = ((len % NCM_DATA_MAX_PACKET_SIZE) == 0) && (len < NCM_InMaxSize);
+      USBD_NCM_Stats.ntb_in++;
+      DCD_EP_Tx (pdev, NCM_IN_EP, NCM_InNTB[next], len);
+      return;
+    }
+  }
+}
+
+/**
+  * @brief  NCM_Notify
+  *         Send the next pending notification on the interrupt endpoint.
+  *         Only called from the USB interrupt, as NCM_NotifyBusy and
+  *         NCM_NotifyBuff are not protected otherwise.
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void NCM_Notify (void *pdev)
+{
+  uint16_t len;
+
+  if (NCM_NotifyBusy || !NCM_NotifyPending)
+  {
+    return;
+  }
+
+  NCM_NotifyBuff[0] = 0xA1;
+  NCM_Put16(NCM_NotifyBuff + 4, NCM_COMM_INTERFACE);
+
+  if (NCM_NotifyPending & NCM_NOTIFY_SPEED)
+  {
+    NCM_NotifyPending &= ~NCM_NOTIFY_SPEED;
+    NCM_NotifyBuff[1] = NCM_NOTIFY_CONNECTION_SPEED_CHANGE;
+    NCM_Put16(NCM_NotifyBuff + 2, 0);
+    NCM_Put16(NCM_NotifyBuff + 6, 8);
+    NCM_Put32(NCM_NotifyBuff + 8, NCM_Bitrate);
+    NCM_Put32(NCM_NotifyBuff + 12, NCM_Bitrate);
+    len = 16;
+  }
+  else
+  {
+    NCM_NotifyPending &= ~NCM_NOTIFY_CONNECTION;
+    NCM_NotifyBuff[1] = NCM_NOTIFY_NETWORK_CONNECTION;
+    NCM_Put16(NCM_NotifyBuff + 2, NCM_LinkUp);
+    NCM_Put16(NCM_NotifyBuff + 6, 0);
+    len = 8;
+  }
+
+  NCM_NotifyBusy = 1;
+  DCD_EP_Tx (pdev, NCM_NOTIFY_EP, NCM_NotifyBuff, len);
+}
+
+/**
+  * @brief  USBD_ncm_GetCfgDesc
+  *         Return configuration descriptor
+  * @param  speed : current device speed
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t  *USBD_ncm_GetCfgDesc (uint8_t speed, uint16_t *length)
+{
+  uint8_t *pbuf = (uint8_t *)get_USB_configuration_descriptor(1);
+
+  *length = (((uint16_t) pbuf[3]) << 8) + pbuf[2];
+  return pbuf;
+}
+
+
+/*********************************************
+   Datagram queue API
+ *********************************************/
+
+/**
+  * @brief  USBD_NCM_SendDatagram
+  *         Queue an Ethernet frame to be sent to the host. Frames are
+  *         aggregated into the current NTB, which is sent when full, or
+  *         after NCM_IN_FLUSH_FRAMES frames.
+  * @param  pdev: device instance
+  * @param  buf: frame to send
+  * @param  len: length of the frame
+  * @retval USBD_OK if queued, USBD_BUSY if the queue is full, USBD_FAIL else
+  */
+uint8_t USBD_NCM_SendDatagram (void *pdev, const uint8_t *buf, uint16_t len)
+{
+  uint8_t fill;
+  uint16_t pos;
+  uint8_t ret = USBD_OK;
+
+  if ((usbd_ncm_AltSet == 0) || (len == 0) || (len > NCM_MAX_SEGMENT_SIZE))
+  {
+    return USBD_FAIL;
+  }
+
+  NCM_InLock = 1;
+
+  NCM_InSwap();
+  fill = NCM_InFill;
+
+  if (NCM_InState[fill] != NCM_NTB_FILLING)
+  {
+    ret = USBD_BUSY;
+  }
+  else
+  {
+    pos = 0;
+    if (NCM_InCount < NCM_MAX_IN_DATAGRAMS)
+    {
+      pos = NCM_NTB_Append(NCM_InNTB[fill], NCM_InPos, NCM_InMaxSize, NCM_InCount, NCM_InEntries, buf, len);
+    }
+
+    if (pos == 0)
+    {
+      /* No more room: close this NTB and try again in the other buffer */
+      NCM_InLen[fill] = NCM_NTB_Finalize(NCM_InNTB[fill], NCM_InPos, NCM_InCount, NCM_InEntries);
+      NCM_InState[fill] = NCM_NTB_READY;
+      NCM_InSwap();
+      fill = NCM_InFill;
+      if (NCM_InState[fill] == NCM_NTB_FILLING)
+      {
+        pos = NCM_NTB_Append(NCM_InNTB[fill], NCM_InPos, NCM_InMaxSize, NCM_InCount, NCM_InEntries, buf, len);
+      }
+    }
+
+    if (pos)
+    {
+      NCM_InPos = pos;
+      NCM_InCount++;
+      USBD_NCM_Stats.datagrams_in++;
+    }
+    else
+    {
+      ret = USBD_BUSY;
+    }
+  }
+
+  NCM_InLock = 0;
+
+  return ret;
+}
+
+/**
+  * @brief  USBD_NCM_Flush
+  *         Close the current NTB at the next SOF, without waiting for
+  *         NCM_IN_FLUSH_FRAMES frames.
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_NCM_Flush (void *pdev)
+{
+  NCM_InAge = NCM_IN_FLUSH_FRAMES;
+}
+
+/**
+  * @brief  USBD_NCM_PeekDatagram
+  *         Get the oldest received Ethernet frame, if any. The frame stays
+  *         valid until USBD_NCM_ReleaseDatagram is called.
+  * @param  len: length of the frame
+  * @retval pointer to the frame, or NULL if none is available
+  */
+uint8_t * USBD_NCM_PeekDatagram (uint16_t *len)
+{
+  uint8_t buf = NCM_OutRead;
+  uint16_t next = NCM_OutNext[buf];
+
+  if (next >= NCM_OutCount[buf])
+  {
+    return NULL;
+  }
+
+  *len = NCM_OutEntries[buf][2 * next + 1];
+  return NCM_OutNTB[buf] + NCM_OutEntries[buf][2 * next];
+}
+
+/**
+  * @brief  USBD_NCM_ReleaseDatagram
+  *         Release the frame returned by USBD_NCM_PeekDatagram. Once all
+  *         the frames of an NTB are released, its buffer is handed back
+  *         to the OUT endpoint.
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_NCM_ReleaseDatagram (void *pdev)
+{
+  uint8_t buf = NCM_OutRead;
+
+  if (NCM_OutNext[buf] >= NCM_OutCount[buf])
+  {
+    return;
+  }
+
+  if (++NCM_OutNext[buf] < NCM_OutCount[buf])
+  {
+    return;
+  }
+
+  NCM_OutCount[buf] = 0;
+  NCM_OutRead = buf ^ 1;
+
+  /* If the endpoint was left NAKing, it can now receive again */
+  if (NCM_OutArmed < 0)
+  {
+    NCM_OutArmed = buf;
+    DCD_EP_PrepareRx(pdev, NCM_OUT_EP, NCM_OutNTB[buf], NCM_NTB_OUT_MAX_SIZE);
+  }
+}
+
+/**
+  * @brief  USBD_NCM_SetLinkState
+  *         Tell the host about the network link state and speed. The
+  *         notifications go out from the next SOF.
+  * @param  pdev: device instance
+  * @param  up: 1 if the link is connected, 0 otherwise
+  * @param  bitrate: link speed, in bits per second
+  * @retval None
+  */
+void USBD_NCM_SetLinkState (void *pdev, uint8_t up, uint32_t bitrate)
+{
+  NCM_LinkUp = up;
+  NCM_Bitrate = bitrate;
+
+  if (usbd_ncm_AltSet)
+  {
+    /* Racing with NCM_Notify clearing a bit only sends it once more */
+    NCM_NotifyPending |= NCM_NOTIFY_SPEED | NCM_NOTIFY_CONNECTION;
+  }
+}
+
@@ -109,6 +109,10 @@
 /**************************************************/
 /* Other defines                                  */
 /**************************************************/
+/* String reporting the programming statistics, given as iString by GETSTATUS:
+   the one following the memories strings */
+#define DFU_STATUS_STR_IDX           (USBD_IDX_INTERFACE_STR + USBD_ITF_MAX_NUM + 1)
+
 /* Bit Detach capable = bit 3 in bmAttributes field */
 #define DFU_DETACH_MASK              (uint8_t)(1 << 4) 
 /**
@@ -171,6 +175,11 @@ extern USBD_Class_cb_TypeDef  DFU_cb;
 /** @defgroup USB_CORE_Exported_Functions
   * @{
   */
+/* Programs the downloaded blocks. With DFU_BACKGROUND_PROGRAMMING defined,
+   the application calls this from its main loop, and the next block is
+   received while the previous one is programmed; otherwise the core calls
+   it from the USB interrupt. */
+void USBD_DFU_Process (void);
 /**
   * @}
   */ 
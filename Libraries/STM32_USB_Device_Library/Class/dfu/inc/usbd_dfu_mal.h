@@ -40,9 +40,14 @@ typedef struct _DFU_MAL_PROP
   uint16_t (*pMAL_Init)     (void);   
   uint16_t (*pMAL_DeInit)   (void);   
   uint16_t (*pMAL_Erase)    (uint32_t Add);
-  uint16_t (*pMAL_Write)    (uint32_t Add, uint32_t Len);
+  /* May overwrite up to 7 bytes past Buf + Len, padding the data to the
+     programming width: the buffers handed over have that room, as the
+     MAL_Buffer blocks do with XFERSIZE a multiple of 8 */
+  uint16_t (*pMAL_Write)    (uint32_t Add, uint8_t *Buf, uint32_t Len);
   uint8_t  *(*pMAL_Read)    (uint32_t Add, uint32_t Len);
+  uint8_t  *(*pMAL_GetPtr)  (uint32_t Add, uint32_t Len);   /* Memory mapped data, sent as is */
   uint16_t (*pMAL_CheckAdd) (uint32_t Add);
+  uint16_t (*pMAL_Manifest) (void);   /* Called once a download completes */
   const uint32_t EraseTiming;
   const uint32_t WriteTiming;
 }
@@ -53,6 +58,12 @@ DFU_MAL_Prop_TypeDef;
 #define MAL_OK                          0
 #define MAL_FAIL                        1
 
+/* Number of XFERSIZE buffers: one block can be received while the previous
+   ones are being programmed */
+#ifndef DFU_MAL_BUFFERS
+#define DFU_MAL_BUFFERS                 2
+#endif
+
 /* utils macro ---------------------------------------------------------------*/
 #define _1st_BYTE(x)  (uint8_t)((x)&0xFF)             /* 1st addressing cycle */
 #define _2nd_BYTE(x)  (uint8_t)(((x)&0xFF00)>>8)      /* 2nd addressing cycle */
@@ -69,11 +80,13 @@ DFU_MAL_Prop_TypeDef;
 uint16_t MAL_Init (void);
 uint16_t MAL_DeInit (void);
 uint16_t MAL_Erase (uint32_t SectorAddress);
-uint16_t MAL_Write (uint32_t SectorAddress, uint32_t DataLength);
+uint16_t MAL_Write (uint32_t SectorAddress, uint8_t *Buffer, uint32_t DataLength);
 uint8_t *MAL_Read  (uint32_t SectorAddress, uint32_t DataLength);
+uint8_t *MAL_GetPtr (uint32_t SectorAddress, uint32_t DataLength);
 uint16_t MAL_GetStatus(uint32_t SectorAddress ,uint8_t Cmd, uint8_t *buffer);
+uint16_t MAL_Manifest (void);
 
-extern uint8_t  MAL_Buffer[XFERSIZE]; /* RAM Buffer for Downloaded Data */
+extern uint8_t  MAL_Buffer[XFERSIZE * DFU_MAL_BUFFERS]; /* RAM Buffers for Downloaded Data */
 #endif /* __DFU_MAL_H */
 
 /******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,102 @@
+/**
+  ******************************************************************************
+  * @file    usbd_dfu_patch.h
+  * @brief   header file for the usbd_dfu_patch.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USBD_DFU_PATCH_H
+#define __USBD_DFU_PATCH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Patch stream format, all integers little endian:
+
+   header, 28 bytes:
+     "DPT1"
+     destination address    where the new image is written
+     source address         image the patch applies to, 0 if none
+     source length
+     destination length
+     source CRC32           checked before anything is written
+     destination CRC32      checked on the flash once written
+
+   then operations, one opcode byte followed by LEB128 arguments:
+     PATCH_OP_END
+     PATCH_OP_LITERAL  n, then n bytes copied to the output
+     PATCH_OP_COPY     n, delta: moves the source position by the zigzag
+                       encoded delta, then copies n bytes from the source
+     PATCH_OP_MATCH    n, distance: copies n bytes from the output,
+                       distance bytes back (LZ77, possibly overlapping)
+     PATCH_OP_ERASE    offset: erases the sector of the destination at
+                       this offset; the generator knows the flash layout,
+                       and erases each sector before the output reaches it
+
+   Source and destination must be memory mapped, and must not overlap. */
+#define PATCH_MAGIC                     0x31545044   /* "DPT1" */
+#define PATCH_HEADER_SIZE               28
+
+#define PATCH_OP_END                    0x00
+#define PATCH_OP_LITERAL                0x01
+#define PATCH_OP_COPY                   0x02
+#define PATCH_OP_MATCH                  0x03
+#define PATCH_OP_ERASE                  0x04
+
+/* Output buffered before being programmed; a multiple of 8, the widest
+   flash program parallelism */
+#ifndef PATCH_WINDOW_SIZE
+#define PATCH_WINDOW_SIZE               256
+#endif
+
+#define PATCH_OK                        0
+#define PATCH_FAIL                      1
+
+/* Memory accesses of the decoder. Map returns where an address can be read
+   from, NULL if it can't; the source and the destination are mapped once,
+   as a whole, once their last bytes are found mapped right after. */
+typedef struct _Patch_Mem
+{
+  uint16_t (*Write) (uint32_t Add, uint8_t *Buf, uint32_t Len);
+  uint16_t (*Erase) (uint32_t Add);
+  const uint8_t *(*Map) (uint32_t Add);
+}
+PATCH_Mem_TypeDef;
+
+typedef struct _Patch_Decoder
+{
+  const PATCH_Mem_TypeDef *mem;
+  uint8_t  state;
+  uint8_t  op;
+  uint8_t  argidx;             /* argument being decoded */
+  uint8_t  shift;              /* LEB128 bit position */
+  uint32_t arg[2];
+  uint8_t  header[PATCH_HEADER_SIZE];
+  uint32_t received;           /* bytes of the stream received */
+  uint32_t dest;
+  uint32_t src;
+  uint32_t srclen;
+  uint32_t outlen;
+  uint32_t outcrc;
+  const uint8_t *smap;         /* source, mapped */
+  const uint8_t *dmap;         /* destination, mapped */
+  uint32_t spos;               /* source position */
+  uint32_t pos;                /* bytes output */
+  uint32_t flushed;            /* bytes output and programmed */
+  uint8_t  window[PATCH_WINDOW_SIZE];
+}
+PATCH_Decoder_TypeDef;
+
+void     PATCH_Init   (PATCH_Decoder_TypeDef *dec, const PATCH_Mem_TypeDef *mem);
+uint16_t PATCH_Feed   (PATCH_Decoder_TypeDef *dec, const uint8_t *buf, uint32_t len);
+uint8_t  PATCH_IsDone (const PATCH_Decoder_TypeDef *dec);
+uint32_t PATCH_CRC32  (uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_DFU_PATCH_H */
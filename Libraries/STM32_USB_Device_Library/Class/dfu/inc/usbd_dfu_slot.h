@@ -0,0 +1,110 @@
+/**
+  ******************************************************************************
+  * @file    usbd_dfu_slot.h
+  * @brief   header file for the usbd_dfu_slot.c file.
+  ******************************************************************************
+  */
+
+#ifndef __USBD_DFU_SLOT_H
+#define __USBD_DFU_SLOT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Two firmware slots: the active one, which is booted, and the staging one,
+   which downloads go to. A download is verified block by block, and its
+   progress is logged to flash, so that after a disconnect or a power loss
+   it can be resumed from the last verified block instead of from scratch.
+   Committing a complete download switches the slots with a single log
+   record, written last: either it made it to flash and the new image is
+   booted, or it didn't and the old one still is.
+
+   The log lives in two flash sectors used in turn. Each record is 4 words,
+   the last being the CRC of the other three, so torn records are ignored:
+     w0: SLOT_REC_TAG << 16 | type << 8 | slot
+     w1, w2: depending on the type
+     w3: CRC32 of w0 to w2 */
+#define SLOT_REC_TAG                    0xD5A0
+#define SLOT_REC_SIZE                   16
+
+#define SLOT_REC_HEADER                 0x01   /* generation; first record of a sector, written last */
+#define SLOT_REC_BOOT                   0x02   /* length, CRC: the slot to boot */
+#define SLOT_REC_BEGIN                  0x03   /* session: a download starts in the slot */
+#define SLOT_REC_BLOCK                  0x04   /* length, CRC: verified part of the download */
+
+#define SLOT_NONE                       0xFF
+
+/* Status, as uploaded by the hosts to resume downloads, little endian:
+     "SLOT", active slot, staging slot, fallback slot, 0,
+     session, verified length, verified CRC, active length, active CRC,
+     slot size
+   Manifestation only commits a download written to since the last reset,
+   as it is called for every media: a host finding its download complete
+   sends the last block again, which is compared rather than programmed. */
+#define SLOT_STATUS_MAGIC               0x544F4C53   /* "SLOT" */
+#define SLOT_STATUS_SIZE                32
+
+#define SLOT_OK                         0
+#define SLOT_FAIL                       1
+
+/* Memory accesses. Map returns where an address can be read from. */
+typedef struct _Slot_Mem
+{
+  uint16_t (*Write) (uint32_t Add, uint8_t *Buf, uint32_t Len);
+  uint16_t (*Erase) (uint32_t Add);
+  const uint8_t *(*Map) (uint32_t Add);
+}
+SLOT_Mem_TypeDef;
+
+/* Flash layout. Slots are made of whole sectors of sector_size; the log
+   sectors are meta_size each. */
+typedef struct _Slot_Layout
+{
+  uint32_t meta[2];
+  uint32_t meta_size;
+  uint32_t slot[2];
+  uint32_t slot_size;
+  uint32_t sector_size;
+}
+SLOT_Layout_TypeDef;
+
+typedef struct _Slot_Image
+{
+  uint32_t len;
+  uint32_t crc;
+}
+SLOT_Image_TypeDef;
+
+typedef struct _Slot_State
+{
+  const SLOT_Mem_TypeDef    *mem;
+  const SLOT_Layout_TypeDef *layout;
+  uint8_t  meta;               /* log sector in use */
+  uint32_t generation;
+  uint32_t next;               /* offset of the next record in the log sector */
+  uint8_t  active;             /* slot to boot, or SLOT_NONE */
+  SLOT_Image_TypeDef boot;
+  uint8_t  fallback;           /* previously active slot, while still intact */
+  SLOT_Image_TypeDef prev;
+  uint32_t session;
+  uint8_t  open;               /* a download is in the staging slot */
+  uint8_t  dirty;              /* and was written to since the last load */
+  SLOT_Image_TypeDef progress; /* verified part of it */
+}
+SLOT_State_TypeDef;
+
+uint16_t SLOT_Load      (SLOT_State_TypeDef *st, const SLOT_Mem_TypeDef *mem, const SLOT_Layout_TypeDef *layout);
+uint8_t  SLOT_Staging   (const SLOT_State_TypeDef *st);
+uint16_t SLOT_Program   (SLOT_State_TypeDef *st, uint32_t off, uint8_t *buf, uint32_t len);
+uint16_t SLOT_Commit    (SLOT_State_TypeDef *st);
+uint32_t SLOT_Boot      (const SLOT_State_TypeDef *st);
+void     SLOT_GetStatus (const SLOT_State_TypeDef *st, uint8_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_DFU_SLOT_H */
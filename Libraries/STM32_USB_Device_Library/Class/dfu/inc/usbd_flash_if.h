@@ -27,6 +27,15 @@
 #include "usbd_dfu_mal.h"
 
 /* Exported types ------------------------------------------------------------*/
+typedef struct _FLASH_If_Stats
+{
+  uint32_t programmed;       /* bytes programmed */
+  uint32_t erased;           /* sectors erased */
+  uint32_t skipped;          /* sector erases skipped, the sectors being blank */
+  uint32_t verify_errors;
+}
+FLASH_If_Stats_TypeDef;
+
 /* Exported constants --------------------------------------------------------*/
 #define FLASH_START_ADD                  0x08000000
 
@@ -38,8 +47,16 @@
  #define FLASH_IF_STRING                 "@Internal Flash   /0x08000000/06*002Ka,122*002Kg"  
 #endif /* STM32F2XX */
 
+/* Supply voltage range, which sets the program parallelism on STM32F2/F4:
+   VoltageRange_1 (1.8V to 2.1V) programs bytes, VoltageRange_2 (2.1V to
+   2.7V) half words, VoltageRange_3 (2.7V to 3.6V) words, and VoltageRange_4
+   (external Vpp) double words */
+#ifndef FLASH_IF_VOLTAGE_RANGE
+ #define FLASH_IF_VOLTAGE_RANGE          VoltageRange_3
+#endif
 
 extern DFU_MAL_Prop_TypeDef DFU_Flash_cb;
+extern FLASH_If_Stats_TypeDef FLASH_If_Stats;   /* since MAL_Init */
 
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
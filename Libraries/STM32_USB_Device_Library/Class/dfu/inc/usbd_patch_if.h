@@ -0,0 +1,30 @@
+/**
+  ******************************************************************************
+  * @file    usbd_patch_if.h
+  * @brief   Header for usbd_patch_if.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __PATCH_IF_MAL_H
+#define __PATCH_IF_MAL_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_dfu_mal.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Patch streams (see usbd_dfu_patch.h) are downloaded to this virtual area,
+   from its start; it is write only, so that hosts don't erase it first. The
+   image it describes is programmed to the flash as the stream is decoded. */
+#define PATCH_START_ADD                0x70000000
+#define PATCH_END_ADD                  (uint32_t)(PATCH_START_ADD + 0x100000)
+
+#define PATCH_IF_STRING                "@Delta Patch   /0x70000000/01*001Md"
+
+extern DFU_MAL_Prop_TypeDef DFU_Patch_cb;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+
+#endif /* __PATCH_IF_MAL_H */
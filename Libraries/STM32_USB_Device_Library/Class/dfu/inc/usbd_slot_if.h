@@ -0,0 +1,49 @@
+/**
+  ******************************************************************************
+  * @file    usbd_slot_if.h
+  * @brief   Header for usbd_slot_if.c file.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SLOT_IF_MAL_H
+#define __SLOT_IF_MAL_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_dfu_mal.h"
+#include "usbd_dfu_slot.h"
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Flash layout, see usbd_dfu_slot.h: the two log sectors, then the two
+   slots, each made of SLOT_SECTOR_SIZE sectors. The defaults leave sectors
+   0 and 1 to the bootloader, and sectors 4 and 11 unused. */
+#ifndef SLOT_META0_ADD
+ #define SLOT_META0_ADD                0x08008000
+ #define SLOT_META1_ADD                0x0800C000
+ #define SLOT_META_SIZE                0x4000
+ #define SLOT_A_ADD                    0x08020000
+ #define SLOT_B_ADD                    0x08080000
+ #define SLOT_SIZE                     0x60000
+ #define SLOT_SECTOR_SIZE              0x20000
+#endif
+
+/* Downloads are written to this virtual area, which maps to the staging
+   slot; it is followed by the status, which hosts upload to know where to
+   resume from. The sectors described must add up to SLOT_SIZE. */
+#define SLOT_START_ADD                 0x71000000
+#define SLOT_STATUS_ADD                (uint32_t)(SLOT_START_ADD + SLOT_SIZE)
+#define SLOT_END_ADD                   (uint32_t)(SLOT_STATUS_ADD + SLOT_STATUS_SIZE)
+
+#ifndef SLOT_IF_STRING
+ #define SLOT_IF_STRING                "@Update Slot   /0x71000000/03*128Ke,01*032 a"
+#endif
+
+extern DFU_MAL_Prop_TypeDef DFU_Slot_cb;
+
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions ------------------------------------------------------- */
+const uint8_t *DFU_Slot_Map (uint32_t Add);
+uint32_t DFU_Slot_BootAddress (void);
+
+#endif /* __SLOT_IF_MAL_H */
@@ -60,6 +60,7 @@
 #include "usbd_desc.h"
 #include "usbd_req.h"
 #include "usb_bsp.h"
+#include "usbd_flash_if.h"
 
 
 /** @addtogroup STM32_USB_OTG_DEVICE_LIBRARY
@@ -75,6 +76,16 @@
 /** @defgroup usbd_dfu_Private_TypesDefinitions
   * @{
   */
+/* Erase or write operation, pending on one of the MAL buffers */
+typedef struct _DFU_Job
+{
+  __IO uint8_t state;
+  uint8_t  cmd;
+  uint32_t Addr;
+  uint32_t Len;
+  uint32_t Start;             /* SOF count the operation started at */
+}
+DFU_Job_TypeDef;
 /**
   * @}
   */
@@ -83,6 +94,15 @@
 /** @defgroup usbd_dfu_Private_Defines
   * @{
   */
+#define DFU_JOB_FREE                 0
+#define DFU_JOB_READY                1
+#define DFU_JOB_BUSY                 2
+
+#define DFU_JOB_WRITE                0
+#define DFU_JOB_ERASE                1
+
+/* Buffer of the n-th job */
+#define DFU_JOB_BUFFER(n)            (MAL_Buffer + ((n) * XFERSIZE))
 /**
   * @}
   */
@@ -116,6 +136,8 @@ static uint8_t  EP0_TxSent        (void  *pdev);
 
 static uint8_t  EP0_RxReady       (void  *pdev);
 
+static uint8_t  usbd_dfu_SOF      (void  *pdev);
+
 
 static uint8_t  *USBD_DFU_GetCfgDesc (uint8_t speed,
                                       uint16_t *length);
@@ -152,6 +174,12 @@ static void DFU_Req_ABORT     (void *pdev);
 
 static void DFU_LeaveDFUMode  (void *pdev);
 
+static void     DFU_Job_Queue   (uint8_t cmd, uint32_t Addr, uint32_t Len);
+static uint8_t  DFU_Job_Pending (void);
+static uint32_t DFU_Job_Timing  (uint8_t cmd, uint32_t Addr, uint32_t Len);
+static void     DFU_Status_String (uint8_t *str);
+static uint32_t DFU_Job_Wait    (uint8_t all);
+
 
 static uint8_t USBD_GetLen(uint8_t *buf);
 
@@ -188,9 +216,21 @@ uint32_t Manifest_State = Manifest_complete;
 /* Data Management variables */
 static uint32_t wBlockNum = 0, wlength = 0;
 static uint32_t Pointer = APP_DEFAULT_ADD;  /* Base Address to Erase, Program or Read */
+static uint32_t UploadSize = XFERSIZE;      /* Size of the upload blocks, for their addresses */
 static __IO uint32_t  usbd_dfu_AltSet = 0;
 
-extern uint8_t MAL_Buffer[];
+/* Download pipeline: blocks are received in turn in each MAL buffer, and
+   programmed in the same order by USBD_DFU_Process */
+static DFU_Job_TypeDef DFU_Jobs[DFU_MAL_BUFFERS];
+static uint32_t JobWr = 0;                  /* buffer the next block goes to */
+static uint32_t JobRd = 0;                  /* next job to be processed */
+static __IO uint8_t JobStatus = STATUS_OK;  /* first failure, reported by GETSTATUS */
+/* Measured programming rates, used for bwPollTimeout */
+static __IO uint32_t DFU_Ticks = 0;         /* SOF count, in ms */
+static uint32_t WriteTicks = 0, WriteBytes = 0, EraseTicks = 0;
+
+/* Programming statistics string, ASCII */
+static uint8_t DFU_StatusStr[64];
 
 /* DFU interface class callbacks structure */
 USBD_Class_cb_TypeDef  DFU_cb =
@@ -202,7 +242,7 @@ USBD_Class_cb_TypeDef  DFU_cb =
   EP0_RxReady,
   NULL, /* DataIn, */
   NULL, /* DataOut, */
-  NULL, /*SOF */
+  usbd_dfu_SOF,
   NULL,
   NULL,
   USBD_DFU_GetCfgDesc,
@@ -543,28 +583,33 @@ static uint8_t  EP0_TxSent (void  *pdev)
 {
   uint32_t Addr;
   USB_SETUP_REQ req;
+  uint8_t *pbuf = DFU_JOB_BUFFER(JobWr);
 
   if (DeviceState == STATE_dfuDNBUSY)
   {
+    /* Only waiting for a buffer to be free */
+    if (wlength == 0)
+    {}
     /* Decode the Special Command*/
-    if (wBlockNum == 0)
+    else if (wBlockNum == 0)
     {
-      if ((MAL_Buffer[0] ==  CMD_GETCOMMANDS) && (wlength == 1))
+      if ((pbuf[0] ==  CMD_GETCOMMANDS) && (wlength == 1))
       {}
-      else if  (( MAL_Buffer[0] ==  CMD_SETADDRESSPOINTER ) && (wlength == 5))
+      else if  (( pbuf[0] ==  CMD_SETADDRESSPOINTER ) && (wlength == 5))
       {
-        Pointer  = MAL_Buffer[1];
-        Pointer += MAL_Buffer[2] << 8;
-        Pointer += MAL_Buffer[3] << 16;
-        Pointer += MAL_Buffer[4] << 24;
+        Pointer  = pbuf[1];
+        Pointer += pbuf[2] << 8;
+        Pointer += pbuf[3] << 16;
+        Pointer += pbuf[4] << 24;
       }
-      else if (( MAL_Buffer[0] ==  CMD_ERASE ) && (wlength == 5))
+      else if (( pbuf[0] ==  CMD_ERASE ) && (wlength == 5))
       {
-        Pointer  = MAL_Buffer[1];
-        Pointer += MAL_Buffer[2] << 8;
-        Pointer += MAL_Buffer[3] << 16;
-        Pointer += MAL_Buffer[4] << 24;
-        MAL_Erase(Pointer);
+        Pointer  = pbuf[1];
+        Pointer += pbuf[2] << 8;
+        Pointer += pbuf[3] << 16;
+        Pointer += pbuf[4] << 24;
+        /* The host may send the blocks of the sector meanwhile */
+        DFU_Job_Queue(DFU_JOB_ERASE, Pointer, 0);
       }
       else
       {
@@ -583,8 +628,8 @@ static uint8_t  EP0_TxSent (void  *pdev)
       /* Decode the required address */
       Addr = ((wBlockNum - 2) * XFERSIZE) + Pointer;
 
-      /* Preform the write operation */
-      MAL_Write(Addr, wlength);
+      /* Queue the write operation */
+      DFU_Job_Queue(DFU_JOB_WRITE, Addr, wlength);
     }
     /* Reset the global lenght and block number */
     wlength = 0;
@@ -596,12 +641,39 @@ static uint8_t  EP0_TxSent (void  *pdev)
     DeviceStatus[1] = 0;
     DeviceStatus[2] = 0;
     DeviceStatus[3] = 0;
+
+#ifndef DFU_BACKGROUND_PROGRAMMING
+    USBD_DFU_Process();
+#endif
     return USBD_OK;
   }
   else if (DeviceState == STATE_dfuMANIFEST)/* Manifestation in progress*/
   {
-    /* Start leaving DFU mode */
-    DFU_LeaveDFUMode(pdev);
+    if (DFU_Job_Pending())
+    {
+      /* Blocks are still being programmed: check again at next GETSTATUS */
+      DeviceState = STATE_dfuMANIFEST_SYNC;
+      DeviceStatus[4] = DeviceState;
+    }
+    else if (JobStatus != STATUS_OK)
+    {
+      /* Don't start an incompletely programmed firmware */
+      DeviceState = STATE_dfuERROR;
+      DeviceStatus[0] = JobStatus;
+      DeviceStatus[4] = DeviceState;
+    }
+    else if (MAL_Manifest() != MAL_OK)
+    {
+      /* The downloaded firmware doesn't check */
+      DeviceState = STATE_dfuERROR;
+      DeviceStatus[0] = STATUS_ERRVERIFY;
+      DeviceStatus[4] = DeviceState;
+    }
+    else
+    {
+      /* Start leaving DFU mode */
+      DFU_LeaveDFUMode(pdev);
+    }
   }
 
   return USBD_OK;
@@ -618,6 +690,19 @@ static uint8_t  EP0_RxReady (void  *pdev)
   return USBD_OK;
 }
 
+/**
+  * @brief  usbd_dfu_SOF
+  *         Counts frames, as time base for the programming rates.
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  usbd_dfu_SOF (void  *pdev)
+{
+  DFU_Ticks++;
+
+  return USBD_OK;
+}
+
 
 /******************************************************************************
      DFU Class requests management
@@ -673,7 +758,8 @@ static void DFU_Req_DNLOAD(void *pdev, USB_SETUP_REQ *req)
   /* Data setup request */
   if (req->wLength > 0)
   {
-    if ((DeviceState == STATE_dfuIDLE) || (DeviceState == STATE_dfuDNLOAD_IDLE))
+    if (((DeviceState == STATE_dfuIDLE) || (DeviceState == STATE_dfuDNLOAD_IDLE)) &&
+        (DFU_Jobs[JobWr].state == DFU_JOB_FREE) && (req->wLength <= XFERSIZE))
     {
       /* Update the global length and block number */
       wBlockNum = req->wValue;
@@ -685,7 +771,7 @@ static void DFU_Req_DNLOAD(void *pdev, USB_SETUP_REQ *req)
 
       /* Prepare the reception of the buffer over EP0 */
       USBD_CtlPrepareRx (pdev,
-                         (uint8_t*)MAL_Buffer,
+                         DFU_JOB_BUFFER(JobWr),
                          wlength);
     }
     /* Unsupported state */
@@ -731,7 +817,9 @@ static void DFU_Req_UPLOAD(void *pdev, USB_SETUP_REQ *req)
   /* Data setup request */
   if (req->wLength > 0)
   {
-    if ((DeviceState == STATE_dfuIDLE) || (DeviceState == STATE_dfuUPLOAD_IDLE))
+    /* MAL_Read may use the first buffer, which may still be programmed */
+    if (((DeviceState == STATE_dfuIDLE) || (DeviceState == STATE_dfuUPLOAD_IDLE)) &&
+        !DFU_Job_Pending())
     {
       /* Update the global langth and block number */
       wBlockNum = req->wValue;
@@ -764,15 +852,35 @@ static void DFU_Req_UPLOAD(void *pdev, USB_SETUP_REQ *req)
         DeviceStatus[1] = 0;
         DeviceStatus[2] = 0;
         DeviceStatus[3] = 0;
-        Addr = ((wBlockNum - 2) * XFERSIZE) + Pointer;  /* Change is Accelerated*/
-
-        /* Return the physical address where data are stored */
-        Phy_Addr = MAL_Read(Addr, wlength);
-
-        /* Send the status data over EP0 */
-        USBD_CtlSendData (pdev,
-                          Phy_Addr,
-                          wlength);
+        /* The first block gives the size of all of them but the last one,
+           which may be larger than XFERSIZE when hosts read memory mapped
+           data faster with longer transfers */
+        if (wBlockNum == 2)
+        {
+          UploadSize = wlength;
+        }
+        Addr = ((wBlockNum - 2) * UploadSize) + Pointer;  /* Change is Accelerated*/
+
+        /* Memory mapped data are sent from where they are, the others are
+           copied to MAL_Buffer first, which is only XFERSIZE long */
+        Phy_Addr = MAL_GetPtr(Addr, wlength);
+        if ((Phy_Addr == NULL) && (wlength <= XFERSIZE))
+        {
+          Phy_Addr = MAL_Read(Addr, wlength);
+        }
+
+        if (Phy_Addr != NULL)
+        {
+          /* Send the status data over EP0 */
+          USBD_CtlSendData (pdev,
+                            Phy_Addr,
+                            wlength);
+        }
+        else
+        {
+          /* Call the error management function (command will be nacked */
+          USBD_CtlError (pdev, req);
+        }
       }
       else  /* unsupported wBlockNum */
       {
@@ -814,40 +922,73 @@ static void DFU_Req_UPLOAD(void *pdev, USB_SETUP_REQ *req)
   */
 static void DFU_Req_GETSTATUS(void *pdev)
 {
+  uint32_t poll;
+
   switch (DeviceState)
   {
   case   STATE_dfuDNLOAD_SYNC:
-    if (wlength != 0)
+    if (JobStatus != STATUS_OK)
+    {
+      /* A previous block failed */
+      DeviceState = STATE_dfuERROR;
+      DeviceStatus[0] = JobStatus;
+      DeviceStatus[4] = DeviceState;
+      DeviceStatus[1] = 0;
+      DeviceStatus[2] = 0;
+      DeviceStatus[3] = 0;
+    }
+    else if (wlength != 0)
     {
       DeviceState = STATE_dfuDNBUSY;
       DeviceStatus[4] = DeviceState;
-      if ((wBlockNum == 0) && (MAL_Buffer[0] == CMD_ERASE))
+#ifdef DFU_BACKGROUND_PROGRAMMING
+      /* The block only gets queued, its buffer being free */
+      poll = 0;
+#else
+      if ((wBlockNum == 0) && (DFU_JOB_BUFFER(JobWr)[0] == CMD_ERASE))
       {
-        MAL_GetStatus(Pointer, 0, DeviceStatus);
+        poll = DFU_Job_Timing(DFU_JOB_ERASE, Pointer, 0);
       }
       else
       {
-        MAL_GetStatus(Pointer, 1, DeviceStatus);
+        poll = DFU_Job_Timing(DFU_JOB_WRITE, Pointer, wlength);
       }
+#endif
+      DeviceStatus[1] = _1st_BYTE(poll);
+      DeviceStatus[2] = _2nd_BYTE(poll);
+      DeviceStatus[3] = _3rd_BYTE(poll);
     }
-    else  /* (wlength==0)*/
+    else if (DFU_Jobs[JobWr].state == DFU_JOB_FREE)
     {
+      /* Ready for the next block */
       DeviceState = STATE_dfuDNLOAD_IDLE;
       DeviceStatus[4] = DeviceState;
       DeviceStatus[1] = 0;
       DeviceStatus[2] = 0;
       DeviceStatus[3] = 0;
     }
+    else
+    {
+      /* All buffers are in use: come back once the oldest one is programmed */
+      poll = DFU_Job_Wait(0);
+      DeviceState = STATE_dfuDNBUSY;
+      DeviceStatus[4] = DeviceState;
+      DeviceStatus[1] = _1st_BYTE(poll);
+      DeviceStatus[2] = _2nd_BYTE(poll);
+      DeviceStatus[3] = _3rd_BYTE(poll);
+    }
     break;
 
   case   STATE_dfuMANIFEST_SYNC :
     if (Manifest_State == Manifest_In_Progress)
     {
+      /* Leave time for the remaining blocks to be programmed */
+      poll = DFU_Job_Wait(1) + 1;
       DeviceState = STATE_dfuMANIFEST;
       DeviceStatus[4] = DeviceState;
-      DeviceStatus[1] = 1;             /*bwPollTimeout = 1ms*/
-      DeviceStatus[2] = 0;
-      DeviceStatus[3] = 0;
+      DeviceStatus[1] = _1st_BYTE(poll);
+      DeviceStatus[2] = _2nd_BYTE(poll);
+      DeviceStatus[3] = _3rd_BYTE(poll);
       //break;
     }
     else if ((Manifest_State == Manifest_complete) && \
@@ -866,6 +1007,9 @@ static void DFU_Req_GETSTATUS(void *pdev)
     break;
   }
 
+  /* Point to the programming statistics */
+  DeviceStatus[5] = DFU_STATUS_STR_IDX;
+
   /* Send the status data over EP0 */
   USBD_CtlSendData (pdev,
                     (uint8_t *)(&(DeviceStatus[0])),
@@ -880,8 +1024,13 @@ static void DFU_Req_GETSTATUS(void *pdev)
   */
 static void DFU_Req_CLRSTATUS(void *pdev)
 {
-  if (DeviceState == STATE_dfuERROR)
+  if ((DeviceState == STATE_dfuERROR) && DFU_Job_Pending())
+  {
+    /* The failed download is still being flushed: stay in error */
+  }
+  else if (DeviceState == STATE_dfuERROR)
   {
+    JobStatus = STATUS_OK;
     DeviceState = STATE_dfuIDLE;
     DeviceStatus[0] = STATUS_OK;/*bStatus*/
     DeviceStatus[1] = 0;
@@ -982,6 +1131,204 @@ void DFU_LeaveDFUMode(void *pdev)
   }
 }
 
+/**
+  * @brief  USBD_DFU_Process
+  *         Erases and programs the queued blocks, in order. Once one of
+  *         them failed, the following ones are dropped.
+  * @param  None
+  * @retval None
+  */
+void USBD_DFU_Process (void)
+{
+  DFU_Job_TypeDef *job = &DFU_Jobs[JobRd];
+
+  while (job->state == DFU_JOB_READY)
+  {
+    job->state = DFU_JOB_BUSY;
+    job->Start = DFU_Ticks;
+
+    if (JobStatus != STATUS_OK)
+    {}
+    else if (job->cmd == DFU_JOB_ERASE)
+    {
+      if (MAL_Erase(job->Addr) != MAL_OK)
+      {
+        JobStatus = STATUS_ERRERASE;
+      }
+      EraseTicks = DFU_Ticks - job->Start;
+    }
+    else
+    {
+      if (MAL_Write(job->Addr, DFU_JOB_BUFFER(JobRd), job->Len) != MAL_OK)
+      {
+        JobStatus = STATUS_ERRPROG;
+      }
+      WriteTicks += DFU_Ticks - job->Start;
+      WriteBytes += job->Len;
+      if (WriteBytes >= 0x100000)
+      {
+        /* Keep the average recent, and away from overflows */
+        WriteTicks /= 2;
+        WriteBytes /= 2;
+      }
+    }
+
+    job->state = DFU_JOB_FREE;
+    JobRd = (JobRd + 1) % DFU_MAL_BUFFERS;
+    job = &DFU_Jobs[JobRd];
+  }
+}
+
+/**
+  * @brief  DFU_Job_Queue
+  *         Queues an operation on the buffer the last block was received in.
+  * @param  cmd: DFU_JOB_WRITE or DFU_JOB_ERASE
+  * @param  Addr: address to be written or erased
+  * @param  Len: number of bytes to be written
+  * @retval None
+  */
+static void DFU_Job_Queue (uint8_t cmd, uint32_t Addr, uint32_t Len)
+{
+  DFU_Job_TypeDef *job = &DFU_Jobs[JobWr];
+
+  job->cmd = cmd;
+  job->Addr = Addr;
+  job->Len = Len;
+  job->state = DFU_JOB_READY;
+
+  JobWr = (JobWr + 1) % DFU_MAL_BUFFERS;
+}
+
+/**
+  * @brief  DFU_Job_Pending
+  *         Tells whether operations are queued or in progress.
+  * @param  None
+  * @retval 1 if so, 0 else
+  */
+static uint8_t DFU_Job_Pending (void)
+{
+  return DFU_Jobs[JobRd].state != DFU_JOB_FREE;
+}
+
+/**
+  * @brief  DFU_Job_Timing
+  *         Estimates the duration of an operation, from the rates measured
+  *         so far, or from the memory nominal timings until then.
+  * @param  cmd: DFU_JOB_WRITE or DFU_JOB_ERASE
+  * @param  Addr: address to be written or erased
+  * @param  Len: number of bytes to be written
+  * @retval duration, in ms
+  */
+static uint32_t DFU_Job_Timing (uint8_t cmd, uint32_t Addr, uint32_t Len)
+{
+  uint8_t timing[6] = {0};
+
+  if ((cmd == DFU_JOB_ERASE) && EraseTicks)
+  {
+    return EraseTicks;
+  }
+  if ((cmd == DFU_JOB_WRITE) && WriteTicks && WriteBytes)
+  {
+    return (Len * WriteTicks) / WriteBytes + 1;
+  }
+
+  MAL_GetStatus(Addr, (cmd == DFU_JOB_ERASE) ? 1 : 0, timing);
+  return timing[1] | (timing[2] << 8) | (timing[3] << 16);
+}
+
+/**
+  * @brief  DFU_Job_Wait
+  *         Estimates how long until the oldest operation, or all of them,
+  *         are complete.
+  * @param  all: 0 for the oldest operation only, 1 for all of them
+  * @retval duration, in ms
+  */
+static uint32_t DFU_Job_Wait (uint8_t all)
+{
+  DFU_Job_TypeDef *job;
+  uint32_t idx = JobRd;
+  uint32_t wait = 0;
+  uint32_t timing;
+  uint32_t n;
+
+  for (n = 0; n < DFU_MAL_BUFFERS; n++)
+  {
+    job = &DFU_Jobs[idx];
+    if (job->state == DFU_JOB_FREE)
+    {
+      break;
+    }
+
+    timing = DFU_Job_Timing(job->cmd, job->Addr, job->Len);
+    if (job->state == DFU_JOB_BUSY)
+    {
+      /* Only what is left of it; at least 1ms, it isn't over yet */
+      timing = (timing > DFU_Ticks - job->Start) ? (timing - (DFU_Ticks - job->Start)) : 1;
+    }
+    wait += timing;
+
+    if (!all)
+    {
+      break;
+    }
+    idx = (idx + 1) % DFU_MAL_BUFFERS;
+  }
+
+  return wait;
+}
+
+/**
+  * @brief  DFU_Append
+  *         Appends a number, then a text, to a string.
+  * @param  str: end of the string
+  * @param  val: number
+  * @param  text: text
+  * @retval new end of the string
+  */
+static uint8_t *DFU_Append (uint8_t *str, uint32_t val, const char *text)
+{
+  uint8_t digits[10];
+  uint8_t n = 0;
+
+  do
+  {
+    digits[n++] = '0' + (val % 10);
+    val /= 10;
+  }
+  while (val);
+
+  while (n)
+  {
+    *str++ = digits[--n];
+  }
+  while (*text)
+  {
+    *str++ = *text++;
+  }
+  *str = 0;
+  return str;
+}
+
+/**
+  * @brief  DFU_Status_String
+  *         Describes the programming so far, as "<rate>B/s E<n> S<n> V<n>":
+  *         the measured rate, and the number of flash sectors erased, of
+  *         erases skipped as the sectors were blank, and of verify errors.
+  *         It is cut to what USBD_StrDesc holds.
+  * @param  str: string, 64 bytes
+  * @retval None
+  */
+static void DFU_Status_String (uint8_t *str)
+{
+  uint8_t *end = str;
+
+  end = DFU_Append(end, WriteTicks ? ((WriteBytes * 1000) / WriteTicks) : 0, "B/s E");
+  end = DFU_Append(end, FLASH_If_Stats.erased, " S");
+  end = DFU_Append(end, FLASH_If_Stats.skipped, " V");
+  DFU_Append(end, FLASH_If_Stats.verify_errors, "");
+  str[(USB_MAX_STR_DESC_SIZ - 2) / 2] = 0;
+}
+
 /**
   * @brief  USBD_DFU_GetCfgDesc
   *         Returns configuration descriptor
@@ -1020,6 +1367,13 @@ static uint8_t  *USBD_DFU_GetOtherCfgDesc (uint8_t speed, uint16_t *length)
   */
 static uint8_t* USBD_DFU_GetUsrStringDesc (uint8_t speed, uint8_t index , uint16_t *length)
 {
+  if (index == DFU_STATUS_STR_IDX)
+  {
+    DFU_Status_String(DFU_StatusStr);
+    USBD_GetString (DFU_StatusStr, USBD_StrDesc, length);
+    return USBD_StrDesc;
+  }
+
   /* Check if the requested string interface is supported */
   if (index <= (USBD_IDX_INTERFACE_STR + USBD_ITF_MAX_NUM))
   {
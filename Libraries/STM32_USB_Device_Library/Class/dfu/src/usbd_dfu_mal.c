@@ -32,6 +32,14 @@
  #include "usbd_mem_if_template.h"
 #endif
 
+#ifdef DFU_MAL_SUPPORT_PATCH
+ #include "usbd_patch_if.h"
+#endif
+
+#ifdef DFU_MAL_SUPPORT_SLOT
+ #include "usbd_slot_if.h"
+#endif
+
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
@@ -50,6 +58,12 @@ DFU_MAL_Prop_TypeDef* tMALTab[MAX_USED_MEDIA] = {
 #ifdef DFU_MAL_SUPPORT_MEM
   , &DFU_Mem_cb
 #endif
+#ifdef DFU_MAL_SUPPORT_PATCH
+  , &DFU_Patch_cb
+#endif
+#ifdef DFU_MAL_SUPPORT_SLOT
+  , &DFU_Slot_cb
+#endif
 };
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
@@ -66,6 +80,12 @@ __ALIGN_BEGIN const uint8_t* usbd_dfu_StringDesc[MAX_USED_MEDIA] __ALIGN_END  =
 #ifdef DFU_MAL_SUPPORT_MEM
   , MEM_IF_STRING
 #endif
+#ifdef DFU_MAL_SUPPORT_PATCH
+  , PATCH_IF_STRING
+#endif
+#ifdef DFU_MAL_SUPPORT_SLOT
+  , SLOT_IF_STRING
+#endif
 };
 
 #ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
@@ -73,8 +93,11 @@ __ALIGN_BEGIN const uint8_t* usbd_dfu_StringDesc[MAX_USED_MEDIA] __ALIGN_END  =
     #pragma data_alignment=4   
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
-/* RAM Buffer for Downloaded Data */
-__ALIGN_BEGIN uint8_t  MAL_Buffer[XFERSIZE] __ALIGN_END ; 
+/* RAM Buffers for Downloaded Data; a write may pad a block to 8 bytes */
+#if (XFERSIZE % 8) != 0
+#error "XFERSIZE must be a multiple of 8: see pMAL_Write"
+#endif
+__ALIGN_BEGIN uint8_t  MAL_Buffer[XFERSIZE * DFU_MAL_BUFFERS] __ALIGN_END ; 
 
 /* Private function prototypes -----------------------------------------------*/
 static uint8_t  MAL_CheckAdd  (uint32_t Add);
@@ -164,10 +187,11 @@ uint16_t MAL_Erase(uint32_t Add)
   * @brief  MAL_Write
   *         Write sectors of memory.
   * @param  Add: Sector address/code
+  * @param  Buf: Data to be written, in one of the MAL_Buffer blocks
   * @param  Len: Number of data to be written (in bytes)
   * @retval Result of the opeartion: MAL_OK if all operations are OK else MAL_FAIL
   */
-uint16_t MAL_Write (uint32_t Add, uint32_t Len)
+uint16_t MAL_Write (uint32_t Add, uint8_t *Buf, uint32_t Len)
 {
   uint32_t memIdx = MAL_CheckAdd(Add);
  
@@ -182,7 +206,7 @@ uint16_t MAL_Write (uint32_t Add, uint32_t Len)
     /* Check if the command is supported */
     if (tMALTab[memIdx]->pMAL_Write != NULL)
     {
-      return tMALTab[memIdx]->pMAL_Write(Add, Len);
+      return tMALTab[memIdx]->pMAL_Write(Add, Buf, Len);
     }
     else
     {
@@ -224,6 +248,28 @@ uint8_t *MAL_Read (uint32_t Add, uint32_t Len)
   }
 }
 
+/**
+  * @brief  MAL_GetPtr
+  *         Gives where memory mapped data can be sent from without a copy.
+  * @param  Add: Sector address/code
+  * @param  Len: Number of data to be sent (in bytes)
+  * @retval Pointer to the data, NULL if they aren't all in the same memory or
+  *         the memory can't be accessed directly
+  */
+uint8_t *MAL_GetPtr (uint32_t Add, uint32_t Len)
+{
+  uint32_t memIdx = MAL_CheckAdd(Add);
+  
+  if ((memIdx < MAX_USED_MEDIA) && (Len > 0) &&
+      (MAL_CheckAdd(Add + Len - 1) == memIdx) &&
+      (tMALTab[memIdx]->pMAL_GetPtr != NULL))
+  {
+    return tMALTab[memIdx]->pMAL_GetPtr(Add, Len);
+  }
+
+  return NULL;
+}
+
 /**
   * @brief  MAL_GetStatus
   *         Get the status of a given memory.
@@ -255,6 +301,30 @@ uint16_t MAL_GetStatus(uint32_t Add , uint8_t Cmd, uint8_t *buffer)
   }
 }
 
+/**
+  * @brief  MAL_Manifest
+  *         Completes a download on the memories needing it.
+  * @param  None
+  * @retval Result of the opeartion: MAL_OK if all operations are OK else MAL_FAIL
+  */
+uint16_t MAL_Manifest(void)
+{
+  uint32_t memIdx = 0;
+  uint16_t status = MAL_OK;
+  
+  for(memIdx = 0; memIdx < MAX_USED_MEDIA; memIdx++)
+  {
+    /* Check if the command is supported */
+    if ((tMALTab[memIdx]->pMAL_Manifest != NULL) &&
+        (tMALTab[memIdx]->pMAL_Manifest() != MAL_OK))
+    {
+      status = MAL_FAIL;
+    }
+  }
+
+  return status;
+}
+
 /**
   * @brief  MAL_CheckAdd
   *         Determine which memory should be managed.
@@ -0,0 +1,392 @@
+/**
+  ******************************************************************************
+  * @file    usbd_dfu_patch.c
+  * @brief   Decoder for compressed and delta firmware images.
+  *
+  *          The stream is decoded as it is received, whatever the block
+  *          boundaries, so that a new image is rebuilt in flash from the one
+  *          already there plus what changed, with a fixed amount of RAM: the
+  *          decoder state and a PATCH_WINDOW_SIZE output window. Back
+  *          references older than the window are read from the flash, where
+  *          that output has already been programmed.
+  *
+  *          The decoder only depends on the memory accesses it is given, so
+  *          the host tools can run it against a simulated flash.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_dfu_patch.h"
+
+#include <string.h>
+
+/* Decoder states */
+#define PATCH_STATE_HEADER              0
+#define PATCH_STATE_OP                  1
+#define PATCH_STATE_ARG                 2
+#define PATCH_STATE_LITERAL             3
+#define PATCH_STATE_DONE                4
+#define PATCH_STATE_ERROR               5
+
+/* CRC-32 (IEEE 802.3), four bits at a time */
+static const uint32_t PATCH_CRCTable[16] =
+{
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/**
+  * @brief  PATCH_CRC32
+  *         Updates a CRC-32. Start with 0 for a new CRC.
+  * @param  crc: CRC of the previous data
+  * @param  buf: data
+  * @param  len: length of the data
+  * @retval CRC of the previous data followed by buf
+  */
+uint32_t PATCH_CRC32 (uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+  crc = ~crc;
+  while (len--)
+  {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ PATCH_CRCTable[crc & 0x0F];
+    crc = (crc >> 4) ^ PATCH_CRCTable[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+/**
+  * @brief  PATCH_Get32
+  *         Reads a little endian word from the header.
+  * @param  p: word
+  * @retval value
+  */
+static uint32_t PATCH_Get32 (const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+  * @brief  PATCH_Fail
+  *         Stops decoding; every later call fails too.
+  * @param  dec: decoder
+  * @retval PATCH_FAIL
+  */
+static uint16_t PATCH_Fail (PATCH_Decoder_TypeDef *dec)
+{
+  dec->state = PATCH_STATE_ERROR;
+  return PATCH_FAIL;
+}
+
+/**
+  * @brief  PATCH_Flush
+  *         Programs the output window.
+  * @param  dec: decoder
+  * @retval PATCH_OK or PATCH_FAIL
+  */
+static uint16_t PATCH_Flush (PATCH_Decoder_TypeDef *dec)
+{
+  uint32_t len = dec->pos - dec->flushed;
+
+  if (len == 0)
+  {
+    return PATCH_OK;
+  }
+  if (dec->mem->Write(dec->dest + dec->flushed, dec->window, len) != PATCH_OK)
+  {
+    return PATCH_FAIL;
+  }
+  dec->flushed = dec->pos;
+  return PATCH_OK;
+}
+
+/**
+  * @brief  PATCH_Put
+  *         Outputs one byte.
+  * @param  dec: decoder
+  * @param  b: byte
+  * @retval PATCH_OK or PATCH_FAIL
+  */
+static __inline uint16_t PATCH_Put (PATCH_Decoder_TypeDef *dec, uint8_t b)
+{
+  dec->window[dec->pos - dec->flushed] = b;
+  dec->pos++;
+  if (dec->pos - dec->flushed == PATCH_WINDOW_SIZE)
+  {
+    return PATCH_Flush(dec);
+  }
+  return PATCH_OK;
+}
+
+/**
+  * @brief  PATCH_Header
+  *         Checks the header, and the image the patch applies to.
+  * @param  dec: decoder
+  * @retval PATCH_OK or PATCH_FAIL
+  */
+static uint16_t PATCH_Header (PATCH_Decoder_TypeDef *dec)
+{
+  const uint8_t *h = dec->header;
+
+  if (PATCH_Get32(h) != PATCH_MAGIC)
+  {
+    return PATCH_FAIL;
+  }
+  dec->dest   = PATCH_Get32(h + 4);
+  dec->src    = PATCH_Get32(h + 8);
+  dec->srclen = PATCH_Get32(h + 12);
+  dec->outlen = PATCH_Get32(h + 16);
+  dec->outcrc = PATCH_Get32(h + 24);
+
+  /* The destination is erased as it is written: it must not hold the source */
+  if ((dec->outlen == 0) ||
+      ((dec->srclen != 0) && (dec->src < dec->dest + dec->outlen) &&
+       (dec->dest < dec->src + dec->srclen)))
+  {
+    return PATCH_FAIL;
+  }
+
+  dec->dmap = dec->mem->Map(dec->dest);
+  dec->smap = dec->srclen ? dec->mem->Map(dec->src) : NULL;
+  if ((dec->dmap == NULL) || (dec->srclen && (dec->smap == NULL)))
+  {
+    return PATCH_FAIL;
+  }
+
+  /* The CRCs read both images to their last byte, which must be mapped
+     too, and right where the first one says */
+  if ((dec->dest + dec->outlen - 1 < dec->dest) ||
+      (dec->mem->Map(dec->dest + dec->outlen - 1) != dec->dmap + (dec->outlen - 1)) ||
+      (dec->srclen &&
+       ((dec->src + dec->srclen - 1 < dec->src) ||
+        (dec->mem->Map(dec->src + dec->srclen - 1) != dec->smap + (dec->srclen - 1)))))
+  {
+    return PATCH_FAIL;
+  }
+
+  /* A patch applied to another image would build garbage */
+  if (dec->srclen && (PATCH_CRC32(0, dec->smap, dec->srclen) != PATCH_Get32(h + 20)))
+  {
+    return PATCH_FAIL;
+  }
+
+  return PATCH_OK;
+}
+
+/**
+  * @brief  PATCH_Execute
+  *         Runs an operation once its arguments are decoded.
+  * @param  dec: decoder
+  * @retval PATCH_OK or PATCH_FAIL
+  */
+static uint16_t PATCH_Execute (PATCH_Decoder_TypeDef *dec)
+{
+  uint32_t n = dec->arg[0];
+  uint32_t idx;
+
+  switch (dec->op)
+  {
+  case PATCH_OP_END:
+    if ((dec->pos != dec->outlen) || (PATCH_Flush(dec) != PATCH_OK) ||
+        (PATCH_CRC32(0, dec->dmap, dec->outlen) != dec->outcrc))
+    {
+      return PATCH_FAIL;
+    }
+    dec->state = PATCH_STATE_DONE;
+    return PATCH_OK;
+
+  case PATCH_OP_LITERAL:
+    if (n > dec->outlen - dec->pos)
+    {
+      return PATCH_FAIL;
+    }
+    dec->state = n ? PATCH_STATE_LITERAL : PATCH_STATE_OP;
+    return PATCH_OK;
+
+  case PATCH_OP_COPY:
+    /* The delta is zigzag encoded */
+    dec->spos += (dec->arg[1] >> 1) ^ (uint32_t)-(int32_t)(dec->arg[1] & 1);
+    if ((n > dec->outlen - dec->pos) || (dec->spos > dec->srclen) ||
+        (n > dec->srclen - dec->spos))
+    {
+      return PATCH_FAIL;
+    }
+    while (n--)
+    {
+      if (PATCH_Put(dec, dec->smap[dec->spos++]) != PATCH_OK)
+      {
+        return PATCH_FAIL;
+      }
+    }
+    break;
+
+  case PATCH_OP_MATCH:
+    if ((n > dec->outlen - dec->pos) || (dec->arg[1] == 0) || (dec->arg[1] > dec->pos))
+    {
+      return PATCH_FAIL;
+    }
+    idx = dec->pos - dec->arg[1];
+    while (n--)
+    {
+      /* Output older than the window is already in flash */
+      uint8_t b = (idx < dec->flushed) ? dec->dmap[idx] : dec->window[idx - dec->flushed];
+      idx++;
+      if (PATCH_Put(dec, b) != PATCH_OK)
+      {
+        return PATCH_FAIL;
+      }
+    }
+    break;
+
+  case PATCH_OP_ERASE:
+    /* Only sectors the output hasn't reached yet */
+    if ((n < dec->pos) || (n >= dec->outlen) ||
+        (dec->mem->Erase(dec->dest + n) != PATCH_OK))
+    {
+      return PATCH_FAIL;
+    }
+    break;
+
+  default:
+    return PATCH_FAIL;
+  }
+
+  dec->state = PATCH_STATE_OP;
+  return PATCH_OK;
+}
+
+/**
+  * @brief  PATCH_Init
+  *         Starts decoding a new stream.
+  * @param  dec: decoder
+  * @param  mem: memory accesses
+  * @retval None
+  */
+void PATCH_Init (PATCH_Decoder_TypeDef *dec, const PATCH_Mem_TypeDef *mem)
+{
+  memset(dec, 0, sizeof(*dec));
+  dec->mem = mem;
+  dec->state = PATCH_STATE_HEADER;
+}
+
+/**
+  * @brief  PATCH_Feed
+  *         Decodes the next part of the stream, which may be cut anywhere.
+  * @param  dec: decoder
+  * @param  buf: stream data
+  * @param  len: length of the data
+  * @retval PATCH_OK, or PATCH_FAIL if the stream is invalid or the flash
+  *         couldn't be programmed
+  */
+uint16_t PATCH_Feed (PATCH_Decoder_TypeDef *dec, const uint8_t *buf, uint32_t len)
+{
+  uint32_t n;
+  uint8_t  b;
+
+  while (len)
+  {
+    switch (dec->state)
+    {
+    case PATCH_STATE_HEADER:
+      n = PATCH_HEADER_SIZE - dec->received;
+      n = (n < len) ? n : len;
+      memcpy(dec->header + dec->received, buf, n);
+      dec->received += n;
+      buf += n;
+      len -= n;
+      if (dec->received == PATCH_HEADER_SIZE)
+      {
+        if (PATCH_Header(dec) != PATCH_OK)
+        {
+          return PATCH_Fail(dec);
+        }
+        dec->state = PATCH_STATE_OP;
+      }
+      continue;
+
+    case PATCH_STATE_OP:
+      dec->op = *buf++;
+      len--;
+      dec->received++;
+      dec->arg[0] = 0;
+      dec->arg[1] = 0;
+      dec->argidx = 0;
+      dec->shift = 0;
+      dec->state = PATCH_STATE_ARG;
+      if (dec->op == PATCH_OP_END)
+      {
+        if (PATCH_Execute(dec) != PATCH_OK)
+        {
+          return PATCH_Fail(dec);
+        }
+      }
+      continue;
+
+    case PATCH_STATE_ARG:
+      b = *buf++;
+      len--;
+      dec->received++;
+      if (dec->shift > 28)
+      {
+        return PATCH_Fail(dec);
+      }
+      dec->arg[dec->argidx] |= (uint32_t)(b & 0x7F) << dec->shift;
+      dec->shift += 7;
+      if (b & 0x80)
+      {
+        continue;
+      }
+      dec->shift = 0;
+      /* COPY and MATCH take two arguments, the others one */
+      if ((dec->argidx == 0) &&
+          ((dec->op == PATCH_OP_COPY) || (dec->op == PATCH_OP_MATCH)))
+      {
+        dec->argidx = 1;
+        continue;
+      }
+      if (PATCH_Execute(dec) != PATCH_OK)
+      {
+        return PATCH_Fail(dec);
+      }
+      continue;
+
+    case PATCH_STATE_LITERAL:
+      n = (dec->arg[0] < len) ? dec->arg[0] : len;
+      dec->arg[0] -= n;
+      dec->received += n;
+      len -= n;
+      while (n--)
+      {
+        if (PATCH_Put(dec, *buf++) != PATCH_OK)
+        {
+          return PATCH_Fail(dec);
+        }
+      }
+      if (dec->arg[0] == 0)
+      {
+        dec->state = PATCH_STATE_OP;
+      }
+      continue;
+
+    default:
+      /* Errors are sticky, and nothing may follow the end */
+      return PATCH_Fail(dec);
+    }
+  }
+
+  return PATCH_OK;
+}
+
+/**
+  * @brief  PATCH_IsDone
+  *         Tells whether the whole stream was decoded and the image checked.
+  * @param  dec: decoder
+  * @retval 1 if so, 0 else
+  */
+uint8_t PATCH_IsDone (const PATCH_Decoder_TypeDef *dec)
+{
+  return dec->state == PATCH_STATE_DONE;
+}
@@ -0,0 +1,495 @@
+/**
+  ******************************************************************************
+  * @file    usbd_dfu_slot.c
+  * @brief   A/B firmware slots, with resumable downloads.
+  *
+  *          Downloads go to the staging slot, sequentially. Each block is
+  *          read back after programming, and once it matches, the length
+  *          and running CRC of the verified part are appended to the log.
+  *          Blocks already verified may be sent again: they are compared
+  *          and skipped, so a host restarting a download from scratch only
+  *          pays for the USB transfer of what already made it to flash.
+  *
+  *          The slot manager only depends on the memory accesses it is
+  *          given, so that it can be run against a simulated flash.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_dfu_slot.h"
+#include "usbd_dfu_patch.h"
+
+#include <string.h>
+
+/**
+  * @brief  SLOT_Put32
+  *         Writes a little endian word.
+  * @param  p: destination
+  * @param  v: value
+  * @retval None
+  */
+static void SLOT_Put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+  * @brief  SLOT_Get32
+  *         Reads a little endian word.
+  * @param  p: source
+  * @retval value
+  */
+static uint32_t SLOT_Get32 (const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+  * @brief  SLOT_IsBlank
+  *         Tells whether flash is erased.
+  * @param  p: flash
+  * @param  len: length
+  * @retval 1 if so, 0 else
+  */
+static uint8_t SLOT_IsBlank (const uint8_t *p, uint32_t len)
+{
+  while (len--)
+  {
+    if (*p++ != 0xFF)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+  * @brief  SLOT_IsRecord
+  *         Tells whether a log record is complete.
+  * @param  p: record
+  * @retval 1 if so, 0 else
+  */
+static uint8_t SLOT_IsRecord (const uint8_t *p)
+{
+  return ((SLOT_Get32(p) >> 16) == SLOT_REC_TAG) &&
+         (PATCH_CRC32(0, p, 12) == SLOT_Get32(p + 12));
+}
+
+/**
+  * @brief  SLOT_WriteRecord
+  *         Programs a log record.
+  * @param  st: slots
+  * @param  meta: log sector
+  * @param  off: offset of the record in the log sector
+  * @param  type: SLOT_REC_xxx
+  * @param  slot: slot the record is about
+  * @param  a, b: arguments
+  * @retval SLOT_OK or SLOT_FAIL
+  */
+static uint16_t SLOT_WriteRecord (SLOT_State_TypeDef *st, uint8_t meta, uint32_t off,
+                                  uint8_t type, uint8_t slot, uint32_t a, uint32_t b)
+{
+  uint8_t rec[SLOT_REC_SIZE];
+
+  SLOT_Put32(rec, ((uint32_t)SLOT_REC_TAG << 16) | ((uint32_t)type << 8) | slot);
+  SLOT_Put32(rec + 4, a);
+  SLOT_Put32(rec + 8, b);
+  SLOT_Put32(rec + 12, PATCH_CRC32(0, rec, 12));
+
+  return st->mem->Write(st->layout->meta[meta] + off, rec, SLOT_REC_SIZE);
+}
+
+/**
+  * @brief  SLOT_Apply
+  *         Updates the state with a log record.
+  * @param  st: slots
+  * @param  type: SLOT_REC_xxx
+  * @param  slot: slot the record is about
+  * @param  a, b: arguments
+  * @retval None
+  */
+static void SLOT_Apply (SLOT_State_TypeDef *st, uint8_t type, uint8_t slot, uint32_t a, uint32_t b)
+{
+  switch (type)
+  {
+  case SLOT_REC_BOOT:
+    /* Back to the previous image: the one it replaces is the broken one */
+    if (slot == st->fallback)
+    {
+      st->fallback = SLOT_NONE;
+    }
+    else
+    {
+      st->fallback = st->active;
+      st->prev = st->boot;
+    }
+    st->active = slot;
+    st->boot.len = a;
+    st->boot.crc = b;
+    st->open = 0;
+    st->dirty = 0;
+    break;
+
+  case SLOT_REC_BEGIN:
+    /* The previous image is being overwritten */
+    if (slot == st->fallback)
+    {
+      st->fallback = SLOT_NONE;
+    }
+    st->session = a;
+    st->open = (slot == SLOT_Staging(st));
+    st->progress.len = 0;
+    st->progress.crc = 0;
+    break;
+
+  case SLOT_REC_BLOCK:
+    if (st->open && (slot == SLOT_Staging(st)))
+    {
+      st->progress.len = a;
+      st->progress.crc = b;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+  * @brief  SLOT_Compact
+  *         Moves the state to the other log sector, once this one is full.
+  *         Its header is written last, so that until then the current
+  *         sector stays the one loaded.
+  * @param  st: slots
+  * @retval SLOT_OK or SLOT_FAIL
+  */
+static uint16_t SLOT_Compact (SLOT_State_TypeDef *st)
+{
+  uint8_t  meta = st->meta ^ 1;
+  uint32_t off = SLOT_REC_SIZE;
+  uint16_t status;
+
+  status = st->mem->Erase(st->layout->meta[meta]);
+
+  /* Replayed in order, the boot records restore the fallback too */
+  if ((status == SLOT_OK) && (st->fallback != SLOT_NONE))
+  {
+    status = SLOT_WriteRecord(st, meta, off, SLOT_REC_BOOT, st->fallback, st->prev.len, st->prev.crc);
+    off += SLOT_REC_SIZE;
+  }
+  if ((status == SLOT_OK) && (st->active != SLOT_NONE))
+  {
+    status = SLOT_WriteRecord(st, meta, off, SLOT_REC_BOOT, st->active, st->boot.len, st->boot.crc);
+    off += SLOT_REC_SIZE;
+  }
+  if ((status == SLOT_OK) && st->open)
+  {
+    status = SLOT_WriteRecord(st, meta, off, SLOT_REC_BEGIN, SLOT_Staging(st), st->session, 0);
+    off += SLOT_REC_SIZE;
+    if ((status == SLOT_OK) && st->progress.len)
+    {
+      status = SLOT_WriteRecord(st, meta, off, SLOT_REC_BLOCK, SLOT_Staging(st), st->progress.len, st->progress.crc);
+      off += SLOT_REC_SIZE;
+    }
+  }
+  if (status == SLOT_OK)
+  {
+    status = SLOT_WriteRecord(st, meta, 0, SLOT_REC_HEADER, 0, st->generation + 1, 0);
+  }
+  if (status != SLOT_OK)
+  {
+    return SLOT_FAIL;
+  }
+
+  st->meta = meta;
+  st->generation++;
+  st->next = off;
+  return SLOT_OK;
+}
+
+/**
+  * @brief  SLOT_Append
+  *         Logs a record and applies it.
+  * @param  st: slots
+  * @param  type: SLOT_REC_xxx
+  * @param  slot: slot the record is about
+  * @param  a, b: arguments
+  * @retval SLOT_OK or SLOT_FAIL
+  */
+static uint16_t SLOT_Append (SLOT_State_TypeDef *st, uint8_t type, uint8_t slot, uint32_t a, uint32_t b)
+{
+  uint16_t status;
+
+  if ((st->next + SLOT_REC_SIZE > st->layout->meta_size) && (SLOT_Compact(st) != SLOT_OK))
+  {
+    return SLOT_FAIL;
+  }
+
+  status = SLOT_WriteRecord(st, st->meta, st->next, type, slot, a, b);
+  /* Even failed, the record may have been partly programmed */
+  st->next += SLOT_REC_SIZE;
+  if (status != SLOT_OK)
+  {
+    return SLOT_FAIL;
+  }
+
+  SLOT_Apply(st, type, slot, a, b);
+  return SLOT_OK;
+}
+
+/**
+  * @brief  SLOT_Load
+  *         Reads the state back from the log, initializing it on a blank
+  *         device, and rolling back to the previous image if the active
+  *         one is broken.
+  * @param  st: slots
+  * @param  mem: memory accesses
+  * @param  layout: flash layout
+  * @retval SLOT_OK or SLOT_FAIL
+  */
+uint16_t SLOT_Load (SLOT_State_TypeDef *st, const SLOT_Mem_TypeDef *mem, const SLOT_Layout_TypeDef *layout)
+{
+  const uint8_t *p[2];
+  uint8_t  valid[2];
+  uint32_t off;
+  uint8_t  i;
+
+  memset(st, 0, sizeof(*st));
+  st->mem = mem;
+  st->layout = layout;
+  st->active = SLOT_NONE;
+  st->fallback = SLOT_NONE;
+
+  for (i = 0; i < 2; i++)
+  {
+    p[i] = mem->Map(layout->meta[i]);
+    valid[i] = SLOT_IsRecord(p[i]) && (p[i][1] == SLOT_REC_HEADER);
+  }
+
+  if (!valid[0] && !valid[1])
+  {
+    /* Blank device */
+    if ((mem->Erase(layout->meta[0]) != SLOT_OK) ||
+        (SLOT_WriteRecord(st, 0, 0, SLOT_REC_HEADER, 0, 1, 0) != SLOT_OK))
+    {
+      return SLOT_FAIL;
+    }
+    st->generation = 1;
+    st->next = SLOT_REC_SIZE;
+    return SLOT_OK;
+  }
+
+  st->meta = (valid[1] && (!valid[0] || (SLOT_Get32(p[1] + 4) > SLOT_Get32(p[0] + 4)))) ? 1 : 0;
+  st->generation = SLOT_Get32(p[st->meta] + 4);
+
+  /* Replay; records are appended in order, so the first blank one ends the log */
+  for (off = SLOT_REC_SIZE; off + SLOT_REC_SIZE <= layout->meta_size; off += SLOT_REC_SIZE)
+  {
+    const uint8_t *rec = p[st->meta] + off;
+
+    if (SLOT_IsBlank(rec, SLOT_REC_SIZE))
+    {
+      break;
+    }
+    if (SLOT_IsRecord(rec))
+    {
+      SLOT_Apply(st, rec[1], rec[0], SLOT_Get32(rec + 4), SLOT_Get32(rec + 8));
+    }
+  }
+  st->next = off;
+  st->dirty = 0;
+
+  /* Once the active image no longer checks, the previous one is booted
+     instead. Make it the active one again, so that the next download goes
+     over the broken image rather than over the one running. */
+  if ((st->active != SLOT_NONE) && (st->fallback != SLOT_NONE) &&
+      (SLOT_Boot(st) == layout->slot[st->fallback]))
+  {
+    return SLOT_Append(st, SLOT_REC_BOOT, st->fallback, st->prev.len, st->prev.crc);
+  }
+
+  return SLOT_OK;
+}
+
+/**
+  * @brief  SLOT_Staging
+  *         Gives the slot downloads go to. Without an active slot, it is
+  *         slot 1, so that an image flashed to slot 0 by other means stays
+  *         until a download completes.
+  * @param  st: slots
+  * @retval slot
+  */
+uint8_t SLOT_Staging (const SLOT_State_TypeDef *st)
+{
+  return (st->active == SLOT_NONE) ? 1 : (st->active ^ 1);
+}
+
+/**
+  * @brief  SLOT_Program
+  *         Programs a block of the download, which must either start it
+  *         anew at offset 0, or follow the verified part of it. The part
+  *         of a block already verified is compared instead of programmed.
+  * @param  st: slots
+  * @param  off: offset of the block in the slot
+  * @param  buf: data; for words programming, its size is rounded up to 4
+  *         and the padding filled with 0xFF
+  * @param  len: length of the data
+  * @retval SLOT_OK, or SLOT_FAIL if the offset isn't the expected one or the
+  *         programming failed; the host should then resume from the
+  *         verified length given by the status
+  */
+uint16_t SLOT_Program (SLOT_State_TypeDef *st, uint32_t off, uint8_t *buf, uint32_t len)
+{
+  const SLOT_Layout_TypeDef *layout = st->layout;
+  uint8_t  staging = SLOT_Staging(st);
+  uint32_t base = layout->slot[staging];
+  uint32_t sector = layout->sector_size;
+  uint32_t done;
+  uint32_t first;
+  uint32_t s;
+
+  if ((len == 0) || (off > layout->slot_size) || (len > layout->slot_size - off))
+  {
+    return SLOT_FAIL;
+  }
+
+  /* Skip what is already verified, or start over */
+  done = 0;
+  if (st->open && (off <= st->progress.len))
+  {
+    done = st->progress.len - off;
+    done = (done < len) ? done : len;
+    if (memcmp(st->mem->Map(base + off), buf, done) != 0)
+    {
+      done = 0;
+      if (off != 0)
+      {
+        return SLOT_FAIL;
+      }
+    }
+  }
+  if (done == 0)
+  {
+    if ((off == 0) && (!st->open || st->progress.len))
+    {
+      if (SLOT_Append(st, SLOT_REC_BEGIN, staging, st->session + 1, 0) != SLOT_OK)
+      {
+        return SLOT_FAIL;
+      }
+    }
+    else if (!st->open || (off != st->progress.len))
+    {
+      return SLOT_FAIL;
+    }
+  }
+  st->dirty = 1;
+  off += done;
+  buf += done;
+  len -= done;
+  if (len == 0)
+  {
+    return SLOT_OK;
+  }
+
+  /* The part of the block in an already started sector must still be
+     blank. If it isn't, a block was interrupted while being programmed:
+     go back to the start of the sector, which is erased again then. */
+  first = ((off + sector - 1) / sector) * sector;
+  if (!SLOT_IsBlank(st->mem->Map(base + off), ((first < off + len) ? first : off + len) - off))
+  {
+    s = (off / sector) * sector;
+    SLOT_Append(st, SLOT_REC_BLOCK, staging, s, PATCH_CRC32(0, st->mem->Map(base), s));
+    return SLOT_FAIL;
+  }
+  for (s = first; s < off + len; s += sector)
+  {
+    if (st->mem->Erase(base + s) != SLOT_OK)
+    {
+      return SLOT_FAIL;
+    }
+  }
+
+  if ((st->mem->Write(base + off, buf, len) != SLOT_OK) ||
+      (memcmp(st->mem->Map(base + off), buf, len) != 0))
+  {
+    return SLOT_FAIL;
+  }
+
+  return SLOT_Append(st, SLOT_REC_BLOCK, staging, off + len,
+                     PATCH_CRC32(st->progress.crc, buf, len));
+}
+
+/**
+  * @brief  SLOT_Commit
+  *         Makes the download the active image, if there was one since the
+  *         state was loaded, once it is checked as a whole.
+  * @param  st: slots
+  * @retval SLOT_OK, or SLOT_FAIL if the download doesn't check
+  */
+uint16_t SLOT_Commit (SLOT_State_TypeDef *st)
+{
+  uint8_t staging = SLOT_Staging(st);
+
+  if (!st->open || !st->dirty || (st->progress.len == 0))
+  {
+    return SLOT_OK;
+  }
+
+  if (PATCH_CRC32(0, st->mem->Map(st->layout->slot[staging]), st->progress.len) != st->progress.crc)
+  {
+    return SLOT_FAIL;
+  }
+
+  /* The switch itself: a single record */
+  return SLOT_Append(st, SLOT_REC_BOOT, staging, st->progress.len, st->progress.crc);
+}
+
+/**
+  * @brief  SLOT_Boot
+  *         Gives the image to start: the active one if it checks, else the
+  *         previous one if still intact.
+  * @param  st: slots
+  * @retval address of the slot, 0 if none can be started
+  */
+uint32_t SLOT_Boot (const SLOT_State_TypeDef *st)
+{
+  const SLOT_Layout_TypeDef *layout = st->layout;
+
+  if ((st->active != SLOT_NONE) &&
+      (PATCH_CRC32(0, st->mem->Map(layout->slot[st->active]), st->boot.len) == st->boot.crc))
+  {
+    return layout->slot[st->active];
+  }
+  if ((st->fallback != SLOT_NONE) &&
+      (PATCH_CRC32(0, st->mem->Map(layout->slot[st->fallback]), st->prev.len) == st->prev.crc))
+  {
+    return layout->slot[st->fallback];
+  }
+  return 0;
+}
+
+/**
+  * @brief  SLOT_GetStatus
+  *         Fills the status hosts read to resume downloads.
+  * @param  st: slots
+  * @param  buf: SLOT_STATUS_SIZE bytes
+  * @retval None
+  */
+void SLOT_GetStatus (const SLOT_State_TypeDef *st, uint8_t *buf)
+{
+  SLOT_Put32(buf, SLOT_STATUS_MAGIC);
+  buf[4] = st->active;
+  buf[5] = SLOT_Staging(st);
+  buf[6] = st->fallback;
+  buf[7] = 0;
+  SLOT_Put32(buf + 8, st->session);
+  SLOT_Put32(buf + 12, st->open ? st->progress.len : 0);
+  SLOT_Put32(buf + 16, st->open ? st->progress.crc : 0);
+  SLOT_Put32(buf + 20, st->boot.len);
+  SLOT_Put32(buf + 24, st->boot.crc);
+  SLOT_Put32(buf + 28, st->layout->slot_size);
+}
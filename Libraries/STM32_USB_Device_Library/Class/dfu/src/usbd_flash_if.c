@@ -23,18 +23,39 @@
 #include "usbd_flash_if.h"
 #include "usbd_dfu_mal.h"
 
+#include <string.h>
+
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
-/* Private macro -------------------------------------------------------------*/
+#ifdef STM32F2XX
+ #define FLASH_IF_SECTORS                12
+
+ /* Program parallelism, in bytes */
+ #define FLASH_IF_WIDTH                  ((FLASH_IF_VOLTAGE_RANGE == VoltageRange_4) ? 8 : \
+                                          (FLASH_IF_VOLTAGE_RANGE == VoltageRange_3) ? 4 : \
+                                          (FLASH_IF_VOLTAGE_RANGE == VoltageRange_2) ? 2 : 1)
+
+ #define FLASH_IF_SR_ERRORS              (FLASH_FLAG_PGSERR | FLASH_FLAG_PGPERR | \
+                                          FLASH_FLAG_PGAERR | FLASH_FLAG_WRPERR)
+#elif defined(STM32F10X_CL)
+ #define FLASH_IF_PAGE_SIZE              0x800
+ #define FLASH_IF_SECTORS                ((FLASH_END_ADD - FLASH_START_ADD) / FLASH_IF_PAGE_SIZE)
+ #define FLASH_IF_WIDTH                  4
+#endif /* STM32F2XX */
 
+/* Private macro -------------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
 uint16_t FLASH_If_Init(void);
 uint16_t FLASH_If_Erase (uint32_t Add);
-uint16_t FLASH_If_Write (uint32_t Add, uint32_t Len);
+uint16_t FLASH_If_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
 uint8_t *FLASH_If_Read  (uint32_t Add, uint32_t Len);
+uint8_t *FLASH_If_GetPtr (uint32_t Add, uint32_t Len);
 uint16_t FLASH_If_DeInit(void);
 uint16_t FLASH_If_CheckAdd(uint32_t Add);
 
+static uint32_t FLASH_If_Sector (uint32_t Add, uint32_t *Start, uint32_t *Size);
+static uint32_t FLASH_If_CRC (const uint8_t *Buf, uint32_t Len);
+
 
 /* Private variables ---------------------------------------------------------*/
 DFU_MAL_Prop_TypeDef DFU_Flash_cb =
@@ -45,11 +66,29 @@ DFU_MAL_Prop_TypeDef DFU_Flash_cb =
     FLASH_If_Erase,
     FLASH_If_Write,
     FLASH_If_Read,
+    FLASH_If_GetPtr,
     FLASH_If_CheckAdd,
+    NULL, /* Manifest not supported */
     50, /* Erase Time in ms */
     50  /* Programming Time in ms */
   };
 
+FLASH_If_Stats_TypeDef FLASH_If_Stats;
+
+#ifdef STM32F2XX
+/* Sectors boundaries */
+static const uint32_t FLASH_If_SectorAdd[FLASH_IF_SECTORS + 1] =
+{
+  0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000,
+  0x08040000, 0x08060000, 0x08080000, 0x080A0000, 0x080C0000, 0x080E0000,
+  0x08100000
+};
+#endif /* STM32F2XX */
+
+/* Sectors known to be blank: erased, or found blank, and not written to
+   since. Host erase commands for them are skipped. */
+static uint32_t FLASH_If_Erased[(FLASH_IF_SECTORS + 31) / 32];
+
 /* Private functions ---------------------------------------------------------*/
 
 /**
@@ -62,6 +101,17 @@ uint16_t FLASH_If_Init(void)
 {
   /* Unlock the internal flash */
   FLASH_Unlock();
+
+  /* The CRC unit verifies the programmed data */
+#ifdef STM32F2XX
+  RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_CRC, ENABLE);
+#elif defined(STM32F10X_CL)
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
+#endif /* STM32F2XX */
+
+  /* New session: the flash may have changed behind our back */
+  memset(FLASH_If_Erased, 0, sizeof(FLASH_If_Erased));
+  memset(&FLASH_If_Stats, 0, sizeof(FLASH_If_Stats));
   
   return MAL_OK;
 }
@@ -80,102 +130,218 @@ uint16_t FLASH_If_DeInit(void)
   return MAL_OK;
 }
 
-/*******************************************************************************
-* Function Name  : FLASH_If_Erase
-* Description    : Erase sector
-* Input          : None
-* Output         : None
-* Return         : None
-*******************************************************************************/
-uint16_t FLASH_If_Erase(uint32_t Add)
+/**
+  * @brief  FLASH_If_Sector
+  *         Finds the sector an address is in.
+  * @param  Add: Address.
+  * @param  Start: Start of the sector.
+  * @param  Size: Size of the sector.
+  * @retval Index of the sector, FLASH_IF_SECTORS if none.
+  */
+static uint32_t FLASH_If_Sector (uint32_t Add, uint32_t *Start, uint32_t *Size)
 {
-#ifdef STM32F2XX
-  /* Check which sector has to be erased */
-  if (Add < 0x08004000)
-  {
-    FLASH_EraseSector(FLASH_Sector_0, VoltageRange_3);
-  }
-  else if (Add < 0x08008000)
-  {
-    FLASH_EraseSector(FLASH_Sector_1, VoltageRange_3);
-  }
-  else if (Add < 0x0800C000)
-  {
-    FLASH_EraseSector(FLASH_Sector_2, VoltageRange_3);
-  }
-  else if (Add < 0x08010000)
-  {
-    FLASH_EraseSector(FLASH_Sector_3, VoltageRange_3);
-  }
-  else if (Add < 0x08020000)
-  {
-    FLASH_EraseSector(FLASH_Sector_4, VoltageRange_3);
-  }
-  else if (Add < 0x08040000)
-  {
-    FLASH_EraseSector(FLASH_Sector_5, VoltageRange_3);
-  }
-  else if (Add < 0x08060000)
-  {
-    FLASH_EraseSector(FLASH_Sector_6, VoltageRange_3);
-  }
-  else if (Add < 0x08080000)
+  uint32_t idx = 0;
+
+  if ((Add < FLASH_START_ADD) || (Add >= FLASH_END_ADD))
   {
-    FLASH_EraseSector(FLASH_Sector_7, VoltageRange_3);
+    return FLASH_IF_SECTORS;
   }
-  else if (Add < 0x080A0000)
+#ifdef STM32F2XX
+  while (Add >= FLASH_If_SectorAdd[idx + 1])
   {
-    FLASH_EraseSector(FLASH_Sector_8, VoltageRange_3);
+    idx++;
   }
-  else if (Add < 0x080C0000)
+  *Start = FLASH_If_SectorAdd[idx];
+  *Size = FLASH_If_SectorAdd[idx + 1] - FLASH_If_SectorAdd[idx];
+#elif defined(STM32F10X_CL)
+  idx = (Add - FLASH_START_ADD) / FLASH_IF_PAGE_SIZE;
+  *Start = FLASH_START_ADD + (idx * FLASH_IF_PAGE_SIZE);
+  *Size = FLASH_IF_PAGE_SIZE;
+#endif /* STM32F2XX */
+
+  return idx;
+}
+
+/**
+  * @brief  FLASH_If_CRC
+  *         Computes the CRC of a buffer with the CRC unit. The bytes after
+  *         the last whole word are read one at a time, and padded with 0xFF
+  *         to a word: nothing past Buf + Len is read.
+  * @param  Buf: Data.
+  * @param  Len: Number of data (in bytes).
+  * @retval CRC.
+  */
+static uint32_t FLASH_If_CRC (const uint8_t *Buf, uint32_t Len)
+{
+  uint32_t tail = 0xFFFFFFFF;
+  uint32_t idx;
+
+  CRC_ResetDR();
+  CRC_CalcBlockCRC((uint32_t *)Buf, Len / 4);
+  if ((Len & 3) == 0)
   {
-    FLASH_EraseSector(FLASH_Sector_9, VoltageRange_3);
+    return CRC_GetCRC();
   }
-  else if (Add < 0x080E0000)
+
+  for (idx = 0; idx < (Len & 3); idx++)
   {
-    FLASH_EraseSector(FLASH_Sector_10, VoltageRange_3);
+    tail &= ~(0xFFUL << (8 * idx));
+    tail |= (uint32_t)Buf[(Len & ~3UL) + idx] << (8 * idx);
   }
-  else if (Add < 0x08100000)
+  return CRC_CalcCRC(tail);
+}
+
+/**
+  * @brief  FLASH_If_Erase
+  *         Memory erase routine. Sectors already blank aren't erased again,
+  *         which saves up to 2s per 128KB sector.
+  * @param  Add: Address of the sector to be erased.
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+uint16_t FLASH_If_Erase(uint32_t Add)
+{
+  uint32_t start, size, idx;
+  const uint32_t *p;
+
+  idx = FLASH_If_Sector(Add, &start, &size);
+  if (idx >= FLASH_IF_SECTORS)
   {
-    FLASH_EraseSector(FLASH_Sector_11, VoltageRange_3);
+    return MAL_FAIL;
   }
-  else
+
+  if (!(FLASH_If_Erased[idx / 32] & (1UL << (idx % 32))))
   {
-    return MAL_FAIL;    
-  }
+    /* Blank check: reading a sector is a thousand times faster than erasing it */
+    for (p = (const uint32_t *)start; (uint32_t)p < start + size; p++)
+    {
+      if (*p != 0xFFFFFFFF)
+      {
+        break;
+      }
+    }
+
+    if ((uint32_t)p < start + size)
+    {
+#ifdef STM32F2XX
+      if (FLASH_EraseSector(FLASH_Sector_0 + (idx * (FLASH_Sector_1 - FLASH_Sector_0)),
+                            FLASH_IF_VOLTAGE_RANGE) != FLASH_COMPLETE)
 #elif defined(STM32F10X_CL)
-  /* Call the standard Flash erase function */
-  FLASH_ErasePage(Add);  
+      if (FLASH_ErasePage(start) != FLASH_COMPLETE)
 #endif /* STM32F2XX */
-  
+      {
+        return MAL_FAIL;
+      }
+      FLASH_If_Stats.erased++;
+      FLASH_If_Erased[idx / 32] |= 1UL << (idx % 32);
+      return MAL_OK;
+    }
+
+    FLASH_If_Erased[idx / 32] |= 1UL << (idx % 32);
+  }
+
+  FLASH_If_Stats.skipped++;
   return MAL_OK;
 }
 
 /**
   * @brief  FLASH_If_Write
-  *         Memory write routine.
+  *         Memory write routine, with the widest parallelism the supply
+  *         voltage allows, then verified with the CRC unit.
   * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written; up to 7 bytes after them may be
+  *         overwritten with 0xFF, see pMAL_Write.
   * @param  Len: Number of data to be written (in bytes).
   * @retval MAL_OK if operation is successeful, MAL_FAIL else.
   */
-uint16_t FLASH_If_Write(uint32_t Add, uint32_t Len)
+uint16_t FLASH_If_Write(uint32_t Add, uint8_t *Buf, uint32_t Len)
 {
   uint32_t idx = 0;
+  uint32_t start, size, sector;
+  uint32_t width = FLASH_IF_WIDTH;
+  uint32_t crc;
   
-  if  (Len & 0x3) /* Not an aligned data */
+  /* Pad to the parallelism: the last write programs 0xFF past Len, which
+     leaves the flash there as it was */
+  while (Add & (width - 1))
+  {
+    width >>= 1;
+  }
+  for (idx = Len; idx & (width - 1); idx++)
+  {
+    Buf[idx] = 0xFF;
+  }
+  crc = FLASH_If_CRC(Buf, Len);
+
+  /* The sectors written to aren't blank anymore */
+  for (idx = Add; idx < Add + Len; idx = start + size)
   {
-    for (idx = Len; idx < ((Len & 0xFFFC) + 4); idx++)
+    sector = FLASH_If_Sector(idx, &start, &size);
+    if (sector >= FLASH_IF_SECTORS)
     {
-      MAL_Buffer[idx] = 0xFF;
+      return MAL_FAIL;
     }
+    FLASH_If_Erased[sector / 32] &= ~(1UL << (sector % 32));
   }
-  
+
+#ifdef STM32F2XX
+  /* Program without going through the library for every word: PG stays
+     set, and the next write only waits for the previous one */
+  FLASH_ClearFlag(FLASH_IF_SR_ERRORS);
+  FLASH->CR &= ~FLASH_CR_PSIZE;
+  FLASH->CR |= (width == 8) ? FLASH_PSIZE_DOUBLE_WORD :
+               (width == 4) ? FLASH_PSIZE_WORD :
+               (width == 2) ? FLASH_PSIZE_HALF_WORD : FLASH_PSIZE_BYTE;
+  FLASH->CR |= FLASH_CR_PG;
+
+  for (idx = 0; idx < Len; idx += width)
+  {
+    switch (width)
+    {
+    case 8:
+      /* Both words make a single double word program */
+      *(__IO uint32_t *)(Add + idx) = *(uint32_t *)(Buf + idx);
+      *(__IO uint32_t *)(Add + idx + 4) = *(uint32_t *)(Buf + idx + 4);
+      break;
+    case 4:
+      *(__IO uint32_t *)(Add + idx) = *(uint32_t *)(Buf + idx);
+      break;
+    case 2:
+      *(__IO uint16_t *)(Add + idx) = *(uint16_t *)(Buf + idx);
+      break;
+    default:
+      *(__IO uint8_t *)(Add + idx) = Buf[idx];
+      break;
+    }
+    while (FLASH->SR & FLASH_FLAG_BSY)
+    {
+    }
+  }
+
+  FLASH->CR &= ~FLASH_CR_PG;
+  if (FLASH->SR & FLASH_IF_SR_ERRORS)
+  {
+    FLASH_ClearFlag(FLASH_IF_SR_ERRORS);
+    return MAL_FAIL;
+  }
+#elif defined(STM32F10X_CL)
   /* Data received are Word multiple */
   for (idx = 0; idx <  Len; idx = idx + 4)
   {
-    FLASH_ProgramWord(Add, *(uint32_t *)(MAL_Buffer + idx));
-    Add += 4;
+    if (FLASH_ProgramWord(Add + idx, *(uint32_t *)(Buf + idx)) != FLASH_COMPLETE)
+    {
+      return MAL_FAIL;
+    }
   }
+#endif /* STM32F2XX */
+
+  /* Verify in a single pass over the flash, the Len bytes written only */
+  if (FLASH_If_CRC((const uint8_t *)Add, Len) != crc)
+  {
+    FLASH_If_Stats.verify_errors++;
+    return MAL_FAIL;
+  }
+
+  FLASH_If_Stats.programmed += Len;
   return MAL_OK;
 }
 
@@ -200,6 +366,27 @@ uint8_t *FLASH_If_Read (uint32_t Add, uint32_t Len)
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 }
 
+/**
+  * @brief  FLASH_If_GetPtr
+  *         Gives the address of memory mapped data, for them to be sent as is.
+  * @param  Add: Address of the data.
+  * @param  Len: Number of data (in bytes).
+  * @retval Pointer to the data, NULL if they can't be accessed directly.
+  */
+uint8_t *FLASH_If_GetPtr (uint32_t Add, uint32_t Len)
+{
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  /* Sent through a copy: see FLASH_If_Read */
+  return NULL;
+#else
+  if ((Add < FLASH_START_ADD) || (Add >= FLASH_END_ADD) || (Len > FLASH_END_ADD - Add))
+  {
+    return NULL;
+  }
+  return (uint8_t *)Add;
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+}
+
 /**
   * @brief  FLASH_If_CheckAdd
   *         Check if the address is an allowed address for this memory.
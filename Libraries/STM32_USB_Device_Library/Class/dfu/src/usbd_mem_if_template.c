@@ -32,7 +32,7 @@
 /* Private function prototypes -----------------------------------------------*/
 uint16_t MEM_If_Init(void);
 uint16_t MEM_If_Erase (uint32_t Add);
-uint16_t MEM_If_Write (uint32_t Add, uint32_t Len);
+uint16_t MEM_If_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
 uint8_t *MEM_If_Read  (uint32_t Add, uint32_t Len);
 uint16_t MEM_If_DeInit(void);
 uint16_t MEM_If_CheckAdd(uint32_t Add);
@@ -47,7 +47,9 @@ DFU_MAL_Prop_TypeDef DFU_Mem_cb =
     MEM_If_Erase,
     MEM_If_Write,
     MEM_If_Read,
+    NULL, /* GetPtr not supported */
     MEM_If_CheckAdd,
+    NULL, /* Manifest not supported */
     10, /* Erase Time in ms */
     10  /* Programming Time in ms */
   };
@@ -91,10 +93,11 @@ uint16_t MEM_If_Erase(uint32_t Add)
   * @brief  MEM_If_Write
   *         Memory write routine.
   * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
   * @param  Len: Number of data to be written (in bytes).
   * @retval MAL_OK if operation is successeful, MAL_FAIL else.
   */
-uint16_t MEM_If_Write(uint32_t Add, uint32_t Len)
+uint16_t MEM_If_Write(uint32_t Add, uint8_t *Buf, uint32_t Len)
 {
   return MAL_OK;
 }
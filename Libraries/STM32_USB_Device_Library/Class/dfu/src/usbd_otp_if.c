@@ -28,8 +28,9 @@
 /* Private macro -------------------------------------------------------------*/
 
 /* Private function prototypes -----------------------------------------------*/
-uint16_t OTP_If_Write (uint32_t Add, uint32_t Len);
+uint16_t OTP_If_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
 uint8_t *OTP_If_Read  (uint32_t Add, uint32_t Len);
+uint8_t *OTP_If_GetPtr (uint32_t Add, uint32_t Len);
 uint16_t OTP_If_DeInit(void);
 uint16_t OTP_If_CheckAdd(uint32_t Add);
 
@@ -43,7 +44,9 @@ DFU_MAL_Prop_TypeDef DFU_Otp_cb =
     NULL, /* Erase not supported */
     OTP_If_Write,
     OTP_If_Read,
+    OTP_If_GetPtr,
     OTP_If_CheckAdd,
+    NULL, /* Manifest not supported */
     1,  /* Erase Time in ms */
     10  /* Programming Time in ms */
   };
@@ -54,10 +57,11 @@ DFU_MAL_Prop_TypeDef DFU_Otp_cb =
   * @brief  OTP_If_Write
   *         Memory write routine.
   * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
   * @param  Len: Number of data to be written (in bytes).
   * @retval MAL_OK if operation is successeful, MAL_FAIL else.
   */
-uint16_t OTP_If_Write(uint32_t Add, uint32_t Len)
+uint16_t OTP_If_Write(uint32_t Add, uint8_t *Buf, uint32_t Len)
 {
   uint32_t idx = 0;
   
@@ -65,14 +69,17 @@ uint16_t OTP_If_Write(uint32_t Add, uint32_t Len)
   {
     for (idx = Len; idx < ((Len & 0xFFFC) + 4); idx++)
     {
-      MAL_Buffer[idx] = 0xFF;
+      Buf[idx] = 0xFF;
     }
   }
   
   /* Data received are Word multiple */
   for (idx = 0; idx <  Len; idx = idx + 4)
   {
-    FLASH_ProgramWord(Add, *(uint32_t *)(MAL_Buffer + idx));
+    if (FLASH_ProgramWord(Add, *(uint32_t *)(Buf + idx)) != FLASH_COMPLETE)
+    {
+      return MAL_FAIL;
+    }
     Add += 4;
   }
   return MAL_OK;
@@ -99,6 +106,27 @@ uint8_t *OTP_If_Read (uint32_t Add, uint32_t Len)
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 }
 
+/**
+  * @brief  OTP_If_GetPtr
+  *         Gives the address of memory mapped data, for them to be sent as is.
+  * @param  Add: Address of the data.
+  * @param  Len: Number of data (in bytes).
+  * @retval Pointer to the data, NULL if they can't be accessed directly.
+  */
+uint8_t *OTP_If_GetPtr (uint32_t Add, uint32_t Len)
+{
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  /* Sent through a copy: see OTP_If_Read */
+  return NULL;
+#else
+  if ((Add < OTP_START_ADD) || (Add >= OTP_END_ADD) || (Len > OTP_END_ADD - Add))
+  {
+    return NULL;
+  }
+  return (uint8_t *)Add;
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+}
+
 /**
   * @brief  OTP_If_CheckAdd
   *         Check if the address is an allowed address for this memory.
@@ -0,0 +1,183 @@
+/**
+  ******************************************************************************
+  * @file    usbd_patch_if.c
+  * @brief   Media access Layer for delta and compressed images: the
+  *          downloaded stream is decoded on the fly, and the image it
+  *          describes is programmed through the other media.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_patch_if.h"
+#include "usbd_dfu_mal.h"
+#include "usbd_dfu_patch.h"
+#include "usbd_flash_if.h"
+
+#ifdef DFU_MAL_SUPPORT_SLOT
+ #include "usbd_slot_if.h"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* The output window goes to MAL_Write, which may pad it to 8 bytes */
+#if (PATCH_WINDOW_SIZE % 8) != 0
+#error "PATCH_WINDOW_SIZE must be a multiple of 8: see pMAL_Write"
+#endif
+/* Private macro -------------------------------------------------------------*/
+
+/* Private function prototypes -----------------------------------------------*/
+uint16_t Patch_If_Init (void);
+uint16_t Patch_If_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
+uint16_t Patch_If_CheckAdd (uint32_t Add);
+
+static uint16_t Patch_Erase (uint32_t Add);
+static uint16_t Patch_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
+static const uint8_t *Patch_Map (uint32_t Add);
+
+
+/* Private variables ---------------------------------------------------------*/
+DFU_MAL_Prop_TypeDef DFU_Patch_cb =
+  {
+    PATCH_IF_STRING,
+    Patch_If_Init,
+    NULL, /* DeInit not supported */
+    NULL, /* Erase not supported */
+    Patch_If_Write,
+    NULL, /* Read not supported */
+    NULL, /* GetPtr not supported */
+    Patch_If_CheckAdd,
+    NULL, /* Manifest not supported */
+    1,   /* Erase Time in ms */
+    100  /* Programming Time in ms: a block may erase sectors and program a lot more */
+  };
+
+static const PATCH_Mem_TypeDef Patch_Mem =
+  {
+    Patch_Write,
+    Patch_Erase,
+    Patch_Map
+  };
+
+static PATCH_Decoder_TypeDef Patch_Decoder;
+
+/* Address the next block of the stream is expected at */
+static uint32_t Patch_Next = 0;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Patch_Erase
+  *         Erases a sector of the destination image.
+  * @param  Add: Address of the sector.
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+static uint16_t Patch_Erase (uint32_t Add)
+{
+  /* Not into ourselves */
+  if (Patch_If_CheckAdd(Add) == MAL_OK)
+  {
+    return MAL_FAIL;
+  }
+  return MAL_Erase(Add);
+}
+
+/**
+  * @brief  Patch_Write
+  *         Programs a part of the destination image.
+  * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
+  * @param  Len: Number of data to be written (in bytes).
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+static uint16_t Patch_Write (uint32_t Add, uint8_t *Buf, uint32_t Len)
+{
+  if (Patch_If_CheckAdd(Add) == MAL_OK)
+  {
+    return MAL_FAIL;
+  }
+  return MAL_Write(Add, Buf, Len);
+}
+
+/**
+  * @brief  Patch_Map
+  *         Gives where an image is read from. Not through MAL_Read, which may
+  *         copy to MAL_Buffer, where the next blocks are being received.
+  * @param  Add: Address of the image.
+  * @retval Pointer to the image, NULL if the address can't be read.
+  */
+static const uint8_t *Patch_Map (uint32_t Add)
+{
+#ifdef DFU_MAL_SUPPORT_SLOT
+  /* Patches may be applied to the staging slot */
+  if (DFU_Slot_cb.pMAL_CheckAdd(Add) == MAL_OK)
+  {
+    return DFU_Slot_Map(Add);
+  }
+#endif
+  if (DFU_Flash_cb.pMAL_CheckAdd(Add) == MAL_OK)
+  {
+    return (const uint8_t *)Add;
+  }
+  return NULL;
+}
+
+/**
+  * @brief  Patch_If_Init
+  *         Memory initialization routine.
+  * @param  None
+  * @retval MAL_OK
+  */
+uint16_t Patch_If_Init(void)
+{
+  PATCH_Init(&Patch_Decoder, &Patch_Mem);
+  Patch_Next = 0;
+  return MAL_OK;
+}
+
+/**
+  * @brief  Patch_If_Write
+  *         Feeds a block of the stream to the decoder. A block at the start of
+  *         the area starts a new stream; the others must follow each other.
+  * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
+  * @param  Len: Number of data to be written (in bytes).
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+uint16_t Patch_If_Write(uint32_t Add, uint8_t *Buf, uint32_t Len)
+{
+  if (Add == PATCH_START_ADD)
+  {
+    Patch_If_Init();
+  }
+  else if ((Patch_Next == 0) || (Add != Patch_Next))
+  {
+    return MAL_FAIL;
+  }
+
+  if ((Len > PATCH_END_ADD - Add) || (PATCH_Feed(&Patch_Decoder, Buf, Len) != PATCH_OK))
+  {
+    Patch_Next = 0;
+    return MAL_FAIL;
+  }
+
+  Patch_Next = Add + Len;
+  return MAL_OK;
+}
+
+/**
+  * @brief  Patch_If_CheckAdd
+  *         Check if the address is an allowed address for this memory.
+  * @param  Add: Address to be checked.
+  * @retval MAL_OK if the address is allowed, MAL_FAIL else.
+  */
+uint16_t Patch_If_CheckAdd(uint32_t Add)
+{
+  if ((Add >= PATCH_START_ADD) && (Add < PATCH_END_ADD))
+  {
+    return MAL_OK;
+  }
+  else
+  {
+    return MAL_FAIL;
+  }
+}
@@ -0,0 +1,250 @@
+/**
+  ******************************************************************************
+  * @file    usbd_slot_if.c
+  * @brief   Media access Layer for A/B firmware slots: downloads go to the
+  *          staging slot, can be resumed after a disconnect, and replace the
+  *          active image on manifestation only.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_slot_if.h"
+#include "usbd_dfu_mal.h"
+#include "usbd_flash_if.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+
+/* Private function prototypes -----------------------------------------------*/
+uint16_t Slot_If_Init (void);
+uint16_t Slot_If_Erase (uint32_t Add);
+uint16_t Slot_If_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
+uint8_t *Slot_If_Read (uint32_t Add, uint32_t Len);
+uint8_t *Slot_If_GetPtr (uint32_t Add, uint32_t Len);
+uint16_t Slot_If_CheckAdd (uint32_t Add);
+uint16_t Slot_If_Manifest (void);
+
+static uint16_t Slot_Erase (uint32_t Add);
+static uint16_t Slot_Write (uint32_t Add, uint8_t *Buf, uint32_t Len);
+static const uint8_t *Slot_Map (uint32_t Add);
+
+
+/* Private variables ---------------------------------------------------------*/
+DFU_MAL_Prop_TypeDef DFU_Slot_cb =
+  {
+    SLOT_IF_STRING,
+    Slot_If_Init,
+    NULL, /* DeInit not supported */
+    Slot_If_Erase,
+    Slot_If_Write,
+    Slot_If_Read,
+    Slot_If_GetPtr,
+    Slot_If_CheckAdd,
+    Slot_If_Manifest,
+    1,   /* Erase Time in ms */
+    100  /* Programming Time in ms: a block may erase a sector */
+  };
+
+/* The slots are accessed through the flash directly, not through the MAL:
+   they are usually in the areas protected from the host */
+static const SLOT_Mem_TypeDef Slot_Mem =
+  {
+    Slot_Write,
+    Slot_Erase,
+    Slot_Map
+  };
+
+static const SLOT_Layout_TypeDef Slot_Layout =
+  {
+    { SLOT_META0_ADD, SLOT_META1_ADD },
+    SLOT_META_SIZE,
+    { SLOT_A_ADD, SLOT_B_ADD },
+    SLOT_SIZE,
+    SLOT_SECTOR_SIZE
+  };
+
+static SLOT_State_TypeDef Slot_State;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Slot_Erase
+  *         Erases a flash sector.
+  * @param  Add: Address of the sector.
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+static uint16_t Slot_Erase (uint32_t Add)
+{
+  return DFU_Flash_cb.pMAL_Erase(Add);
+}
+
+/**
+  * @brief  Slot_Write
+  *         Programs the flash.
+  * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
+  * @param  Len: Number of data to be written (in bytes).
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+static uint16_t Slot_Write (uint32_t Add, uint8_t *Buf, uint32_t Len)
+{
+  return DFU_Flash_cb.pMAL_Write(Add, Buf, Len);
+}
+
+/**
+  * @brief  Slot_Map
+  *         Gives where the flash is read from.
+  * @param  Add: Address in the flash.
+  * @retval Pointer to the flash.
+  */
+static const uint8_t *Slot_Map (uint32_t Add)
+{
+  return (const uint8_t *)Add;
+}
+
+/**
+  * @brief  DFU_Slot_Map
+  *         Gives where the virtual area is read from, for the other media.
+  * @param  Add: Address in the virtual area.
+  * @retval Pointer to the staging slot.
+  */
+const uint8_t *DFU_Slot_Map (uint32_t Add)
+{
+  return (const uint8_t *)(Slot_Layout.slot[SLOT_Staging(&Slot_State)] + (Add - SLOT_START_ADD));
+}
+
+/**
+  * @brief  DFU_Slot_BootAddress
+  *         For the bootloader: gives the image to start, if any checks.
+  * @param  None
+  * @retval Address of the image, 0 if none.
+  */
+uint32_t DFU_Slot_BootAddress (void)
+{
+  if (SLOT_Load(&Slot_State, &Slot_Mem, &Slot_Layout) != SLOT_OK)
+  {
+    return 0;
+  }
+  return SLOT_Boot(&Slot_State);
+}
+
+/**
+  * @brief  Slot_If_Init
+  *         Memory initialization routine: loads the slots state.
+  * @param  None
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+uint16_t Slot_If_Init(void)
+{
+  return SLOT_Load(&Slot_State, &Slot_Mem, &Slot_Layout);
+}
+
+/**
+  * @brief  Slot_If_Erase
+  *         Memory erase routine. The staging slot is erased as it is
+  *         written, so there is nothing to do here.
+  * @param  Add: Address of the sector.
+  * @retval MAL_OK
+  */
+uint16_t Slot_If_Erase(uint32_t Add)
+{
+  return MAL_OK;
+}
+
+/**
+  * @brief  Slot_If_Write
+  *         Memory write routine.
+  * @param  Add: Address to be written to.
+  * @param  Buf: Data to be written.
+  * @param  Len: Number of data to be written (in bytes).
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+uint16_t Slot_If_Write(uint32_t Add, uint8_t *Buf, uint32_t Len)
+{
+  if (Add >= SLOT_STATUS_ADD)
+  {
+    return MAL_FAIL;
+  }
+  return SLOT_Program(&Slot_State, Add - SLOT_START_ADD, Buf, Len);
+}
+
+/**
+  * @brief  Slot_If_Read
+  *         Memory read routine.
+  * @param  Add: Address to be read from.
+  * @param  Len: Number of data to be read (in bytes).
+  * @retval Pointer to the phyisical address where data should be read.
+  */
+uint8_t *Slot_If_Read (uint32_t Add, uint32_t Len)
+{
+  uint32_t idx = 0;
+
+  if (Add >= SLOT_STATUS_ADD)
+  {
+    SLOT_GetStatus(&Slot_State, MAL_Buffer);
+    return MAL_Buffer + (Add - SLOT_STATUS_ADD);
+  }
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  for (idx = 0; idx < Len; idx += 4)
+  {
+    *(uint32_t*)(MAL_Buffer + idx) = *(uint32_t *)(DFU_Slot_Map(Add) + idx);
+  }
+  return (uint8_t*)(MAL_Buffer);
+#else
+  (void)idx;
+  return (uint8_t *)DFU_Slot_Map(Add);
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+}
+
+/**
+  * @brief  Slot_If_GetPtr
+  *         Gives the address of the staging slot data, for them to be sent
+  *         as is. The status is built on read, so it always goes through a
+  *         copy.
+  * @param  Add: Address of the data.
+  * @param  Len: Number of data (in bytes).
+  * @retval Pointer to the data, NULL if they can't be accessed directly.
+  */
+uint8_t *Slot_If_GetPtr (uint32_t Add, uint32_t Len)
+{
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  return NULL;
+#else
+  if ((Add < SLOT_START_ADD) || (Add >= SLOT_STATUS_ADD) || (Len > SLOT_STATUS_ADD - Add))
+  {
+    return NULL;
+  }
+  return (uint8_t *)DFU_Slot_Map(Add);
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+}
+
+/**
+  * @brief  Slot_If_Manifest
+  *         Switches to the downloaded image, if any.
+  * @param  None
+  * @retval MAL_OK if operation is successeful, MAL_FAIL else.
+  */
+uint16_t Slot_If_Manifest(void)
+{
+  return SLOT_Commit(&Slot_State);
+}
+
+/**
+  * @brief  Slot_If_CheckAdd
+  *         Check if the address is an allowed address for this memory.
+  * @param  Add: Address to be checked.
+  * @retval MAL_OK if the address is allowed, MAL_FAIL else.
+  */
+uint16_t Slot_If_CheckAdd(uint32_t Add)
+{
+  if ((Add >= SLOT_START_ADD) && (Add < SLOT_END_ADD))
+  {
+    return MAL_OK;
+  }
+  else
+  {
+    return MAL_FAIL;
+  }
+}
@@ -25,18 +25,68 @@
 
 #include  "usbd_ioreq.h"
 
+/* Number of reports with their own mailbox. With more than one, reports
+   start with their ID, from 1 to HID_MAX_REPORTS. */
+#ifndef HID_MAX_REPORTS
+#define HID_MAX_REPORTS               1
+#endif
+
+/* Latest value wins: the report replaces whatever was posted before and
+   not sent yet. It is only sent if it differs from the previous one, or
+   once the idle period set by the host has expired. When the IN endpoint
+   is free, it is loaded right away, ready for the next poll of the host.
+   Relative reports are the exception, see USBD_HID_SetRelative. */
+uint8_t USBD_HID_Post(uint8_t *report, uint16_t len);
+
+/* Frames between the post of a report and its IN transfer: one bin per
+   frame, the last one for anything longer. */
+#ifndef HID_LATENCY_BINS
+#define HID_LATENCY_BINS              8
+#endif
+
+void USBD_HID_GetLatency(uint32_t *hist, uint8_t clear);
+
+/* Report types, as in GET_REPORT and SET_REPORT */
+#define HID_REPORT_INPUT              1
+#define HID_REPORT_OUTPUT             2
+#define HID_REPORT_FEATURE            3
+
+/* Called with the reports the host sends, through SET_REPORT or the OUT
+   endpoint, from USBD_HID_Process. */
+typedef void (*HID_ReportHandler_TypeDef)(uint8_t type, uint8_t *report, uint16_t len);
+
+/* OUT reports received ahead of USBD_HID_Process; the host is NAKed while
+   they are all full. */
+#ifndef HID_OUT_BUFFERS
+#define HID_OUT_BUFFERS               2
+#endif
+
+/* Hands the reports received since the last call to their handlers; to be
+   called from the application, out of the USB interrupt. */
+void USBD_HID_Process(void);
+
+/* When several reports have something to send, the one with the lowest
+   priority value goes first. They all start at 0. */
+uint8_t USBD_HID_SetPriority(uint8_t id, uint8_t priority);
+
+/* Relative reports, such as mouse moves, are sent on every post, equal to
+   the previous one or not. Posting one while the previous is still pending
+   returns USBD_BUSY, rather than losing its motion. */
+uint8_t USBD_HID_SetRelative(uint8_t id, uint8_t relative);
+uint8_t USBD_HID_SetHandler(uint8_t id, HID_ReportHandler_TypeDef handler);
+
 void USBD_HID_Init(void *pdev, uint8_t cfgidx);       //this one is still here
 void USBD_HID_DeInit(void *pdev, uint8_t cfgidx);     //this one is still here
 void USBD_HID_Setup(void *pdev, USB_SETUP_REQ *req);  //this one is still here
-void USBD_HID_EP0_TxSent(void *pdev) {};
-void USBD_HID_EP0_RxReady(void *pdev) {};
-void USBD_HID_DataIn(void *pdev, uint8_t epnum) {};
-void USBD_HID_DataOut(void *pdev, uint8_t epnum) {};
-void USBD_HID_OF(void *pdev) {};
-void USBD_HID_IsoINIncomplete(void *pdev) {};
-void USBD_HID_IsoOUTIncomplete(void *pdev) {};
-void USBD_HID_GetConfigDescriptor(uint8_t speed, uint16_t *length) {};
-void USBD_HID_GetOtherConfigDescriptor(uint8_t speed, uint16_t *length) {};
-void USBD_HID_GetUsrStrDescriptor(uint8_t speed, uint8_t index, uint16_t *length) {};
+void USBD_HID_EP0_TxSent(void *pdev);
+void USBD_HID_EP0_RxReady(void *pdev);
+void USBD_HID_DataIn(void *pdev, uint8_t epnum);
+void USBD_HID_DataOut(void *pdev, uint8_t epnum);
+void USBD_HID_OF(void *pdev);
+void USBD_HID_IsoINIncomplete(void *pdev);
+void USBD_HID_IsoOUTIncomplete(void *pdev);
+void USBD_HID_GetConfigDescriptor(uint8_t speed, uint16_t *length);
+void USBD_HID_GetOtherConfigDescriptor(uint8_t speed, uint16_t *length);
+void USBD_HID_GetUsrStrDescriptor(uint8_t speed, uint8_t index, uint16_t *length);
 
 /******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
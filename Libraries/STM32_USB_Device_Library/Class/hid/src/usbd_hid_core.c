@@ -43,8 +43,9 @@
 #include "usbd_hid_core.h"
 #include "usbd_req.h"
 
+#include <string.h>
+
 #define USB_HID_DESC_SIZ              9
-#define HID_MOUSE_REPORT_DESC_SIZE    74
 
 #define HID_DESCRIPTOR_TYPE           0x21
 #define HID_REPORT_DESC               0x22
@@ -58,64 +59,390 @@
 #define HID_REQ_SET_REPORT            0x09
 #define HID_REQ_GET_REPORT            0x01
 
-__ALIGN_BEGIN static uint8_t HID_MOUSE_ReportDesc[HID_MOUSE_REPORT_DESC_SIZE] __ALIGN_END =
-{
-  0x05, 0x01,        // Usage Page (Generic Desktop Ctrls)
-  0x09, 0x02,        // Usage (Mouse)
-  0xA1, 0x01,        // Collection (Application)
-  0x09, 0x01,        //   Usage (Pointer)
-  0xA1, 0x00,        //   Collection (Physical)
-  0x05, 0x09,        //     Usage Page (Button)
-  0x19, 0x01,        //     Usage Minimum (0x01)
-  0x29, 0x03,        //     Usage Maximum (0x03)
-  0x15, 0x00,        //     Logical Minimum (0)
-  0x25, 0x01,        //     Logical Maximum (1)
-  0x95, 0x03,        //     Report Count (3 bits)
-  0x75, 0x01,        //     Report Size (1)
-  0x81, 0x02,        //     Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
-  0x95, 0x01,        //     Report Count (1)
-  0x75, 0x05,        //     Report Size (5 bits) (padding)
-  0x81, 0x01,        //     Input (Const,Array,Abs,No Wrap,Linear,Preferred State,No Null Position)
-  0x05, 0x01,        //     Usage Page (Generic Desktop Ctrls)
-  0x09, 0x30,        //     Usage (X)
-  0x09, 0x31,        //     Usage (Y)
-  0x09, 0x38,        //     Usage (Wheel)
-  0x15, 0x81,        //     Logical Minimum (-127)
-  0x25, 0x7F,        //     Logical Maximum (127)
-  0x75, 0x08,        //     Report Size (8 bits)
-  0x95, 0x03,        //     Report Count (3)
-  0x81, 0x06,        //     Input (Data,Var,Rel,No Wrap,Linear,Preferred State,No Null Position)
-  0xC0,              //   End Collection
-  0x09, 0x3C,        //   Usage (Motion Wakeup)
-  0x05, 0xFF,        //   Usage Page (Reserved 0xFF)
-  0x09, 0x01,        //   Usage (0x01)
-  0x15, 0x00,        //   Logical Minimum (0)
-  0x25, 0x01,        //   Logical Maximum (1)
-  0x75, 0x01,        //   Report Size (1)
-  0x95, 0x02,        //   Report Count (2)
-  0xB1, 0x22,        //   Feature (Data,Var,Abs,No Wrap,Linear,No Preferred State,No Null Position,Non-volatile)
-  0x75, 0x06,        //   Report Size (6)
-  0x95, 0x01,        //   Report Count (1)
-  0xB1, 0x01,        //   Feature (Const,Array,Abs,No Wrap,Linear,Preferred State,No Null Position,Non-volatile)
-  0xC0,              // End Collection
-};
+/* Frame numbers wrap at 2048; in high speed, DSTS.SOFFN has the number
+   of the microframe in its low 3 bits, and the SOF interrupt comes with
+   every microframe */
+#define HID_FRAME_MASK                0x7FF
+
+/* Post loads the IN endpoint itself, out of the USB interrupt */
+#define HID_LOCK(state)               do { (state) = __get_PRIMASK(); __disable_irq(); } while (0)
+#define HID_UNLOCK(state)             __set_PRIMASK(state)
+
+/* One mailbox per report: the latest report posted by the application,
+   and the last one sent, which the IN transfer is done from. The SOF
+   handler skips a mailbox while it is being posted to, so that it never
+   sends half a report. */
+typedef struct _HID_Report
+{
+  __ALIGN_BEGIN uint8_t sent[HID_IN_PACKET] __ALIGN_END;
+  volatile uint8_t  pending[HID_IN_PACKET];
+  volatile uint16_t len;
+  uint16_t          sentlen;
+  volatile uint8_t  posting;
+  volatile uint8_t  dirty;      /* posted since the last send */
+  volatile uint16_t stamp;      /* frame of the last post */
+  uint8_t           valid;      /* sent at least once */
+  uint8_t           idle;       /* in 4 ms units, 0 for only on change */
+  uint16_t          elapsed;    /* ms since the last send */
+}
+HID_Report_TypeDef;
+
+/* What the application set up for each report, kept across resets */
+typedef struct _HID_Report_Cfg
+{
+  uint8_t                   priority;
+  uint8_t                   relative;   /* sent on every post */
+  HID_ReportHandler_TypeDef handler;
+}
+HID_ReportCfg_TypeDef;
+
+#define HID_CTL_SIZE                  ((HID_IN_PACKET > HID_OUT_PACKET) ? HID_IN_PACKET : HID_OUT_PACKET)
+
+static HID_Report_TypeDef    HID_Reports[HID_MAX_REPORTS];
+static HID_ReportCfg_TypeDef HID_ReportCfg[HID_MAX_REPORTS];
+static void                 *HID_Dev = NULL;    /* while configured */
+static volatile uint8_t      HID_InBusy = 0;
+static uint8_t               HID_Next = 0;
+
+/* Latency of the report being sent, if it carries a new sample */
+static uint8_t               HID_InProbe = 0;
+static uint16_t              HID_InStamp = 0;
+static volatile uint32_t     HID_Latency[HID_LATENCY_BINS];
+
+/* Reports received on the OUT endpoint, in a ring: the endpoint receives
+   into head while USBD_HID_Process dispatches from tail. */
+typedef struct _HID_Out
+{
+  __ALIGN_BEGIN uint8_t data[HID_OUT_PACKET] __ALIGN_END;
+  uint16_t              len;
+}
+HID_Out_TypeDef;
+
+static HID_Out_TypeDef       HID_Out[HID_OUT_BUFFERS];
+static uint8_t               HID_OutHead = 0;
+static uint8_t               HID_OutTail = 0;
+static volatile uint8_t      HID_OutCount = 0;   /* full buffers */
+static volatile uint8_t      HID_OutArmed = 0;
+
+/* GET_REPORT data stage */
+__ALIGN_BEGIN static uint8_t HID_CtlBuf[HID_CTL_SIZE] __ALIGN_END;
+
+/* SET_REPORT data stage, held until USBD_HID_Process dispatches it */
+__ALIGN_BEGIN static uint8_t HID_SetBuf[HID_CTL_SIZE] __ALIGN_END;
+static uint8_t               HID_SetType = 0;
+static uint8_t               HID_SetId = 0;
+static uint16_t              HID_SetLen = 0;
+static volatile uint8_t      HID_SetFull = 0;
 
 __ALIGN_BEGIN static uint32_t  USBD_HID_Protocol  __ALIGN_END = 0;
 __ALIGN_BEGIN static uint32_t  USBD_HID_IdleState __ALIGN_END = 0;
 __ALIGN_BEGIN static uint32_t  USBD_HID_AltSet  __ALIGN_END = 0;
 
-const uint8_t * get_USB_first_interface_descriptor(int configuration);
+const uint8_t * get_USB_hid_descriptor(int interface);
+const uint8_t * get_USB_report_descriptor(int interface);
+uint16_t get_USB_report_descriptor_size(int interface);
+
+/**
+  * @brief  HID_Index
+  *         Gives the index of a report in the tables.
+  * @param  id: report ID
+  * @retval index, HID_MAX_REPORTS if there is no such report
+  */
+static uint8_t HID_Index (uint8_t id)
+{
+#if (HID_MAX_REPORTS > 1)
+  if ((id == 0) || (id > HID_MAX_REPORTS))
+  {
+    return HID_MAX_REPORTS;
+  }
+  return id - 1;
+#else
+  return 0;
+#endif
+}
+
+/**
+  * @brief  HID_Report
+  *         Gives the mailbox of a report.
+  * @param  id: report ID
+  * @retval mailbox, NULL if there is no such report
+  */
+static HID_Report_TypeDef *HID_Report (uint8_t id)
+{
+  uint8_t idx = HID_Index(id);
+
+  return (idx < HID_MAX_REPORTS) ? &HID_Reports[idx] : NULL;
+}
+
+/**
+  * @brief  HID_Frame
+  *         Gives the number of the current frame, in 1 ms units at any
+  *         speed.
+  * @param  pdev: device instance
+  * @param  uframe: the microframe in it, 0 at full speed; may be NULL
+  * @retval frame number
+  */
+static uint16_t HID_Frame (void *pdev, uint8_t *uframe)
+{
+  USB_OTG_CORE_HANDLE *otg = (USB_OTG_CORE_HANDLE *)pdev;
+  USB_OTG_DSTS_TypeDef dsts;
+  uint16_t frame;
+
+  dsts.d32 = USB_OTG_READ_REG32(&otg->regs.DREGS->DSTS);
+  frame = dsts.b.soffn;
+  if (uframe != NULL)
+    *uframe = (otg->cfg.speed == USB_OTG_SPEED_HIGH) ? (frame & 7) : 0;
+  if (otg->cfg.speed == USB_OTG_SPEED_HIGH)
+    frame >>= 3;
+  return frame & HID_FRAME_MASK;
+}
+
+/**
+  * @brief  HID_Ready
+  *         Tells whether a report has to be sent: it changed, or was
+  *         posted at all for relative reports, or its idle period expired.
+  * @param  idx: report index
+  * @retval 1 if so, 0 else
+  */
+static uint8_t HID_Ready (uint16_t idx)
+{
+  HID_Report_TypeDef *rep = &HID_Reports[idx];
+
+  if (rep->posting)
+    return 0;
+
+  if (rep->dirty)
+  {
+    if (HID_ReportCfg[idx].relative || !rep->valid || (rep->sentlen != rep->len) ||
+        memcmp(rep->sent, (uint8_t *)rep->pending, rep->len))
+      return 1;
+    /* Posted back to what was sent last */
+    rep->dirty = 0;
+  }
+
+  return rep->valid && rep->idle && (rep->elapsed >= rep->idle * 4);
+}
+
+/**
+  * @brief  HID_Arm
+  *         Loads the IN endpoint with the most urgent report that changed or
+  *         whose idle period expired, if any. The endpoint must be free.
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void HID_Arm (void *pdev)
+{
+  HID_Report_TypeDef *rep;
+  uint16_t idx, n, best;
+
+  /* Round robin between equal priorities, so that none of them starves
+     the others */
+  best = HID_MAX_REPORTS;
+  for (n = 0; n < HID_MAX_REPORTS; n++)
+  {
+    idx = (HID_Next + n) % HID_MAX_REPORTS;
+    if (HID_Ready(idx) &&
+        ((best == HID_MAX_REPORTS) || (HID_ReportCfg[idx].priority < HID_ReportCfg[best].priority)))
+      best = idx;
+  }
+  if (best == HID_MAX_REPORTS)
+    return;
+
+  rep = &HID_Reports[best];
+  HID_InProbe = rep->dirty;
+  if (rep->dirty)
+  {
+    for (idx = 0; idx < rep->len; idx++)
+      rep->sent[idx] = rep->pending[idx];
+    rep->sentlen = rep->len;
+    HID_InStamp = rep->stamp;
+    rep->dirty = 0;
+  }
+  rep->valid = 1;
+  rep->elapsed = 0;
+  HID_InBusy = 1;
+  HID_Next = (best + 1) % HID_MAX_REPORTS;
+  DCD_EP_Tx(pdev, HID_IN_EP, rep->sent, rep->sentlen);
+}
+
+/**
+  * @brief  USBD_HID_GetLatency
+  *         Gives the latency histogram.
+  * @param  hist: HID_LATENCY_BINS counts
+  * @param  clear: restart from zero afterwards
+  * @retval None
+  */
+void USBD_HID_GetLatency(uint32_t *hist, uint8_t clear)
+{
+  uint8_t idx;
+
+  for (idx = 0; idx < HID_LATENCY_BINS; idx++)
+  {
+    hist[idx] = HID_Latency[idx];
+    if (clear)
+      HID_Latency[idx] = 0;
+  }
+}
+
+/**
+  * @brief  HID_Dispatch
+  *         Hands a report sent by the host to its handler.
+  * @param  type: HID_REPORT_OUTPUT or HID_REPORT_FEATURE
+  * @param  id: report ID
+  * @param  report: report
+  * @param  len: length of the report
+  * @retval None
+  */
+static void HID_Dispatch (uint8_t type, uint8_t id, uint8_t *report, uint16_t len)
+{
+  uint8_t idx = HID_Index(id);
+
+  if ((idx < HID_MAX_REPORTS) && (HID_ReportCfg[idx].handler != NULL))
+    HID_ReportCfg[idx].handler(type, report, len);
+}
+
+/**
+  * @brief  USBD_HID_SetPriority
+  *         Sets the priority of a report.
+  * @param  id: report ID
+  * @param  priority: 0 for the most urgent
+  * @retval USBD_OK, or USBD_FAIL if there is no such report
+  */
+uint8_t USBD_HID_SetPriority(uint8_t id, uint8_t priority)
+{
+  uint8_t idx = HID_Index(id);
+
+  if (idx >= HID_MAX_REPORTS)
+    return USBD_FAIL;
+  HID_ReportCfg[idx].priority = priority;
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_SetRelative
+  *         Marks a report as carrying relative data, such as the motion of
+  *         a mouse: each post is sent, even if it equals the previous one,
+  *         and none replaces a post not sent yet.
+  * @param  id: report ID
+  * @param  relative: 1 for relative, 0 to only send changes
+  * @retval USBD_OK, or USBD_FAIL if there is no such report
+  */
+uint8_t USBD_HID_SetRelative(uint8_t id, uint8_t relative)
+{
+  uint8_t idx = HID_Index(id);
+
+  if (idx >= HID_MAX_REPORTS)
+    return USBD_FAIL;
+  HID_ReportCfg[idx].relative = relative;
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_SetHandler
+  *         Sets the handler of the reports the host sends with an ID.
+  * @param  id: report ID
+  * @param  handler: handler, NULL to ignore them
+  * @retval USBD_OK, or USBD_FAIL if there is no such report
+  */
+uint8_t USBD_HID_SetHandler(uint8_t id, HID_ReportHandler_TypeDef handler)
+{
+  uint8_t idx = HID_Index(id);
+
+  if (idx >= HID_MAX_REPORTS)
+    return USBD_FAIL;
+  HID_ReportCfg[idx].handler = handler;
+  return USBD_OK;
+}
+
+/**
+  * @brief  HID_Reset
+  *         Forgets every report, and the idle periods.
+  * @param  None
+  * @retval None
+  */
+static void HID_Reset (void)
+{
+  memset(HID_Reports, 0, sizeof(HID_Reports));
+  HID_InBusy = 0;
+  HID_InProbe = 0;
+  HID_Next = 0;
+  HID_OutHead = 0;
+  HID_OutTail = 0;
+  HID_OutCount = 0;
+  HID_OutArmed = 0;
+  HID_SetLen = 0;
+  HID_SetFull = 0;
+}
+
+/**
+  * @brief  USBD_HID_Post
+  *         Posts a report, replacing the one not sent yet if any.
+  * @param  report: report, starting with its ID when there are several
+  * @param  len: length of the report
+  * @retval USBD_OK, USBD_FAIL if the report is invalid, or USBD_BUSY if
+  *         it is relative and the previous one was not sent yet
+  */
+uint8_t USBD_HID_Post(uint8_t *report, uint16_t len)
+{
+  HID_Report_TypeDef *rep;
+  uint16_t idx;
+  uint32_t state;
+
+  if ((len == 0) || (len > HID_IN_PACKET))
+    return USBD_FAIL;
+
+  idx = HID_Index(HID_MAX_REPORTS > 1 ? report[0] : 0);
+  if (idx >= HID_MAX_REPORTS)
+    return USBD_FAIL;
+  rep = &HID_Reports[idx];
+
+  if (HID_ReportCfg[idx].relative)
+  {
+    /* Replacing it would lose its motion */
+    if (rep->dirty)
+      return USBD_BUSY;
+  }
+  /* The SOF handler leaves sent alone while nothing is pending */
+  else if (!rep->dirty && rep->valid && (rep->sentlen == len) && !memcmp(rep->sent, report, len))
+    return USBD_OK;
+
+  rep->posting = 1;
+  for (idx = 0; idx < len; idx++)
+    rep->pending[idx] = report[idx];
+  rep->len = len;
+  if (HID_Dev != NULL)
+    rep->stamp = HID_Frame(HID_Dev, NULL);
+  rep->dirty = 1;
+  rep->posting = 0;
+
+  /* Don't wait for the next SOF if the endpoint is free */
+  HID_LOCK(state);
+  if ((HID_Dev != NULL) && !HID_InBusy)
+    HID_Arm(HID_Dev);
+  HID_UNLOCK(state);
+
+  return USBD_OK;
+}
 
 void USBD_HID_Init(void *pdev, uint8_t cfgidx)
 {
+  HID_Reset();
+  HID_Dev = pdev;
+
   /* Open EP IN */
   DCD_EP_Open(pdev, HID_IN_EP, HID_IN_PACKET, USB_OTG_EP_INT);
   /* Open EP OUT */
   DCD_EP_Open(pdev, HID_OUT_EP, HID_OUT_PACKET, USB_OTG_EP_INT);
+  /* Prepare Out endpoint to receive the first report */
+  HID_OutArmed = 1;
+  DCD_EP_PrepareRx(pdev, HID_OUT_EP, HID_Out[HID_OutHead].data, HID_OUT_PACKET);
 }
 
 void USBD_HID_DeInit(void *pdev, uint8_t cfgidx)
 {
+  HID_Dev = NULL;
+  HID_Reset();
+
   /* Close HID EPs */
   DCD_EP_Close (pdev , HID_IN_EP);
   DCD_EP_Close (pdev , HID_OUT_EP);
@@ -125,6 +452,8 @@ void USBD_HID_Setup (void  *pdev, USB_SETUP_REQ *req)
 {
   uint16_t len = 0;
   uint8_t  *pbuf = NULL;
+  HID_Report_TypeDef *rep;
+  uint8_t  idx;
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
@@ -140,13 +469,71 @@ void USBD_HID_Setup (void  *pdev, USB_SETUP_REQ *req)
           break;
 
         case HID_REQ_SET_IDLE:
-          USBD_HID_IdleState = (uint8_t)(req->wValue >> 8);
+          /* Report ID 0 stands for all of them */
+          if ((uint8_t)(req->wValue) == 0)
+          {
+            for (idx = 0; idx < HID_MAX_REPORTS; idx++)
+              HID_Reports[idx].idle = (uint8_t)(req->wValue >> 8);
+          }
+          else if ((rep = HID_Report((uint8_t)(req->wValue))) != NULL)
+          {
+            rep->idle = (uint8_t)(req->wValue >> 8);
+          }
+          else
+          {
+            USBD_CtlError (pdev, req);
+            return;
+          }
           break;
 
         case HID_REQ_GET_IDLE:
+          rep = HID_Report((uint8_t)(req->wValue) ? (uint8_t)(req->wValue) : 1);
+          if (rep == NULL)
+          {
+            USBD_CtlError (pdev, req);
+            return;
+          }
+          USBD_HID_IdleState = rep->idle;
           USBD_CtlSendData (pdev, (uint8_t *)&USBD_HID_IdleState, 1);
           break;
 
+        case HID_REQ_GET_REPORT:
+          /* Input reports come from the mailboxes: the latest one posted,
+             unless it is being written to */
+          rep = HID_Report((uint8_t)(req->wValue));
+          if ((rep == NULL) || ((req->wValue >> 8) != HID_REPORT_INPUT) ||
+              !(rep->valid || (rep->dirty && !rep->posting)))
+          {
+            USBD_CtlError (pdev, req);
+            return;
+          }
+          if (rep->dirty && !rep->posting)
+          {
+            len = rep->len;
+            for (idx = 0; idx < len; idx++)
+              HID_CtlBuf[idx] = rep->pending[idx];
+          }
+          else
+          {
+            len = rep->sentlen;
+            memcpy(HID_CtlBuf, rep->sent, len);
+          }
+          USBD_CtlSendData (pdev, HID_CtlBuf, MIN(len, req->wLength));
+          break;
+
+        case HID_REQ_SET_REPORT:
+          /* Stalled while the previous one is not dispatched yet */
+          if ((req->wLength == 0) || (req->wLength > HID_CTL_SIZE) || HID_SetFull)
+          {
+            USBD_CtlError (pdev, req);
+            return;
+          }
+          HID_SetType = (uint8_t)(req->wValue >> 8);
+          HID_SetId = (uint8_t)(req->wValue);
+          HID_SetLen = req->wLength;
+          USBD_CtlPrepareRx (pdev, HID_SetBuf, req->wLength);
+          break;
+
         default:
           USBD_CtlError (pdev, req);
           return;
@@ -159,15 +546,22 @@ void USBD_HID_Setup (void  *pdev, USB_SETUP_REQ *req)
         case USB_REQ_GET_DESCRIPTOR:
           if (req->wValue >> 8 == HID_REPORT_DESC)
           {
-            len = MIN(HID_MOUSE_REPORT_DESC_SIZE , req->wLength);
-            pbuf = HID_MOUSE_ReportDesc;
+            len = MIN(get_USB_report_descriptor_size(req->wIndex) , req->wLength);
+            pbuf = (uint8_t  *)get_USB_report_descriptor(req->wIndex);
           }
           else if (req->wValue >> 8 == HID_DESCRIPTOR_TYPE)
           {
-            pbuf = (uint8_t  *)get_USB_first_interface_descriptor(0);//USBD_HID_CfgDesc + 0x12;
-            len = MIN(USB_HID_DESC_SIZ , req->wLength);
+            /* The HID class descriptor alone, as found in the configuration */
+            pbuf = (uint8_t  *)get_USB_hid_descriptor(req->wIndex);
+            if (pbuf != NULL)
+              len = MIN(pbuf[0] , req->wLength);
           }
 
+          if (pbuf == NULL)
+          {
+            USBD_CtlError (pdev, req);
+            return;
+          }
           USBD_CtlSendData (pdev, pbuf, len);
 
           break;
@@ -183,4 +577,145 @@ void USBD_HID_Setup (void  *pdev, USB_SETUP_REQ *req)
   }
 }
 
+void USBD_HID_EP0_TxSent(void *pdev) {}
+void USBD_HID_IsoINIncomplete(void *pdev) {}
+void USBD_HID_IsoOUTIncomplete(void *pdev) {}
+void USBD_HID_GetConfigDescriptor(uint8_t speed, uint16_t *length) {}
+void USBD_HID_GetOtherConfigDescriptor(uint8_t speed, uint16_t *length) {}
+void USBD_HID_GetUsrStrDescriptor(uint8_t speed, uint8_t index, uint16_t *length) {}
+
+/**
+  * @brief  USBD_HID_EP0_RxReady
+  *         Completes the data stage of SET_REPORT.
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_HID_EP0_RxReady(void *pdev)
+{
+  if (HID_SetLen)
+    HID_SetFull = 1;
+}
+
+/**
+  * @brief  USBD_HID_DataOut
+  *         Queues a report received on the OUT endpoint, and receives the
+  *         next one in the following buffer if there is a free one.
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval None
+  */
+void USBD_HID_DataOut(void *pdev, uint8_t epnum)
+{
+  uint16_t len;
+
+  if (epnum != (HID_OUT_EP & 0x7F))
+    return;
+
+  len = USBD_GetRxCount(pdev, epnum);
+  if (len)
+  {
+    HID_Out[HID_OutHead].len = len;
+    HID_OutHead = (HID_OutHead + 1) % HID_OUT_BUFFERS;
+    HID_OutCount++;
+  }
+
+  /* Else the endpoint NAKs until USBD_HID_Process frees a buffer */
+  HID_OutArmed = (HID_OutCount < HID_OUT_BUFFERS);
+  if (HID_OutArmed)
+    DCD_EP_PrepareRx(pdev, HID_OUT_EP, HID_Out[HID_OutHead].data, HID_OUT_PACKET);
+}
+
+/**
+  * @brief  USBD_HID_Process
+  *         Dispatches the reports received from the host.
+  * @param  None
+  * @retval None
+  */
+void USBD_HID_Process(void)
+{
+  HID_Out_TypeDef *out;
+  uint32_t state;
+
+  while (HID_OutCount)
+  {
+    out = &HID_Out[HID_OutTail];
+    HID_Dispatch(HID_REPORT_OUTPUT, HID_MAX_REPORTS > 1 ? out->data[0] : 0, out->data, out->len);
+
+    /* Unless a reset emptied the ring meanwhile */
+    HID_LOCK(state);
+    if (HID_OutCount)
+    {
+      HID_OutTail = (HID_OutTail + 1) % HID_OUT_BUFFERS;
+      HID_OutCount--;
+    }
+    if ((HID_Dev != NULL) && !HID_OutArmed)
+    {
+      HID_OutArmed = 1;
+      DCD_EP_PrepareRx(HID_Dev, HID_OUT_EP, HID_Out[HID_OutHead].data, HID_OUT_PACKET);
+    }
+    HID_UNLOCK(state);
+  }
+
+  if (HID_SetFull)
+  {
+    HID_Dispatch(HID_SetType, HID_SetId, HID_SetBuf, HID_SetLen);
+    HID_SetLen = 0;
+    HID_SetFull = 0;
+  }
+}
+
+/**
+  * @brief  USBD_HID_DataIn
+  *         The host polled the report: accounts for its latency, and loads
+  *         the next one, if any, before the next poll.
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval None
+  */
+void USBD_HID_DataIn(void *pdev, uint8_t epnum)
+{
+  uint16_t latency;
+
+  if ((epnum | 0x80) != HID_IN_EP)
+    return;
+
+  if (HID_InProbe)
+  {
+    latency = (HID_Frame(pdev, NULL) - HID_InStamp) & HID_FRAME_MASK;
+    HID_Latency[latency < HID_LATENCY_BINS ? latency : HID_LATENCY_BINS - 1]++;
+    HID_InProbe = 0;
+  }
+
+  HID_InBusy = 0;
+  HID_Arm(pdev);
+}
+
+/**
+  * @brief  USBD_HID_OF
+  *         Counts the idle periods, and sends what neither a post nor the
+  *         end of the previous transfer could: reports whose idle period
+  *         expired, and the ones posted while the endpoint was busy.
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_HID_OF(void *pdev)
+{
+  uint16_t n;
+  uint8_t uframe;
+
+  /* The idle periods are in ms, whatever the speed */
+  HID_Frame(pdev, &uframe);
+  if (uframe == 0)
+  {
+    for (n = 0; n < HID_MAX_REPORTS; n++)
+    {
+      if (HID_Reports[n].elapsed < 0xFFFF)
+        HID_Reports[n].elapsed++;
+    }
+  }
+
+  if (!HID_InBusy)
+    HID_Arm(pdev);
+}
+
 /******************* (C) COPYRIGHT 2011 STMicroelectronics *****END OF FILE****/
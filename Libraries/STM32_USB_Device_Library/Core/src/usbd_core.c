@@ -25,8 +25,13 @@
 #include "usb_dcd_int.h"
 #include "usb_bsp.h"
 
-/*void USBD_SOF(USB_OTG_CORE_HANDLE *pdev) { return 0; }
-void USBD_Reset(USB_OTG_CORE_HANDLE *pdev) { return 0; }
+void USBD_SOF(USB_OTG_CORE_HANDLE *pdev)
+{
+  if (pdev->dev.device_status == USB_OTG_CONFIGURED)
+    USBD_Class_OF(pdev);
+}
+
+/*void USBD_Reset(USB_OTG_CORE_HANDLE *pdev) { return 0; }
 void USBD_Suspend(USB_OTG_CORE_HANDLE *pdev) { return 0; }
 void USBD_Resume(USB_OTG_CORE_HANDLE *pdev) { return 0; }
 void USBD_IsoINIncomplete(USB_OTG_CORE_HANDLE *pdev) { return 0; }*/
@@ -130,7 +135,7 @@ void USBD_DataInStage(USB_OTG_CORE_HANDLE *pdev, uint8_t epnum)
     }
   }
   else if (pdev->dev.device_status == USB_OTG_CONFIGURED)
-    DCD_EP_Flush(pdev, HID_IN_EP);
+    USBD_Class_DataIn(pdev, epnum);
 }
 
 
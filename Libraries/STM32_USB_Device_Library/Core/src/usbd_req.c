@@ -33,6 +33,7 @@ __ALIGN_BEGIN uint8_t USBD_StrDesc[USB_MAX_STR_DESC_SIZ] __ALIGN_END ;
 
 
 static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
+static void USBD_VendorDevReq(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
 static void USBD_SetAddress(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
 static void USBD_SetConfig(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
 static void USBD_GetConfig(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req);
@@ -58,6 +59,14 @@ USBD_Status USBD_StdDevReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 {
   USBD_Status ret = USBD_OK;
 
+  //vendor requests to the device, such as the Microsoft OS 2.0 descriptors
+  //one; their bRequest is ours to pick, and may well collide with these
+  if ((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_VENDOR)
+  {
+    USBD_VendorDevReq(pdev, req);
+    return ret;
+  }
+
   switch (req->bRequest)
   {
     case USB_REQ_GET_DESCRIPTOR: //0x06
@@ -151,6 +160,25 @@ USBD_Status  USBD_StdEPReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
 
   ep_addr  = LOBYTE(req->wIndex);
 
+  //class requests addressed to an endpoint, such as the audio sampling frequency
+  if ((req->bmRequest & USB_REQ_TYPE_MASK) == USB_REQ_TYPE_CLASS)
+  {
+    if (pdev->dev.device_status == USB_OTG_CONFIGURED)
+    {
+      USBD_Class_Setup(pdev, req);
+
+      if (req->wLength == 0)
+      {
+        USBD_CtlSendStatus(pdev);
+      }
+    }
+    else
+    {
+      USBD_CtlError(pdev , req);
+    }
+    return ret;
+  }
+
   switch (req->bRequest)
   {
     case USB_REQ_SET_FEATURE :
@@ -260,10 +288,36 @@ USBD_Status  USBD_StdEPReq (USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ  *req)
   return ret;
 }
 
-const uint8_t * get_USB_interface_descriptor(int configuration, int interface);
-const uint8_t * get_USB_configuration_descriptor(int index);
-const uint8_t * get_USB_device_descriptor();
-const uint8_t * get_USB_string_descriptor(int index);
+const uint8_t * get_USB_descriptor(uint8_t type, uint8_t index, uint16_t *length);
+const uint8_t * get_USB_vendor_descriptor(uint8_t request, uint16_t index, uint16_t *length);
+
+/**
+* @brief  USBD_VendorDevReq
+*         Answer the vendor requests reading a descriptor, stall the others
+* @param  pdev: device instance
+* @param  req: usb request
+* @retval None
+*/
+static void USBD_VendorDevReq(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req)
+{
+  uint16_t len = 0;
+  const uint8_t *pbuf = NULL;
+
+  if (req->bmRequest & 0x80)
+  {
+    pbuf = get_USB_vendor_descriptor(req->bRequest, req->wIndex, &len);
+  }
+  if (pbuf == NULL)
+  {
+    USBD_CtlError(pdev , req);
+    return;
+  }
+  if((len != 0)&& (req->wLength != 0))
+  {
+    len = MIN(len , req->wLength);
+    USBD_CtlSendData (pdev, (uint8_t *)pbuf, len);
+  }
+}
 
 /**
 * @brief  USBD_GetDescriptor
@@ -280,19 +334,18 @@ static void USBD_GetDescriptor(USB_OTG_CORE_HANDLE  *pdev, USB_SETUP_REQ *req)
   switch (req->wValue >> 8)
   {
     case USB_DESC_TYPE_DEVICE: //0x01
-      pbuf = (uint8_t *)get_USB_device_descriptor();
-      len = pbuf[0];
-      break;
-
     case USB_DESC_TYPE_CONFIGURATION: //0x02
-      pbuf = (uint8_t *)get_USB_configuration_descriptor(1);
-      len = (((uint16_t) pbuf[3]) << 8) + pbuf[2]; //totallength
-      pdev->dev.pConfig_descriptor = pbuf;
-      break;
-
     case USB_DESC_TYPE_STRING: //0x03
-        pbuf = (uint8_t *)get_USB_string_descriptor((uint8_t)(req->wValue));
-        len = pbuf[0];
+    case USB_DESC_TYPE_BOS: //0x0f
+      //straight from the tables built along with the descriptors
+      pbuf = (uint8_t *)get_USB_descriptor(req->wValue >> 8, (uint8_t)(req->wValue), &len);
+      if (pbuf == NULL)
+      {
+        USBD_CtlError(pdev , req);
+        return;
+      }
+      if ((req->wValue >> 8) == USB_DESC_TYPE_CONFIGURATION)
+        pdev->dev.pConfig_descriptor = pbuf;
       break;
     case USB_DESC_TYPE_DEVICE_QUALIFIER: //0x06 //TODO
       //we use FS currently
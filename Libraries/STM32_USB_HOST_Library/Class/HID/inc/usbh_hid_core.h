@@ -62,6 +62,7 @@ typedef enum
   HID_GET_DATA,   
   HID_POLL,
   HID_ERROR,
+  HID_CLEAR_STALL,
 }
 HID_State;
 
@@ -109,8 +109,6 @@ __ALIGN_BEGIN USB_Setup_TypeDef          HID_Setup __ALIGN_END ;
   #endif
 #endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
 __ALIGN_BEGIN USBH_HIDDesc_TypeDef       HID_Desc __ALIGN_END ; 
-
-__IO uint8_t flag = 0;
 /**
 * @}
 */ 
@@ -248,7 +246,6 @@ static USBH_Status USBH_HID_InterfaceInit ( USB_OTG_CORE_HANDLE *pdev,
       
     }   
     
-     flag =0;
      status = USBH_OK; 
   }
   else
@@ -287,8 +284,6 @@ void USBH_HID_InterfaceDeInit ( USB_OTG_CORE_HANDLE *pdev,
     USBH_Free_Channel  (pdev, HID_Machine.hc_num_out);
     HID_Machine.hc_num_out = 0;     /* Reset the Channel as Free */  
   }
- 
-  flag = 0;
 }
 
 /**
@@ -386,52 +381,64 @@ static USBH_Status USBH_HID_Handle(USB_OTG_CORE_HANDLE *pdev ,
     
   case HID_IDLE:
     HID_Machine.cb->Init();
+    HID_Machine.timer = HCD_GetCurrentFrame(pdev);
     HID_Machine.state = HID_GET_DATA;
     break;  
     
   case HID_GET_DATA:
     
-    /* Sync with start of Even Frame */
-    while(USB_OTG_IsEvenFrame(pdev) == FALSE);
+    /* Late, after a stall or a slow decode: poll again right away */
+    if(((HCD_GetCurrentFrame(pdev) - HID_Machine.timer) & HCD_FRAME_MASK) <= 
+       (HCD_FRAME_MASK >> 1))
+    {
+      HID_Machine.timer = HCD_GetCurrentFrame(pdev);
+    }
     
-    USBH_InterruptReceiveData(pdev, 
-                              HID_Machine.buff,
-                              HID_Machine.length,
-                              HID_Machine.hc_num_in);
-    flag = 1;
+    /* The SOF interrupt sends the IN token when the frame comes */
+    USBH_InterruptReceiveDataAt(pdev, 
+                                HID_Machine.buff,
+                                HID_Machine.length,
+                                HID_Machine.hc_num_in,
+                                HID_Machine.timer);
     
     HID_Machine.state = HID_POLL;
-    HID_Machine.timer = HCD_GetCurrentFrame(pdev);
     break;
     
   case HID_POLL:
-    if(( HCD_GetCurrentFrame(pdev) - HID_Machine.timer) >= HID_Machine.poll)
+    switch (HCD_GetURB_Event(pdev , HID_Machine.hc_num_in))
     {
+    case URB_DONE:
+      HID_Machine.cb->Decode(HID_Machine.buff);
+      HID_Machine.timer += HID_Machine.poll;
       HID_Machine.state = HID_GET_DATA;
+      break;
+      
+    case URB_NOTREADY:
+    case URB_ERROR:
+      /* Nothing this time, try again on the next poll */
+      HID_Machine.timer += HID_Machine.poll;
+      HID_Machine.state = HID_GET_DATA;
+      break;
+      
+    case URB_STALL: /* IN Endpoint Stalled */
+      HID_Machine.state = HID_CLEAR_STALL;
+      break;
+      
+    default:
+      break;
     }
-    else if(HCD_GetURB_State(pdev , HID_Machine.hc_num_in) == URB_DONE)
+    break;
+    
+  case HID_CLEAR_STALL:
+    /* Issue Clear Feature on interrupt IN endpoint */ 
+    if( (USBH_ClrFeature(pdev, 
+                         pphost,
+                         HID_Machine.ep_addr,
+                         HID_Machine.hc_num_in)) == USBH_OK)
     {
-      if(flag == 1) /* handle data once */
-      {
-        flag = 0;
-        HID_Machine.cb->Decode(HID_Machine.buff);
-      }
+      /* Change state to issue next IN token */
+      HID_Machine.state = HID_GET_DATA;
     }
-    else if(HCD_GetURB_State(pdev, HID_Machine.hc_num_in) == URB_STALL) /* IN Endpoint Stalled */
-    {
-      
-      /* Issue Clear Feature on interrupt IN endpoint */ 
-      if( (USBH_ClrFeature(pdev, 
-                           pphost,
-                           HID_Machine.ep_addr,
-                           HID_Machine.hc_num_in)) == USBH_OK)
-      {
-        /* Change state to issue next IN token */
-        HID_Machine.state = HID_GET_DATA;
-        
-      }
-      
-    }      
     break;
     
   default:
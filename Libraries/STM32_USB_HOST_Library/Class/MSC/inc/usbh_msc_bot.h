@@ -150,6 +150,11 @@ typedef union _USBH_CSW_Block
 //#define USBH_MSC_PAGE_LENGTH                 0x40
 #define USBH_MSC_PAGE_LENGTH              512
 
+/* Largest bulk transfer of the data stage, programmed at once into the
+   channel: at most 256 packets, and 64KB - 1 for USBH_BulkSendData */
+#ifndef USBH_MSC_XFER_SIZE
+#define USBH_MSC_XFER_SIZE                (USBH_MSC_MPS_SIZE * 64)
+#endif
 
 #define CBW_CB_LENGTH                     16
 #define CBW_LENGTH                        10
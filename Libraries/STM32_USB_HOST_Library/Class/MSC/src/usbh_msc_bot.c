@@ -97,6 +97,7 @@ static uint32_t BOTStallErrorCount;   /* Keeps count of STALL Error Cases*/
 /** @defgroup USBH_MSC_BOT_Private_FunctionPrototypes
 * @{
 */ 
+static void USBH_MSC_BOT_ReceiveCSW(USB_OTG_CORE_HANDLE *pdev);
 /**
 * @}
 */ 
@@ -139,16 +140,19 @@ void USBH_MSC_Init(USB_OTG_CORE_HANDLE *pdev )
 /**
 * @brief  USBH_MSC_HandleBOTXfer 
 *         This function manages the different states of BOT transfer and 
-*         updates the status to upper layer.
+*         updates the status to upper layer. Each completion of the bulk
+*         channels is handled once, read with HCD_GetURB_Event.
 * @param  None
 * @retval None
 * 
 */
 void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
 {
-  uint8_t xferDirection, index;
+  uint8_t xferDirection;
   static uint32_t remainingDataLength;
   static uint8_t *datapointer;
+  static uint16_t xferLength;
+  uint32_t acked;
   static uint8_t error_direction;
   USBH_Status status;
   
@@ -172,7 +176,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       break;
       
     case USBH_MSC_SENT_CBW:
-      URB_Status = HCD_GetURB_State(pdev , MSC_Machine.hc_num_out);
+      URB_Status = HCD_GetURB_Event(pdev , MSC_Machine.hc_num_out);
       
       if(URB_Status == URB_DONE)
       { 
@@ -202,7 +206,7 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
         
         else
         {/* If there is NO Data Transfer Stage */
-          USBH_MSC_BOTXferParam.BOTState = USBH_MSC_RECEIVE_CSW_STATE;
+          USBH_MSC_BOT_ReceiveCSW(pdev);
         }
         
       }   
@@ -219,36 +223,39 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       
     case USBH_MSC_BOT_DATAIN_STATE:
       
-      URB_Status =   HCD_GetURB_State(pdev , MSC_Machine.hc_num_in);
+      URB_Status =   HCD_GetURB_Event(pdev , MSC_Machine.hc_num_in);
       /* BOT DATA IN stage */
       if((URB_Status == URB_DONE) ||(USBH_MSC_BOTXferParam.BOTStateBkp != USBH_MSC_BOT_DATAIN_STATE))
       {
         BOTStallErrorCount = 0;
-        USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_BOT_DATAIN_STATE;    
         
-        if(remainingDataLength > USBH_MSC_MPS_SIZE)
+        /* A short transfer ends the data stage: the device has no more */
+        if((USBH_MSC_BOTXferParam.BOTStateBkp == USBH_MSC_BOT_DATAIN_STATE) &&
+           (HCD_GetXferCnt(pdev, MSC_Machine.hc_num_in) < xferLength))
         {
-          USBH_BulkReceiveData (pdev,
-	                        datapointer, 
-			        USBH_MSC_MPS_SIZE , 
-			        MSC_Machine.hc_num_in);
-          
-          remainingDataLength -= USBH_MSC_MPS_SIZE;
-          datapointer = datapointer + USBH_MSC_MPS_SIZE;
+          remainingDataLength = 0;
         }
-        else if ( remainingDataLength == 0)
+        USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_BOT_DATAIN_STATE;    
+        
+        if ( remainingDataLength == 0)
         {
-          /* If value was 0, and successful transfer, then change the state */
-          USBH_MSC_BOTXferParam.BOTState = USBH_MSC_RECEIVE_CSW_STATE;
+          /* If value was 0, and successful transfer, then ask for the CSW
+             right away */
+          USBH_MSC_BOT_ReceiveCSW(pdev);
         }
         else
-        {       
+        {
+          /* As many packets as one transfer takes, the channel reloads
+             itself from one to the next */
+          xferLength = (remainingDataLength > USBH_MSC_XFER_SIZE) ?
+            USBH_MSC_XFER_SIZE : remainingDataLength;
           USBH_BulkReceiveData (pdev,
 	                        datapointer, 
-			        remainingDataLength , 
+			        xferLength , 
 			        MSC_Machine.hc_num_in);
           
-          remainingDataLength = 0; /* Reset this value and keep in same state */
+          remainingDataLength -= xferLength;
+          datapointer = datapointer + xferLength;
         }
       }
       else if(URB_Status == URB_STALL)
@@ -276,41 +283,44 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       
     case USBH_MSC_BOT_DATAOUT_STATE:
       /* BOT DATA OUT stage */
-      URB_Status = HCD_GetURB_State(pdev , MSC_Machine.hc_num_out);       
-      if(URB_Status == URB_DONE)
+      URB_Status = HCD_GetURB_Event(pdev , MSC_Machine.hc_num_out);       
+      /* The first transfer is sent on entering the stage: the completion
+         of the CBW was handled already */
+      if((URB_Status == URB_DONE) ||(USBH_MSC_BOTXferParam.BOTStateBkp != USBH_MSC_BOT_DATAOUT_STATE))
       {
         BOTStallErrorCount = 0;
         USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_BOT_DATAOUT_STATE;    
-        if(remainingDataLength > USBH_MSC_MPS_SIZE)
+        if ( remainingDataLength == 0)
         {
-          USBH_BulkSendData (pdev,
-                             datapointer, 
-                             USBH_MSC_MPS_SIZE , 
-                             MSC_Machine.hc_num_out);
-          datapointer = datapointer + USBH_MSC_MPS_SIZE;
-          remainingDataLength = remainingDataLength - USBH_MSC_MPS_SIZE;
-        }
-        else if ( remainingDataLength == 0)
-        {
-          /* If value was 0, and successful transfer, then change the state */
-          USBH_MSC_BOTXferParam.BOTState = USBH_MSC_RECEIVE_CSW_STATE;
+          /* If value was 0, and successful transfer, then ask for the CSW
+             right away */
+          USBH_MSC_BOT_ReceiveCSW(pdev);
         }
         else
         {
+          xferLength = (remainingDataLength > USBH_MSC_XFER_SIZE) ?
+            USBH_MSC_XFER_SIZE : remainingDataLength;
           USBH_BulkSendData (pdev,
-	                     datapointer, 
-			     remainingDataLength , 
-			     MSC_Machine.hc_num_out);
-          
-          remainingDataLength = 0; /* Reset this value and keep in same state */   
+                             datapointer, 
+                             xferLength , 
+                             MSC_Machine.hc_num_out);
+          datapointer = datapointer + xferLength;
+          remainingDataLength = remainingDataLength - xferLength;
         }      
       }
       
       else if(URB_Status == URB_NOTREADY)
       {
+        /* Send again what the device did not acknowledge of the transfer */
+        acked = HCD_GetXferCnt(pdev, MSC_Machine.hc_num_out);
+        if (acked > xferLength)
+        {
+          acked = xferLength;
+        }
+        xferLength -= acked;
         USBH_BulkSendData (pdev,
-	                   (datapointer - USBH_MSC_MPS_SIZE), 
-			   USBH_MSC_MPS_SIZE , 
+	                   (datapointer - xferLength), 
+			   xferLength , 
 			   MSC_Machine.hc_num_out);
       }
       
@@ -339,31 +349,13 @@ void USBH_MSC_HandleBOTXfer (USB_OTG_CORE_HANDLE *pdev ,USBH_HOST *phost)
       
     case USBH_MSC_RECEIVE_CSW_STATE:
       /* BOT CSW stage */     
-        /* NOTE: We cannot reset the BOTStallErrorCount here as it may come from 
-        the clearFeature from previous command */
-        
-        USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_RECEIVE_CSW_STATE;
-        
-        USBH_MSC_BOTXferParam.pRxTxBuff = USBH_MSC_CSWData.CSWArray;
-        USBH_MSC_BOTXferParam.DataLength = USBH_MSC_CSW_MAX_LENGTH;
-        
-        for(index = USBH_MSC_CSW_LENGTH; index != 0; index--)
-        {
-          USBH_MSC_CSWData.CSWArray[index] = 0;
-        }
-        
-        USBH_MSC_CSWData.CSWArray[0] = 0;
-        
-        USBH_BulkReceiveData (pdev,
-                              USBH_MSC_BOTXferParam.pRxTxBuff, 
-                              USBH_MSC_CSW_MAX_LENGTH , 
-                              MSC_Machine.hc_num_in);
-        USBH_MSC_BOTXferParam.BOTState = USBH_MSC_DECODE_CSW;    
-
+      /* NOTE: We cannot reset the BOTStallErrorCount here as it may come from 
+      the clearFeature from previous command */
+      USBH_MSC_BOT_ReceiveCSW(pdev);
       break;
       
     case USBH_MSC_DECODE_CSW:
-      URB_Status = HCD_GetURB_State(pdev , MSC_Machine.hc_num_in);
+      URB_Status = HCD_GetURB_Event(pdev , MSC_Machine.hc_num_in);
       /* Decode CSW */
       if(URB_Status == URB_DONE)
       {
@@ -469,6 +461,36 @@ USBH_Status USBH_MSC_BOT_Abort(USB_OTG_CORE_HANDLE *pdev,
   return status;
 }
 
+/**
+* @brief  USBH_MSC_BOT_ReceiveCSW 
+*         Asks for the CSW, as soon as the previous stage is over, and
+*         moves to its decoding.
+* @param  pdev: Selected device
+* @retval None
+*/
+static void USBH_MSC_BOT_ReceiveCSW(USB_OTG_CORE_HANDLE *pdev)
+{
+  uint8_t index;
+  
+  USBH_MSC_BOTXferParam.BOTStateBkp = USBH_MSC_RECEIVE_CSW_STATE;
+  
+  USBH_MSC_BOTXferParam.pRxTxBuff = USBH_MSC_CSWData.CSWArray;
+  USBH_MSC_BOTXferParam.DataLength = USBH_MSC_CSW_MAX_LENGTH;
+  
+  for(index = USBH_MSC_CSW_LENGTH; index != 0; index--)
+  {
+    USBH_MSC_CSWData.CSWArray[index] = 0;
+  }
+  
+  USBH_MSC_CSWData.CSWArray[0] = 0;
+  
+  USBH_BulkReceiveData (pdev,
+                        USBH_MSC_BOTXferParam.pRxTxBuff, 
+                        USBH_MSC_CSW_MAX_LENGTH , 
+                        MSC_Machine.hc_num_in);
+  USBH_MSC_BOTXferParam.BOTState = USBH_MSC_DECODE_CSW;    
+}
+
 /**
 * @brief  USBH_MSC_DecodeCSW
 *         This function decodes the CSW received by the device and updates the
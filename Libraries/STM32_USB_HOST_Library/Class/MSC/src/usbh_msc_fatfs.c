@@ -2,6 +2,24 @@
 #include "usb_conf.h"
 #include "diskio.h"
 #include "usbh_msc_core.h"
+#include "usbh_msc_bot.h"
+#include "usbh_msc_scsi.h"
+#include <string.h>
+
+/* Sectors read ahead when FatFs reads sequentially a few sectors at a time;
+   the next read command is sent as soon as the previous one is served */
+#ifndef USBH_MSC_READAHEAD
+#define USBH_MSC_READAHEAD    8
+#endif
+
+/* What msc_xfer does while the transfer in flight has nothing for it to
+   handle, eg. block until the Wakeup user callback signals a completion;
+   by default it polls */
+#ifndef USBH_MSC_WAIT
+#define USBH_MSC_WAIT()
+#endif
+
+#define SECTOR_SIZE           512
 /*--------------------------------------------------------------------------
 
 Module Private Functions and Variables
@@ -13,6 +31,98 @@ static volatile DSTATUS Stat = STA_NOINIT;	/* Disk status */
 extern USB_OTG_CORE_HANDLE          USB_OTG_Core;
 extern USBH_HOST                     USB_Host;
 
+#define RA_EMPTY    0
+#define RA_PENDING  1	/* READ(10) sent, not completed yet */
+#define RA_VALID    2
+
+#ifdef USB_OTG_HS_INTERNAL_DMA_ENABLED
+  #if defined ( __ICCARM__ ) /*!< IAR Compiler */
+    #pragma data_alignment=4   
+  #endif
+#endif /* USB_OTG_HS_INTERNAL_DMA_ENABLED */
+__ALIGN_BEGIN static BYTE RaBuff[USBH_MSC_READAHEAD * SECTOR_SIZE] __ALIGN_END;
+
+static BYTE  RaState = RA_EMPTY;
+static DWORD RaSector;		/* First sector in RaBuff */
+static DWORD RaCount;		/* Sectors in RaBuff */
+static DWORD NextSector;	/* Sector after the last one read */
+
+
+/* Runs a READ(10) or WRITE(10) to completion; a command already sent is
+   completed, whatever the arguments */
+static BYTE msc_xfer (BYTE *buff, DWORD sector, DWORD count, BYTE write)
+{
+  BYTE status;
+
+  do
+  {
+    if (write)
+    {
+      status = USBH_MSC_Write10(&USB_OTG_Core, buff, sector, SECTOR_SIZE*count);
+    }
+    else
+    {
+      status = USBH_MSC_Read10(&USB_OTG_Core, buff, sector, SECTOR_SIZE*count);
+    }
+    USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
+
+    if(!HCD_IsDeviceConnected(&USB_OTG_Core))
+    {
+      return USBH_MSC_FAIL;
+    }
+    if((status == USBH_MSC_BUSY) && HCD_IsWaiting(&USB_OTG_Core))
+    {
+      USBH_MSC_WAIT();
+    }
+  }
+  while(status == USBH_MSC_BUSY );
+
+  return status;
+}
+
+/* Completes the read ahead in flight, before anything else uses the
+   transport */
+static void ra_complete (void)
+{
+  if (RaState == RA_PENDING)
+  {
+    if (msc_xfer(RaBuff, RaSector, RaCount, 0) == USBH_MSC_OK)
+    {
+      RaState = RA_VALID;
+    }
+    else
+    {
+      RaState = RA_EMPTY;
+    }
+  }
+}
+
+/* Sends the READ(10) of the sectors following NextSector and returns with
+   its CBW on the way; USBH_Process or the next disk access completes it */
+static void ra_start (void)
+{
+  DWORD capacity = USBH_MSC_Param.MSCapacity;
+
+  RaState = RA_EMPTY;
+  if ((NextSector >= capacity) || (USBH_MSC_BOTXferParam.CmdStateMachine != CMD_SEND_STATE))
+  {
+    return;
+  }
+
+  RaSector = NextSector;
+  RaCount = capacity - NextSector;
+  if (RaCount > USBH_MSC_READAHEAD)
+  {
+    RaCount = USBH_MSC_READAHEAD;
+  }
+
+  if (USBH_MSC_Read10(&USB_OTG_Core, RaBuff, RaSector, SECTOR_SIZE*RaCount) == USBH_MSC_BUSY)
+  {
+    USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
+    RaState = RA_PENDING;
+  }
+}
+
 /*-----------------------------------------------------------------------*/
 /* Initialize Disk Drive                                                 */
 /*-----------------------------------------------------------------------*/
@@ -22,6 +132,9 @@ DSTATUS disk_initialize (
                            )
 {
   
+  RaState = RA_EMPTY;
+  NextSector = 0;
+
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
     Stat &= ~STA_NOINIT;
@@ -60,6 +173,7 @@ DRESULT disk_read (
                      )
 {
   BYTE status = USBH_MSC_OK;
+  BYTE sequential;
   
   if (drv || !count) return RES_PARERR;
   if (Stat & STA_NOINIT) return RES_NOTRDY;
@@ -67,18 +181,43 @@ DRESULT disk_read (
   
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
+    ra_complete();
+    sequential = (sector == NextSector);
     
-    do
+    if ((RaState == RA_VALID) && (sector >= RaSector) &&
+        (sector + count <= RaSector + RaCount))
+    {
+      memcpy(buff, RaBuff + (sector - RaSector) * SECTOR_SIZE, count * SECTOR_SIZE);
+    }
+    else
     {
-      status = USBH_MSC_Read10(&USB_OTG_Core, buff, sector, 512*count);
-      USBH_MSC_HandleBOTXfer(&USB_OTG_Core ,&USB_Host);
+      if (sequential && (count < USBH_MSC_READAHEAD))
+      {
+        /* The read ahead was not sent: read the sectors with it */
+        NextSector = sector;
+        ra_start();
+        ra_complete();
+      }
       
-      if(!HCD_IsDeviceConnected(&USB_OTG_Core))
-      { 
-        return RES_ERROR;
-      }      
+      if ((RaState == RA_VALID) && (RaSector == sector) && (RaCount >= count))
+      {
+        memcpy(buff, RaBuff, count * SECTOR_SIZE);
+      }
+      else
+      {
+        status = msc_xfer(buff, sector, count, 0);
+      }
+    }
+    
+    NextSector = sector + count;
+    
+    /* Small sequential reads: queue the next command right away when the
+       cache is about to run dry */
+    if ((status == USBH_MSC_OK) && sequential && (count < USBH_MSC_READAHEAD) &&
+        ((RaState != RA_VALID) || (NextSector >= RaSector + RaCount)))
+    {
+      ra_start();
     }
-    while(status == USBH_MSC_BUSY );
   }
   
   if(status == USBH_MSC_OK)
@@ -109,19 +248,14 @@ DRESULT disk_write (
   
   if(HCD_IsDeviceConnected(&USB_OTG_Core))
   {  
-    do
+    ra_complete();
+    if ((RaState == RA_VALID) && (sector < RaSector + RaCount) &&
+        (sector + count > RaSector))
     {
-      status = USBH_MSC_Write10(&USB_OTG_Core,(BYTE*)buff, sector, 512*count);
-      USBH_MSC_HandleBOTXfer(&USB_OTG_Core, &USB_Host);
-      
-      if(!HCD_IsDeviceConnected(&USB_OTG_Core))
-      { 
-        return RES_ERROR;
-      }
+      RaState = RA_EMPTY;
     }
     
-    while(status == USBH_MSC_BUSY );
-    
+    status = msc_xfer((BYTE*)buff, sector, count, 1);
   }
   
   if(status == USBH_MSC_OK)
@@ -154,6 +288,7 @@ DRESULT disk_ioctl (
   switch (ctrl) {
   case CTRL_SYNC :		/* Make sure that no pending write process */
     
+    ra_complete();
     res = RES_OK;
     break;
     
@@ -512,6 +512,9 @@ uint8_t USBH_MSC_Write10(USB_OTG_CORE_HANDLE *pdev,
       /* Start the transfer, then let the state machine 
       magage the other transactions */
       USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
+      /* Back to the application once done, also when USBH_Process completes
+      the transfer */
+      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_DEFAULT_APPLI_STATE;
       USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
       USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
       
@@ -604,6 +607,9 @@ uint8_t USBH_MSC_Read10(USB_OTG_CORE_HANDLE *pdev,
       /* Start the transfer, then let the state machine 
       magage the other transactions */
       USBH_MSC_BOTXferParam.MSCState = USBH_MSC_BOT_USB_TRANSFERS;
+      /* Back to the application once done, also when USBH_Process completes
+      the transfer */
+      USBH_MSC_BOTXferParam.MSCStateCurrent = USBH_MSC_DEFAULT_APPLI_STATE;
       USBH_MSC_BOTXferParam.BOTXferStatus = USBH_MSC_BUSY;
       USBH_MSC_BOTXferParam.CmdStateMachine = CMD_WAIT_STATUS;
       
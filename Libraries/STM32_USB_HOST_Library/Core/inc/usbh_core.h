@@ -208,7 +208,8 @@ typedef struct _USBH_USR_PROP
   int (*USBH_USR_MSC_Application) (void);
   void (*USBH_USR_DeviceNotSupported)(void); /* Device is not supported*/
   void (*UnrecoveredError)(void);
-
+  void (*Wakeup)(void);      /* From the interrupt: USBH_Process has work,
+                                typically wakes up the host task. May be NULL */
 }
 USBH_Usr_cb_TypeDef;
 
@@ -263,6 +264,8 @@ USBH_Status USBH_DeInit(USB_OTG_CORE_HANDLE *pdev,
                         USBH_HOST *phost);
 void USBH_Process(USB_OTG_CORE_HANDLE *pdev , 
                   USBH_HOST *phost);
+uint8_t USBH_IsWaiting(USB_OTG_CORE_HANDLE *pdev , 
+                       USBH_HOST *phost);
 void USBH_ErrorHandle(USBH_HOST *phost, 
                       USBH_Status errType);
 
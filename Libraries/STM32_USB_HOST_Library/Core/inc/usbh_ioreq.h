@@ -108,6 +108,12 @@ USBH_Status USBH_InterruptReceiveData( USB_OTG_CORE_HANDLE *pdev,
                                        uint8_t             length,
                                        uint8_t             hc_num);
 
+USBH_Status USBH_InterruptReceiveDataAt( USB_OTG_CORE_HANDLE *pdev, 
+                                         uint8_t             *buff, 
+                                         uint8_t             length,
+                                         uint8_t             hc_num,
+                                         uint16_t            frame);
+
 USBH_Status USBH_InterruptSendData( USB_OTG_CORE_HANDLE *pdev, 
                                     uint8_t *buff, 
                                     uint8_t length,
@@ -47,6 +47,7 @@
   */ 
 void USBH_Disconnect (void *pdev); 
 void USBH_Connect (void *pdev); 
+void USBH_Event (void *pdev); 
 
 USB_OTG_hPort_TypeDef  USBH_DeviceConnStatus_cb = 
 {
@@ -55,7 +56,8 @@ USB_OTG_hPort_TypeDef  USBH_DeviceConnStatus_cb =
   0,
   0,
   0,
-  0
+  0,
+  USBH_Event
 };
 /**
   * @}
@@ -81,6 +83,7 @@ USB_OTG_hPort_TypeDef  USBH_DeviceConnStatus_cb =
 /** @defgroup USBH_CORE_Private_Variables
   * @{
   */ 
+static USBH_Usr_cb_TypeDef *USBH_Event_cb;
 /**
   * @}
   */ 
@@ -132,6 +135,21 @@ void USBH_Disconnect (void *pdev)
   ppdev->host.port_cb->DisconnHandled = 0;
 }
 
+/**
+  * @brief  USBH_Event
+  *         Callback function from the Interrupt: a URB completed or the
+  *         port changed, USBH_Process has to run.
+  * @param  selected device
+  * @retval none
+  */
+void USBH_Event (void *pdev)
+{
+  if ((USBH_Event_cb != 0) && (USBH_Event_cb->Wakeup != 0))
+  {
+    USBH_Event_cb->Wakeup();
+  }
+}
+
 /**
   * @brief  USBH_Init
   *         Host hardware and stack initializations 
@@ -159,6 +177,7 @@ void USBH_Init(USB_OTG_CORE_HANDLE *pdev,
   /*Register class and user callbacks */
   phost->class_cb = class_cb;
   phost->usr_cb = usr_cb;  
+  USBH_Event_cb = usr_cb;
   pdev->host.port_cb = &USBH_DeviceConnStatus_cb;
   
   pdev->host.port_cb->ConnStatus = 0;   
@@ -354,6 +373,43 @@ void USBH_Process(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
 }
 
 
+/**
+* @brief  USBH_IsWaiting
+*         Tells whether USBH_Process has nothing to do until the interrupt
+*         calls the Wakeup user callback: no device, or requests in flight
+*         with no completion left to handle. A host task runs USBH_Process
+*         until this returns TRUE, then blocks until woken up; it should
+*         wake up every few frames anyway, as the control transfer timeouts
+*         are counted in frames.
+* @param  None 
+* @retval TRUE when waiting
+*/
+uint8_t USBH_IsWaiting(USB_OTG_CORE_HANDLE *pdev , USBH_HOST *phost)
+{
+  switch (phost->gState)
+  {
+  case HOST_IDLE:
+    return HCD_IsDeviceConnected(pdev) ? FALSE : TRUE;
+    
+  case HOST_SUSPENDED:
+    return TRUE;
+    
+  case HOST_USR_INPUT:
+  case HOST_ERROR_STATE:
+    return FALSE;
+    
+  default:
+    /* Disconnection not handled yet */
+    if (!HCD_IsDeviceConnected(pdev) && 
+        (pdev->host.port_cb->DisconnHandled == 0))
+    {
+      return FALSE;
+    }
+    return HCD_IsWaiting(pdev) ? TRUE : FALSE;
+  }
+}
+
+
 /**
   * @brief  USBH_ErrorHandle 
   *         This function handles the Error on Host side.
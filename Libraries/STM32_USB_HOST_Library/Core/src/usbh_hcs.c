@@ -188,6 +188,7 @@ uint8_t USBH_Free_Channel  (USB_OTG_CORE_HANDLE *pdev, uint8_t idx)
 {
    if(idx < HC_MAX)
    {
+	 HCD_FlushURB(pdev, idx);
 	 pdev->host.channel[idx] &= HC_USED_MASK;
    }
    return USBH_OK;
@@ -206,6 +207,7 @@ uint8_t USBH_DeAllocate_AllChannel  (USB_OTG_CORE_HANDLE *pdev)
    
    for (idx = 2; idx < HC_MAX ; idx ++)
    {
+	 HCD_FlushURB(pdev, idx);
 	 pdev->host.channel[idx] = 0;
    }
    return USBH_OK;
@@ -334,6 +334,48 @@ USBH_Status USBH_InterruptReceiveData( USB_OTG_CORE_HANDLE *pdev,
   return USBH_OK;
 }
 
+/**
+  * @brief  USBH_InterruptReceiveDataAt
+  *         Receives the Device Response to an Interrupt IN token sent in
+  *         the given frame, or the first odd frame after it. The SOF
+  *         interrupt starts the transfer; the completion is then posted as
+  *         for USBH_InterruptReceiveData
+  * @param  pdev: Selected device
+  * @param  buff: Buffer pointer in which the response needs to be copied
+  * @param  length: Length of the data to be received
+  * @param  hc_num: Host channel Number
+  * @param  frame: Frame number, as returned by HCD_GetCurrentFrame
+  * @retval Status. 
+  */
+USBH_Status USBH_InterruptReceiveDataAt( USB_OTG_CORE_HANDLE *pdev, 
+                                uint8_t *buff, 
+                                uint8_t length,
+                                uint8_t hc_num,
+                                uint16_t frame)
+{
+
+  pdev->host.hc[hc_num].ep_is_in = 1;  
+  pdev->host.hc[hc_num].xfer_buff = buff;
+  pdev->host.hc[hc_num].xfer_len = length;
+  
+  if(pdev->host.hc[hc_num].toggle_in == 0)
+  {
+    pdev->host.hc[hc_num].data_pid = HC_PID_DATA0;
+  }
+  else
+  {
+    pdev->host.hc[hc_num].data_pid = HC_PID_DATA1;
+  }
+
+  /* toggle DATA PID */
+  pdev->host.hc[hc_num].toggle_in ^= 1;  
+  
+  /* Started on an even frame, sent in the odd one that follows */
+  HCD_ScheduleRequest (pdev , hc_num, frame - 1);  
+  
+  return USBH_OK;
+}
+
 /**
   * @brief  USBH_InterruptSendData
   *         Sends the data on Interrupt OUT Endpoint
@@ -46,6 +46,14 @@
 
 #define   MAX_DATA_LENGTH                        0xFF
 
+/* URB completions kept per host channel, a power of 2 */
+#ifndef HCD_URB_QUEUE_SIZE
+#define HCD_URB_QUEUE_SIZE                       4
+#endif
+
+/* Frame numbers count up to this value, then wrap to 0 */
+#define HCD_FRAME_MASK                           0x3FFF
+
 typedef enum {
   USB_OTG_OK = 0,
   USB_OTG_FAIL
@@ -169,6 +177,9 @@ typedef struct USB_OTG_hPort
   uint8_t DisconnStatus;
   uint8_t ConnHandled;
   uint8_t DisconnHandled;
+  /* Called from the interrupt after a URB completion was queued or the port
+     changed, so that USBH_Process can be run again. May be NULL. */
+  void (*Event) (void *pdev);
 } USB_OTG_hPort_TypeDef;
 
 typedef struct _Device_cb
@@ -236,6 +247,17 @@ typedef struct _HCD
   __IO uint32_t            XferCnt[USB_OTG_MAX_TX_FIFOS];
   __IO HC_STATUS           HC_Status[USB_OTG_MAX_TX_FIFOS];
   __IO URB_STATE           URB_State[USB_OTG_MAX_TX_FIFOS];
+  /* Completions posted by the channel interrupt since the last request,
+     read with HCD_GetURB_Event */
+  __IO URB_STATE           URB_Queue[USB_OTG_MAX_TX_FIFOS][HCD_URB_QUEUE_SIZE];
+  __IO uint8_t             URB_Head[USB_OTG_MAX_TX_FIFOS];
+  __IO uint8_t             URB_Tail[USB_OTG_MAX_TX_FIFOS];
+  /* Request submitted or scheduled, and not completed yet */
+  __IO uint8_t             URB_Busy[USB_OTG_MAX_TX_FIFOS];
+  /* Request started by the SOF interrupt on the first even frame from
+     SOF_Frame on */
+  __IO uint8_t             SOF_Pending[USB_OTG_MAX_TX_FIFOS];
+  uint16_t                 SOF_Frame[USB_OTG_MAX_TX_FIFOS];
   USB_OTG_HC               hc [USB_OTG_MAX_TX_FIFOS];
   uint16_t                 channel [USB_OTG_MAX_TX_FIFOS];
   USB_OTG_hPort_TypeDef    *port_cb;
@@ -295,6 +317,7 @@ USB_OTG_STS  USB_OTG_EnableHostInt   (USB_OTG_CORE_HANDLE *pdev);
 USB_OTG_STS  USB_OTG_HC_Init         (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
 USB_OTG_STS  USB_OTG_HC_Halt         (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
 USB_OTG_STS  USB_OTG_HC_StartXfer    (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
+void         USB_OTG_HC_WriteNPTxFifo(USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
 USB_OTG_STS  USB_OTG_HC_DoPing       (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num);
 uint32_t     USB_OTG_ReadHostAllChannels_intr    (USB_OTG_CORE_HANDLE *pdev);
 uint32_t     USB_OTG_ResetPort       (USB_OTG_CORE_HANDLE *pdev);
@@ -32,7 +32,13 @@ uint32_t HCD_GetCurrentSpeed (USB_OTG_CORE_HANDLE *pdev);
 uint32_t HCD_ResetPort (USB_OTG_CORE_HANDLE *pdev);
 uint32_t HCD_IsDeviceConnected (USB_OTG_CORE_HANDLE *pdev);
 uint32_t HCD_GetCurrentFrame (USB_OTG_CORE_HANDLE *pdev) ;
+/* A channel is read with either: HCD_GetURB_State drops the completions
+   HCD_GetURB_Event has not returned yet */
 URB_STATE HCD_GetURB_State (USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num);
+URB_STATE HCD_GetURB_Event (USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num);
+uint32_t HCD_ScheduleRequest (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num, uint16_t frame);
+void     HCD_FlushURB (USB_OTG_CORE_HANDLE *pdev, uint8_t hc_num);
+uint32_t HCD_IsWaiting (USB_OTG_CORE_HANDLE *pdev);
 uint32_t HCD_GetXferCnt (USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num);
 HC_STATUS HCD_GetHCState (USB_OTG_CORE_HANDLE *pdev, uint8_t ch_num) ;
 
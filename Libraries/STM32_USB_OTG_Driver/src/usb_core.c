@@ -934,7 +934,6 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
   USB_OTG_STS status = USB_OTG_OK;
   USB_OTG_HCCHAR_TypeDef   hcchar;
   USB_OTG_HCTSIZn_TypeDef  hctsiz;
-  USB_OTG_HNPTXSTS_TypeDef hnptxsts;
   USB_OTG_HPTXSTS_TypeDef  hptxsts;
   USB_OTG_GINTMSK_TypeDef  intmsk;
   uint16_t                 len_words = 0;
@@ -999,18 +998,11 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
         /* Non periodic transfer */
       case EP_TYPE_CTRL:
       case EP_TYPE_BULK:
-
-        hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
-        len_words = (pdev->host.hc[hc_num].xfer_len + 3) / 4;
-
-        /* check if there is enough space in FIFO space */
-        if(len_words > hnptxsts.b.nptxfspcavail)
-        {
-          /* need to process data in nptxfempty interrupt */
-          intmsk.b.nptxfempty = 1;
-          USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, 0, intmsk.d32);
-        }
-
+        /* The nptxfempty interrupt writes the packets, as far as the FIFO
+           goes each time. Writing them from here would race with it, and
+           with the halt of the channel, which both update xfer_len */
+        intmsk.b.nptxfempty = 1;
+        USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, 0, intmsk.d32);
         break;
         /* Periodic transfer */
       case EP_TYPE_INTR:
@@ -1024,22 +1016,70 @@ USB_OTG_STS USB_OTG_HC_StartXfer(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
           intmsk.b.ptxfempty = 1;
           USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, 0, intmsk.d32);
         }
+
+        /* Write packet into the Tx FIFO. */
+        USB_OTG_WritePacket(pdev,
+                            pdev->host.hc[hc_num].xfer_buff ,
+                            hc_num, pdev->host.hc[hc_num].xfer_len);
         break;
 
       default:
         break;
       }
-
-      /* Write packet into the Tx FIFO. */
-      USB_OTG_WritePacket(pdev,
-                          pdev->host.hc[hc_num].xfer_buff ,
-                          hc_num, pdev->host.hc[hc_num].xfer_len);
     }
   }
   return status;
 }
 
 
+/**
+* @brief  USB_OTG_HC_WriteNPTxFifo : Writes the next packets of a control or
+*         bulk OUT transfer, as many as the non periodic Tx FIFO and its
+*         request queue take, and leaves the nptxfempty interrupt enabled
+*         as long as some are left. xfer_buff and xfer_len then move on
+*         and xfer_count counts the bytes written. Only called from the
+*         interrupt, which also halts the channel.
+* @param  pdev : Selected device
+* @param  hc_num : channel number
+* @retval None
+*/
+void USB_OTG_HC_WriteNPTxFifo(USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
+{
+  USB_OTG_HNPTXSTS_TypeDef hnptxsts;
+  USB_OTG_GINTMSK_TypeDef  intmsk;
+  USB_OTG_HC               *hc = &pdev->host.hc[hc_num];
+  uint16_t                 len;
+
+  hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
+  while ((hc->xfer_len > 0) && (hnptxsts.b.nptxqspcavail > 0))
+  {
+    len = (hc->xfer_len > hc->max_packet) ? hc->max_packet : hc->xfer_len;
+    if (((len + 3) / 4) > hnptxsts.b.nptxfspcavail)
+    {
+      break;
+    }
+
+    USB_OTG_WritePacket(pdev, hc->xfer_buff, hc_num, len);
+    hc->xfer_buff  += len;
+    hc->xfer_len   -= len;
+    hc->xfer_count += len;
+
+    hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
+  }
+
+  intmsk.d32 = 0;
+  intmsk.b.nptxfempty = 1;
+  if (hc->xfer_len > 0)
+  {
+    USB_OTG_MODIFY_REG32(&pdev->regs.GREGS->GINTMSK, 0, intmsk.d32);
+  }
+  else
+  {
+    USB_OTG_MODIFY_REG32(&pdev->regs.GREGS->GINTMSK, intmsk.d32, 0);
+  }
+}
+
+
 /**
 * @brief  USB_OTG_HC_Halt : Halt channel
 * @param  pdev : Selected device
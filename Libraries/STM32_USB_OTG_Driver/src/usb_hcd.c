@@ -177,16 +177,67 @@ uint32_t HCD_GetCurrentFrame (USB_OTG_CORE_HANDLE *pdev)
 
 /**
   * @brief  HCD_GetURB_State
-  *         This function returns the last URBstate
+  *         This function returns the last URBstate, and acknowledges the
+  *         completions queued for HCD_GetURB_Event: a channel is read with
+  *         one or the other, never both. The control transfers use this
+  *         one, the HID and MSC classes HCD_GetURB_Event
   * @param  pdev: Selected device
   * @retval URB_STATE
   *
   */
 URB_STATE HCD_GetURB_State (USB_OTG_CORE_HANDLE *pdev , uint8_t ch_num)
 {
+  pdev->host.URB_Tail[ch_num] = pdev->host.URB_Head[ch_num];
   return pdev->host.URB_State[ch_num] ;
 }
 
+/**
+  * @brief  HCD_GetURB_Event
+  *         This function returns the oldest completion of the channel not
+  *         read yet, in the order the interrupt posted them
+  * @param  pdev: Selected device
+  * @retval URB_STATE: URB_IDLE when nothing completed
+  *
+  */
+URB_STATE HCD_GetURB_Event (USB_OTG_CORE_HANDLE *pdev , uint8_t ch_num)
+{
+  uint8_t tail = pdev->host.URB_Tail[ch_num];
+  URB_STATE state;
+
+  if (tail == pdev->host.URB_Head[ch_num])
+  {
+    return URB_IDLE;
+  }
+  state = pdev->host.URB_Queue[ch_num][tail & (HCD_URB_QUEUE_SIZE - 1)];
+  pdev->host.URB_Tail[ch_num] = tail + 1;
+  return state;
+}
+
+/**
+  * @brief  HCD_IsWaiting
+  *         This function tells whether the host only waits for the
+  *         interrupt: a request is in flight or scheduled, and no completion
+  *         is left to read
+  * @param  pdev: Selected device
+  * @retval 1 when waiting
+  *
+  */
+uint32_t HCD_IsWaiting (USB_OTG_CORE_HANDLE *pdev)
+{
+  uint32_t busy = 0;
+  uint8_t i;
+
+  for (i = 0; i < pdev->cfg.host_channels; i++)
+  {
+    if (pdev->host.URB_Head[i] != pdev->host.URB_Tail[i])
+    {
+      return 0;
+    }
+    busy |= pdev->host.URB_Busy[i];
+  }
+  return busy;
+}
+
 /**
   * @brief  HCD_GetXferCnt
   *         This function returns the last URBstate
@@ -235,11 +286,51 @@ uint32_t HCD_HC_Init (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 uint32_t HCD_SubmitRequest (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
 {
 
+  HCD_FlushURB(pdev, hc_num);
   pdev->host.URB_State[hc_num] =   URB_IDLE;
   pdev->host.hc[hc_num].xfer_count = 0 ;
+  pdev->host.XferCnt[hc_num] = 0;
+  pdev->host.URB_Busy[hc_num] = 1;
   return USB_OTG_HC_StartXfer(pdev, hc_num);
 }
 
+/**
+  * @brief  HCD_ScheduleRequest
+  *         This function prepares a HC and lets the SOF interrupt start the
+  *         transfer, on the first even frame from the given one on. Meant
+  *         for periodic IN channels, instead of waiting for the frame
+  * @param  pdev: Selected device
+  * @param  hc_num: Channel number
+  * @param  frame: Frame number, as returned by HCD_GetCurrentFrame
+  * @retval status
+  */
+uint32_t HCD_ScheduleRequest (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num, uint16_t frame)
+{
+  HCD_FlushURB(pdev, hc_num);
+  pdev->host.URB_State[hc_num] =   URB_IDLE;
+  pdev->host.hc[hc_num].xfer_count = 0 ;
+  pdev->host.XferCnt[hc_num] = 0;
+  pdev->host.URB_Busy[hc_num] = 1;
+  pdev->host.SOF_Frame[hc_num] = frame & HCD_FRAME_MASK;
+  pdev->host.SOF_Pending[hc_num] = 1;
+  return 0;
+}
+
+/**
+  * @brief  HCD_FlushURB
+  *         This function drops the scheduled request and the completions
+  *         not read yet of a HC, before it is reused or freed
+  * @param  pdev: Selected device
+  * @param  hc_num: Channel number
+  * @retval None
+  */
+void HCD_FlushURB (USB_OTG_CORE_HANDLE *pdev , uint8_t hc_num)
+{
+  pdev->host.SOF_Pending[hc_num] = 0;
+  pdev->host.URB_Busy[hc_num] = 0;
+  pdev->host.URB_Tail[hc_num] = pdev->host.URB_Head[hc_num];
+}
+
 
 /**
 * @}
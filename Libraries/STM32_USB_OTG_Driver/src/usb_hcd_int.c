@@ -94,6 +94,10 @@ static uint32_t USB_OTG_USBH_handle_nptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_ptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_Disconnect_ISR (USB_OTG_CORE_HANDLE *pdev);
 static uint32_t USB_OTG_USBH_handle_IncompletePeriodicXfer_ISR (USB_OTG_CORE_HANDLE *pdev);
+static void USB_OTG_USBH_URB_Post (USB_OTG_CORE_HANDLE *pdev ,
+                                   uint32_t num ,
+                                   URB_STATE state);
+static void USB_OTG_USBH_Event (USB_OTG_CORE_HANDLE *pdev);
 
 /**
   * @}
@@ -222,6 +226,8 @@ static uint32_t USB_OTG_USBH_handle_hc_ISR (USB_OTG_CORE_HANDLE *pdev)
 static uint32_t USB_OTG_USBH_handle_sof_ISR (USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_GINTSTS_TypeDef      gintsts;
+  uint32_t frame;
+  uint32_t i;
 
 
   gintsts.d32 = 0;
@@ -229,6 +235,22 @@ static uint32_t USB_OTG_USBH_handle_sof_ISR (USB_OTG_CORE_HANDLE *pdev)
   gintsts.b.sofintr = 1;
   USB_OTG_WRITE_REG32(&pdev->regs.GREGS->GINTSTS, gintsts.d32);
 
+  /* Start the requests scheduled for this frame. Started on an even frame,
+     they are sent in the odd frame that follows, see USB_OTG_HC_StartXfer */
+  frame = USB_OTG_READ_REG32(&pdev->regs.HREGS->HFNUM) & HCD_FRAME_MASK;
+  if ((frame & 1) == 0)
+  {
+    for (i = 0; i < pdev->cfg.host_channels; i++)
+    {
+      if (pdev->host.SOF_Pending[i] &&
+          (((frame - pdev->host.SOF_Frame[i]) & HCD_FRAME_MASK) <= (HCD_FRAME_MASK >> 1)))
+      {
+        pdev->host.SOF_Pending[i] = 0;
+        USB_OTG_HC_StartXfer(pdev, i);
+      }
+    }
+  }
+
   return 1;
 }
 
@@ -246,6 +268,7 @@ static uint32_t USB_OTG_USBH_handle_Disconnect_ISR (USB_OTG_CORE_HANDLE *pdev)
   gintsts.d32 = 0;
 
   pdev->host.port_cb->Disconnect(pdev);
+  USB_OTG_USBH_Event(pdev);
 
   /* Clear interrupt */
   gintsts.b.disconnect = 1;
@@ -263,40 +286,27 @@ static uint32_t USB_OTG_USBH_handle_Disconnect_ISR (USB_OTG_CORE_HANDLE *pdev)
 static uint32_t USB_OTG_USBH_handle_nptxfempty_ISR (USB_OTG_CORE_HANDLE *pdev)
 {
   USB_OTG_GINTMSK_TypeDef      intmsk;
-  USB_OTG_HNPTXSTS_TypeDef     hnptxsts;
-  uint16_t                     len_words , len;
-
-  hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
-
-  len_words = (pdev->host.hc[hnptxsts.b.chnum].xfer_len + 3) / 4;
+  USB_OTG_HCCHAR_TypeDef       hcchar;
+  uint8_t                      num;
 
-  while ((hnptxsts.b.nptxfspcavail > len_words)&&
-      (pdev->host.hc[hnptxsts.b.chnum].xfer_len != 0))
+  /* HNPTXSTS.chnum is the channel at the top of the request queue, not the
+     one with data left to write: look for the OUT transfer still going */
+  for (num = 0; num < pdev->cfg.host_channels; num++)
   {
-
-    len = hnptxsts.b.nptxfspcavail * 4;
-
-    if (len > pdev->host.hc[hnptxsts.b.chnum].xfer_len)
+    hcchar.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[num]->HCCHAR);
+    if ((hcchar.b.chen) && (hcchar.b.epdir == 0) &&
+        ((hcchar.b.eptype == EP_TYPE_CTRL) || (hcchar.b.eptype == EP_TYPE_BULK)) &&
+        (pdev->host.hc[num].xfer_len != 0))
     {
-      /* Last packet */
-      len = pdev->host.hc[hnptxsts.b.chnum].xfer_len;
-
-      intmsk.d32 = 0;
-      intmsk.b.nptxfempty = 1;
-      USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, intmsk.d32, 0);
+      USB_OTG_HC_WriteNPTxFifo(pdev, num);
+      return 1;
     }
-
-    len_words = (pdev->host.hc[hnptxsts.b.chnum].xfer_len + 3) / 4;
-
-    USB_OTG_WritePacket (pdev , pdev->host.hc[hnptxsts.b.chnum].xfer_buff, hnptxsts.b.chnum, len);
-
-    pdev->host.hc[hnptxsts.b.chnum].xfer_buff  += len;
-    pdev->host.hc[hnptxsts.b.chnum].xfer_len   -= len;
-    pdev->host.hc[hnptxsts.b.chnum].xfer_count  += len;
-
-    hnptxsts.d32 = USB_OTG_READ_REG32(&pdev->regs.GREGS->HNPTXSTS);
   }
 
+  intmsk.d32 = 0;
+  intmsk.b.nptxfempty = 1;
+  USB_OTG_MODIFY_REG32( &pdev->regs.GREGS->GINTMSK, intmsk.d32, 0);
+
   return 1;
 }
 
@@ -377,6 +387,7 @@ static uint32_t USB_OTG_USBH_handle_port_ISR (USB_OTG_CORE_HANDLE *pdev)
   if (hprt0.b.prtconndet)
   {
     pdev->host.port_cb->Connect(pdev);
+    USB_OTG_USBH_Event(pdev);
     hprt0_dup.b.prtconndet = 1;
     do_reset = 1;
     retval |= 1;
@@ -456,6 +467,9 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   USB_OTG_HCGINTMSK_TypeDef  hcintmsk;
   USB_OTG_HC_REGS *hcreg;
   USB_OTG_HCCHAR_TypeDef     hcchar;
+  USB_OTG_HCTSIZn_TypeDef    hctsiz;
+  USB_OTG_GINTMSK_TypeDef    intmsk;
+  uint32_t                   total, packets;
 
   hcreg = pdev->regs.HC_REGS[num];
   hcint.d32 = USB_OTG_READ_REG32(&hcreg->HCINT);
@@ -530,18 +544,47 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
   {
     MASK_HOST_INT_CHH (num);
 
-    if(pdev->host.HC_Status[num] == HC_XFRC)
+    /* Bytes the device acknowledged: the packets the core no longer counts,
+       the last one possibly short */
+    hctsiz.d32 = USB_OTG_READ_REG32(&hcreg->HCTSIZ);
+    total = pdev->host.hc[num].xfer_len + pdev->host.hc[num].xfer_count;
+    packets = (total + pdev->host.hc[num].max_packet - 1) / pdev->host.hc[num].max_packet;
+    if (packets == 0)
+    {
+      packets = 1;
+    }
+    pdev->host.XferCnt[num] = (packets - hctsiz.b.pktcnt) * pdev->host.hc[num].max_packet;
+    if (pdev->host.XferCnt[num] > total)
+    {
+      pdev->host.XferCnt[num] = total;
+    }
+
+    if ((hcchar.b.eptype == EP_TYPE_CTRL) || (hcchar.b.eptype == EP_TYPE_BULK))
     {
-      pdev->host.URB_State[num] = URB_DONE;
+      /* Nothing more is written for a halted channel */
+      pdev->host.hc[num].xfer_len = 0;
+      intmsk.d32 = 0;
+      intmsk.b.nptxfempty = 1;
+      USB_OTG_MODIFY_REG32(&pdev->regs.GREGS->GINTMSK, intmsk.d32, 0);
+    }
 
+    if(pdev->host.HC_Status[num] == HC_XFRC)
+    {
       if (hcchar.b.eptype == EP_TYPE_BULK)
       {
-        pdev->host.hc[num].toggle_out ^= 1;
+        /* The core moves the PID on with each packet acknowledged */
+        pdev->host.hc[num].toggle_out = (hctsiz.b.pid == HC_PID_DATA1);
       }
+      USB_OTG_USBH_URB_Post(pdev, num, URB_DONE);
     }
     else if(pdev->host.HC_Status[num] == HC_NAK)
     {
-      pdev->host.URB_State[num] = URB_NOTREADY;
+      if (hcchar.b.eptype == EP_TYPE_BULK)
+      {
+        /* The packet refused goes again, with the PID it had */
+        pdev->host.hc[num].toggle_out = (hctsiz.b.pid == HC_PID_DATA1);
+      }
+      USB_OTG_USBH_URB_Post(pdev, num, URB_NOTREADY);
     }
     else if(pdev->host.HC_Status[num] == HC_NYET)
     {
@@ -549,17 +592,17 @@ uint32_t USB_OTG_USBH_handle_hc_n_Out_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t
       {
         USB_OTG_HC_DoPing(pdev, num);
       }
-      pdev->host.URB_State[num] = URB_NOTREADY;
+      USB_OTG_USBH_URB_Post(pdev, num, URB_NOTREADY);
     }
     else if(pdev->host.HC_Status[num] == HC_STALL)
     {
-      pdev->host.URB_State[num] = URB_STALL;
+      USB_OTG_USBH_URB_Post(pdev, num, URB_STALL);
     }
     else if(pdev->host.HC_Status[num] == HC_XACTERR)
     {
       if (pdev->host.ErrCnt[num] == 3)
       {
-        pdev->host.URB_State[num] = URB_ERROR;
+        USB_OTG_USBH_URB_Post(pdev, num, URB_ERROR);
         pdev->host.ErrCnt[num] = 0;
       }
     }
@@ -651,14 +694,17 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
       UNMASK_HOST_INT_CHH (num);
       USB_OTG_HC_Halt(pdev, num);
       CLEAR_HC_INT(hcreg , nak);
-      pdev->host.hc[num].toggle_in ^= 1;
+      /* A multi packet transfer toggles once per packet: take the PID the
+         core expects next rather than flipping it once */
+      hctsiz.d32 = USB_OTG_READ_REG32(&pdev->regs.HC_REGS[num]->HCTSIZ);
+      pdev->host.hc[num].toggle_in = (hctsiz.b.pid == HC_PID_DATA1);
 
     }
     else if(hcchar.b.eptype == EP_TYPE_INTR)
     {
       hcchar.b.oddfrm  = 1;
       USB_OTG_WRITE_REG32(&pdev->regs.HC_REGS[num]->HCCHAR, hcchar.d32);
-      pdev->host.URB_State[num] = URB_DONE;
+      USB_OTG_USBH_URB_Post(pdev, num, URB_DONE);
     }
 
   }
@@ -668,24 +714,26 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
 
     if(pdev->host.HC_Status[num] == HC_XFRC)
     {
-      pdev->host.URB_State[num] = URB_DONE;
+      USB_OTG_USBH_URB_Post(pdev, num, URB_DONE);
     }
 
     else if (pdev->host.HC_Status[num] == HC_STALL)
     {
-       pdev->host.URB_State[num] = URB_STALL;
+       USB_OTG_USBH_URB_Post(pdev, num, URB_STALL);
     }
 
     else if((pdev->host.HC_Status[num] == HC_XACTERR) ||
             (pdev->host.HC_Status[num] == HC_DATATGLERR))
     {
         pdev->host.ErrCnt[num] = 0;
-        pdev->host.URB_State[num] = URB_ERROR;
+        USB_OTG_USBH_URB_Post(pdev, num, URB_ERROR);
 
     }
     else if(hcchar.b.eptype == EP_TYPE_INTR)
     {
       pdev->host.hc[num].toggle_in ^= 1;
+      /* Halted on a NAK: nothing this poll, the class schedules the next */
+      USB_OTG_USBH_URB_Post(pdev, num, URB_NOTREADY);
     }
 
     CLEAR_HC_INT(hcreg , chhltd);
@@ -724,6 +772,48 @@ uint32_t USB_OTG_USBH_handle_hc_n_In_ISR (USB_OTG_CORE_HANDLE *pdev , uint32_t n
 
 }
 
+/**
+  * @brief  USB_OTG_USBH_URB_Post
+  *         Records the completion of the request of a channel, and queues it
+  *         for HCD_GetURB_Event
+  * @param  pdev: Selected device
+  * @param  num: Channel number
+  * @param  state: URB state reached
+  * @retval None
+  */
+static void USB_OTG_USBH_URB_Post (USB_OTG_CORE_HANDLE *pdev ,
+                                   uint32_t num ,
+                                   URB_STATE state)
+{
+  uint8_t head = pdev->host.URB_Head[num];
+
+  pdev->host.URB_State[num] = state;
+  pdev->host.URB_Busy[num] = 0;
+
+  /* When the queue is full the newest completion is only kept in URB_State */
+  if ((uint8_t)(head - pdev->host.URB_Tail[num]) < HCD_URB_QUEUE_SIZE)
+  {
+    pdev->host.URB_Queue[num][head & (HCD_URB_QUEUE_SIZE - 1)] = state;
+    pdev->host.URB_Head[num] = head + 1;
+  }
+
+  USB_OTG_USBH_Event(pdev);
+}
+
+/**
+  * @brief  USB_OTG_USBH_Event
+  *         Tells the host stack that USBH_Process has something to do
+  * @param  pdev: Selected device
+  * @retval None
+  */
+static void USB_OTG_USBH_Event (USB_OTG_CORE_HANDLE *pdev)
+{
+  if (pdev->host.port_cb->Event)
+  {
+    pdev->host.port_cb->Event(pdev);
+  }
+}
+
 /**
   * @brief  USB_OTG_USBH_handle_rx_qlvl_ISR
   *         Handles the Rx Status Queue Level Interrupt
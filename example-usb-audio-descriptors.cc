@@ -0,0 +1,187 @@
+//descriptors for usbd_audio_core: a speaker taking 16 or 24 bits stereo
+//at several sample rates, with an explicit feedback endpoint, and a mono
+//microphone (build the core with USBD_AUDIO_IN_ENABLED).
+#include "usb_descriptors.hh"
+#include "usb_constants.h"
+
+typedef USB::StringDescriptor<typestring_is("GrumpyCoders")> manufacturer;
+typedef USB::StringDescriptor<typestring_is("USB Speaker")> product;
+typedef USB::StringDescriptor<typestring_is("00000000011C")> serial;
+typedef USB::StringDescriptor<typestring_is("Audio Config")> config;
+
+typedef USB::StringCollection<
+    manufacturer,
+    product,
+    serial,
+    config
+> strings;
+
+static const strings strings_collection;
+
+// Terminal 1 is the USB stream, unit 2 the mute control, terminal 3 the
+// speaker. AUDIO_OUT_STREAMING_CTRL in usbd_audio_core.h refers to unit 2.
+// Terminal 4 is the microphone, terminal 5 its USB stream.
+typedef USB::Audio::FormatTypeI<2, 2, 16, 44100, 48000> format_16bits;
+typedef USB::Audio::FormatTypeI<2, 3, 24, 44100, 48000, 96000> format_24bits;
+typedef USB::Audio::FormatTypeI<1, 2, 16, 48000> format_mic;
+
+static const USB::DeviceDescriptor<
+    USB::USB2_0,
+    USB::DeviceClass_NONE,
+    USB::DeviceSubClass<0>,
+    USB::DeviceProtocol<0>,
+    USB::MaxPacketSize<64>,
+    USB::VendorID<0x483>,
+    USB::ProductID<0x5730>,
+    USB::DeviceReleaseNumber<0x200>,
+    strings::find<manufacturer>(),
+    strings::find<product>(),
+    strings::find<serial>(),
+    USB::ConfigurationDescriptorList<
+        USB::ConfigurationDescriptor<
+            USB::ConfigurationAttributes<
+                USB::ConfigurationSelfPowered
+            >,
+            USB::MaxPower<100>,
+            strings::find<config>(),
+            USB::InterfaceDescriptorList<
+                USB::InterfaceAlternateList<
+                    USB::InterfaceDescriptorExtended<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioControl,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::OptionalDescriptorList<
+                            USB::Audio::ControlInterfaceHeader<
+                                USB::Audio::StreamingInterfaceList<1, 2>,
+                                USB::Audio::InputTerminal<1, USB::Audio::USBStreaming, 2, USB::Audio::Stereo>,
+                                USB::Audio::FeatureUnit<2, 1, USB::Audio::Mute, USB::Audio::NoControl, USB::Audio::NoControl>,
+                                USB::Audio::OutputTerminal<3, USB::Audio::Speaker, 2>,
+                                USB::Audio::InputTerminal<4, USB::Audio::Microphone, 1, USB::Audio::Mono>,
+                                USB::Audio::OutputTerminal<5, USB::Audio::USBStreaming, 4>
+                            >
+                        >,
+                        USB::EndpointDescriptorList<>
+                    >
+                >,
+                USB::InterfaceAlternateList<
+                    // Alternate 0: zero bandwidth
+                    USB::InterfaceDescriptor<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioStreaming,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::EndpointDescriptorList<>
+                    >,
+                    // Alternate 1: 16 bits stereo
+                    USB::InterfaceDescriptorExtended<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioStreaming,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::OptionalDescriptorList<
+                            USB::Audio::StreamingGeneral<1>,
+                            format_16bits
+                        >,
+                        USB::EndpointDescriptorList<
+                            USB::Audio::StreamingEndpointDescriptor<
+                                USB::EndpointAddress<USB::Out>, //0x01
+                                USB::IsochronousEndpoint<USB::Asynchrnous, USB::DataEndpoint>,
+                                format_16bits,
+                                true
+                            >,
+                            USB::Audio::FeedbackEndpointDescriptor<> //0x82
+                        >
+                    >,
+                    // Alternate 2: 24 bits stereo
+                    USB::InterfaceDescriptorExtended<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioStreaming,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::OptionalDescriptorList<
+                            USB::Audio::StreamingGeneral<1>,
+                            format_24bits
+                        >,
+                        USB::EndpointDescriptorList<
+                            USB::Audio::StreamingEndpointDescriptor<
+                                USB::EndpointAddress<USB::Out>, //0x01
+                                USB::IsochronousEndpoint<USB::Asynchrnous, USB::DataEndpoint>,
+                                format_24bits,
+                                true
+                            >,
+                            USB::Audio::FeedbackEndpointDescriptor<> //0x82
+                        >
+                    >
+                >,
+                USB::InterfaceAlternateList<
+                    // Alternate 0: zero bandwidth
+                    USB::InterfaceDescriptor<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioStreaming,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::EndpointDescriptorList<>
+                    >,
+                    // Alternate 1: 16 bits mono
+                    USB::InterfaceDescriptorExtended<
+                        USB::InterfaceClass_AUDIO,
+                        USB::Audio::InterfaceSubClass_AudioStreaming,
+                        USB::InterfaceProtocol<0>,
+                        USB::EmptyString,
+                        USB::OptionalDescriptorList<
+                            USB::Audio::StreamingGeneral<5>,
+                            format_mic
+                        >,
+                        USB::EndpointDescriptorList<
+                            USB::Audio::StreamingEndpointDescriptor<
+                                USB::EndpointAddress<USB::In>, //0x81
+                                USB::IsochronousEndpoint<USB::Asynchrnous, USB::DataEndpoint>,
+                                format_mic
+                            >
+                        >
+                    >
+                >
+            >
+        >
+    >
+> device_descriptor;
+
+
+static constexpr auto configuration_table = device_descriptor.GetConfigurationTable();
+static constexpr auto string_table = strings_collection.GetStringTable();
+
+extern "C" const uint8_t * get_USB_descriptor(uint8_t type, uint8_t index, uint16_t * length) {
+    switch (type) {
+    case USB_DESC_DEVICE:
+        if (index != 0) return NULL;
+        *length = device_descriptor.m_bLength;
+        return reinterpret_cast<const uint8_t *>(&device_descriptor);
+    case USB_DESC_CONFIG:
+        return configuration_table.get(index, length);
+    case USB_DESC_STRING:
+        return string_table.get(index, length);
+    }
+    return NULL;
+}
+
+extern "C" const uint8_t * get_USB_vendor_descriptor(uint8_t, uint16_t, uint16_t *) {
+    return NULL;
+}
+
+extern "C" const uint8_t * get_USB_first_interface_descriptor(int configuration) {
+    const uint8_t * desc = configuration_table.get(configuration - 1, NULL);
+    return desc ? desc + device_descriptor.firstInterfaceOffset : NULL;
+}
+
+extern "C" const uint8_t * get_USB_configuration_descriptor(int configuration) {
+    return configuration_table.get(configuration - 1, NULL);
+}
+
+extern "C" const uint8_t * get_USB_device_descriptor() {
+    return reinterpret_cast<const uint8_t *>(&device_descriptor);
+}
+
+extern "C" const uint8_t * get_USB_string_descriptor(int index) {
+    return string_table.get(index, NULL);
+}
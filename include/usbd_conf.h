@@ -49,10 +49,13 @@
   * @{
   */ 
 #define HID_IN_EP                    0x81
-#define HID_OUT_EP                   0x01
+#define HID_OUT_EP                   0x02
 
-#define HID_IN_PACKET                4
-#define HID_OUT_PACKET               4
+#define HID_IN_PACKET                64
+#define HID_OUT_PACKET               64
+
+/* Keyboard, mouse and telemetry, see usb.h */
+#define HID_MAX_REPORTS              3
 
 /**
   * @}
@@ -7,15 +7,14 @@
 
 #include "usb.h"
 
-#define RTOS_DEBUG
-
 void sendData()
 {
-  uint8_t buf[] = {0, 1, 0, 0};
   while(1)
   {
-    usb_send_report(buf, 4);
-    //vTaskDelay(100);
+    usb_send_mouse_report(0, 1, 0, 0);
+    usb_process_reports();
+    // A move per tick, and time for the other tasks
+    vTaskDelay(1);
   }
 }
 
@@ -56,13 +55,9 @@ int main(void)
 
   usb_fs_device_init();
 
-#ifdef RTOS_DEBUG
     xTaskCreate(sendData, (const signed char *)NULL, configMINIMAL_STACK_SIZE, (void *)NULL, tskIDLE_PRIORITY, NULL);
 
     vTaskStartScheduler();
-#else
-    sendData();
-#endif
     return 1;
 }
 
@@ -1,5 +1,10 @@
 //descriptors
 #include "usb_descriptors.hh"
+#include "usb_constants.h"
+#include "usb.h"
+#include "usbd_conf.h"
+
+#include <string.h>
 
 typedef USB::StringDescriptor<typestring_is("GrumpyCoders")> manufacturer;
 typedef USB::StringDescriptor<typestring_is("Custom HID device")> product;
@@ -9,6 +14,7 @@ typedef USB::StringDescriptor<typestring_is("CDC Config")> config2;
 typedef USB::StringDescriptor<typestring_is("HID Interface")> interface;
 typedef USB::StringDescriptor<typestring_is("CDC Interface Ctrl")> interface2;
 typedef USB::StringDescriptor<typestring_is("CDC Interface Data")> interface3;
+typedef USB::StringDescriptor<typestring_is("WinUSB Interface")> interface4;
 
 typedef USB::StringCollection<
     manufacturer,
@@ -18,11 +24,111 @@ typedef USB::StringCollection<
     config2,
     interface,
     interface2,
-    interface3
+    interface3,
+    interface4
 > strings;
 
 static const strings strings_collection;
 
+// A keyboard, the ST mouse with its wakeup feature report, and a vendor
+// defined telemetry channel, each behind its own report ID.
+typedef USB::HID::ReportDescriptor<
+    USB::HID::UsagePage<USB::HID::GenericDesktop>,
+    USB::HID::Usage<0x06>, // Keyboard
+    USB::HID::Collection<USB::HID::Application,
+        USB::HID::ReportID<USB_REPORT_KEYBOARD>,
+        USB::HID::UsagePage<USB::HID::KeyboardKeypad>,
+        USB::HID::UsageMinimum<0xe0>, // Left Control
+        USB::HID::UsageMaximum<0xe7>, // Right GUI
+        USB::HID::LogicalMinimum<0>,
+        USB::HID::LogicalMaximum<1>,
+        USB::HID::ReportSize<1>,
+        USB::HID::ReportCount<8>,
+        USB::HID::Input<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute>,
+        USB::HID::ReportSize<8>,
+        USB::HID::ReportCount<1>,
+        USB::HID::Input<USB::HID::Constant>, // reserved
+        USB::HID::UsagePage<USB::HID::LEDs>,
+        USB::HID::UsageMinimum<1>, // Num Lock
+        USB::HID::UsageMaximum<5>, // Kana
+        USB::HID::ReportSize<1>,
+        USB::HID::ReportCount<5>,
+        USB::HID::Output<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute>,
+        USB::HID::ReportSize<3>,
+        USB::HID::ReportCount<1>,
+        USB::HID::Output<USB::HID::Constant>, // padding
+        USB::HID::UsagePage<USB::HID::KeyboardKeypad>,
+        USB::HID::UsageMinimum<0>,
+        USB::HID::UsageMaximum<101>,
+        USB::HID::LogicalMaximum<101>,
+        USB::HID::ReportSize<8>,
+        USB::HID::ReportCount<6>,
+        USB::HID::Input<USB::HID::Data, USB::HID::Array, USB::HID::Absolute>
+    >,
+    USB::HID::UsagePage<USB::HID::GenericDesktop>,
+    USB::HID::Usage<0x02>, // Mouse
+    USB::HID::Collection<USB::HID::Application,
+        USB::HID::ReportID<USB_REPORT_MOUSE>,
+        USB::HID::Usage<0x01>, // Pointer
+        USB::HID::Collection<USB::HID::Physical,
+            USB::HID::UsagePage<USB::HID::Button>,
+            USB::HID::UsageMinimum<1>,
+            USB::HID::UsageMaximum<3>,
+            USB::HID::LogicalMinimum<0>,
+            USB::HID::LogicalMaximum<1>,
+            USB::HID::ReportCount<3>,
+            USB::HID::ReportSize<1>,
+            USB::HID::Input<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute>,
+            USB::HID::ReportCount<1>,
+            USB::HID::ReportSize<5>,
+            USB::HID::Input<USB::HID::Constant>, // padding
+            USB::HID::UsagePage<USB::HID::GenericDesktop>,
+            USB::HID::Usage<0x30>, // X
+            USB::HID::Usage<0x31>, // Y
+            USB::HID::Usage<0x38>, // Wheel
+            USB::HID::LogicalMinimum<-127>,
+            USB::HID::LogicalMaximum<127>,
+            USB::HID::ReportSize<8>,
+            USB::HID::ReportCount<3>,
+            USB::HID::Input<USB::HID::Data, USB::HID::Variable, USB::HID::Relative>
+        >,
+        USB::HID::Usage<0x3c>, // Motion Wakeup
+        USB::HID::UsagePage<0xff>,
+        USB::HID::Usage<0x01>,
+        USB::HID::LogicalMinimum<0>,
+        USB::HID::LogicalMaximum<1>,
+        USB::HID::ReportSize<1>,
+        USB::HID::ReportCount<2>,
+        USB::HID::Feature<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute, USB::HID::NoPreferred>,
+        USB::HID::ReportSize<6>,
+        USB::HID::ReportCount<1>,
+        USB::HID::Feature<USB::HID::Constant>
+    >,
+    USB::HID::UsagePage<USB::HID::VendorDefined>,
+    USB::HID::Usage<0x01>, // Telemetry
+    USB::HID::Collection<USB::HID::Application,
+        USB::HID::ReportID<USB_REPORT_TELEMETRY>,
+        USB::HID::LogicalMinimum<0>,
+        USB::HID::LogicalMaximum<255>,
+        USB::HID::ReportSize<8>,
+        USB::HID::ReportCount<USB_TELEMETRY_SIZE>,
+        USB::HID::Usage<0x02>, // To the host
+        USB::HID::Input<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute>,
+        USB::HID::Usage<0x03>, // From the host
+        USB::HID::Output<USB::HID::Data, USB::HID::Variable, USB::HID::Absolute>
+    >
+> hid_report_descriptor;
+
+static const hid_report_descriptor hid_report_descriptor_blob;
+
+// Modifiers, one bit each, then the keys pressed.
+typedef USB::HID::Report<hid_report_descriptor, USB::HID::InputReport, USB_REPORT_KEYBOARD> keyboard_report;
+// Three buttons, then X, Y and the wheel.
+typedef USB::HID::Report<hid_report_descriptor, USB::HID::InputReport, USB_REPORT_MOUSE> mouse_report;
+typedef USB::HID::Report<hid_report_descriptor, USB::HID::InputReport, USB_REPORT_TELEMETRY> telemetry_report;
+
+static_assert(telemetry_report::wLength <= HID_IN_PACKET, "Reports don't fit in the HID IN endpoint");
+
 //For reminder purpose, not used anymore
 struct ExtraDescriptor : USB::OptionalDescriptorBase {
     uint8_t m_extra[9] = {
@@ -39,7 +145,7 @@ struct ExtraDescriptor : USB::OptionalDescriptorBase {
 } __attribute__((packed));
 
 static const USB::DeviceDescriptor<
-    USB::USB2_0,
+    USB::USB2_1, // for the BOS descriptor
     USB::DeviceClass_NONE,
     USB::DeviceSubClass<0>,
     USB::DeviceProtocol<0>,
@@ -62,26 +168,43 @@ static const USB::DeviceDescriptor<
                 USB::InterfaceAlternateList<
                     USB::InterfaceDescriptorExtended<
                         USB::InterfaceClass_HID,
-                        USB::InterfaceSubClass<1>,
-                        USB::InterfaceProtocol<2>,
+                        USB::InterfaceSubClass<0>,
+                        USB::InterfaceProtocol<0>,
                         strings::find<interface>(), //0 in st descriptor
                         USB::OptionalDescriptorList<
                             USB::HID::HIDDescriptor<
                                 USB::HID::CountryCode_Not_Supported,
                                 USB::HID::ReportDescriptorIndexList<
-                                    USB::HID::ReportDescriptorIndex<0x004a>
+                                    USB::HID::ReportDescriptorIndex<hid_report_descriptor>
                                 >
                             >
                         >,
                         USB::EndpointDescriptorList<
                             USB::EndpointDescriptor<
-                                USB::EndpointAddress<USB::In>,
+                                USB::EndpointAddress<USB::In>, //0x81
+                                USB::InterruptEndpoint,
+                                USB::EndpointMaxPacketSize<HID_IN_PACKET>,
+                                USB::Interval<1>
+                            >,
+                            USB::EndpointDescriptor<
+                                USB::EndpointAddress<USB::Out>, //0x02
                                 USB::InterruptEndpoint,
-                                USB::EndpointMaxPacketSize<4>,
-                                USB::Interval<10>
+                                USB::EndpointMaxPacketSize<HID_OUT_PACKET>,
+                                USB::Interval<1>
                             >
                         >
                     >
+                >,
+                // Vendor requests only, through WinUSB on Windows; see the
+                // Microsoft OS 2.0 descriptors below.
+                USB::InterfaceAlternateList<
+                    USB::InterfaceDescriptor<
+                        USB::InterfaceClass_VENDORSPECIFIC,
+                        USB::InterfaceSubClass<0>,
+                        USB::InterfaceProtocol<0>,
+                        strings::find<interface4>(),
+                        USB::EndpointDescriptorList<>
+                    >
                 >
             >
         >,
@@ -133,13 +256,15 @@ static const USB::DeviceDescriptor<
                         >,
                         USB::EndpointDescriptorList<
                             USB::EndpointDescriptor<
-                                USB::EndpointAddress<USB::In>, //0x82
+                                USB::EndpointAddress<USB::In>, //0x81
                                 USB::InterruptEndpoint,
                                 USB::EndpointMaxPacketSize<8>,
                                 USB::Interval<0xff>
                             >
                         >
-                    >,
+                    >
+                >,
+                USB::InterfaceAlternateList<
                     USB::InterfaceDescriptor<
                         USB::InterfaceClass_CDCDATA,
                         USB::InterfaceSubClass<0>,
@@ -148,13 +273,13 @@ static const USB::DeviceDescriptor<
                         USB::EndpointDescriptorList<
                             USB::EndpointDescriptor<
                                 USB::EndpointAddress<USB::Out>, //0x01
-                                USB::InterruptEndpoint,
+                                USB::BulkEndpoint,
                                 USB::EndpointMaxPacketSize<64>,
                                 USB::Interval<0>
                             >,
                             USB::EndpointDescriptor<
-                                USB::EndpointAddress<USB::In>, //0x81
-                                USB::InterruptEndpoint,
+                                USB::EndpointAddress<USB::In>, //0x82
+                                USB::BulkEndpoint,
                                 USB::EndpointMaxPacketSize<64>,
                                 USB::Interval<0>
                             >
@@ -166,13 +291,62 @@ static const USB::DeviceDescriptor<
     >
 > device_descriptor;
 
+// Binds WinUSB to the vendor interface of the first configuration, without
+// an INF, and without the extra requests of the OS 1.0 descriptors.
+static constexpr uint8_t msos20_vendor_code = 0x20;
+
+typedef USB::MSOS20::DescriptorSet<
+    USB::MSOS20::Windows8_1,
+    USB::MSOS20::ConfigurationSubset<0,
+        USB::MSOS20::FunctionSubset<1,
+            USB::MSOS20::CompatibleID_WinUSB,
+            USB::MSOS20::DeviceInterfaceGUIDs<typestring_is("{2C4C3D1E-7E88-4A8E-9C5B-6F1A2D3B4C5D}")>
+        >
+    >
+> msos20_descriptor_set;
+
+static const msos20_descriptor_set msos20_descriptors;
+
+static const USB::BOSDescriptor<
+    USB::USB20ExtensionCapability<>,
+    USB::MSOS20::PlatformCapability<msos20_vendor_code, msos20_descriptor_set>
+> bos_descriptor;
+
+
+static constexpr auto configuration_table = device_descriptor.GetConfigurationTable();
+static constexpr auto string_table = strings_collection.GetStringTable();
+
+extern "C" const uint8_t * get_USB_descriptor(uint8_t type, uint8_t index, uint16_t * length) {
+    switch (type) {
+    case USB_DESC_DEVICE:
+        if (index != 0) return NULL;
+        *length = device_descriptor.m_bLength;
+        return reinterpret_cast<const uint8_t *>(&device_descriptor);
+    case USB_DESC_CONFIG:
+        return configuration_table.get(index, length);
+    case USB_DESC_STRING:
+        return string_table.get(index, length);
+    case USB_DESC_BOS:
+        if (index != 0) return NULL;
+        *length = sizeof(bos_descriptor);
+        return reinterpret_cast<const uint8_t *>(&bos_descriptor);
+    }
+    return NULL;
+}
+
+extern "C" const uint8_t * get_USB_vendor_descriptor(uint8_t request, uint16_t index, uint16_t * length) {
+    if (request != msos20_vendor_code || index != USB_MSOS20_DESCRIPTOR_INDEX) return NULL;
+    *length = sizeof(msos20_descriptors);
+    return reinterpret_cast<const uint8_t *>(&msos20_descriptors);
+}
 
 extern "C" const uint8_t * get_USB_first_interface_descriptor(int configuration) {
-    return device_descriptor.GetFirstInterfaceDescriptor(configuration);
+    const uint8_t * desc = configuration_table.get(configuration - 1, NULL);
+    return desc ? desc + device_descriptor.firstInterfaceOffset : NULL;
 }
 
-extern "C" const uint8_t * get_USB_configuration_descriptor(int index) {
-    return device_descriptor.GetConfigurationDescriptor(index);
+extern "C" const uint8_t * get_USB_configuration_descriptor(int configuration) {
+    return configuration_table.get(configuration - 1, NULL);
 }
 
 extern "C" const uint8_t * get_USB_device_descriptor() {
@@ -180,7 +354,41 @@ extern "C" const uint8_t * get_USB_device_descriptor() {
 }
 
 extern "C" const uint8_t * get_USB_string_descriptor(int index) {
-    return strings_collection.GetStringDescriptor(index);
+    return string_table.get(index, NULL);
+}
+
+// The HID interface is in the first configuration only.
+extern "C" const uint8_t * get_USB_hid_descriptor(int interface) {
+    return USB::FindInterfaceDescriptor(configuration_table.get(0, NULL), interface, USB_DESC_HID);
+}
+
+extern "C" const uint8_t * get_USB_report_descriptor(int interface) {
+    return interface == 0 ? reinterpret_cast<const uint8_t *>(&hid_report_descriptor_blob) : NULL;
+}
+
+extern "C" uint16_t get_USB_report_descriptor_size(int interface) {
+    return interface == 0 ? sizeof(hid_report_descriptor) : 0;
+}
+
+extern "C" void usb_send_keyboard_report(uint8_t modifiers, const uint8_t keys[6]) {
+    keyboard_report report(
+        modifiers & 1, (modifiers >> 1) & 1, (modifiers >> 2) & 1, (modifiers >> 3) & 1,
+        (modifiers >> 4) & 1, (modifiers >> 5) & 1, (modifiers >> 6) & 1, (modifiers >> 7) & 1,
+        keys[0], keys[1], keys[2], keys[3], keys[4], keys[5]);
+    usb_send_report(const_cast<uint8_t *>(report.data()), sizeof(report));
+}
+
+extern "C" void usb_send_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel) {
+    mouse_report report(buttons & 1, (buttons >> 1) & 1, (buttons >> 2) & 1, x, y, wheel);
+    usb_send_report(const_cast<uint8_t *>(report.data()), sizeof(report));
+}
+
+extern "C" void usb_send_telemetry(const uint8_t * data, uint16_t len) {
+    uint8_t report[telemetry_report::wLength] = { USB_REPORT_TELEMETRY };
+    if (len > telemetry_report::wLength - 1)
+        len = telemetry_report::wLength - 1;
+    memcpy(report + 1, data, len);
+    usb_send_report(report, sizeof(report));
 }
 
 
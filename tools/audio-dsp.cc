@@ -0,0 +1,303 @@
+// Host side test of the audio sample processing (usbd_audio_dsp.c): runs
+// the gain and the format conversion on random samples, and compares what
+// they give with a floating point model written from the USB audio formats
+// rather than from the code:
+//   - the volume is (vol / 100)^2, and a change ramps by 1/256 of unity per
+//     frame; mute ramps to 0;
+//   - a subframe of 2, 3 or 4 bytes holds a left justified sample, the
+//     value being the subframe read as a signed fraction of full scale;
+//   - a 16 bits output is the value rounded, a 32 bits one the value as is,
+//     and the downmix the mean of the channels.
+// The largest difference seen, in least significant bits of the output, is
+// printed for each case; one above the tolerance makes the exit status non
+// zero. The tolerances are what the fixed point allows: the gain is 16.16,
+// so it is good to 2^-16 of full scale, about 0.5 LSB of 16 bits or 2^15 of
+// 32 bits, and the samples it scales are truncated; the downmix drops the
+// lowest bit of each channel before adding them.
+//
+// Build:
+//   cc -c -DUSE_USB_OTG_FS -Itools/host -Iinclude
+//       -ILibraries/STM32_USB_OTG_Driver/inc
+//       -ILibraries/STM32_USB_Device_Library/Core/inc
+//       -ILibraries/STM32_USB_Device_Library/Class/audio/inc
+//       Libraries/STM32_USB_Device_Library/Class/audio/src/usbd_audio_dsp.c
+//   c++ -std=c++11 (same flags) tools/audio-dsp.cc usbd_audio_dsp.o -o audio-dsp
+//
+// On the host, usbd_audio_dsp.c uses the portable versions of the DSP
+// instructions, which are meant to give the same results.
+//
+// Usage:
+//   audio-dsp [seed]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+#include "usbd_audio_dsp.h"
+}
+
+namespace {
+
+const unsigned kRounds = 2000;
+const unsigned kMaxFrames = 96;
+
+uint32_t seed = 1;
+
+uint32_t random(uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+uint32_t random32() {
+    return (random(0x10000) << 16) | random(0x10000);
+}
+
+unsigned failures;
+
+void fail(const char *test, const char *what) {
+    fprintf(stderr, "audio-dsp: %s: %s\n", test, what);
+    failures++;
+}
+
+// The largest difference of a test, against its tolerance.
+struct Error {
+    char test[64];
+    double tolerance;
+    double max = 0;
+    unsigned samples = 0;
+
+    Error(const char *name, double tolerance) : tolerance(tolerance) {
+        snprintf(test, sizeof(test), "%s", name);
+    }
+
+    void add(double got, double expected) {
+        max = fmax(max, fabs(got - expected));
+        samples++;
+    }
+
+    void report() {
+        printf("%-28s %8u %12.2f %12.2f\n", test, samples, max, tolerance);
+        if (max > tolerance)
+            fail(test, "differs from the model");
+    }
+};
+
+// The gain, as the model has it.
+struct Gain {
+    double current, target, volume;
+    bool mute;
+
+    static double of(unsigned vol) {
+        return vol >= 100 ? 1.0 : (vol / 100.0) * (vol / 100.0);
+    }
+
+    explicit Gain(unsigned vol) : current(of(vol)), target(of(vol)), volume(of(vol)), mute(false) {}
+
+    void set_volume(unsigned vol) {
+        volume = of(vol);
+        if (!mute)
+            target = volume;
+    }
+
+    void set_mute(bool m) {
+        mute = m;
+        target = mute ? 0 : volume;
+    }
+
+    double step() {
+        if (current < target)
+            current = fmin(current + 1.0 / 256, target);
+        else
+            current = fmax(current - 1.0 / 256, target);
+        return current;
+    }
+};
+
+// Volume and mute changes between buffers of random sizes, on random
+// samples, for 16 or 32 bits frames.
+void gain(bool wide) {
+    Error error(wide ? "gain, 32 bits" : "gain, 16 bits", wide ? 65536 + 2 : 2);
+
+    unsigned vol = random(101);
+    AUDIO_DSP_Gain_TypeDef dsp;
+    AUDIO_DSP_GainInit(&dsp, vol);
+    Gain model(vol);
+
+    std::vector<int16_t> b16(2 * kMaxFrames);
+    std::vector<int32_t> b32(2 * kMaxFrames);
+    for (unsigned round = 0; round < kRounds; round++) {
+        switch (random(8)) {
+        case 0:
+            vol = random(4) ? random(101) : 100;
+            AUDIO_DSP_SetVolume(&dsp, vol);
+            model.set_volume(vol);
+            break;
+        case 1: {
+            bool m = random(2);
+            AUDIO_DSP_SetMute(&dsp, m);
+            model.set_mute(m);
+            break;
+        }
+        }
+
+        unsigned frames = random(kMaxFrames + 1);
+        std::vector<double> in(2 * frames);
+        for (unsigned i = 0; i < 2 * frames; i++) {
+            if (wide) {
+                b32[i] = (int32_t)random32();
+                in[i] = b32[i];
+            } else {
+                b16[i] = (int16_t)random(0x10000);
+                in[i] = b16[i];
+            }
+        }
+        if (wide)
+            AUDIO_DSP_Gain32(&dsp, b32.data(), frames);
+        else
+            AUDIO_DSP_Gain16(&dsp, b16.data(), frames);
+
+        for (unsigned f = 0; f < frames; f++) {
+            double g = model.step();
+            for (unsigned c = 0; c < 2; c++) {
+                unsigned i = 2 * f + c;
+                error.add(wide ? b32[i] : b16[i], in[i] * g);
+            }
+        }
+        // Both at the same point of the ramp, within the 16.16 precision
+        if (fabs(dsp.current / 65536.0 - model.current) > 2.0 / 65536) {
+            fail(error.test, "ramp out of step");
+            break;
+        }
+    }
+    error.report();
+}
+
+// A sample of the given subframe size, as the model reads it.
+double value(const uint8_t *p, unsigned bytes) {
+    int64_t v = 0;
+    for (unsigned i = 0; i < bytes; i++)
+        v |= (int64_t)p[i] << (8 * i);
+    if (v & ((int64_t)1 << (8 * bytes - 1)))
+        v -= (int64_t)1 << (8 * bytes);
+    return v / (double)((int64_t)1 << (8 * bytes - 1));
+}
+
+const char *channel(uint8_t map) {
+    return map == AUDIO_DSP_MIX ? "mix" : map ? "R" : "L";
+}
+
+// One stream format and channel map, on random frames.
+void convert(unsigned channels, unsigned subframe, unsigned resolution, unsigned out_bytes,
+             uint8_t map0, uint8_t map1) {
+    char test[64];
+    snprintf(test, sizeof(test), "%u ch %u/%u to %u, %s %s", channels, resolution, subframe * 8,
+             out_bytes * 8, channel(map0), channel(map1));
+    bool mix = map0 == AUDIO_DSP_MIX || map1 == AUDIO_DSP_MIX;
+    Error error(test, mix ? 1 : 0);
+
+    AUDIO_DSP_Format_TypeDef fmt;
+    if (AUDIO_DSP_FormatInit(&fmt, channels, subframe, resolution, out_bytes) != USBD_OK) {
+        fail(error.test, "format refused");
+        return;
+    }
+    if (fmt.map[0] != 0 || fmt.map[1] != channels - 1)
+        fail(error.test, "not the default map");
+    fmt.map[0] = map0;
+    fmt.map[1] = map1;
+
+    // Words, for the alignment the kernels expect
+    std::vector<uint32_t> in(kMaxFrames * 2 * 4 / 4);
+    std::vector<uint32_t> out(kMaxFrames * 2 * 4 / 4);
+    uint8_t *pin = (uint8_t *)in.data();
+    uint8_t *pout = (uint8_t *)out.data();
+    double scale = out_bytes == 2 ? 32768.0 : 2147483648.0;
+
+    for (unsigned round = 0; round < kRounds / 10; round++) {
+        unsigned frames = 1 + random(kMaxFrames);
+        unsigned unused = subframe * 8 - resolution;
+        for (unsigned i = 0; i < frames * channels; i++) {
+            uint32_t v = random32() >> unused << unused;
+            // Full scale, now and then
+            if (!random(16))
+                v = random(2) ? (0x7FFFFFFFu >> (32 - subframe * 8)) >> unused << unused
+                              : 0x80000000u >> (32 - subframe * 8);
+            for (unsigned b = 0; b < subframe; b++)
+                pin[i * subframe + b] = v >> (8 * b);
+        }
+        if (AUDIO_DSP_Convert(&fmt, pin, pout, frames) != frames * 2 * out_bytes) {
+            fail(error.test, "wrong output size");
+            return;
+        }
+
+        for (unsigned f = 0; f < frames; f++) {
+            const uint8_t *frame = pin + f * channels * subframe;
+            double x[2] = { value(frame, subframe), value(frame + (channels - 1) * subframe, subframe) };
+            for (unsigned c = 0; c < 2; c++) {
+                uint8_t map = c ? map1 : map0;
+                double v = map == AUDIO_DSP_MIX ? (x[0] + x[1]) / 2 : x[map];
+                double expected, got;
+                if (out_bytes == 2) {
+                    expected = fmin(floor(v * scale + 0.5), 32767);
+                    got = ((int16_t *)pout)[2 * f + c];
+                } else {
+                    expected = v * scale;
+                    got = ((int32_t *)pout)[2 * f + c];
+                }
+                error.add(got, expected);
+            }
+        }
+    }
+    error.report();
+}
+
+void formats() {
+    const struct { unsigned subframe, resolution; } streams[] = {
+        { 2, 16 }, { 3, 24 }, { 4, 24 }, { 4, 32 }, { 3, 20 },
+    };
+    const uint8_t maps[][2] = {
+        { 0, 1 }, { 1, 0 }, { 0, 0 }, { 1, 1 }, { AUDIO_DSP_MIX, AUDIO_DSP_MIX }, { 0, AUDIO_DSP_MIX },
+    };
+
+    for (const auto &s : streams) {
+        for (unsigned out_bytes : { 2, 4 }) {
+            convert(1, s.subframe, s.resolution, out_bytes, 0, 0);
+            for (const auto &m : maps)
+                convert(2, s.subframe, s.resolution, out_bytes, m[0], m[1]);
+        }
+    }
+}
+
+// What the descriptors may hold but the conversion can't do.
+void refused() {
+    const struct { unsigned channels, subframe, resolution, out_bytes; } bad[] = {
+        { 0, 2, 16, 2 }, { 3, 2, 16, 2 }, { 2, 1, 8, 2 }, { 2, 5, 24, 2 },
+        { 2, 2, 24, 2 }, { 2, 3, 32, 4 }, { 2, 2, 16, 3 },
+    };
+    AUDIO_DSP_Format_TypeDef fmt;
+    for (const auto &b : bad) {
+        if (AUDIO_DSP_FormatInit(&fmt, b.channels, b.subframe, b.resolution, b.out_bytes) == USBD_OK) {
+            char what[64];
+            snprintf(what, sizeof(what), "%u channels, %u/%u bits to %u accepted",
+                     b.channels, b.resolution, b.subframe * 8, b.out_bytes * 8);
+            fail("formats", what);
+        }
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    seed = argc > 1 ? atoi(argv[1]) : 1;
+
+    printf("%-28s %8s %12s %12s\n", "test", "samples", "max, LSB", "tolerance");
+    gain(false);
+    gain(true);
+    formats();
+    refused();
+    return failures ? 1 : 0;
+}
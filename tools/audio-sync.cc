@@ -0,0 +1,528 @@
+// Host side simulation of the clock synchronization of the audio class
+// (usbd_audio_core.c): a host streaming to the speaker at the rate the
+// explicit feedback endpoint asks for, and a codec playing from the FIFO
+// on a clock of its own, off the USB one by a few hundred ppm, and
+// drifting. Checks, for a few rates and clocks:
+//   - every sample is played once and in order: no FIFO overflow, and no
+//     underrun once playback started;
+//   - the FIFO level settles around its middle, and stays there;
+//   - the feedback the host follows matches the codec rate, and doesn't
+//     swing around it by more than the drift of the codec clock needs.
+// The same goes for the microphone, whose packets the class sizes out of
+// the level of the capture ring (AUDIO_IN_SOF):
+//   - every sample is sent once and in order, but for the packets the host
+//     didn't poll, and no silence once the ring was half full;
+//   - the latency, from the capture of a sample to its packet, stays
+//     around the middle of the ring;
+//   - the packets follow the codec rate, adjusted by a sample frame no more
+//     often than the drift needs.
+// Any failure makes the exit status non zero.
+//
+// Build:
+//   cc -c -DUSE_USB_OTG_FS -DUSBD_AUDIO_IN_ENABLED -DUSBD_AUDIO_FREQ=48000
+//       -DUSBD_AUDIO_MAX_FREQ=96000 -DDEFAULT_VOLUME=70 -Itools/host -Iinclude
+//       -ILibraries/STM32_USB_OTG_Driver/inc
+//       -ILibraries/STM32_USB_Device_Library/Core/inc
+//       -ILibraries/STM32_USB_Device_Library/Class/audio/inc
+//       Libraries/STM32_USB_Device_Library/Class/audio/src/usbd_audio_core.c
+//       Libraries/STM32_USB_Device_Library/Class/audio/src/usbd_audio_fifo.c
+//   c++ -std=c++11 -Wno-invalid-offsetof -I. (same flags) tools/audio-sync.cc
+//       example-usb-audio-descriptors.cc *.o -o audio-sync
+//
+// The descriptors are the ones of example-usb-audio-descriptors.cc. The
+// host polls the feedback endpoint in each frame it was armed in, and sizes
+// its packets from the last value it got, carrying the fraction over as
+// Linux does. The codec plays each chunk the class hands it at its own
+// rate, and calls USBD_AUDIO_OUT_TransferComplete at the end of it, and
+// GetPosition gives how much of it it played, as a DMA counter would; the
+// first 4 bytes of each sample frame carry a counter, for the codec to
+// check. The microphone codec writes the ring in circular mode at its own
+// rate, and the host polls the microphone endpoint in the middle of each
+// frame. The driver under the class, usb_dcd.c and usb_dcd_int.c, is not
+// run.
+//
+// Usage:
+//   audio-sync
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+extern "C" {
+#include "usbd_audio_core.h"
+#include "usbd_audio_out_if.h"
+}
+
+namespace {
+
+const unsigned kFrames = 20000;         // 20 s
+const unsigned kSettle = 5000;          // frames before the checks
+const unsigned kOutEp = 0x01;
+const unsigned kFeedbackEp = 0x82;
+const unsigned kMicEp = 0x81;
+const double kMaxSwing = 2000;          // ppm, from the lowest to the highest
+
+struct Scenario {
+    const char *name;
+    uint8_t alt;
+    uint32_t freq;
+    std::function<double(double)> ppm;  // of the codec clock, over time in s
+};
+
+USB_OTG_CORE_HANDLE core;
+double now;                             // in us
+const Scenario *scenario;
+uint32_t frame_size;
+unsigned failures;
+
+void fail(const char *what) {
+    fprintf(stderr, "audio-sync: %s: %s\n", scenario->name, what);
+    failures++;
+}
+
+uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// What the device armed on its IN endpoints, for the host to pick up.
+struct In {
+    bool armed = false;
+    std::vector<uint8_t> data;
+} in[16];
+
+uint8_t *out_buf;
+uint16_t out_len;
+uint8_t *ctl_buf;
+
+// The codec, playing a chunk at a time at its own rate.
+struct Codec {
+    bool playing = false;
+    const uint8_t *buf = nullptr;
+    uint32_t len = 0;
+    double start = 0, end = 0;
+    double rate = 0;                    // samples per us
+    uint32_t expected = 0;              // counter of the next sample frame
+    uint64_t played = 0;
+    bool started = false;
+    unsigned underruns = 0;
+    unsigned gaps = 0;
+} codec;
+
+double codec_rate(double t) {
+    return scenario->freq * (1 + scenario->ppm(t / 1e6) * 1e-6) / 1e6;
+}
+
+void play(uint8_t *pbuf, uint32_t size) {
+    codec.playing = true;
+    codec.buf = pbuf;
+    codec.len = size;
+    codec.start = now;
+    codec.rate = codec_rate(now);
+    codec.end = now + size / frame_size / codec.rate;
+    codec.started = true;
+}
+
+// The end of the chunk being played: check it, and get the next one.
+void complete() {
+    now = codec.end;
+    for (uint32_t i = 0; i + frame_size <= codec.len; i += frame_size) {
+        uint32_t counter = get32(codec.buf + i);
+        if (counter != codec.expected && codec.gaps++ == 0)
+            fail("samples lost or played twice");
+        codec.expected = counter + 1;
+    }
+    codec.played += codec.len / frame_size;
+    codec.playing = false;
+    USBD_AUDIO_OUT_TransferComplete();
+}
+
+// Samples in the device, the one being played counted as it goes.
+double depth(uint32_t sent) {
+    double played = codec.played;
+    if (codec.playing)
+        played += (now - codec.start) * codec.rate;
+    return sent - played;
+}
+
+void setup(uint8_t bmRequest, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
+           const uint8_t *data = nullptr, uint16_t wLength = 0) {
+    USB_SETUP_REQ req = { bmRequest, bRequest, wValue, wIndex, wLength };
+    ctl_buf = nullptr;
+    AUDIO_cb.Setup(&core, &req);
+    if (wLength && ctl_buf) {
+        memcpy(ctl_buf, data, wLength);
+        AUDIO_cb.EP0_RxReady(&core);
+    }
+}
+
+void run(const Scenario &s) {
+    scenario = &s;
+    codec = Codec();
+    for (auto &ep : in)
+        ep = In();
+    now = 0;
+
+    AUDIO_cb.Init(&core, 1);
+    setup(0x01, USB_REQ_SET_INTERFACE, s.alt, AUDIO_STREAMING_IF);
+    uint8_t freq[3] = { (uint8_t)s.freq, (uint8_t)(s.freq >> 8), (uint8_t)(s.freq >> 16) };
+    setup(0x22, AUDIO_REQ_SET_CUR, AUDIO_SAMPLING_FREQ_CONTROL << 8, kOutEp, freq, 3);
+    if (USBD_AUDIO_GetFrequency() != s.freq)
+        fail("rate not taken");
+    frame_size = s.alt == 1 ? 4 : 6;
+    // The stream was restarted by the rate change: from scratch
+    codec = Codec();
+
+    uint32_t fb = ((s.freq / 1000) << 16) + (((s.freq % 1000) << 16) / 1000);
+    uint32_t accum = 0, sent = 0;
+    double min = 1e9, max = 0, fb_sum = 0, rate_sum = 0, fb_min = 1e9, fb_max = 0;
+    unsigned window = 0;
+
+    for (unsigned f = 0; f < kFrames; f++) {
+        double sof = f * 1000.0;
+        while (codec.playing && codec.end <= sof)
+            complete();
+        now = sof;
+
+        AUDIO_cb.SOF(&core);
+
+        // The feedback, if armed in this frame
+        In &feedback = in[kFeedbackEp & 0x7F];
+        if (feedback.armed) {
+            feedback.armed = false;
+            fb = (feedback.data[0] | (feedback.data[1] << 8) | (feedback.data[2] << 16)) << 2;
+            AUDIO_cb.DataIn(&core, kFeedbackEp & 0x7F);
+        }
+
+        // The packet of the frame
+        accum += fb;
+        uint32_t n = accum >> 16;
+        accum &= 0xFFFF;
+        if (!out_buf) {
+            fail("OUT endpoint not armed");
+            break;
+        }
+        if (n * frame_size > out_len) {
+            fail("packet larger than the endpoint takes");
+            break;
+        }
+        memset(out_buf, 0, n * frame_size);
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t counter = sent + i;
+            memcpy(out_buf + i * frame_size, &counter, 4);
+        }
+        sent += n;
+        out_buf = nullptr;
+        core.dev.out_ep[kOutEp].xfer_count = n * frame_size;
+        AUDIO_cb.DataOut(&core, kOutEp);
+
+        if (f >= kSettle) {
+            double d = depth(sent) / (s.freq / 1000.0);
+            min = fmin(min, d);
+            max = fmax(max, d);
+            fb_min = fmin(fb_min, fb / 65536.0);
+            fb_max = fmax(fb_max, fb / 65536.0);
+        }
+        if (f >= kFrames - 2000) {
+            fb_sum += fb / 65536.0;
+            rate_sum += codec_rate(now) * 1000;
+            window++;
+        }
+    }
+
+    double error = (fb_sum / rate_sum - 1) * 1e6;
+    double swing = (fb_max - fb_min) / (s.freq / 1000.0) * 1e6;
+    printf("%-28s %8.2f %8.2f %8.1f %8.0f %10u %6u\n", s.name, min, max, error, swing, codec.underruns, codec.gaps);
+    if (codec.underruns)
+        fail("underrun");
+    if (min < 2 || max > OUT_PACKET_NUM - 2)
+        fail("FIFO level strays from the middle");
+    if (fabs(error) > 20)
+        fail("feedback off the codec rate");
+    if (swing > kMaxSwing)
+        fail("feedback swinging");
+
+    setup(0x01, USB_REQ_SET_INTERFACE, 0, AUDIO_STREAMING_IF);
+    AUDIO_cb.DeInit(&core, 1);
+}
+
+// The microphone codec, writing the ring the class gave it in circular
+// mode at its own rate. Sample n is n % 65535 + 1, so that silence reads
+// 0 and the host can tell what it got.
+struct Mic {
+    bool running = false;
+    uint8_t *ring = nullptr;
+    uint32_t size = 0;
+    double written = 0;                 // sample frames since the start
+    double last = 0;
+} mic;
+
+const uint32_t kMicFrame = 2;           // mono, 16 bits
+
+void mic_advance() {
+    if (!mic.running)
+        return;
+    uint64_t from = mic.written;
+    mic.written += (now - mic.last) * codec_rate(mic.last);
+    mic.last = now;
+    uint32_t frames = mic.size / kMicFrame;
+    for (uint64_t n = from; n < (uint64_t)mic.written; n++) {
+        uint16_t v = n % 65535 + 1;
+        memcpy(mic.ring + n % frames * kMicFrame, &v, kMicFrame);
+    }
+}
+
+// The sample frame v was, the latest one of that value written so far.
+uint64_t mic_index(uint16_t v) {
+    uint64_t last = (uint64_t)mic.written - 1;
+    return last - (last - (v - 1)) % 65535;
+}
+
+// The host polling the microphone endpoint in the middle of each frame,
+// but for the frames in skip, whose packets the device has to drop.
+void capture(const Scenario &s, unsigned skip_from = 0, unsigned skip = 0) {
+    scenario = &s;
+    mic = Mic();
+    for (auto &ep : in)
+        ep = In();
+    now = 0;
+
+    AUDIO_cb.Init(&core, 1);
+    memset(&USBD_AUDIO_IN_Stats, 0, sizeof(USBD_AUDIO_IN_Stats));
+    setup(0x01, USB_REQ_SET_INTERFACE, s.alt, AUDIO_STREAMING_IN_IF);
+    if (USBD_AUDIO_IN_GetFrequency() != s.freq)
+        fail("rate not taken");
+
+    In &ep = in[kMicEp & 0x7F];
+    uint64_t received = 0, start = 0;
+    uint16_t expected = 0, last = 0;
+    bool started = false;
+    unsigned gaps = 0, silences = 0;
+    double min = 1e9, max = 0;
+    bool window = false;
+    uint64_t window_received = 0;
+    double window_written = 0;
+    double drift = 0;                   // sample frames off the nominal rate
+
+    for (unsigned f = 0; f < kFrames; f++) {
+        now = f * 1000.0;
+        mic_advance();
+        AUDIO_cb.SOF(&core);
+
+        now += 500;
+        mic_advance();
+        if (f >= skip_from && f < skip_from + skip) {
+            // Not polled: the incomplete IN interrupt, at the end of the frame
+            now += 400;
+            mic_advance();
+            if (ep.armed) {
+                AUDIO_cb.IsoINIncomplete(&core);
+                // The samples of the packet are lost: resynchronize
+                started = false;
+            }
+            continue;
+        }
+        if (!ep.armed) {
+            fail("no packet in the frame");
+            break;
+        }
+        ep.armed = false;
+        AUDIO_cb.DataIn(&core, kMicEp & 0x7F);
+
+        for (size_t i = 0; i + kMicFrame <= ep.data.size(); i += kMicFrame) {
+            uint16_t v = ep.data[i] | (ep.data[i + 1] << 8);
+            if (!v) {
+                if (started && silences++ == 0)
+                    fail("silence once capture started");
+                continue;
+            }
+            if (started && v != expected && gaps++ == 0)
+                fail("samples lost or sent twice");
+            if (!started)
+                start = f;
+            started = true;
+            expected = v % 65535 + 1;
+            last = v;
+        }
+        received += ep.data.size() / kMicFrame;
+
+        // Samples captured but not sent yet: the latency of the capture
+        if (started && f >= start + kSettle / 5 && f >= skip_from + skip) {
+            double d = (mic.written - mic_index(last) - 1) / (s.freq / 1000.0);
+            min = fmin(min, d);
+            max = fmax(max, d);
+        }
+        // From the poll of the first frame of the window on
+        if (f >= kSettle && f >= skip_from + skip) {
+            if (window)
+                window_received += ep.data.size() / kMicFrame;
+            else
+                window_written = -mic.written;
+            window = true;
+        }
+        drift += fabs(codec_rate(now) * 1000 - s.freq / 1000.0);
+    }
+    window_written += mic.written;
+
+    double error = (window_received / window_written - 1) * 1e6;
+    printf("%-28s %8.2f %8.2f %8.1f %8u %8u %8u %6u\n", s.name, min, max, error,
+           (unsigned)USBD_AUDIO_IN_Stats.adjusted, (unsigned)USBD_AUDIO_IN_Stats.dropped,
+           (unsigned)USBD_AUDIO_IN_Stats.underruns + (unsigned)USBD_AUDIO_IN_Stats.overruns, gaps);
+    if (USBD_AUDIO_IN_Stats.dropped != skip)
+        fail("packets dropped other than the ones not polled");
+    if (USBD_AUDIO_IN_Stats.underruns || USBD_AUDIO_IN_Stats.overruns)
+        fail("ring underrun or overrun");
+    if (min < 1 || max > IN_PACKET_NUM - 1)
+        fail("latency strays from the middle of the ring");
+    if (fabs(error) > 20)
+        fail("packets off the codec rate");
+    // Once per sample frame of drift, and for the way there
+    if (USBD_AUDIO_IN_Stats.adjusted > drift + AUDIO_IN_RATE_THRESHOLD + 1)
+        fail("packets adjusted more than the drift needs");
+
+    setup(0x01, USB_REQ_SET_INTERFACE, 0, AUDIO_STREAMING_IN_IF);
+    AUDIO_cb.DeInit(&core, 1);
+}
+
+}
+
+extern "C" {
+
+uint8_t in_Init(uint32_t, uint32_t, uint32_t) { return AUDIO_OK; }
+uint8_t in_DeInit(uint32_t) { return AUDIO_OK; }
+
+uint8_t in_AudioCmd(uint8_t *pbuf, uint32_t size, uint8_t cmd) {
+    switch (cmd) {
+    case AUDIO_CMD_PLAY:
+        mic.running = true;
+        mic.ring = pbuf;
+        mic.size = size;
+        mic.written = 0;
+        mic.last = now;
+        break;
+    case AUDIO_CMD_PAUSE:
+    case AUDIO_CMD_STOP:
+        mic_advance();
+        mic.running = false;
+        break;
+    }
+    return AUDIO_OK;
+}
+
+uint32_t in_GetPosition(void) {
+    mic_advance();
+    return (uint64_t)mic.written % (mic.size / kMicFrame) * kMicFrame;
+}
+
+uint8_t out_Init(uint32_t, uint32_t, uint32_t) { return AUDIO_OK; }
+uint8_t out_DeInit(uint32_t) { return AUDIO_OK; }
+
+uint8_t out_AudioCmd(uint8_t *pbuf, uint32_t size, uint8_t cmd) {
+    switch (cmd) {
+    case AUDIO_CMD_PLAY:
+        if (codec.playing)
+            fail("chunk played before the previous one ended");
+        play(pbuf, size);
+        break;
+    case AUDIO_CMD_PAUSE:
+    case AUDIO_CMD_STOP:
+        if (codec.started)
+            codec.underruns++;
+        codec.playing = false;
+        break;
+    }
+    return AUDIO_OK;
+}
+
+uint8_t out_VolumeCtl(uint8_t) { return AUDIO_OK; }
+uint8_t out_MuteCtl(uint8_t) { return AUDIO_OK; }
+uint8_t out_PeriodicTC(uint8_t) { return AUDIO_OK; }
+uint8_t out_GetState(void) { return 0; }
+
+uint32_t out_GetPosition(void) {
+    if (!codec.playing)
+        return 0;
+    uint32_t frames = (now - codec.start) * codec.rate;
+    return std::min(frames * frame_size, codec.len);
+}
+
+AUDIO_FOPS_TypeDef AUDIO_OUT_fops = {
+    out_Init, out_DeInit, out_AudioCmd, out_VolumeCtl, out_MuteCtl, out_PeriodicTC, out_GetState, NULL, out_GetPosition
+};
+
+AUDIO_FOPS_TypeDef AUDIO_IN_fops = {
+    in_Init, in_DeInit, in_AudioCmd, out_VolumeCtl, out_MuteCtl, out_PeriodicTC, out_GetState, NULL, in_GetPosition
+};
+
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *, uint8_t, uint16_t, uint8_t) { return 0; }
+uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *, uint8_t) { return 0; }
+
+uint32_t DCD_EP_Flush(USB_OTG_CORE_HANDLE *, uint8_t epnum) {
+    in[epnum & 0x7F].armed = false;
+    return 0;
+}
+
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *, uint8_t, uint8_t *pbuf, uint16_t buf_len) {
+    out_buf = pbuf;
+    out_len = buf_len;
+    return 0;
+}
+
+uint32_t DCD_EP_Tx(USB_OTG_CORE_HANDLE *, uint8_t ep_addr, uint8_t *pbuf, uint32_t buf_len) {
+    In &ep = in[ep_addr & 0x7F];
+    if (ep.armed)
+        fail("IN endpoint armed twice");
+    ep.armed = true;
+    ep.data.assign(pbuf, pbuf + buf_len);
+    return 0;
+}
+
+USBD_Status USBD_CtlPrepareRx(USB_OTG_CORE_HANDLE *, uint8_t *pbuf, uint16_t) {
+    ctl_buf = pbuf;
+    return USBD_OK;
+}
+
+void USBD_CtlError(USB_OTG_CORE_HANDLE *, USB_SETUP_REQ *) {
+    fail("request stalled");
+}
+
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *, uint8_t *, uint16_t) { abort(); }
+
+}
+
+int main() {
+    const double kPi = 3.14159265358979;
+    const Scenario scenarios[] = {
+        { "48kHz, same clock", 1, 48000, [](double) { return 0.0; } },
+        { "48kHz, +500 ppm", 1, 48000, [](double) { return 500.0; } },
+        { "48kHz, -500 ppm", 1, 48000, [](double) { return -500.0; } },
+        { "44.1kHz, +200 ppm", 1, 44100, [](double) { return 200.0; } },
+        { "48kHz, -300 to +300 ppm", 1, 48000, [](double t) { return -300 + 600 * t / 20; } },
+        { "48kHz, 200 ppm wander", 1, 48000, [&](double t) { return 200 * sin(2 * kPi * t / 4); } },
+        { "96kHz 24 bits, -300 ppm", 2, 96000, [](double) { return -300.0; } },
+    };
+
+    printf("%-28s %8s %8s %8s %8s %10s %6s\n", "codec clock", "min, ms", "max, ms", "fb, ppm", "swing", "underruns", "gaps");
+    for (const auto &s : scenarios)
+        run(s);
+
+    const Scenario microphone[] = {
+        { "mic 48kHz, same clock", 1, 48000, [](double) { return 0.0; } },
+        { "mic 48kHz, +500 ppm", 1, 48000, [](double) { return 500.0; } },
+        { "mic 48kHz, -500 ppm", 1, 48000, [](double) { return -500.0; } },
+        { "mic 48kHz, -300 to +300 ppm", 1, 48000, [](double t) { return -300 + 600 * t / 20; } },
+        { "mic 48kHz, 200 ppm wander", 1, 48000, [&](double t) { return 200 * sin(2 * kPi * t / 4); } },
+    };
+
+    printf("\n%-28s %8s %8s %8s %8s %8s %8s %6s\n", "codec clock", "min, ms", "max, ms", "rate, ppm",
+           "adjusted", "dropped", "xruns", "gaps");
+    for (const auto &s : microphone)
+        capture(s);
+    capture({ "mic 48kHz, 10 polls missed", 1, 48000, [](double) { return 300.0; } }, 10000, 10);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#!/bin/sh
+# Compile time and memory of the descriptor templates: builds device
+# descriptors of increasing size, with as many strings as interfaces, and
+# reports how long the compiler took and how much memory it needed.
+#
+# Usage:
+#   tools/descriptor-bench.sh [sizes...]
+#
+# Sizes default to "4 8 16 32 64". Each size N makes N strings of 48
+# characters and N interfaces of two endpoints each. CXX (c++) and
+# CXXFLAGS are honoured; the compiler only checks the syntax, so no
+# toolchain for the target is needed. The memory needs GNU time.
+
+CXX=${CXX:-c++}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+SIZES=${*:-4 8 16 32 64}
+
+generate() {
+    n=$1
+    echo '#include "usb_descriptors.hh"'
+    echo
+    i=1
+    while [ $i -le $n ]; do
+        printf 'typedef USB::StringDescriptor<typestring_is("String %04d abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ")> s%d;\n' $i $i
+        i=$((i + 1))
+    done
+    echo
+    echo 'typedef USB::StringCollection<'
+    i=1
+    while [ $i -le $n ]; do
+        [ $i -lt $n ] && sep=, || sep=
+        echo "    s$i$sep"
+        i=$((i + 1))
+    done
+    echo '> strings;'
+    echo
+    echo 'static const strings strings_collection;'
+    echo
+    echo 'static const USB::DeviceDescriptor<USB::USB2_0, USB::DeviceClass_NONE, USB::DeviceSubClass<0>, USB::DeviceProtocol<0>,'
+    echo '    USB::MaxPacketSize<64>, USB::VendorID<0x483>, USB::ProductID<0x5710>, USB::DeviceReleaseNumber<0x200>,'
+    echo '    strings::find<s1>(), 0, 0,'
+    echo '    USB::ConfigurationDescriptorList<USB::ConfigurationDescriptor<'
+    echo '        USB::ConfigurationAttributes<USB::ConfigurationSelfPowered>, USB::MaxPower<100>, 0,'
+    echo '        USB::InterfaceDescriptorList<'
+    i=1
+    while [ $i -le $n ]; do
+        [ $i -lt $n ] && sep=, || sep=
+        echo "            USB::InterfaceAlternateList<USB::InterfaceDescriptor<USB::InterfaceClass_VENDORSPECIFIC, USB::InterfaceSubClass<0>, USB::InterfaceProtocol<0>, strings::find<s$i>(),"
+        echo '                USB::EndpointDescriptorList<'
+        echo '                    USB::EndpointDescriptor<USB::EndpointAddress<USB::In>, USB::BulkEndpoint, USB::EndpointMaxPacketSize<64>, USB::Interval<0>>,'
+        echo '                    USB::EndpointDescriptor<USB::EndpointAddress<USB::Out>, USB::BulkEndpoint, USB::EndpointMaxPacketSize<64>, USB::Interval<0>>'
+        echo "                >>>$sep"
+        i=$((i + 1))
+    done
+    echo '        >'
+    echo '    >>'
+    echo '> device_descriptor;'
+    echo
+    echo 'static constexpr auto configuration_table = device_descriptor.GetConfigurationTable();'
+    echo 'static constexpr auto string_table = strings_collection.GetStringTable();'
+    echo
+    echo 'const uint8_t * get(int type, int index) {'
+    echo '    return type == 2 ? configuration_table.get(index, NULL) : string_table.get(index, NULL);'
+    echo '}'
+}
+
+if /usr/bin/time -f '' true 2> /dev/null; then
+    TIME="/usr/bin/time -f %e\t%M -o $TMP/time"
+else
+    TIME=
+fi
+
+printf 'size\tseconds\tmax KB\n'
+for n in $SIZES; do
+    generate $n > "$TMP/bench-$n.cc"
+    if [ -n "$TIME" ]; then
+        $TIME $CXX -std=c++11 -Wno-invalid-offsetof $CXXFLAGS -fsyntax-only -I"$ROOT" "$TMP/bench-$n.cc" || exit 1
+        printf '%s\t%s\n' $n "$(cat "$TMP/time")"
+    else
+        start=$(date +%s%N)
+        $CXX -std=c++11 -Wno-invalid-offsetof $CXXFLAGS -fsyntax-only -I"$ROOT" "$TMP/bench-$n.cc" || exit 1
+        ms=$((($(date +%s%N) - start) / 1000000))
+        printf '%s\t%d.%03d\t-\n' $n $((ms / 1000)) $((ms % 1000))
+    fi
+done
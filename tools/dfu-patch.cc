@@ -0,0 +1,579 @@
+// Host side of the DFU patch media (usbd_patch_if.c): builds compressed
+// and delta images, and applies them to a simulated flash using the very
+// decoder the device runs. Its test mode checks both ends against each
+// other.
+//
+// Build (make -C tools check does it, and runs the test):
+//   c++ -std=c++11 -O2 -ILibraries/STM32_USB_Device_Library/Class/dfu/inc
+//       tools/dfu-patch.cc Libraries/STM32_USB_Device_Library/Class/dfu/src/usbd_dfu_patch.c
+//       -o dfu-patch
+//
+// Usage:
+//   dfu-patch diff [options] old.bin new.bin patch.bin
+//       new.bin, to be written at --dest, from old.bin, found at --src.
+//   dfu-patch compress [options] new.bin patch.bin
+//       new.bin alone, to be written at --dest.
+//   dfu-patch apply [options] flash.bin patch.bin [out.bin]
+//       applies the patch to flash.bin, an image of the flash at --base,
+//       fed in --block sized downloads; writes the result to out.bin, or
+//       back to flash.bin.
+//   dfu-patch test [rounds [seed]]
+//       diffs and compresses random images, applies the patches to the
+//       simulated flash, and compares; then checks that the decoder never
+//       reports done with a wrong image when the patch is corrupted or
+//       truncated, and that it refuses a source with another CRC without
+//       touching the flash. Any failure makes the exit status non zero.
+//       rounds: images to patch (200); seed: of the images (1).
+//
+// Options:
+//   --dest ADDR     address of the new image (0x08000000)
+//   --src ADDR      address of the old image (0x08080000)
+//   --base ADDR     address of flash.bin (0x08000000)
+//   --layout STR    flash sectors, as in the DfuSe strings
+//                   ("0x08000000/04*016K,01*064K,07*128K")
+//   --block N       download block size (1024)
+//
+// The patch is then downloaded to the patch media:
+//   dfu-util -a <alt> -s 0x70000000 -D patch.bin
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "usbd_dfu_patch.h"
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Sector {
+    uint32_t addr;
+    uint32_t size;
+};
+
+struct Options {
+    uint32_t dest = 0x08000000;
+    uint32_t src = 0x08080000;
+    uint32_t base = 0x08000000;
+    std::string layout = "0x08000000/04*016K,01*064K,07*128K";
+    uint32_t block = 1024;
+};
+
+void die(const char *msg, const char *arg = "") {
+    fprintf(stderr, "dfu-patch: %s%s\n", msg, arg);
+    exit(1);
+}
+
+Bytes load(const char *name) {
+    FILE *f = fopen(name, "rb");
+    if (!f) die("can't open ", name);
+    Bytes data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+void save(const char *name, const Bytes &data) {
+    FILE *f = fopen(name, "wb");
+    if (!f || fwrite(data.data(), 1, data.size(), f) != data.size()) die("can't write ", name);
+    fclose(f);
+}
+
+// "0x08000000/04*016K,01*064K,07*128K", attribute letters ignored
+std::vector<Sector> parseLayout(const std::string &str) {
+    std::vector<Sector> sectors;
+    const char *p = str.c_str();
+    char *end;
+    uint32_t addr = strtoul(p, &end, 0);
+    if (*end != '/') die("bad layout ", str.c_str());
+    p = end + 1;
+    while (*p) {
+        unsigned long count = strtoul(p, &end, 10);
+        if (*end != '*') die("bad layout ", str.c_str());
+        unsigned long size = strtoul(end + 1, &end, 10);
+        if (*end == 'K') size *= 1024, end++;
+        else if (*end == 'M') size *= 1024 * 1024, end++;
+        while (*end && *end != ',') end++;
+        if (*end == ',') end++;
+        if (!count || !size) die("bad layout ", str.c_str());
+        for (unsigned long i = 0; i < count; i++) {
+            sectors.push_back({addr, uint32_t(size)});
+            addr += size;
+        }
+        p = end;
+    }
+    return sectors;
+}
+
+const Sector *findSector(const std::vector<Sector> &sectors, uint32_t addr) {
+    for (auto &s : sectors) {
+        if (addr >= s.addr && addr - s.addr < s.size) return &s;
+    }
+    return nullptr;
+}
+
+void put32(Bytes &out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back(uint8_t(v >> (8 * i)));
+}
+
+void putVarint(Bytes &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+unsigned varintSize(uint32_t v) {
+    unsigned n = 1;
+    while (v >= 0x80) v >>= 7, n++;
+    return n;
+}
+
+uint32_t zigzag(int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+
+// Hash chains over 4 bytes sequences, LZ77 style
+class Index {
+  public:
+    static const unsigned kBits = 16;
+    static const unsigned kMinMatch = 4;
+
+    explicit Index(const Bytes &data) : m_data(data), m_head(1 << kBits, -1), m_prev(data.size(), -1) {}
+
+    void insert(uint32_t pos) {
+        if (pos + kMinMatch > m_data.size()) return;
+        uint32_t h = hash(&m_data[pos]);
+        m_prev[pos] = m_head[h];
+        m_head[h] = int32_t(pos);
+    }
+
+    template <typename Visit>
+    void candidates(const uint8_t *key, unsigned depth, Visit visit) const {
+        for (int32_t c = m_head[hash(key)]; c >= 0 && depth--; c = m_prev[c]) visit(uint32_t(c));
+    }
+
+  private:
+    static uint32_t hash(const uint8_t *p) {
+        uint32_t v = uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+        return (v * 2654435761u) >> (32 - kBits);
+    }
+
+    const Bytes &m_data;
+    std::vector<int32_t> m_head;
+    std::vector<int32_t> m_prev;
+};
+
+struct Stats {
+    unsigned literals = 0, copies = 0, matches = 0, erases = 0;
+    uint32_t literalBytes = 0, copyBytes = 0, matchBytes = 0;
+};
+
+// Greedy parse: at each position, the longest of the matches against the
+// old image and against the output so far, if it pays for its encoding
+Bytes encode(const Bytes *old, const Bytes &image, const Options &opts, Stats &stats) {
+    std::vector<Sector> sectors = parseLayout(opts.layout);
+    uint32_t srclen = old ? uint32_t(old->size()) : 0;
+
+    const Sector *first = findSector(sectors, opts.dest);
+    if (!first || first->addr != opts.dest) die("the destination must start a sector");
+    if (!findSector(sectors, opts.dest + uint32_t(image.size()) - 1)) die("the image doesn't fit in the flash");
+    if (srclen && opts.src < opts.dest + image.size() && opts.dest < opts.src + srclen) die("the old and new images overlap");
+
+    Bytes out;
+    put32(out, PATCH_MAGIC);
+    put32(out, opts.dest);
+    put32(out, srclen ? opts.src : 0);
+    put32(out, srclen);
+    put32(out, uint32_t(image.size()));
+    put32(out, srclen ? PATCH_CRC32(0, old->data(), srclen) : 0);
+    put32(out, PATCH_CRC32(0, image.data(), uint32_t(image.size())));
+
+    Index srcIndex(old ? *old : image);
+    if (old) {
+        for (uint32_t i = 0; i < srclen; i++) srcIndex.insert(i);
+    }
+    Index outIndex(image);
+
+    uint32_t size = uint32_t(image.size());
+    uint32_t spos = 0, erased = 0, literal = 0;
+
+    // Erases the sectors of [pos, pos + len) not erased yet
+    auto erase = [&](uint32_t pos, uint32_t len) {
+        while (erased < pos + len) {
+            const Sector *s = findSector(sectors, opts.dest + erased);
+            out.push_back(PATCH_OP_ERASE);
+            putVarint(out, s->addr - opts.dest);
+            erased = s->addr + s->size - opts.dest;
+            stats.erases++;
+        }
+    };
+    auto flushLiteral = [&](uint32_t pos) {
+        if (!literal) return;
+        erase(pos - literal, literal);
+        out.push_back(PATCH_OP_LITERAL);
+        putVarint(out, literal);
+        out.insert(out.end(), image.begin() + (pos - literal), image.begin() + pos);
+        stats.literals++;
+        stats.literalBytes += literal;
+        literal = 0;
+    };
+
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t bestLen = 0, bestArg = 0;
+        int bestGain = 0;
+        bool bestCopy = false;
+        uint32_t left = size - pos;
+
+        auto tryCopy = [&](uint32_t c) {
+            uint32_t max = std::min(left, srclen - c), len = 0;
+            while (len < max && (*old)[c + len] == image[pos + len]) len++;
+            if (len < Index::kMinMatch) return;
+            uint32_t delta = zigzag(int32_t(c - spos));
+            int gain = int(len) - int(1 + varintSize(len) + varintSize(delta));
+            if (gain > bestGain) bestGain = gain, bestLen = len, bestArg = c, bestCopy = true;
+        };
+        auto tryMatch = [&](uint32_t c) {
+            uint32_t len = 0;
+            while (len < left && image[c + len] == image[pos + len]) len++;
+            if (len < Index::kMinMatch) return;
+            uint32_t dist = pos - c;
+            int gain = int(len) - int(1 + varintSize(len) + varintSize(dist));
+            if (gain > bestGain) bestGain = gain, bestLen = len, bestArg = dist, bestCopy = false;
+        };
+
+        if (left >= Index::kMinMatch) {
+            if (old) {
+                if (spos < srclen) tryCopy(spos);
+                srcIndex.candidates(&image[pos], 64, tryCopy);
+            }
+            outIndex.candidates(&image[pos], 64, tryMatch);
+        }
+
+        // Literals have to pay for their own opcode too
+        if (bestGain <= (literal ? 0 : 2)) {
+            outIndex.insert(pos);
+            pos++;
+            literal++;
+            continue;
+        }
+
+        flushLiteral(pos);
+        erase(pos, bestLen);
+        if (bestCopy) {
+            out.push_back(PATCH_OP_COPY);
+            putVarint(out, bestLen);
+            putVarint(out, zigzag(int32_t(bestArg - spos)));
+            spos = bestArg + bestLen;
+            stats.copies++;
+            stats.copyBytes += bestLen;
+        } else {
+            out.push_back(PATCH_OP_MATCH);
+            putVarint(out, bestLen);
+            putVarint(out, bestArg);
+            stats.matches++;
+            stats.matchBytes += bestLen;
+        }
+        for (uint32_t i = 0; i < bestLen; i++) outIndex.insert(pos + i);
+        pos += bestLen;
+    }
+    flushLiteral(pos);
+    out.push_back(PATCH_OP_END);
+    return out;
+}
+
+// Simulated flash for the decoder: erasing sets sectors to 0xFF, and
+// programming can only clear bits, as on the real thing
+struct Flash {
+    uint32_t base;
+    Bytes data;
+    std::vector<Sector> sectors;
+    unsigned erases = 0;
+};
+
+Flash s_flash;
+
+// Corrupted patches are expected to program non erased flash.
+bool s_quiet;
+
+uint16_t flashWrite(uint32_t addr, uint8_t *buf, uint32_t len) {
+    if (addr < s_flash.base || addr - s_flash.base + uint64_t(len) > s_flash.data.size()) return PATCH_FAIL;
+    uint8_t *p = &s_flash.data[addr - s_flash.base];
+    for (uint32_t i = 0; i < len; i++) {
+        p[i] &= buf[i];
+        if (p[i] != buf[i]) {
+            if (!s_quiet) fprintf(stderr, "dfu-patch: programming non erased flash at 0x%08x\n", addr + i);
+            return PATCH_FAIL;
+        }
+    }
+    return PATCH_OK;
+}
+
+uint16_t flashErase(uint32_t addr) {
+    const Sector *s = findSector(s_flash.sectors, addr);
+    if (!s || s->addr < s_flash.base || s->addr - s_flash.base + uint64_t(s->size) > s_flash.data.size()) return PATCH_FAIL;
+    memset(&s_flash.data[s->addr - s_flash.base], 0xFF, s->size);
+    s_flash.erases++;
+    return PATCH_OK;
+}
+
+const uint8_t *flashMap(uint32_t addr) {
+    if (addr < s_flash.base || addr - s_flash.base >= s_flash.data.size()) return nullptr;
+    return &s_flash.data[addr - s_flash.base];
+}
+
+const PATCH_Mem_TypeDef s_mem = {flashWrite, flashErase, flashMap};
+PATCH_Decoder_TypeDef s_dec;
+
+// The flash holding data at base, extended with erased bytes up to the end
+// of the layout
+void setFlash(uint32_t base, const Bytes &data, const std::string &layout) {
+    s_flash.base = base;
+    s_flash.data = data;
+    s_flash.sectors = parseLayout(layout);
+    s_flash.erases = 0;
+    uint32_t end = s_flash.sectors.back().addr + s_flash.sectors.back().size;
+    if (end > base && s_flash.data.size() < end - base) s_flash.data.resize(end - base, 0xFF);
+}
+
+// Feeds the patch in block sized downloads, the way the patch media gets
+// them. Returns the offset of the block the decoder refused, or the size
+// of the patch.
+size_t feed(const Bytes &patch, uint32_t block) {
+    PATCH_Init(&s_dec, &s_mem);
+    for (size_t off = 0; off < patch.size(); off += block) {
+        uint32_t len = uint32_t(std::min<size_t>(block, patch.size() - off));
+        if (PATCH_Feed(&s_dec, &patch[off], len) != PATCH_OK) return off;
+    }
+    return patch.size();
+}
+
+int apply(const char *flashName, const char *patchName, const char *outName, const Options &opts) {
+    setFlash(opts.base, load(flashName), opts.layout);
+
+    Bytes patch = load(patchName);
+    size_t off = feed(patch, opts.block);
+    if (off != patch.size()) {
+        fprintf(stderr, "dfu-patch: decoding failed in the block at 0x%08zx\n", off);
+        return 1;
+    }
+    if (!PATCH_IsDone(&s_dec)) die("truncated patch");
+
+    save(outName, s_flash.data);
+    printf("0x%08x: %u bytes written, %u sectors erased\n", s_dec.dest, s_dec.outlen, s_flash.erases);
+    return 0;
+}
+
+// The test: images of up to 8 sectors of 4K, the new one at the start of
+// the flash, the old one right after
+const uint32_t kTestBase = 0x08000000;
+const uint32_t kTestSrc = 0x08008000;
+const uint32_t kTestMax = 0x8000;
+const char *const kTestLayout = "0x08000000/16*004K";
+
+uint32_t s_seed = 1;
+unsigned s_failures;
+
+uint32_t random(uint32_t max) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % max;
+}
+
+void fail(unsigned round, const char *what) {
+    fprintf(stderr, "dfu-patch: round %u: %s\n", round, what);
+    s_failures++;
+}
+
+// Firmware-like: runs of a few recurring words, and random bytes
+Bytes testImage() {
+    uint32_t words[16];
+    for (auto &w : words) w = random(0x10000) | (random(0x10000) << 16);
+    Bytes data(1 + random(kTestMax));
+    for (size_t i = 0; i < data.size(); i += 4) {
+        uint32_t w = random(4) ? words[random(16)] : random(0x10000) | (random(0x10000) << 16);
+        for (size_t j = 0; j < 4 && i + j < data.size(); j++) data[i + j] = uint8_t(w >> (8 * j));
+    }
+    return data;
+}
+
+// The next version: a few bytes changed, ranges inserted and removed
+Bytes testEdit(const Bytes &old) {
+    Bytes data = old;
+    for (unsigned edits = 1 + random(8); edits--;) {
+        uint32_t at = random(uint32_t(data.size()) + 1);
+        uint32_t len = 1 + random(256);
+        switch (random(3)) {
+        case 0:
+            for (uint32_t i = at; i < at + len && i < data.size(); i++) data[i] = uint8_t(random(256));
+            break;
+        case 1:
+            if (data.size() + len <= kTestMax) {
+                Bytes ins(len);
+                for (auto &b : ins) b = uint8_t(random(256));
+                data.insert(data.begin() + at, ins.begin(), ins.end());
+            }
+            break;
+        default:
+            if (data.size() > len) data.erase(data.begin() + std::min<size_t>(at, data.size() - len), data.begin() + std::min<size_t>(at + len, data.size()));
+            break;
+        }
+    }
+    return data;
+}
+
+// The flash before a patch: the old image at its place, garbage elsewhere,
+// so that the patch has to erase what it writes
+Bytes testFlash(const Bytes &old) {
+    Bytes data(2 * kTestMax);
+    for (auto &b : data) b = uint8_t(random(256));
+    std::copy(old.begin(), old.end(), data.begin() + (kTestSrc - kTestBase));
+    return data;
+}
+
+bool holds(uint32_t addr, const Bytes &data) {
+    return memcmp(&s_flash.data[addr - kTestBase], data.data(), data.size()) == 0;
+}
+
+struct TestStats {
+    uint64_t bytes = 0, diffBytes = 0, compressBytes = 0;
+    unsigned corruptRefused = 0, corruptHarmless = 0, truncated = 0, mismatches = 0;
+};
+
+// A patch applied to flash, which must then hold image at the destination,
+// and the old image, if any, untouched
+void testApply(unsigned round, const char *what, const Bytes &patch, const Bytes &flash,
+               const Bytes &image, const Bytes *old) {
+    setFlash(kTestBase, flash, kTestLayout);
+    uint32_t block = 1 + random(2048);
+    if (feed(patch, block) != patch.size() || !PATCH_IsDone(&s_dec)) {
+        fail(round, what);
+        return;
+    }
+    if (!holds(kTestBase, image) || (old && !holds(kTestSrc, *old))) fail(round, what);
+}
+
+int test(unsigned rounds) {
+    Options opts;
+    opts.dest = kTestBase;
+    opts.src = kTestSrc;
+    opts.layout = kTestLayout;
+    TestStats stats;
+    s_quiet = true;
+
+    for (unsigned round = 0; round < rounds && !s_failures; round++) {
+        Bytes old = testImage();
+        Bytes image = random(8) ? testEdit(old) : testImage();
+        Bytes flash = testFlash(old);
+        Stats encoding;
+        Bytes diff = encode(&old, image, opts, encoding);
+        Bytes compressed = encode(nullptr, image, opts, encoding);
+        stats.bytes += image.size();
+        stats.diffBytes += diff.size();
+        stats.compressBytes += compressed.size();
+
+        testApply(round, "diff not applied as made", diff, flash, image, &old);
+        testApply(round, "compressed image not applied as made", compressed, flash, image, nullptr);
+
+        // Corrupted: refused, or by chance still building the same image,
+        // possibly at another address if that is what was corrupted
+        Bytes bad = random(2) ? diff : compressed;
+        size_t at = random(uint32_t(bad.size()));
+        bad[at] ^= uint8_t(1 + random(255));
+        setFlash(kTestBase, flash, kTestLayout);
+        if (feed(bad, 1 + random(2048)) == bad.size() && PATCH_IsDone(&s_dec)) {
+            if (!holds(s_dec.dest, image)) fail(round, "corrupted patch done with another image");
+            stats.corruptHarmless++;
+        } else {
+            stats.corruptRefused++;
+        }
+
+        // Truncated: never done
+        Bytes cut(diff.begin(), diff.begin() + random(uint32_t(diff.size())));
+        setFlash(kTestBase, flash, kTestLayout);
+        feed(cut, 1 + random(2048));
+        if (PATCH_IsDone(&s_dec)) fail(round, "truncated patch done");
+        stats.truncated++;
+
+        // Another source: refused before anything is written
+        Bytes other = flash;
+        other[kTestSrc - kTestBase + random(uint32_t(old.size()))] ^= uint8_t(1 + random(255));
+        setFlash(kTestBase, other, kTestLayout);
+        if (feed(diff, 1 + random(2048)) == diff.size() || s_flash.data != other || s_flash.erases)
+            fail(round, "patch applied to another source");
+        stats.mismatches++;
+    }
+
+    printf("%u rounds, %.1f%% for diffs, %.1f%% compressed\n", rounds,
+           100.0 * stats.diffBytes / stats.bytes, 100.0 * stats.compressBytes / stats.bytes);
+    printf("%u corrupted patches refused, %u still right, %u truncated, %u other sources refused\n",
+           stats.corruptRefused, stats.corruptHarmless, stats.truncated, stats.mismatches);
+    return s_failures ? 1 : 0;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: dfu-patch diff [options] old.bin new.bin patch.bin\n"
+            "       dfu-patch compress [options] new.bin patch.bin\n"
+            "       dfu-patch apply [options] flash.bin patch.bin [out.bin]\n"
+            "       dfu-patch test [rounds [seed]]\n"
+            "options: --dest ADDR --src ADDR --base ADDR --layout STR --block N\n");
+    exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options opts;
+    std::vector<const char *> args;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            args.push_back(argv[i]);
+            continue;
+        }
+        if (i + 1 >= argc) usage();
+        const char *value = argv[++i];
+        if (arg == "--dest") opts.dest = strtoul(value, nullptr, 0);
+        else if (arg == "--src") opts.src = strtoul(value, nullptr, 0);
+        else if (arg == "--base") opts.base = strtoul(value, nullptr, 0);
+        else if (arg == "--layout") opts.layout = value;
+        else if (arg == "--block") opts.block = strtoul(value, nullptr, 0);
+        else usage();
+    }
+    if (args.empty() || !opts.block) usage();
+
+    std::string cmd = args[0];
+    if (cmd == "test" && args.size() <= 3) {
+        s_seed = args.size() > 2 ? strtoul(args[2], nullptr, 0) : 1;
+        return test(args.size() > 1 ? strtoul(args[1], nullptr, 0) : 200);
+    }
+    if (cmd == "apply" && (args.size() == 3 || args.size() == 4)) {
+        return apply(args[1], args[2], args.size() == 4 ? args[3] : args[1], opts);
+    }
+
+    bool diff = cmd == "diff";
+    if (!((diff && args.size() == 4) || (cmd == "compress" && args.size() == 3))) usage();
+
+    Bytes old = diff ? load(args[1]) : Bytes();
+    Bytes image = load(args[args.size() - 2]);
+    if (image.empty()) die("empty image");
+
+    Stats stats;
+    Bytes patch = encode(diff && !old.empty() ? &old : nullptr, image, opts, stats);
+    save(args.back(), patch);
+
+    printf("%zu bytes -> %zu bytes (%.1f%%)\n", image.size(), patch.size(), 100.0 * patch.size() / image.size());
+    printf("  %u literals, %u bytes\n", stats.literals, stats.literalBytes);
+    printf("  %u copies, %u bytes\n", stats.copies, stats.copyBytes);
+    printf("  %u matches, %u bytes\n", stats.matches, stats.matchBytes);
+    printf("  %u erases\n", stats.erases);
+    return 0;
+}
@@ -0,0 +1,313 @@
+// Power loss simulator for the A/B firmware slots (usbd_dfu_slot.c): runs
+// the slot manager the device runs against a simulated flash, downloading
+// image after image the way a host resumes them, and cuts the power at
+// random points: in the middle of a block, of a log record, of an erase,
+// of the compaction of the log, of the commit, or of the reload itself.
+// After each power loss, the state is loaded back and checked:
+//   - the image booted is the last one committed, or the one being
+//     committed when the power went, and only nothing before the first
+//     commit;
+//   - the verified part of the download, as given by the status, is what
+//     the staging slot holds, so torn log records were ignored;
+//   - the fallback slot, if any, still holds the previous image.
+// Some commits are followed by a corruption of the active image, after
+// which the previous image has to be booted, and to stay bootable while
+// the next download goes on.
+// Any failure makes the exit status non zero.
+//
+// Build:
+//   c++ -std=c++11 -O2 -ILibraries/STM32_USB_Device_Library/Class/dfu/inc
+//       tools/dfu-slot.cc Libraries/STM32_USB_Device_Library/Class/dfu/src/usbd_dfu_slot.c
+//       Libraries/STM32_USB_Device_Library/Class/dfu/src/usbd_dfu_patch.c
+//       -o dfu-slot
+//
+// Usage:
+//   dfu-slot [rounds [seed]]
+//       rounds: images to download and commit (1000)
+//       seed: of the power losses and the images (1)
+//
+// The flash programs bytes by clearing bits, and erases whole sectors; a
+// program cut by the power loss leaves the byte it was at half programmed,
+// and a cut erase leaves some of the sector erased.
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "usbd_dfu_slot.h"
+#include "usbd_dfu_patch.h"
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint32_t kBase = 0x08000000;
+const uint32_t kMetaSize = 512;         // 32 records, to compact often
+const uint32_t kSectorSize = 4096;
+const uint32_t kSlotSize = 4 * kSectorSize;
+const uint32_t kBlock = 1024;
+
+const SLOT_Layout_TypeDef layout = {
+    { kBase, kBase + kMetaSize },
+    kMetaSize,
+    { kBase + kSectorSize, kBase + kSectorSize + kSlotSize },
+    kSlotSize,
+    kSectorSize,
+};
+
+Bytes flash(kSectorSize + 2 * kSlotSize, 0xFF);
+
+uint32_t seed = 1;
+
+uint32_t random(uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+// Power: the operations left before it goes, a byte programmed or a sector
+// erased being one; negative for never.
+long budget = -1;
+jmp_buf power;
+
+struct Stats {
+    unsigned losses = 0;
+    unsigned torn = 0;          // log records cut
+    unsigned erases = 0;        // erases cut
+    unsigned rollbacks = 0;
+    unsigned commits = 0;
+    uint64_t sent = 0;          // bytes sent by the host
+    uint64_t resumed = 0;       // bytes not sent again thanks to the log
+} stats;
+
+unsigned failures;
+
+void fail(unsigned round, const char *what) {
+    fprintf(stderr, "dfu-slot: round %u: %s\n", round, what);
+    failures++;
+}
+
+bool cut() {
+    if (budget < 0) return false;
+    return budget-- == 0;
+}
+
+bool in_meta(uint32_t add) {
+    return add < layout.meta[0] + 2 * kMetaSize;
+}
+
+uint16_t write(uint32_t add, uint8_t *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t &b = flash[add - kBase + i];
+        if (cut()) {
+            b &= buf[i] | random(256);
+            if (in_meta(add)) stats.torn++;
+            longjmp(power, 1);
+        }
+        b &= buf[i];
+    }
+    return SLOT_OK;
+}
+
+uint16_t erase(uint32_t add) {
+    uint32_t start, size;
+    if (in_meta(add)) {
+        size = kMetaSize;
+        start = add - (add - kBase) % kMetaSize;
+    } else {
+        size = kSectorSize;
+        start = add - (add - kBase) % kSectorSize;
+    }
+    uint8_t *p = &flash[start - kBase];
+    if (cut()) {
+        for (uint32_t i = 0; i < size; i++)
+            if (random(2)) p[i] = 0xFF;
+        stats.erases++;
+        longjmp(power, 1);
+    }
+    memset(p, 0xFF, size);
+    return SLOT_OK;
+}
+
+const uint8_t *map(uint32_t add) {
+    return &flash[add - kBase];
+}
+
+const SLOT_Mem_TypeDef mem = { write, erase, map };
+
+uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t crc(const uint8_t *p, uint32_t len) {
+    return PATCH_CRC32(0, p, len);
+}
+
+Bytes image() {
+    Bytes data(1 + random(kSlotSize));
+    for (auto &b : data) b = random(256);
+    return data;
+}
+
+// Whether the slot at add, 0 for none, holds the image.
+bool holds(uint32_t add, const Bytes &data) {
+    return add && !data.empty() && memcmp(map(add), data.data(), data.size()) == 0;
+}
+
+// The device, and what the host knows of it. Out of main, as longjmp would
+// leave its locals undefined.
+SLOT_State_TypeDef st;
+Bytes current, previous, next;
+bool committing;    // the power may have gone during the commit of next
+bool corrupted;     // the active image was corrupted since the last load
+
+struct Status {
+    uint8_t active, staging, fallback;
+    uint32_t verified, verified_crc;
+};
+
+Status status(const SLOT_State_TypeDef &st) {
+    uint8_t buf[SLOT_STATUS_SIZE];
+    SLOT_GetStatus(&st, buf);
+    return { buf[4], buf[5], buf[6], get32(buf + 12), get32(buf + 16) };
+}
+
+// Where the host resumes: from the block holding the end of the verified
+// part if it is a prefix of the image, else from scratch. At least a block
+// is sent, for the commit to happen.
+uint32_t resume(const Bytes &data) {
+    Status s = status(st);
+    if (s.verified == 0 || s.verified > data.size() || s.verified_crc != crc(data.data(), s.verified))
+        return 0;
+    return (s.verified - 1) / kBlock * kBlock;
+}
+
+// What the host does after connecting: download from where it can resume,
+// then commit. Returns false if the device keeps failing.
+bool download(const Bytes &data) {
+    unsigned retries = 0;
+    uint32_t off = resume(data);
+    stats.resumed += off;
+    while (off < data.size()) {
+        uint32_t len = std::min<uint32_t>(kBlock - off % kBlock, data.size() - off);
+        Bytes block(data.begin() + off, data.begin() + off + len);
+        stats.sent += len;
+        if (SLOT_Program(&st, off, block.data(), len) == SLOT_OK) {
+            off += len;
+            retries = 0;
+            continue;
+        }
+        if (++retries > 8) return false;
+        off = resume(data);
+    }
+    committing = true;
+    if (SLOT_Commit(&st) != SLOT_OK) return false;
+    committing = false;
+    return true;
+}
+
+// A bit of the active image flipped, after its commit.
+void corrupt(const Bytes &data) {
+    uint32_t add = layout.slot[st.active] - kBase;
+    for (;;) {
+        uint32_t i = random(data.size());
+        if (flash[add + i]) {
+            flash[add + i] &= flash[add + i] - 1;
+            return;
+        }
+    }
+}
+
+// The checks after a load; updates what is current when the power went
+// during a commit, or when the active image was found corrupted.
+void check(unsigned round) {
+    uint32_t boot = SLOT_Boot(&st);
+    Status s = status(st);
+
+    if (committing && boot && holds(boot, next)) {
+        previous = current;
+        current = next;
+        stats.commits++;
+    }
+    committing = false;
+
+    if (corrupted) {
+        if (!boot || !holds(boot, previous)) {
+            fail(round, "no rollback to the previous image");
+            return;
+        }
+        current = previous;
+        previous.clear();
+        corrupted = false;
+        stats.rollbacks++;
+    }
+
+    if (current.empty() ? boot != 0 : (!boot || !holds(boot, current)))
+        fail(round, "booting other than the last image committed");
+    if (s.verified > kSlotSize ||
+        crc(map(layout.slot[s.staging]), s.verified) != s.verified_crc)
+        fail(round, "status doesn't match the staging slot");
+    if (s.fallback != SLOT_NONE && !holds(layout.slot[s.fallback], previous))
+        fail(round, "fallback doesn't hold the previous image");
+}
+
+}
+
+int main(int argc, char **argv) {
+    unsigned rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    seed = argc > 2 ? atoi(argv[2]) : 1;
+
+    for (unsigned round = 0; round < rounds && !failures; round++) {
+        next = image();
+        for (volatile unsigned boots = 0;; boots++) {
+            if (boots > 1000) {
+                fail(round, "download never completes");
+                break;
+            }
+            // Mostly enough for a few blocks, sometimes for the whole download
+            budget = random(4) ? (long)random(8 * kBlock) : -1;
+            if (setjmp(power)) {
+                budget = -1;
+                stats.losses++;
+                continue;
+            }
+            if (SLOT_Load(&st, &mem, &layout) != SLOT_OK) {
+                budget = -1;
+                fail(round, "load failed");
+                break;
+            }
+            long left = budget;
+            budget = -1;
+            check(round);
+            if (failures) break;
+            if (holds(SLOT_Boot(&st), next)) break;
+            budget = left;
+
+            if (!download(next)) {
+                budget = -1;
+                fail(round, "download failed");
+                break;
+            }
+            budget = -1;
+            previous = current;
+            current = next;
+            stats.commits++;
+
+            // A flipped bit in the active image, to roll back from
+            if (!previous.empty() && random(4) == 0) {
+                corrupt(current);
+                corrupted = true;
+            }
+        }
+    }
+
+    printf("%u commits, %u power losses: %u log records and %u erases cut\n",
+           stats.commits, stats.losses, stats.torn, stats.erases);
+    printf("%u rollbacks, %.1f%% of the bytes resumed rather than sent again\n",
+           stats.rollbacks, stats.sent ? 100.0 * stats.resumed / (stats.sent + stats.resumed) : 0.0);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+// Host side test of the report scheduling of the HID class
+// (usbd_hid_core.c): drives USBD_HID_Post, USBD_HID_OF and USBD_HID_DataIn
+// the way the application, the SOF interrupt and the IN transfers would,
+// against a simulated frame counter and a host polling the IN endpoint
+// once per ms, at full and at high speed. Checks, for the reports of the
+// example (keyboard, mouse and telemetry, see usb.h):
+//   - a relative report posted every ms goes out every ms, none lost;
+//   - an absolute report only goes out when it changes;
+//   - the idle period set with SET_IDLE is counted in ms at either speed;
+//   - the priorities don't starve the less urgent reports;
+//   - USBD_HID_GetLatency gives the frames between posts and polls that
+//     the simulation saw.
+// Any failure makes the exit status non zero.
+//
+// Build:
+//   cc -c -DUSE_USB_OTG_FS -Itools/host -Iinclude
+//       -ILibraries/STM32_USB_OTG_Driver/inc
+//       -ILibraries/STM32_USB_Device_Library/Core/inc
+//       -ILibraries/STM32_USB_Device_Library/Class/hid/inc
+//       Libraries/STM32_USB_Device_Library/Class/hid/src/usbd_hid_core.c
+//   c++ -std=c++11 (same flags) tools/hid-cadence.cc usbd_hid_core.o -o hid-cadence
+//
+// Time goes in 125us microframes at both speeds; at full speed, the SOF
+// interrupt only comes with the first one of each frame. The host polls
+// in the middle of the frame, and the transfer completes right away. The
+// driver under the class, usb_dcd.c and usb_dcd_int.c, is not run.
+//
+// Usage:
+//   hid-cadence
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+extern "C" {
+#include "usbd_hid_core.h"
+#include "usbd_req.h"
+}
+
+namespace {
+
+enum { Keyboard = 1, Mouse = 2, Telemetry = 3 };
+
+const unsigned kPollMicroframe = 4;
+const unsigned kFrames = 4000;
+
+typedef std::vector<uint8_t> Report;
+
+struct Sent {
+    unsigned frame;
+    Report report;
+};
+
+USB_OTG_CORE_HANDLE core;
+USB_OTG_DREGS dregs;
+bool armed;
+Report in;
+unsigned now;   // in microframes
+bool high_speed;
+std::vector<Sent> sent;
+uint32_t latency[HID_LATENCY_BINS];
+
+unsigned failures;
+
+void fail(const char * test, const char * what) {
+    fprintf(stderr, "%s, %s speed: %s\n", test, high_speed ? "high" : "full", what);
+    failures++;
+}
+
+uint32_t seed = 1;
+
+unsigned random(unsigned max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+unsigned frame() {
+    return now / 8;
+}
+
+void account(unsigned posted) {
+    unsigned frames = frame() - posted;
+    latency[frames < HID_LATENCY_BINS ? frames : HID_LATENCY_BINS - 1]++;
+}
+
+// One microframe: its SOF, then the application, then the poll of the host
+// in the middle of the frame.
+void tick(const std::function<void()> & application) {
+    uint32_t soffn = high_speed ? now : frame();
+    dregs.DSTS = (soffn & 0x3FFF) << 8;
+    if (high_speed || now % 8 == 0)
+        USBD_HID_OF(&core);
+    application();
+    if (now % 8 == kPollMicroframe && armed) {
+        armed = false;
+        sent.push_back({ frame(), in });
+        USBD_HID_DataIn(&core, HID_IN_EP & 0x7F);
+    }
+    now++;
+}
+
+void start(bool high) {
+    high_speed = high;
+    now = 0;
+    armed = false;
+    sent.clear();
+    memset(latency, 0, sizeof(latency));
+    memset(&dregs, 0, sizeof(dregs));
+    core.regs.DREGS = &dregs;
+    core.cfg.speed = high ? USB_OTG_SPEED_HIGH : USB_OTG_SPEED_FULL;
+    USBD_HID_DeInit(&core, 0);
+    USBD_HID_Init(&core, 0);
+    for (uint8_t id = Keyboard; id <= Telemetry; id++) {
+        USBD_HID_SetPriority(id, id == Telemetry ? 1 : 0);
+        USBD_HID_SetRelative(id, id == Mouse);
+    }
+    uint32_t clear[HID_LATENCY_BINS];
+    USBD_HID_GetLatency(clear, 1);
+}
+
+void set_idle(uint8_t id, uint8_t duration) {
+    USB_SETUP_REQ req = { USB_REQ_TYPE_CLASS | 0x01, 0x0A, (uint16_t)((duration << 8) | id), 0, 0 };
+    USBD_HID_Setup(&core, &req);
+}
+
+bool check_latency(const char * test) {
+    uint32_t hist[HID_LATENCY_BINS];
+    USBD_HID_GetLatency(hist, 0);
+    if (memcmp(hist, latency, sizeof(hist))) {
+        fail(test, "latency histogram differs from the simulation");
+        return false;
+    }
+    return true;
+}
+
+void print(const char * test, unsigned posts) {
+    uint32_t hist[HID_LATENCY_BINS];
+    USBD_HID_GetLatency(hist, 0);
+    printf("%-16s %-5s %6u %6u ", test, high_speed ? "high" : "full", posts, (unsigned)sent.size());
+    for (unsigned i = 0; i < HID_LATENCY_BINS; i++)
+        printf(" %5u", (unsigned)hist[i]);
+    printf("\n");
+}
+
+unsigned count(uint8_t id) {
+    unsigned n = 0;
+    for (const auto & s : sent)
+        n += s.report[0] == id;
+    return n;
+}
+
+// The example's sendData loop: the same move posted every ms, at a random
+// point of the frame, retried while the previous one is pending. The first
+// one comes after the poll, so that from then on a move is always queued
+// ahead of the next poll; the endpoint and the mailbox hold two.
+void mouse() {
+    const char * test = "mouse, 1 ms";
+    uint8_t report[] = { Mouse, 0, 1, 0, 0 };
+    unsigned posts = 0, due = 0;
+    std::deque<unsigned> stamps;
+    bool waiting = false;
+
+    for (unsigned f = 0; f < kFrames; f++) {
+        unsigned at = f ? random(8) : 7;
+        for (unsigned m = 0; m < 8; m++) {
+            tick([&] {
+                if (m == at)
+                    waiting = true;
+                if (waiting && USBD_HID_Post(report, sizeof(report)) == USBD_OK) {
+                    waiting = false;
+                    stamps.push_back(frame());
+                    posts++;
+                }
+            });
+            for (; due < sent.size(); due++) {
+                account(stamps.front());
+                stamps.pop_front();
+            }
+        }
+    }
+
+    if (posts - sent.size() > 2)
+        fail(test, "moves lost");
+    for (unsigned i = 1; i < sent.size(); i++) {
+        if (sent[i].frame != sent[i - 1].frame + 1) {
+            fail(test, "not sent every ms");
+            break;
+        }
+    }
+    check_latency(test);
+    print(test, posts);
+}
+
+// A key held for a while, posted again and again: only the changes go out.
+void keyboard() {
+    const char * test = "keyboard";
+    uint8_t report[9] = { Keyboard };
+    unsigned posts = 0, changes = 0, due = 0;
+    std::vector<unsigned> stamps;
+
+    for (unsigned f = 0; f < kFrames; f++) {
+        unsigned at = random(8);
+        for (unsigned m = 0; m < 8; m++) {
+            tick([&] {
+                if (m != at)
+                    return;
+                if (f % 10 == 0) {
+                    report[3] = report[3] ? 0 : 4 + random(26);
+                    changes++;
+                    stamps.push_back(frame());
+                }
+                USBD_HID_Post(report, sizeof(report));
+                posts++;
+            });
+            if (sent.size() > due && due < stamps.size())
+                account(stamps[due++]);
+        }
+    }
+
+    if (sent.size() != changes)
+        fail(test, "sent other than the changes");
+    check_latency(test);
+    print(test, posts);
+}
+
+// SET_IDLE of 8 ms, one post: the report is repeated every 8 ms.
+void idle() {
+    const char * test = "idle 8 ms";
+    uint8_t report[9] = { Keyboard, 0, 0, 4 };
+
+    set_idle(Keyboard, 2);
+    for (unsigned f = 0; f < kFrames; f++) {
+        for (unsigned m = 0; m < 8; m++) {
+            tick([&] {
+                if (f == 0 && m == 0)
+                    USBD_HID_Post(report, sizeof(report));
+            });
+        }
+    }
+    // The post itself only counts in the histogram.
+    latency[0] = 1;
+
+    for (unsigned i = 1; i < sent.size(); i++) {
+        if (sent[i].frame - sent[i - 1].frame != 8) {
+            fail(test, "not repeated every 8 ms");
+            break;
+        }
+    }
+    if (sent.size() < kFrames / 8)
+        fail(test, "not repeated");
+    check_latency(test);
+    print(test, 1);
+}
+
+// Telemetry streaming as fast as it can, with keyboard changes: the
+// keyboard goes first, and telemetry takes the other polls. A change
+// posted after the endpoint was loaded with telemetry waits for one more
+// poll, so it may take two frames.
+void priorities() {
+    const char * test = "priorities";
+    uint8_t keys[9] = { Keyboard };
+    uint8_t telemetry[64] = { Telemetry };
+    unsigned posts = 0, changes = 0;
+    std::vector<unsigned> stamps;
+
+    for (unsigned f = 0; f < kFrames; f++) {
+        unsigned at = random(8);
+        for (unsigned m = 0; m < 8; m++) {
+            tick([&] {
+                telemetry[1] = now;
+                telemetry[2] = now >> 8;
+                USBD_HID_Post(telemetry, sizeof(telemetry));
+                posts++;
+                if (m == at && f % 4 == 0) {
+                    keys[3] = keys[3] ? 0 : 4 + random(26);
+                    USBD_HID_Post(keys, sizeof(keys));
+                    stamps.push_back(frame());
+                    changes++;
+                    posts++;
+                }
+            });
+        }
+    }
+
+    unsigned k = 0;
+    for (const auto & s : sent) {
+        if (s.report[0] != Keyboard)
+            continue;
+        if (k >= stamps.size() || s.frame - stamps[k] > 2) {
+            fail(test, "keyboard delayed");
+            break;
+        }
+        k++;
+    }
+    if (count(Keyboard) != changes)
+        fail(test, "keyboard changes lost");
+    if (count(Telemetry) < kFrames - 2 * changes)
+        fail(test, "telemetry starved");
+    print(test, posts);
+}
+
+}
+
+extern "C" {
+
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *, uint8_t, uint16_t, uint8_t) { return 0; }
+uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *, uint8_t) { return 0; }
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *, uint8_t, uint8_t *, uint16_t) { return 0; }
+
+uint32_t DCD_EP_Tx(USB_OTG_CORE_HANDLE *, uint8_t, uint8_t * pbuf, uint32_t buf_len) {
+    if (armed) {
+        fprintf(stderr, "IN endpoint loaded twice\n");
+        exit(1);
+    }
+    armed = true;
+    in.assign(pbuf, pbuf + buf_len);
+    return 0;
+}
+
+uint16_t USBD_GetRxCount(USB_OTG_CORE_HANDLE *, uint8_t) { return 0; }
+void USBD_CtlError(USB_OTG_CORE_HANDLE *, USB_SETUP_REQ *) { abort(); }
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *, uint8_t *, uint16_t) { abort(); }
+USBD_Status USBD_CtlPrepareRx(USB_OTG_CORE_HANDLE *, uint8_t *, uint16_t) { abort(); }
+
+const uint8_t * get_USB_hid_descriptor(int) { abort(); }
+const uint8_t * get_USB_report_descriptor(int) { abort(); }
+uint16_t get_USB_report_descriptor_size(int) { abort(); }
+
+}
+
+int main() {
+    printf("%-16s %-5s %6s %6s  latency, in frames\n", "test", "speed", "posts", "sent");
+    for (bool high : { false, true }) {
+        start(high); mouse();
+        start(high); keyboard();
+        start(high); idle();
+        start(high); priorities();
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+// Host stand-in for uC-sdk's decl.h, so that the descriptor examples build
+// on a workstation (see usb-dump.cc).
+#pragma once
+
+#ifdef __cplusplus
+#define BEGIN_DECL extern "C" {
+#define END_DECL }
+#else
+#define BEGIN_DECL
+#define END_DECL
+#endif
@@ -0,0 +1,44 @@
+// Host stand-in for FatFs' diskio.h, which usbh_msc_fatfs.c implements
+// (see msc-bench.cc).
+#pragma once
+
+typedef unsigned char   BYTE;
+typedef unsigned short  WORD;
+typedef unsigned long   DWORD;
+typedef unsigned int    UINT;
+
+typedef BYTE DSTATUS;
+
+typedef enum {
+    RES_OK = 0,
+    RES_ERROR,
+    RES_WRPRT,
+    RES_NOTRDY,
+    RES_PARERR
+} DRESULT;
+
+#define _READONLY       0
+#define _USE_IOCTL      1
+
+#define STA_NOINIT      0x01
+#define STA_NODISK      0x02
+#define STA_PROTECT     0x04
+
+#define CTRL_SYNC           0
+#define GET_SECTOR_COUNT    1
+#define GET_SECTOR_SIZE     2
+#define GET_BLOCK_SIZE      3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DSTATUS disk_initialize(BYTE drv);
+DSTATUS disk_status(BYTE drv);
+DRESULT disk_read(BYTE drv, BYTE * buff, DWORD sector, BYTE count);
+DRESULT disk_write(BYTE drv, const BYTE * buff, DWORD sector, BYTE count);
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void * buff);
+
+#ifdef __cplusplus
+}
+#endif
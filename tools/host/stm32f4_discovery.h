@@ -0,0 +1,3 @@
+// Host stand-in for the board header included by usbd_conf.h, which only
+// the firmware needs (see usb-dump.cc).
+#pragma once
@@ -0,0 +1,12 @@
+// Host stand-in for the application's usbh_conf.h, with the values of
+// usbh_conf_template.h (see msc-bench.cc).
+#pragma once
+
+#define USBH_MAX_NUM_ENDPOINTS                2
+#define USBH_MAX_NUM_INTERFACES               2
+
+#ifdef USE_USB_OTG_FS
+#define USBH_MSC_MPS_SIZE                     0x40
+#else
+#define USBH_MSC_MPS_SIZE                     0x200
+#endif
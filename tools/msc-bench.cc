@@ -0,0 +1,326 @@
+// Host side benchmark of the mass storage host: runs the BOT state
+// machine, the SCSI commands and the FatFs glue of the host library
+// against a simulated flash drive, behind a simulated full speed bus, and
+// reports the throughput FatFs would see for a few access patterns. The
+// time is simulated, from the costs below, so that two revisions of the
+// library compare the same way on any workstation; the data read back is
+// checked against what the drive holds, and a mismatch makes the exit
+// status non zero.
+//
+// Build (msc-bench.sh does it, for the tree and for an older revision):
+//   cc -c -DUSE_HOST_MODE -DUSE_USB_OTG_FS -Itools/host -Iinclude
+//       -ILibraries/STM32_USB_OTG_Driver/inc
+//       -ILibraries/STM32_USB_HOST_Library/Core/inc
+//       -ILibraries/STM32_USB_HOST_Library/Class/MSC/inc
+//       Libraries/STM32_USB_HOST_Library/Class/MSC/src/usbh_msc_bot.c
+//       Libraries/STM32_USB_HOST_Library/Class/MSC/src/usbh_msc_scsi.c
+//       Libraries/STM32_USB_HOST_Library/Class/MSC/src/usbh_msc_fatfs.c
+//   c++ -std=c++11 (same flags) tools/msc-bench.cc *.o -o msc-bench
+//
+// tools/host holds stand-ins for the firmware and FatFs headers the host
+// library includes. What the simulation stands for is the HCD and the
+// request layer: a bulk request completes once its packets went through
+// the bus, at most 256 of them as the channel counts, and the device
+// answers each command after a latency of its own. The driver under it,
+// usb_core.c and usb_hcd_int.c, is not run: how it fills the FIFO and
+// halts the channels is left out of the figures.
+//
+// Usage:
+//   msc-bench
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+#include "usbh_core.h"
+#include "usbh_msc_core.h"
+#include "usbh_msc_bot.h"
+#include "usbh_msc_scsi.h"
+#include "diskio.h"
+}
+
+namespace {
+
+// Costs, in microseconds.
+const double kPoll = 1.0;           // a pass through the disk_read loop
+const double kSubmit = 4.0;         // programming a channel
+const double kInterrupt = 3.0;      // channel halted to URB_DONE
+const double kReadLatency = 150.0;  // READ(10) to its first data
+const double kWriteLatency = 400.0; // last data of a WRITE(10) to its CSW
+const double kApplication = 30.0;   // FatFs and the application, per sector
+
+const unsigned kMaxPacket = USBH_MSC_MPS_SIZE;
+const unsigned kSectorSize = 512;
+const unsigned kSectors = 16384;    // 8MB drive
+const unsigned kChannelIn = 1;
+const unsigned kChannelOut = 2;
+
+// One full speed bulk transaction: token, data and handshake, with the
+// bit stuffing of random data.
+double packet(unsigned length) {
+    return (length + 13) * 8 * 7.0 / 6.0 / 12.0;
+}
+
+double transfer(unsigned length) {
+    unsigned packets = (length + kMaxPacket - 1) / kMaxPacket;
+    if (packets == 0)
+        packets = 1;
+    if (packets > 256) {
+        fprintf(stderr, "transfer of %u packets, the channel counts 256\n", packets);
+        exit(1);
+    }
+    return (packets - 1) * packet(kMaxPacket) + packet(length - (packets - 1) * kMaxPacket);
+}
+
+uint8_t expected(uint32_t sector, unsigned offset) {
+    return (sector * 7 + offset * 13 + (offset >> 8)) & 0xff;
+}
+
+class Drive {
+  public:
+    Drive() : m_data(kSectors * kSectorSize) {
+        for (uint32_t s = 0; s < kSectors; s++)
+            for (unsigned i = 0; i < kSectorSize; i++)
+                m_data[s * kSectorSize + i] = expected(s, i);
+    }
+
+    // A CBW went through at the given time.
+    void command(const uint8_t * cbw, double time) {
+        memcpy(&m_tag, cbw + 4, 4);
+        memcpy(&m_left, cbw + 8, 4);
+        uint32_t lba = (cbw[17] << 24) | (cbw[18] << 16) | (cbw[19] << 8) | cbw[20];
+        m_position = lba * kSectorSize;
+        m_ready = time + (cbw[15] == 0x2a ? 0 : kReadLatency);
+        m_stage = m_left ? Data : Status;
+        m_commands++;
+    }
+
+    // Data or CSW the host asked for, from the given time on: returns the
+    // bytes sent, and when the transfer ends.
+    unsigned read(uint8_t * buff, unsigned length, double & time) {
+        if (time < m_ready)
+            time = m_ready;
+        if (m_stage == Status) {
+            uint8_t csw[13] = { 'U', 'S', 'B', 'S' };
+            memcpy(csw + 4, &m_tag, 4);
+            memcpy(buff, csw, sizeof(csw));
+            time += transfer(sizeof(csw));
+            m_stage = Command;
+            return sizeof(csw);
+        }
+        if (length > m_left)
+            length = m_left;
+        memcpy(buff, &m_data[m_position], length);
+        m_position += length;
+        m_left -= length;
+        time += transfer(length);
+        m_ready = time;
+        if (m_left == 0)
+            m_stage = Status;
+        return length;
+    }
+
+    unsigned write(const uint8_t * buff, unsigned length, double & time) {
+        if (time < m_ready)
+            time = m_ready;
+        memcpy(&m_data[m_position], buff, length);
+        m_position += length;
+        m_left -= length;
+        time += transfer(length);
+        m_ready = time;
+        if (m_left == 0) {
+            m_ready += kWriteLatency;
+            m_stage = Status;
+        }
+        return length;
+    }
+
+    bool expecting_command() const { return m_stage == Command; }
+    unsigned commands() const { return m_commands; }
+    uint8_t * data(uint32_t sector) { return &m_data[sector * kSectorSize]; }
+
+  private:
+    std::vector<uint8_t> m_data;
+    uint32_t m_tag = 0;
+    uint32_t m_position = 0;
+    uint32_t m_left = 0;
+    enum { Command, Data, Status } m_stage = Command;
+    double m_ready = 0;
+    unsigned m_commands = 0;
+};
+
+struct Channel {
+    bool busy = false;
+    double done = 0;
+    unsigned count = 0;
+};
+
+Drive * drive;
+Channel channels[3];
+double now;
+unsigned transfers;
+
+void advance(double time) {
+    now += time;
+}
+
+void submit(uint8_t hc_num, uint8_t * buff, uint16_t length, bool in) {
+    Channel & channel = channels[hc_num];
+    double time = now + kSubmit;
+    now = time;
+    transfers++;
+    if (in) {
+        // A request rounds up to whole packets.
+        unsigned packets = (length + kMaxPacket - 1) / kMaxPacket;
+        channel.count = drive->read(buff, packets * kMaxPacket, time);
+    } else if (drive->expecting_command()) {
+        time += transfer(length);
+        drive->command(buff, time);
+        channel.count = length;
+    } else {
+        channel.count = drive->write(buff, length, time);
+    }
+    channel.busy = true;
+    channel.done = time + kInterrupt;
+}
+
+}
+
+extern "C" {
+
+USB_OTG_CORE_HANDLE USB_OTG_Core;
+USBH_HOST USB_Host;
+MSC_Machine_TypeDef MSC_Machine;
+uint8_t MSCErrorCount;
+
+uint32_t HCD_IsDeviceConnected(USB_OTG_CORE_HANDLE *) {
+    return 1;
+}
+
+URB_STATE HCD_GetURB_Event(USB_OTG_CORE_HANDLE *, uint8_t ch_num) {
+    Channel & channel = channels[ch_num];
+    advance(kPoll);
+    if (!channel.busy || now < channel.done)
+        return URB_IDLE;
+    channel.busy = false;
+    return URB_DONE;
+}
+
+// Level triggered: the state of the last request, until the next one. The
+// BOT no longer uses it, but the revisions before it read its completions
+// as events do, only this; it stays so that msc-bench.sh can still build
+// them to compare with.
+URB_STATE HCD_GetURB_State(USB_OTG_CORE_HANDLE *, uint8_t ch_num) {
+    Channel & channel = channels[ch_num];
+    advance(kPoll);
+    if (channel.busy) {
+        if (now < channel.done)
+            return URB_IDLE;
+        channel.busy = false;
+    }
+    return URB_DONE;
+}
+
+uint32_t HCD_IsWaiting(USB_OTG_CORE_HANDLE *) {
+    bool waiting = false;
+    for (const auto & channel : channels) {
+        if (channel.busy && now >= channel.done)
+            return 0;
+        waiting |= channel.busy;
+    }
+    return waiting;
+}
+
+uint32_t HCD_GetXferCnt(USB_OTG_CORE_HANDLE *, uint8_t ch_num) {
+    return channels[ch_num].count;
+}
+
+USBH_Status USBH_BulkSendData(USB_OTG_CORE_HANDLE *, uint8_t * buff, uint16_t length, uint8_t hc_num) {
+    submit(hc_num, buff, length, false);
+    return USBH_OK;
+}
+
+USBH_Status USBH_BulkReceiveData(USB_OTG_CORE_HANDLE *, uint8_t * buff, uint16_t length, uint8_t hc_num) {
+    submit(hc_num, buff, length, true);
+    return USBH_OK;
+}
+
+USBH_Status USBH_ClrFeature(USB_OTG_CORE_HANDLE *, USBH_HOST *, uint8_t, uint8_t) {
+    fprintf(stderr, "unexpected STALL\n");
+    exit(1);
+}
+
+}
+
+namespace {
+
+enum Pattern { Sequential, Random };
+
+bool run(const char * name, Pattern pattern, unsigned count, bool write) {
+    static uint8_t buff[255 * kSectorSize];
+    const unsigned total = 2 * 1024 * 1024 / kSectorSize;
+
+    Drive d;
+    drive = &d;
+    now = 0;
+    transfers = 0;
+    disk_initialize(0);
+
+    uint32_t seed = 1;
+    for (unsigned done = 0; done < total; done += count) {
+        uint32_t sector = done;
+        if (pattern == Random) {
+            seed = seed * 1103515245 + 12345;
+            sector = (seed >> 8) % (kSectors - count);
+        }
+        DRESULT result;
+        if (write) {
+            for (unsigned i = 0; i < count * kSectorSize; i++)
+                buff[i] = expected(sector + i / kSectorSize, i % kSectorSize) ^ 0x5a;
+            result = disk_write(0, buff, sector, count);
+        } else {
+            result = disk_read(0, buff, sector, count);
+        }
+        if (result != RES_OK) {
+            fprintf(stderr, "%s: sector %u: error %d\n", name, sector, result);
+            return false;
+        }
+        for (unsigned i = 0; i < count * kSectorSize; i++) {
+            uint8_t * data = write ? d.data(sector) : buff;
+            uint8_t value = expected(sector + i / kSectorSize, i % kSectorSize) ^ (write ? 0x5a : 0);
+            if (data[i] != value) {
+                fprintf(stderr, "%s: sector %u: byte %u differs\n", name, sector + i / kSectorSize, i % kSectorSize);
+                return false;
+            }
+        }
+        advance(count * kApplication);
+    }
+    disk_ioctl(0, CTRL_SYNC, NULL);
+
+    printf("%-24s %6.3f\t%u\t%u\n", name, total * kSectorSize / now, d.commands(), transfers);
+    return true;
+}
+
+}
+
+int main() {
+    USBH_MSC_Param.MSCapacity = kSectors;
+    MSC_Machine.hc_num_in = kChannelIn;
+    MSC_Machine.hc_num_out = kChannelOut;
+    USBH_MSC_Init(&USB_OTG_Core);
+
+    printf("%-24s %s\t%s\t%s\n", "pattern", "MB/s", "commands", "transfers");
+    bool ok = true;
+    ok &= run("read 1, sequential", Sequential, 1, false);
+    ok &= run("read 8, sequential", Sequential, 8, false);
+    ok &= run("read 64, sequential", Sequential, 64, false);
+    ok &= run("read 1, random", Random, 1, false);
+    ok &= run("write 1, sequential", Sequential, 1, true);
+    ok &= run("write 8, sequential", Sequential, 8, true);
+    ok &= run("write 64, sequential", Sequential, 64, true);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Throughput of the mass storage host, simulated (see msc-bench.cc): builds
+# the benchmark against the host library of the tree, and of a revision to
+# compare with when one is given, and runs them.
+#
+# Usage:
+#   tools/msc-bench.sh [revision]
+#
+# CC (cc), CXX (c++), CFLAGS and CXXFLAGS are honoured; everything is built
+# for the workstation, no toolchain for the target is needed.
+
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# bench <libraries directory> <output>
+bench() {
+    lib=$1
+    out=$2
+    flags="-DUSE_HOST_MODE -DUSE_USB_OTG_FS -I$ROOT/tools/host -I$ROOT/include
+        -I$lib/STM32_USB_OTG_Driver/inc
+        -I$lib/STM32_USB_HOST_Library/Core/inc
+        -I$lib/STM32_USB_HOST_Library/Class/MSC/inc"
+    mkdir -p "$out"
+    for f in bot scsi fatfs; do
+        $CC $CFLAGS $flags -c "$lib/STM32_USB_HOST_Library/Class/MSC/src/usbh_msc_$f.c" -o "$out/$f.o" || exit 1
+    done
+    $CXX -std=c++11 $CXXFLAGS $flags "$ROOT/tools/msc-bench.cc" "$out"/*.o -o "$out/msc-bench" || exit 1
+    "$out/msc-bench" || exit 1
+}
+
+if [ -n "$1" ]; then
+    mkdir "$TMP/rev"
+    git -C "$ROOT" archive "$1" Libraries | tar -x -C "$TMP/rev" || exit 1
+    echo "$1:"
+    bench "$TMP/rev/Libraries" "$TMP/rev/build"
+    echo
+    echo "tree:"
+fi
+bench "$ROOT/Libraries" "$TMP/build"
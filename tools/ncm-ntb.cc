@@ -0,0 +1,352 @@
+// Host side test of the NTB16 helpers of the CDC-NCM class
+// (usbd_cdc_ncm_core.c), against the way the Linux cdc_ncm driver builds
+// and parses NTBs:
+//   - OUT NTBs are built like cdc_ncm_fill_tx_frame() does, with the NDP16
+//     right after the NTH16 or, as for the devices flagged NDP_TO_END,
+//     after the datagrams, and padded up to the NTB size; NCM_NTB_Parse
+//     has to find every datagram back.
+//   - IN NTBs are built with NCM_NTB_Begin, NCM_NTB_Append and
+//     NCM_NTB_Finalize, and read back with the checks of
+//     cdc_ncm_rx_verify_nth16() and cdc_ncm_rx_verify_ndp16().
+//   - Malformed NTBs have to be rejected by NCM_NTB_Parse.
+// Any failure makes the exit status non zero.
+//
+// Build:
+//   cc -c -DUSE_USB_OTG_FS -Itools/host -Iinclude
+//       -ILibraries/STM32_USB_OTG_Driver/inc
+//       -ILibraries/STM32_USB_Device_Library/Core/inc
+//       -ILibraries/STM32_USB_Device_Library/Class/cdc/inc
+//       Libraries/STM32_USB_Device_Library/Class/cdc/src/usbd_cdc_ncm_core.c
+//   c++ -std=c++11 (same flags) tools/ncm-ntb.cc usbd_cdc_ncm_core.o -o ncm-ntb
+//
+// Usage:
+//   ncm-ntb
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+#include "usbd_cdc_ncm_core.h"
+}
+
+namespace {
+
+// What the device reports in GET_NTB_PARAMETERS, as Linux reads it.
+const unsigned kOutMaxSize = NCM_NTB_OUT_MAX_SIZE;
+const unsigned kOutDivisor = 4;
+const unsigned kOutRemainder = 0;
+const unsigned kOutAlignment = 4;
+const unsigned kOutMaxDatagrams = NCM_MAX_OUT_DATAGRAMS;
+const unsigned kMaxPacket = NCM_DATA_MAX_PACKET_SIZE;
+
+const unsigned kEthernetHeader = 14;
+
+typedef std::vector<uint8_t> Buffer;
+
+unsigned failures;
+
+void fail(const char * test, const char * what) {
+    fprintf(stderr, "%s: %s\n", test, what);
+    failures++;
+}
+
+uint32_t seed = 1;
+
+unsigned random(unsigned max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+Buffer datagram(unsigned length) {
+    Buffer d(length);
+    for (auto & b : d)
+        b = random(256);
+    return d;
+}
+
+void put16(Buffer & b, unsigned at, uint16_t v) {
+    b[at] = v;
+    b[at + 1] = v >> 8;
+}
+
+void put32(Buffer & b, unsigned at, uint32_t v) {
+    put16(b, at, v);
+    put16(b, at + 2, v >> 16);
+}
+
+uint16_t get16(const Buffer & b, unsigned at) {
+    return b[at] | (b[at + 1] << 8);
+}
+
+uint32_t get32(const Buffer & b, unsigned at) {
+    return get16(b, at) | (get16(b, at + 2) << 16);
+}
+
+unsigned align(unsigned x, unsigned a) {
+    return (x + a - 1) / a * a;
+}
+
+// cdc_ncm_align_tail(): zero pad so that the length is remainder modulo
+// modulus, unless that goes past max.
+void align_tail(Buffer & b, unsigned modulus, unsigned remainder, unsigned max) {
+    unsigned align = b.size() + (modulus - 1) - ((b.size() + (modulus - 1) - remainder) % modulus);
+    if (align > b.size() && align <= max)
+        b.resize(align, 0);
+}
+
+// An OUT NTB, as cdc_ncm_fill_tx_frame() builds it from the given
+// datagrams; those that don't fit are left out, and count tells how many
+// went in.
+Buffer linux_ntb(const std::vector<Buffer> & datagrams, uint16_t sequence, bool ndp_to_end, unsigned & count) {
+    const unsigned ndp_size = NCM_NDP16_HEADER_SIZE + (kOutMaxDatagrams + 1) * NCM_NDP16_ENTRY_SIZE;
+    Buffer b(NCM_NTH16_SIZE);
+    put32(b, 0, NCM_NTH16_SIGNATURE);
+    put16(b, 4, NCM_NTH16_SIZE);
+    put16(b, 6, sequence);
+
+    Buffer ndp(ndp_size, 0);
+    put32(ndp, 0, NCM_NDP16_NOCRC_SIGNATURE);
+    put16(ndp, 4, NCM_NDP16_HEADER_SIZE + NCM_NDP16_ENTRY_SIZE);
+    unsigned ndp_index = 0;
+    if (!ndp_to_end) {
+        align_tail(b, kOutAlignment, 0, kOutMaxSize);
+        ndp_index = b.size();
+        b.insert(b.end(), ndp.begin(), ndp.end());
+    }
+
+    count = 0;
+    for (const auto & d : datagrams) {
+        if (count == kOutMaxDatagrams)
+            break;
+        Buffer next = b;
+        align_tail(next, kOutDivisor, kOutRemainder, kOutMaxSize);
+        unsigned index = next.size();
+        unsigned room = ndp_to_end ? align(index + d.size(), kOutAlignment) + ndp_size : index + d.size();
+        if (room > kOutMaxSize)
+            break;
+        next.insert(next.end(), d.begin(), d.end());
+        b.swap(next);
+
+        Buffer & n = ndp_to_end ? ndp : b;
+        unsigned at = (ndp_to_end ? 0 : ndp_index);
+        unsigned length = get16(n, at + 4);
+        put16(n, at + length - NCM_NDP16_ENTRY_SIZE, index);
+        put16(n, at + length - NCM_NDP16_ENTRY_SIZE + 2, d.size());
+        put16(n, at + 4, length + NCM_NDP16_ENTRY_SIZE);
+        count++;
+    }
+
+    if (ndp_to_end) {
+        align_tail(b, kOutAlignment, 0, kOutMaxSize);
+        ndp_index = b.size();
+        b.insert(b.end(), ndp.begin(), ndp.begin() + get16(ndp, 4));
+    }
+    put16(b, 10, ndp_index);
+
+    // Long NTBs are padded up to the maximum size, others are ended by a
+    // short packet.
+    if (b.size() > kOutMaxSize - kMaxPacket)
+        b.resize(kOutMaxSize, 0);
+    else if (b.size() % kMaxPacket == 0)
+        b.push_back(0);
+    put16(b, 8, b.size());
+    return b;
+}
+
+void out_ntbs(bool ndp_to_end) {
+    const char * test = ndp_to_end ? "OUT, NDP at the end" : "OUT, NDP first";
+    unsigned ntbs = 0, datagrams = 0;
+
+    for (unsigned round = 0; round < 2000; round++) {
+        std::vector<Buffer> queue;
+        unsigned n = 1 + random(kOutMaxDatagrams + 4);
+        for (unsigned i = 0; i < n; i++) {
+            // Mostly small frames, as TCP acks, and a few full ones.
+            unsigned length = random(4) ? kEthernetHeader + random(100) : kEthernetHeader + random(NCM_MAX_SEGMENT_SIZE - kEthernetHeader + 1);
+            queue.push_back(datagram(length));
+        }
+
+        unsigned count;
+        Buffer ntb = linux_ntb(queue, round, ndp_to_end, count);
+        if (count == 0)
+            continue;
+
+        uint16_t entries[2 * NCM_MAX_OUT_DATAGRAMS];
+        uint16_t parsed = NCM_NTB_Parse(ntb.data(), ntb.size(), NCM_MAX_OUT_DATAGRAMS, entries);
+        if (parsed != count) {
+            fail(test, parsed == NCM_NTB_INVALID ? "valid NTB rejected" : "wrong datagram count");
+            return;
+        }
+        for (unsigned i = 0; i < count; i++) {
+            if (entries[2 * i + 1] != queue[i].size() ||
+                memcmp(ntb.data() + entries[2 * i], queue[i].data(), queue[i].size())) {
+                fail(test, "datagram differs");
+                return;
+            }
+        }
+        ntbs++;
+        datagrams += count;
+    }
+    printf("%-24s %u NTBs, %u datagrams\n", test, ntbs, datagrams);
+}
+
+// An IN NTB read back as cdc_ncm_rx_fixup() does; returns false if Linux
+// would drop it.
+bool linux_parse(const Buffer & b, std::vector<Buffer> & datagrams) {
+    if (b.size() < NCM_NTH16_SIZE + 16 || get32(b, 0) != NCM_NTH16_SIGNATURE ||
+        get16(b, 4) != NCM_NTH16_SIZE || get16(b, 8) > b.size())
+        return false;
+    unsigned ndp = get16(b, 10);
+    while (ndp) {
+        if ((ndp & 3) || ndp + NCM_NDP16_HEADER_SIZE > b.size() || get32(b, ndp) != NCM_NDP16_NOCRC_SIGNATURE)
+            return false;
+        unsigned length = get16(b, ndp + 4);
+        if (length < 16 || ndp + length > b.size())
+            return false;
+        unsigned entries = (length - NCM_NDP16_HEADER_SIZE) / NCM_NDP16_ENTRY_SIZE - 1;
+        for (unsigned i = 0; i < entries; i++) {
+            unsigned at = ndp + NCM_NDP16_HEADER_SIZE + i * NCM_NDP16_ENTRY_SIZE;
+            unsigned index = get16(b, at), dlen = get16(b, at + 2);
+            if (index == 0 || dlen == 0)
+                break;
+            if (index + dlen > b.size() || dlen < kEthernetHeader)
+                return false;
+            datagrams.push_back(Buffer(b.begin() + index, b.begin() + index + dlen));
+        }
+        ndp = get16(b, ndp + 6);
+    }
+    return true;
+}
+
+void in_ntbs() {
+    const char * test = "IN";
+    unsigned ntbs = 0, datagrams = 0;
+
+    for (unsigned round = 0; round < 2000; round++) {
+        Buffer ntb(NCM_NTB_IN_MAX_SIZE);
+        uint16_t entries[2 * NCM_MAX_IN_DATAGRAMS];
+        std::vector<Buffer> queue;
+        uint16_t pos = NCM_NTB_Begin(ntb.data(), round);
+        while (queue.size() < NCM_MAX_IN_DATAGRAMS) {
+            unsigned length = random(3) ? kEthernetHeader + random(200) : kEthernetHeader + random(NCM_MAX_SEGMENT_SIZE - kEthernetHeader + 1);
+            Buffer d = datagram(length);
+            uint16_t next = NCM_NTB_Append(ntb.data(), pos, ntb.size(), queue.size(), entries, d.data(), d.size());
+            if (next == 0)
+                break;
+            if ((entries[2 * queue.size()] - NCM_NDP_IN_PAYLOAD_REMAINDER) % NCM_NDP_IN_DIVISOR) {
+                fail(test, "datagram not aligned");
+                return;
+            }
+            pos = next;
+            queue.push_back(d);
+        }
+        uint16_t length = NCM_NTB_Finalize(ntb.data(), pos, queue.size(), entries);
+        if (length > ntb.size() || get16(ntb, 10) % NCM_NDP_IN_ALIGNMENT) {
+            fail(test, "NDP misplaced");
+            return;
+        }
+        ntb.resize(length);
+
+        std::vector<Buffer> parsed;
+        if (!linux_parse(ntb, parsed)) {
+            fail(test, "NTB rejected");
+            return;
+        }
+        if (parsed != queue) {
+            fail(test, "datagrams differ");
+            return;
+        }
+        ntbs++;
+        datagrams += queue.size();
+    }
+    printf("%-24s %u NTBs, %u datagrams\n", test, ntbs, datagrams);
+}
+
+// A valid NTB to break: two datagrams, NDP at the end.
+Buffer reference() {
+    std::vector<Buffer> queue = { datagram(60), datagram(100) };
+    unsigned count;
+    return linux_ntb(queue, 0, true, count);
+}
+
+void malformed() {
+    const char * test = "malformed";
+    uint16_t entries[2 * NCM_MAX_OUT_DATAGRAMS];
+    Buffer good = reference();
+    unsigned ndp = get16(good, 10);
+    unsigned cases = 0;
+
+    if (NCM_NTB_Parse(good.data(), good.size(), NCM_MAX_OUT_DATAGRAMS, entries) != 2) {
+        fail(test, "reference NTB not parsed");
+        return;
+    }
+
+    auto reject = [&](const char * what, Buffer b, unsigned len, uint16_t maxcount) {
+        cases++;
+        if (NCM_NTB_Parse(b.data(), len, maxcount, entries) != NCM_NTB_INVALID)
+            fail(test, what);
+    };
+
+    Buffer b;
+    reject("short NTB accepted", good, NCM_NTH16_SIZE - 1, NCM_MAX_OUT_DATAGRAMS);
+    b = good; put32(b, 0, NCM_NDP16_NOCRC_SIGNATURE);
+    reject("bad NTH16 signature accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, 4, 16);
+    reject("bad wHeaderLength accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good;
+    reject("truncated NTB accepted", b, b.size() - 1, NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, 10, ndp + 2);
+    reject("unaligned NDP accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, 10, 8);
+    reject("NDP over the NTH16 accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, 10, b.size() & ~3);
+    reject("NDP past the block accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put32(b, ndp, NCM_NTH16_SIGNATURE);
+    reject("bad NDP16 signature accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, ndp + 4, 8);
+    reject("short NDP16 accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, ndp + 4, b.size());
+    reject("NDP16 past the block accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, ndp + NCM_NDP16_HEADER_SIZE + 2, b.size());
+    reject("datagram past the block accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    b = good; put16(b, ndp + 6, ndp);
+    reject("NDP16 loop accepted", b, b.size(), NCM_MAX_OUT_DATAGRAMS);
+    reject("too many datagrams accepted", good, good.size(), 1);
+
+    // Zero wBlockLength: up to the short packet.
+    cases++;
+    b = good; put16(b, 8, 0);
+    if (NCM_NTB_Parse(b.data(), b.size(), NCM_MAX_OUT_DATAGRAMS, entries) != 2)
+        fail(test, "zero wBlockLength rejected");
+
+    printf("%-24s %u cases\n", test, cases);
+}
+
+}
+
+// Neither the endpoints nor the application are touched by the helpers.
+extern "C" {
+
+const uint8_t * get_USB_configuration_descriptor(int) { abort(); }
+NCM_IF_Prop_TypeDef NCM_APP_FOPS;
+uint32_t DCD_EP_Open(USB_OTG_CORE_HANDLE *, uint8_t, uint16_t, uint8_t) { abort(); }
+uint32_t DCD_EP_Close(USB_OTG_CORE_HANDLE *, uint8_t) { abort(); }
+uint32_t DCD_EP_PrepareRx(USB_OTG_CORE_HANDLE *, uint8_t, uint8_t *, uint16_t) { abort(); }
+uint32_t DCD_EP_Tx(USB_OTG_CORE_HANDLE *, uint8_t, uint8_t *, uint32_t) { abort(); }
+void USBD_CtlError(USB_OTG_CORE_HANDLE *, USB_SETUP_REQ *) { abort(); }
+USBD_Status USBD_CtlSendData(USB_OTG_CORE_HANDLE *, uint8_t *, uint16_t) { abort(); }
+USBD_Status USBD_CtlPrepareRx(USB_OTG_CORE_HANDLE *, uint8_t *, uint16_t) { abort(); }
+
+}
+
+int main() {
+    out_ntbs(false);
+    out_ntbs(true);
+    in_ntbs();
+    malformed();
+    return failures ? 1 : 0;
+}
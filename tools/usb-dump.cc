@@ -0,0 +1,436 @@
+// Host side check of the descriptor templates: builds one of the
+// descriptor files the firmware uses, walks the bytes it emits with a
+// parser of its own, and prints them the way lsusb -v does. Anything
+// that would make enumeration fail on the device, such as a wTotalLength
+// or a bNumEndpoints not matching what follows, or periodic endpoints
+// needing more than a frame can give them, is reported, and makes
+// the exit status non zero. So is a lookup the class code makes,
+// get_USB_first_interface_descriptor or get_USB_hid_descriptor, that
+// doesn't land on the descriptor the walk found. It takes a few
+// milliseconds.
+//
+// Build:
+//   c++ -std=c++11 -Wno-invalid-offsetof -Itools/host -Iinclude -I.
+//       -DDESCRIPTORS='"st-example-usb-descriptors.cc"' tools/usb-dump.cc
+//       -o usb-dump
+//
+// make -C tools check builds and runs it for both example descriptor files.
+//
+// tools/host holds stand-ins for the few firmware headers the descriptor
+// files include.
+//
+// Usage:
+//   usb-dump [-q]
+//       -q only reports the errors.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#ifndef DESCRIPTORS
+#define DESCRIPTORS "st-example-usb-descriptors.cc"
+#endif
+
+// Only some descriptor files have HID interfaces.
+extern "C" const uint8_t * get_USB_report_descriptor(int interface) __attribute__((weak));
+extern "C" uint16_t get_USB_report_descriptor_size(int interface) __attribute__((weak));
+extern "C" const uint8_t * get_USB_hid_descriptor(int interface) __attribute__((weak));
+extern "C" const uint8_t * get_USB_first_interface_descriptor(int configuration) __attribute__((weak));
+// And only some have vendor requests reading descriptors.
+extern "C" const uint8_t * get_USB_vendor_descriptor(uint8_t request, uint16_t index, uint16_t * length) __attribute__((weak));
+
+#include DESCRIPTORS
+
+// The examples sending reports need it to link.
+extern "C" void usb_send_report(uint8_t *, uint16_t) __attribute__((weak));
+extern "C" void usb_send_report(uint8_t *, uint16_t) { }
+
+namespace {
+
+int errors = 0;
+bool quiet = false;
+
+void error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "usb-dump: ");
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+    errors++;
+}
+
+void print(int indent, const char *fmt, ...) {
+    if (quiet) return;
+    va_list ap;
+    va_start(ap, fmt);
+    printf("%*s", indent, "");
+    vprintf(fmt, ap);
+    putchar('\n');
+    va_end(ap);
+}
+
+uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// Strings are only read through the indexes the other descriptors hold.
+std::string string_at(uint8_t index) {
+    if (index == 0) return "";
+    uint16_t len = 0;
+    const uint8_t *s = get_USB_descriptor(USB_DESC_STRING, index, &len);
+    if (!s) {
+        error("string %u doesn't exist", index);
+        return "(missing)";
+    }
+    if (s[0] != len || s[1] != USB_DESC_STRING || len < 2 || (len & 1)) {
+        error("string %u: bLength %u, bDescriptorType %u, for %u bytes", index, s[0], s[1], len);
+        return "(invalid)";
+    }
+    std::string str;
+    for (uint16_t i = 2; i < len; i += 2) str += le16(s + i) < 0x80 ? static_cast<char>(s[i]) : '?';
+    return str;
+}
+
+const char *transfer_types[] = { "Control", "Isochronous", "Bulk", "Interrupt" };
+
+struct ConfigurationState {
+    const uint8_t *interface = NULL;  // current interface descriptor
+    unsigned endpoints = 0;           // of the current interface
+    std::set<uint8_t> numbers;        // of the interfaces
+    std::map<uint8_t, uint8_t> owners;  // interface of each endpoint address
+    unsigned periodic = 0;            // bytes per frame of the current interface
+    std::map<uint8_t, unsigned> worst;  // of the alternates of each interface
+};
+
+// Full speed frame bytes an isochronous or interrupt transaction costs:
+// its payload with worst case bit stuffing, and the protocol overhead.
+const unsigned frame_budget = 1500 * 9 / 10;
+
+unsigned periodic_bytes(uint8_t type, uint16_t size) {
+    if (type != 1 && type != 3) return 0;
+    return (type == 1 ? 9 : 13) + ((size & 0x7ff) * 7 + 5) / 6;
+}
+
+void end_interface(ConfigurationState &st) {
+    if (st.interface && st.endpoints != st.interface[4])
+        error("interface %u alternate %u: bNumEndpoints %u, but %u endpoint descriptors",
+              st.interface[2], st.interface[3], st.interface[4], st.endpoints);
+    if (st.interface && st.periodic > st.worst[st.interface[2]]) st.worst[st.interface[2]] = st.periodic;
+    st.interface = NULL;
+    st.endpoints = 0;
+    st.periodic = 0;
+}
+
+void dump_interface(ConfigurationState &st, const uint8_t *d) {
+    end_interface(st);
+    if (d[0] != 9) error("interface descriptor: bLength %u instead of 9", d[0]);
+    st.interface = d;
+    st.numbers.insert(d[2]);
+    print(4, "Interface Descriptor:");
+    print(6, "bLength             %5u", d[0]);
+    print(6, "bDescriptorType     %5u", d[1]);
+    print(6, "bInterfaceNumber    %5u", d[2]);
+    print(6, "bAlternateSetting   %5u", d[3]);
+    print(6, "bNumEndpoints       %5u", d[4]);
+    print(6, "bInterfaceClass     %5u", d[5]);
+    print(6, "bInterfaceSubClass  %5u", d[6]);
+    print(6, "bInterfaceProtocol  %5u", d[7]);
+    print(6, "iInterface          %5u %s", d[8], string_at(d[8]).c_str());
+}
+
+void dump_endpoint(ConfigurationState &st, const uint8_t *d) {
+    // Audio 1.0 endpoints carry two more bytes.
+    if (d[0] != 7 && d[0] != 9) error("endpoint descriptor: bLength %u instead of 7", d[0]);
+    uint8_t address = d[2];
+    uint8_t type = d[3] & 3;
+    uint16_t size = le16(d + 4);
+    if (!st.interface) {
+        error("endpoint 0x%02x outside of any interface", address);
+    } else {
+        st.endpoints++;
+        st.periodic += periodic_bytes(type, size);
+        uint8_t owner = st.interface[2];
+        auto it = st.owners.find(address);
+        if (it != st.owners.end() && it->second != owner)
+            error("endpoint 0x%02x used by interfaces %u and %u", address, it->second, owner);
+        st.owners[address] = owner;
+    }
+    if ((address & 0x0f) == 0 || (address & 0x70)) error("endpoint address 0x%02x is invalid", address);
+    // Full speed limits.
+    if (type == 2 && size != 8 && size != 16 && size != 32 && size != 64)
+        error("bulk endpoint 0x%02x: wMaxPacketSize %u", address, size);
+    if (type == 3 && size > 64) error("interrupt endpoint 0x%02x: wMaxPacketSize %u", address, size);
+    if (type == 1 && size > 1023) error("isochronous endpoint 0x%02x: wMaxPacketSize %u", address, size);
+    if (type == 3 && d[6] == 0) error("interrupt endpoint 0x%02x: bInterval 0", address);
+    print(6, "Endpoint Descriptor:");
+    print(8, "bLength             %5u", d[0]);
+    print(8, "bDescriptorType     %5u", d[1]);
+    print(8, "bEndpointAddress     0x%02x  EP %u %s", address, address & 0x0f, address & 0x80 ? "IN" : "OUT");
+    print(8, "bmAttributes        %5u", d[3]);
+    print(10, "Transfer Type            %s", transfer_types[type]);
+    print(8, "wMaxPacketSize     0x%04x  %u bytes", size, size);
+    print(8, "bInterval           %5u", d[6]);
+    if (d[0] == 9) {
+        print(8, "bRefresh            %5u", d[7]);
+        print(8, "bSynchAddress       %5u", d[8]);
+    }
+}
+
+void dump_hid(ConfigurationState &st, const uint8_t *d) {
+    if (d[0] < 6 || d[0] != 6 + 3 * d[5]) error("HID descriptor: bLength %u for %u class descriptors", d[0], d[5]);
+    print(6, "HID Device Descriptor:");
+    print(8, "bLength             %5u", d[0]);
+    print(8, "bDescriptorType     %5u", d[1]);
+    print(8, "bcdHID              %2x.%02x", d[3], d[2]);
+    print(8, "bCountryCode        %5u", d[4]);
+    print(8, "bNumDescriptors     %5u", d[5]);
+    for (unsigned i = 0; i < d[5] && 6 + 3 * i + 3 <= d[0]; i++) {
+        const uint8_t *c = d + 6 + 3 * i;
+        uint16_t len = le16(c + 1);
+        print(8, "bDescriptorType     %5u %s", c[0], c[0] == USB_DESC_REPORT ? "Report" : "");
+        print(8, "wDescriptorLength   %5u", len);
+        uint16_t (*report_size)(int) = get_USB_report_descriptor_size;
+        if (c[0] == USB_DESC_REPORT && st.interface && report_size) {
+            uint16_t actual = report_size(st.interface[2]);
+            if (actual != len)
+                error("interface %u: wDescriptorLength %u, but the report descriptor is %u bytes", st.interface[2], len, actual);
+        }
+    }
+    // What GET_DESCRIPTOR(HID) sends, for the interface in its alternate 0.
+    const uint8_t *(*hid_descriptor)(int) = get_USB_hid_descriptor;
+    if (hid_descriptor && st.interface && st.interface[3] == 0) {
+        const uint8_t *served = hid_descriptor(st.interface[2]);
+        if (served != d)
+            error("interface %u: get_USB_hid_descriptor gives %s, not the HID descriptor", st.interface[2],
+                  !served ? "NULL" : served[1] == USB_DESC_HID ? "another HID descriptor" : "a descriptor of another type");
+    }
+}
+
+void dump_other(int indent, const uint8_t *d) {
+    if (quiet) return;
+    printf("%*sDescriptor type 0x%02x:", indent, "", d[1]);
+    for (unsigned i = 0; i < d[0]; i++) printf(" %02x", d[i]);
+    putchar('\n');
+}
+
+void dump_configuration(const uint8_t *c, uint16_t len) {
+    if (c[0] != 9 || c[1] != USB_DESC_CONFIG) error("configuration descriptor: bLength %u, bDescriptorType %u", c[0], c[1]);
+    uint16_t total = le16(c + 2);
+    if (total != len) error("configuration %u: wTotalLength %u, but the descriptor is %u bytes", c[5], total, len);
+    print(2, "Configuration Descriptor:");
+    print(4, "bLength             %5u", c[0]);
+    print(4, "bDescriptorType     %5u", c[1]);
+    print(4, "wTotalLength       0x%04x", total);
+    print(4, "bNumInterfaces      %5u", c[4]);
+    print(4, "bConfigurationValue %5u", c[5]);
+    print(4, "iConfiguration      %5u %s", c[6], string_at(c[6]).c_str());
+    print(4, "bmAttributes         0x%02x", c[7]);
+    if (c[7] & 0x40) print(6, "Self Powered");
+    if (c[7] & 0x20) print(6, "Remote Wakeup");
+    print(4, "MaxPower            %5umA", c[8] * 2);
+    if (!(c[7] & 0x80)) error("configuration %u: bmAttributes bit 7 must be set", c[5]);
+
+    ConfigurationState st;
+    const uint8_t *first = NULL;
+    size_t end = total < len ? total : len;
+    for (size_t pos = 9; pos < end; ) {
+        const uint8_t *d = c + pos;
+        if (pos + 2 > end || d[0] < 2 || pos + d[0] > end) {
+            error("configuration %u: descriptor at offset %u overruns wTotalLength", c[5], unsigned(pos));
+            break;
+        }
+        switch (d[1]) {
+        case USB_DESC_INTERFACE:
+            if (!first) first = d;
+            dump_interface(st, d);
+            break;
+        case USB_DESC_ENDPOINT: dump_endpoint(st, d); break;
+        case USB_DESC_HID: dump_hid(st, d); break;
+        default: dump_other(st.interface ? 6 : 4, d); break;
+        }
+        pos += d[0];
+    }
+    end_interface(st);
+
+    const uint8_t *(*first_interface)(int) = get_USB_first_interface_descriptor;
+    if (first_interface) {
+        const uint8_t *p = first_interface(c[5]);
+        if (p != first)
+            error("configuration %u: get_USB_first_interface_descriptor gives %s, not the first interface", c[5],
+                  !p ? "NULL" : p[1] == USB_DESC_INTERFACE ? "another interface" : "a descriptor of another type");
+    }
+
+    if (st.numbers.size() != c[4])
+        error("configuration %u: bNumInterfaces %u, but %u interfaces", c[5], c[4], unsigned(st.numbers.size()));
+    unsigned expected = 0;
+    for (uint8_t n : st.numbers)
+        if (n != expected++) error("configuration %u: interface numbers are not contiguous from 0", c[5]);
+
+    // Only one alternate of each interface is selected at a time.
+    unsigned periodic = 0;
+    for (auto &w : st.worst) periodic += w.second;
+    print(4, "Periodic bandwidth  %5u of %u bytes per frame", periodic, frame_budget);
+    if (periodic > frame_budget)
+        error("configuration %u: periodic endpoints need %u bytes per frame, over %u", c[5], periodic, frame_budget);
+}
+
+// The Microsoft OS 2.0 descriptor set, whose subsets nest.
+void dump_msos20_elements(int indent, const uint8_t *p, const uint8_t *end, unsigned configurations) {
+    while (p < end) {
+        if (end - p < 4 || le16(p) < 4 || le16(p) > end - p) {
+            error("MS OS 2.0 descriptor at offset %u overruns its subset", unsigned(end - p));
+            return;
+        }
+        uint16_t len = le16(p), type = le16(p + 2);
+        if ((type == 1 || type == 2) && len == 8) {
+            uint16_t total = le16(p + 6);
+            if (total < 8 || total > end - p) {
+                error("MS OS 2.0 subset: length %u, with %u bytes left", total, unsigned(end - p));
+                return;
+            }
+            if (type == 1 && p[4] >= configurations)
+                error("MS OS 2.0 configuration subset: configuration index %u, but %u configurations", p[4], configurations);
+            print(indent, "%s Subset: %s %u, %u bytes", type == 1 ? "Configuration" : "Function",
+                  type == 1 ? "configuration index" : "first interface", p[4], total);
+            dump_msos20_elements(indent + 2, p + 8, p + total, configurations);
+            p += total;
+            continue;
+        }
+        if (type == 3) {
+            if (len != 20) error("MS OS 2.0 compatible ID: wLength %u instead of 20", len);
+            print(indent, "Compatible ID: %.8s %.8s", p + 4, p + 12);
+        } else if (type == 4) {
+            uint16_t name = le16(p + 6);
+            uint16_t data = 8 + name + 2 <= len ? le16(p + 8 + name) : 0;
+            if (10 + name + data != len) error("MS OS 2.0 registry property: wLength %u, for %u + %u bytes", len, name, data);
+            std::string str;
+            for (unsigned i = 0; i + 1 < name && 8 + i < len && p[8 + i]; i += 2) str += static_cast<char>(p[8 + i]);
+            print(indent, "Registry Property: %s, type %u, %u bytes", str.c_str(), le16(p + 4), data);
+        } else {
+            dump_other(indent, p);
+        }
+        p += len;
+    }
+}
+
+void dump_msos20(const uint8_t *cap, unsigned configurations) {
+    uint16_t expected = le16(cap + 24);
+    uint8_t code = cap[26];
+    print(2, "MS OS 2.0 Platform Capability:");
+    print(4, "dwWindowsVersion  0x%08x", cap[20] | (cap[21] << 8) | (cap[22] << 16) | (cap[23] << 24));
+    print(4, "wMSOSDescriptorSetTotalLength %u", expected);
+    print(4, "bMS_VendorCode       0x%02x", code);
+    print(4, "bAltEnumCode        %5u", cap[27]);
+    uint16_t len = 0;
+    const uint8_t *(*vendor_descriptor)(uint8_t, uint16_t, uint16_t *) = get_USB_vendor_descriptor;
+    const uint8_t *set = vendor_descriptor ? vendor_descriptor(code, USB_MSOS20_DESCRIPTOR_INDEX, &len) : NULL;
+    if (!set) {
+        error("MS OS 2.0 descriptor set: no answer to vendor request 0x%02x", code);
+        return;
+    }
+    if (len != expected || len < 10 || le16(set) != 10 || le16(set + 2) != 0 || le16(set + 8) != len) {
+        error("MS OS 2.0 descriptor set: %u bytes, %u announced by the capability, %u by its header", len, expected, len >= 10 ? le16(set + 8) : 0);
+        return;
+    }
+    print(2, "MS OS 2.0 Descriptor Set:");
+    dump_msos20_elements(4, set + 10, set + len, configurations);
+}
+
+const uint8_t msos20_uuid[16] = {
+    0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c, 0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f,
+};
+
+void dump_bos(const uint8_t *device) {
+    uint16_t len = 0;
+    const uint8_t *b = get_USB_descriptor(USB_DESC_BOS, 0, &len);
+    uint16_t bcdUSB = le16(device + 2);
+    if (!b) {
+        if (bcdUSB >= 0x201) error("bcdUSB %x.%02x, but no BOS descriptor", bcdUSB >> 8, bcdUSB & 0xff);
+        return;
+    }
+    if (bcdUSB < 0x201) error("BOS descriptor, but bcdUSB %x.%02x: hosts won't ask for it", bcdUSB >> 8, bcdUSB & 0xff);
+    if (len < 5 || b[0] != 5 || b[1] != USB_DESC_BOS || le16(b + 2) != len) {
+        error("BOS descriptor: bLength %u, bDescriptorType %u, wTotalLength %u, for %u bytes", b[0], b[1], len >= 4 ? le16(b + 2) : 0, len);
+        return;
+    }
+    print(0, "Binary Object Store Descriptor:");
+    print(2, "bLength             %5u", b[0]);
+    print(2, "bDescriptorType     %5u", b[1]);
+    print(2, "wTotalLength       0x%04x", le16(b + 2));
+    print(2, "bNumDeviceCaps      %5u", b[4]);
+    unsigned caps = 0;
+    for (size_t pos = 5; pos < len; caps++) {
+        const uint8_t *c = b + pos;
+        if (pos + 3 > len || c[0] < 3 || pos + c[0] > len || c[1] != USB_DESC_DEVICE_CAPABILITY) {
+            error("BOS descriptor: capability at offset %u is invalid", unsigned(pos));
+            return;
+        }
+        if (c[2] == 2 && c[0] == 7) {
+            print(2, "USB 2.0 Extension Device Capability:");
+            print(4, "bmAttributes   0x%08x", c[3] | (c[4] << 8) | (c[5] << 16) | (c[6] << 24));
+        } else if (c[2] == 5 && c[0] == 28 && !memcmp(c + 4, msos20_uuid, 16)) {
+            dump_msos20(c, device[17]);
+        } else {
+            dump_other(2, c);
+        }
+        pos += c[0];
+    }
+    if (caps != b[4]) error("BOS descriptor: bNumDeviceCaps %u, but %u capabilities", b[4], caps);
+}
+
+void dump_device() {
+    uint16_t len = 0;
+    const uint8_t *d = get_USB_descriptor(USB_DESC_DEVICE, 0, &len);
+    if (!d) {
+        error("no device descriptor");
+        return;
+    }
+    if (len != 18 || d[0] != 18 || d[1] != USB_DESC_DEVICE)
+        error("device descriptor: bLength %u, bDescriptorType %u, for %u bytes", d[0], d[1], len);
+    if (d[7] != 8 && d[7] != 16 && d[7] != 32 && d[7] != 64) error("bMaxPacketSize0 %u", d[7]);
+    print(0, "Device Descriptor:");
+    print(2, "bLength             %5u", d[0]);
+    print(2, "bDescriptorType     %5u", d[1]);
+    print(2, "bcdUSB              %2x.%02x", d[3], d[2]);
+    print(2, "bDeviceClass        %5u", d[4]);
+    print(2, "bDeviceSubClass     %5u", d[5]);
+    print(2, "bDeviceProtocol     %5u", d[6]);
+    print(2, "bMaxPacketSize0     %5u", d[7]);
+    print(2, "idVendor           0x%04x", le16(d + 8));
+    print(2, "idProduct          0x%04x", le16(d + 10));
+    print(2, "bcdDevice           %2x.%02x", d[13], d[12]);
+    print(2, "iManufacturer       %5u %s", d[14], string_at(d[14]).c_str());
+    print(2, "iProduct            %5u %s", d[15], string_at(d[15]).c_str());
+    print(2, "iSerial             %5u %s", d[16], string_at(d[16]).c_str());
+    print(2, "bNumConfigurations  %5u", d[17]);
+
+    const uint8_t *langs = get_USB_descriptor(USB_DESC_STRING, 0, &len);
+    if (!langs || len < 4 || langs[0] != len || langs[1] != USB_DESC_STRING) error("string 0, the language IDs, is missing or invalid");
+
+    for (uint8_t i = 0; i < d[17]; i++) {
+        const uint8_t *c = get_USB_descriptor(USB_DESC_CONFIG, i, &len);
+        if (!c) {
+            error("configuration descriptor %u is missing", i);
+            continue;
+        }
+        if (c[5] != i + 1) error("configuration descriptor %u: bConfigurationValue %u", i, c[5]);
+        dump_configuration(c, len);
+    }
+    if (get_USB_descriptor(USB_DESC_CONFIG, d[17], &len))
+        error("more configuration descriptors than bNumConfigurations");
+
+    dump_bos(d);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    quiet = argc > 1 && !strcmp(argv[1], "-q");
+    dump_device();
+    if (errors) fprintf(stderr, "usb-dump: %d error(s)\n", errors);
+    return errors ? 1 : 0;
+}
@@ -1,8 +1,10 @@
 #include "usb.h"
 
 #include <stm32f4xx.h>
+#include <FreeRTOS.h>
+#include <task.h>
 
-//#include "usbd_hid_core.h"
+#include "usbd_hid_core.h"
 #include  "usbd_ioreq.h"
 #include  "usb_dcd_int.h"
 
@@ -70,6 +72,13 @@ void usb_fs_device_init()
   set_irq_handler(OTG_FS_WKUP_IRQ_handler, &usbwakeuphandler);
   #endif
 
+  //input devices first, telemetry when the endpoint is free
+  USBD_HID_SetPriority(USB_REPORT_KEYBOARD, 0);
+  USBD_HID_SetPriority(USB_REPORT_MOUSE, 0);
+  USBD_HID_SetPriority(USB_REPORT_TELEMETRY, 1);
+  //every mouse report is a move, even the same one twice
+  USBD_HID_SetRelative(USB_REPORT_MOUSE, 1);
+
   //configure endpoints
   DCD_Init(&USB_OTG_dev , USB_OTG_FS_CORE_ID);
 
@@ -86,7 +95,22 @@ void usb_fs_device_init()
 
 void usb_send_report(uint8_t *buffer, uint16_t nb)
 {
-  if (USB_OTG_dev.dev.device_status == USB_OTG_CONFIGURED )
-    DCD_EP_Tx(&USB_OTG_dev, HID_IN_EP, buffer, nb);
+  // Only sent on change, or when the host's idle period expires; mouse
+  // reports are all sent, one at a time, so wait for the previous one.
+  // The host takes it on its next poll: sleep a tick at a time until then,
+  // rather than spin through the time slice.
+  while ((USBD_HID_Post(buffer, nb) == USBD_BUSY) &&
+         (USB_OTG_dev.dev.device_status == USB_OTG_CONFIGURED))
+    vTaskDelay(1);
+}
+
+void usb_set_report_handler(uint8_t id, void (*handler)(uint8_t type, uint8_t *report, uint16_t len))
+{
+  USBD_HID_SetHandler(id, handler);
+}
+
+void usb_process_reports()
+{
+  USBD_HID_Process();
 }
 
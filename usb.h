@@ -7,6 +7,26 @@ BEGIN_DECL
 
 void usb_fs_device_init();
 
+// Report IDs of the HID interface. The keyboard and the mouse go before the
+// telemetry when several reports are waiting.
+enum {
+    USB_REPORT_KEYBOARD = 1,
+    USB_REPORT_MOUSE = 2,
+    USB_REPORT_TELEMETRY = 3,
+};
+
+#define USB_TELEMETRY_SIZE 32
+
 void usb_send_report(uint8_t *buffer, uint16_t nb);
+void usb_send_keyboard_report(uint8_t modifiers, const uint8_t keys[6]);
+void usb_send_mouse_report(uint8_t buttons, int8_t x, int8_t y, int8_t wheel);
+void usb_send_telemetry(const uint8_t *data, uint16_t len);
+
+// Output and feature reports the host sends with this ID: keyboard LEDs,
+// telemetry from the host. Called from usb_process_reports.
+void usb_set_report_handler(uint8_t id, void (*handler)(uint8_t type, uint8_t *report, uint16_t len));
+// To be called often enough to keep up with the host, at most a couple of
+// reports are held in between.
+void usb_process_reports();
 
 END_DECL
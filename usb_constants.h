@@ -42,3 +42,7 @@
 #define USB_HID_REPORT_OUTPUT           0x02
 #define USB_HID_REPORT_FEATURE          0x03
 
+
+//Microsoft OS 2.0 vendor request wIndex
+#define USB_MSOS20_DESCRIPTOR_INDEX     0x07
+#define USB_MSOS20_SET_ALT_ENUMERATION  0x08
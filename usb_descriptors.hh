@@ -101,6 +101,11 @@ struct pack16 {
     uint8_t m_lo = value & 0xff;
     uint8_t m_hi = (value >> 8) & 0xff;
 } USB_PACKED;
+template<uint32_t value>
+struct pack32 {
+    pack16<value & 0xffff> m_lo;
+    pack16<(value >> 16)> m_hi;
+} USB_PACKED;
 
 /**
   * We will make heavy usage of tuple<>-like structures all over the code,
@@ -132,14 +137,12 @@ struct pack16 {
   * Same as above, but every instanciated type will be constructed with
   * its index as its argument, instead of no argument.
   *
-  * They both provide the ::offsets type that can be cast into an array of
-  * const ptrdiff_t the following way:
-  *
-  *   typename tuple_type<...>::offsets m_offsets_list;
-  *   const ptrdiff_t * m_offsets_array = reinterpret_cast<const ptrdiff_t *>(&m_offsets_list);
+  * They both provide the ::get<index>() method, that returns a reference to
+  * the element at this index, and its type as ::type_at<index>. This is
+  * what descriptor tables are built from, at compile time.
   *
   * They also offer the ::find<type>() method, that returns the index of the
-  * given type into the tuple. This then can be used into the offset array.
+  * given type into the tuple.
   *
   * And finally we have the following tuple:
   *
@@ -155,14 +158,19 @@ template<size_t... indices>
 struct index_sequence {
     using type = index_sequence<indices...>;
 } USB_PACKED;
-template<size_t index, typename sequence>
-struct cat_index_sequence;
-template<size_t index, size_t... indices>
-struct cat_index_sequence<index, index_sequence<indices...>> : index_sequence<indices..., index> { } USB_PACKED;
+// Both halves are built separately then joined, so that a sequence of N
+// indices only takes log(N) nested instantiations.
+template<typename left, typename right>
+struct join_index_sequence;
+template<size_t... left, size_t... right>
+struct join_index_sequence<index_sequence<left...>, index_sequence<right...>> : index_sequence<left..., (sizeof...(left) + right)...> { } USB_PACKED;
 template<size_t N>
-struct make_index_sequence : cat_index_sequence<N - 1, typename make_index_sequence<N - 1>::type>::type { } USB_PACKED;
+struct make_index_sequence
+    : join_index_sequence<typename make_index_sequence<N / 2>::type, typename make_index_sequence<N - N / 2>::type>::type { } USB_PACKED;
 template<>
 struct make_index_sequence<1> : index_sequence<0> { } USB_PACKED;
+template<>
+struct make_index_sequence<0> : index_sequence<> { } USB_PACKED;
 
 template<size_t index, typename basetype, typename type>
 struct tuple_notindexed_element {
@@ -180,30 +188,75 @@ struct tuple_indexed_element {
     type m_value;
 } USB_PACKED;
 
-template<ptrdiff_t offset, typename head, typename... tail>
-struct offset_calculator {
-    ptrdiff_t m_offset = offset;
-    offset_calculator<offset + sizeof(head), tail...> m_next_offsets;
-} USB_PACKED;
-
-template<ptrdiff_t offset, typename tail>
-struct offset_calculator<offset, tail> {
-    ptrdiff_t m_offset = offset;
+// Every type of the list is tagged with its index, all at once, then the
+// one we want is picked by overload resolution: no recursion on the list.
+template<typename type>
+struct type_wrapper {
+    using unwrapped = type;
+};
+template<size_t index, typename type>
+struct indexed_type { };
+template<typename sequence, typename... types>
+struct indexed_types;
+template<size_t... indices, typename... types>
+struct indexed_types<index_sequence<indices...>, types...> : indexed_type<indices, types>... { };
+template<size_t index, typename type>
+type_wrapper<type> pick_indexed_type(const indexed_type<index, type> *);
+
+template<size_t index, typename... types>
+struct type_at_index {
+    static_assert(index < sizeof...(types), "type_at_index: index out of range");
+    using type = typename decltype(pick_indexed_type<index>(
+        static_cast<indexed_types<typename make_index_sequence<sizeof...(types)>::type, types...> *>(nullptr)))::unwrapped;
 } USB_PACKED;
 
-template<typename>
-constexpr int count() { return 0; }
-template<typename type, typename head, typename... tail>
-constexpr int count() {
-    return (std::is_same<type, head>::value ? 1 : 0) + count<type, tail...>();
+// Folds over a list of flags, halving it at each step, so that long lists
+// don't hit the constexpr recursion limit either.
+template<size_t N>
+constexpr int count_flags(const bool (&flags)[N], size_t lo = 0, size_t hi = N) {
+    return
+        (hi - lo == 0) ? 0 :
+        (hi - lo == 1) ? (flags[lo] ? 1 : 0) :
+        count_flags(flags, lo, lo + (hi - lo) / 2) + count_flags(flags, lo + (hi - lo) / 2, hi);
+}
+constexpr int first_found(int left, int right) { return left >= 0 ? left : right; }
+template<size_t N>
+constexpr int find_flag(const bool (&flags)[N], size_t lo = 0, size_t hi = N) {
+    return
+        (hi - lo == 0) ? -1 :
+        (hi - lo == 1) ? (flags[lo] ? static_cast<int>(lo) : -1) :
+        first_found(find_flag(flags, lo, lo + (hi - lo) / 2), find_flag(flags, lo + (hi - lo) / 2, hi));
 }
 
-template<typename>
-constexpr int find_inner(int) { return -1; }
-template<typename type, typename head, typename... tail>
-constexpr int find_inner(int index = 0) {
-    return std::is_same<type, head>::value ? index : find_inner<type, tail...>(index + 1);
+// Same folds over values, for the bandwidth sums.
+template<size_t N>
+constexpr unsigned sum_values(const unsigned (&values)[N], size_t lo = 0, size_t hi = N) {
+    return
+        (hi - lo == 0) ? 0 :
+        (hi - lo == 1) ? values[lo] :
+        sum_values(values, lo, lo + (hi - lo) / 2) + sum_values(values, lo + (hi - lo) / 2, hi);
+}
+constexpr unsigned larger(unsigned left, unsigned right) { return left > right ? left : right; }
+template<size_t N>
+constexpr unsigned max_values(const unsigned (&values)[N], size_t lo = 0, size_t hi = N) {
+    return
+        (hi - lo == 0) ? 0 :
+        (hi - lo == 1) ? values[lo] :
+        larger(max_values(values, lo, lo + (hi - lo) / 2), max_values(values, lo + (hi - lo) / 2, hi));
 }
+constexpr int smaller(int left, int right) { return left < right ? left : right; }
+template<size_t N>
+constexpr int min_values(const int (&values)[N], size_t lo = 0, size_t hi = N) {
+    return
+        (hi - lo == 1) ? values[lo] :
+        smaller(min_values(values, lo, lo + (hi - lo) / 2), min_values(values, lo + (hi - lo) / 2, hi));
+}
+
+// True if all of the flags are, without looking at them one by one.
+template<bool... flags>
+struct bool_pack { };
+template<bool... flags>
+using all_of = std::is_same<bool_pack<true, flags...>, bool_pack<flags..., true>>;
 
 template<size_t index, bool indexed, typename basetype, typename type>
 struct tuple_element :
@@ -216,12 +269,18 @@ struct tuple_impl;
 template<size_t... indices, bool indexed, typename basetype, typename... types>
 struct tuple_impl<index_sequence<indices...>, indexed, basetype, types...> :
     tuple_element<indices, indexed, basetype, types>... {
-    using offsets = offset_calculator<0, types...>;
+    template<size_t index>
+    using type_at = typename type_at_index<index, types...>::type;
+    template<size_t index>
+    constexpr const type_at<index> & get() const {
+        return static_cast<const tuple_element<index, indexed, basetype, type_at<index>> &>(*this).m_value;
+    }
+    // The trailing false only keeps the array from being empty.
     template<typename type>
     static constexpr int find() {
-        static_assert(count<type, types...>() <= 1, "get_index() failed: too many duplicate entries");
-        static_assert(count<type, types...>() == 1, "get_index() failed: couldn't find entry");
-        return find_inner<type, types...>();
+        static_assert(count_flags<sizeof...(types) + 1>({ std::is_same<type, types>::value..., false }) <= 1, "get_index() failed: too many duplicate entries");
+        static_assert(count_flags<sizeof...(types) + 1>({ std::is_same<type, types>::value..., false }) == 1, "get_index() failed: couldn't find entry");
+        return find_flag<sizeof...(types) + 1>({ std::is_same<type, types>::value..., false });
     }
 } USB_PACKED;
 
@@ -232,16 +291,51 @@ struct typed_tuple : typed_tuple_generic<basetype, false, types...> { } USB_PACK
 template<typename basetype, typename... types>
 struct typed_indexed_tuple : typed_tuple_generic<basetype, true, types...> { } USB_PACKED;
 
-template<size_t index, typename head, typename... tail>
-struct type_at_index {
-    using type = typename type_at_index<index - 1, tail...>::type;
+/**
+  * A table of descriptors, as sent to the host: where each of them starts
+  * in ROM, and its length. It is computed at compile time from a tuple of
+  * descriptors, each starting with its m_bLength, and lives next to it,
+  * so that answering GET_DESCRIPTOR is a bounds checked array lookup.
+  */
+struct descriptor_entry {
+    const uint8_t * m_data;
+    uint16_t m_wLength;
 } USB_PACKED;
 
-template<typename head, typename... tail>
-struct type_at_index<0, head, tail...> {
-    using type = head;
+template<size_t N>
+struct descriptor_table {
+    descriptor_entry m_entries[N];
+    // NULL for indexes out of the table; length can be NULL as well.
+    const uint8_t * get(size_t index, uint16_t * length) const {
+        if (index >= N) return NULL;
+        if (length) *length = m_entries[index].m_wLength;
+        return m_entries[index].m_data;
+    }
 } USB_PACKED;
 
+template<typename tuple, size_t... indices>
+constexpr descriptor_table<sizeof...(indices)> make_descriptor_table(const tuple & t, index_sequence<indices...>) {
+    return descriptor_table<sizeof...(indices)> { {
+        { &t.template get<indices>().m_bLength, sizeof(typename tuple::template type_at<indices>) }...
+    } };
+}
+
+/**
+  * A plain list of types, that never gets instanciated. It is used to
+  * carry computed lists around, such as the fields of a HID report.
+  */
+template<typename... types>
+struct type_list {
+    template<typename type>
+    using append = type_list<types..., type>;
+    static constexpr size_t size = sizeof...(types);
+};
+
+template<size_t index, typename list>
+struct type_list_at;
+template<size_t index, typename... types>
+struct type_list_at<index, type_list<types...>> : type_at_index<index, types...> { };
+
 template<size_t outer_index, size_t inner_index, typename basetype, typename type>
 struct inner_tuple_element {
     constexpr inner_tuple_element() : m_value(outer_index, inner_index) {
@@ -285,7 +379,7 @@ struct embedded_tuple :
   * This concat<> helper will call | recursively on a tuple.
   */
 template<typename rettype, typename basetype, typename type>
-constexpr rettype concat(rettype dummy, basetype ref, type value) {
+constexpr rettype concat(rettype, basetype, type value) {
     static_assert(std::is_same<basetype, type>::value, "Wrong type for concatenation");
     return static_cast<rettype>(value);
 }
@@ -308,39 +402,32 @@ namespace USB {
   */
 template<size_t L>
 struct StringDescriptorHeader {
-    uint8_t m_bLenght = 2 + L * 2;
+    uint8_t m_bLength = 2 + L * 2;
     uint8_t m_bDescriptorType = 3;
 } USB_PACKED;
 
 // I'm not going to try doing true UTF-8 or Unicode support,
 // so let's limit ourselves to plain ASCII.
-template<size_t index, char C>
-struct CharChecker {
-    constexpr CharChecker() {
-        static_assert(C < 127, "Invalid (non ascii) character in a USB string");
-        static_assert(C >= 32, "Invalid (non ascii) character in a USB string");
+template<char... C>
+struct StringChecker {
+    constexpr StringChecker() {
+        static_assert(usb_template_helpers::all_of<(C >= 32 && C < 127)...>::value, "Invalid (non ascii) character in a USB string");
     }
 } USB_PACKED;
 
-template<typename indices, char... C>
-struct StringCheckerInner;
-template<size_t... indices, char... C>
-struct StringCheckerInner<usb_template_helpers::index_sequence<indices...>, C...> : CharChecker<indices, C>... { } USB_PACKED;
-
-template<char... C>
-struct StringChecker : StringCheckerInner<typename usb_template_helpers::make_index_sequence<sizeof...(C)>::type, C...> { } USB_PACKED;
-
-// Strings are stored in little endian unicode.
-template<size_t index, char C>
-struct StringChar : usb_template_helpers::pack16<C> { } USB_PACKED;
-
-template<typename indices, char... C>
-struct StringContentsInner;
-template<size_t... indices, char... C>
-struct StringContentsInner<usb_template_helpers::index_sequence<indices...>, C...> : StringChar<indices, C>... { } USB_PACKED;
+// Strings are stored in little endian unicode, in a single array rather
+// than one type per character.
+struct StringChar {
+    uint8_t m_lo;
+    uint8_t m_hi;
+} USB_PACKED;
 
 template<char... C>
-struct StringContents : StringContentsInner<typename usb_template_helpers::make_index_sequence<sizeof...(C)>::type, C...> { } USB_PACKED;
+struct StringContents {
+    StringChar m_chars[sizeof...(C)] = { { static_cast<uint8_t>(C), 0 }... };
+} USB_PACKED;
+template<>
+struct StringContents<> { } USB_PACKED;
 
 struct StringDescriptorBase { } USB_PACKED;
 template<typename type>
@@ -377,15 +464,15 @@ struct StringCollection
     : StringCollectionBase
     , string_tuple<strings...> {
     using type = string_tuple<strings...>;
+    using table = usb_template_helpers::descriptor_table<1 + sizeof...(strings)>;
 
-    typename type::offsets stringOffsets;
     // StringCollection being the top level type for StringDescriptors,
-    // this is where we're going to return a pointer to a host request.
-    constexpr const uint8_t * GetStringDescriptor(size_t index) const {
-        return
-            (index >= sizeof...(strings)) ? NULL :
-            (index < 0) ? NULL :
-            reinterpret_cast<const uint8_t *>(this) + reinterpret_cast<const ptrdiff_t *>(&stringOffsets)[index];
+    // this is where the table answering host requests comes from. It is
+    // indexed by string index, and meant to be a constexpr of its own.
+    constexpr table GetStringTable() const {
+        return usb_template_helpers::make_descriptor_table(
+            static_cast<const type &>(*this),
+            typename usb_template_helpers::make_index_sequence<1 + sizeof...(strings)>::type());
     }
 } USB_PACKED;
 
@@ -411,13 +498,16 @@ struct EndpointAddress : EndpointAddressBase {
 
 struct EndpointAttributesBase { } USB_PACKED;
 struct ControlEndpoint : EndpointAttributesBase {
-    uint8_t m_value = 0;
+    static constexpr uint8_t transferType = 0;
+    uint8_t m_value = transferType;
 } USB_PACKED;
 struct BulkEndpoint : EndpointAttributesBase {
-    uint8_t m_value = 2;
+    static constexpr uint8_t transferType = 2;
+    uint8_t m_value = transferType;
 } USB_PACKED;
 struct InterruptEndpoint : EndpointAttributesBase {
-    uint8_t m_value = 3;
+    static constexpr uint8_t transferType = 3;
+    uint8_t m_value = transferType;
 } USB_PACKED;
 enum SynchronisationType {
     NoSynchronisation,
@@ -435,17 +525,20 @@ template<
     UsageType usageType
 >
 struct IsochronousEndpoint : EndpointAttributesBase {
+    static constexpr uint8_t transferType = 1;
     uint8_t m_value =
-        1 |
+        transferType |
         (static_cast<uint8_t>(synchronisationType) << 2) |
         (static_cast<uint8_t>(usageType) << 4);
-};
+} USB_PACKED;
 
 struct EndpointMaxPacketSizeBase { } USB_PACKED;
 template<uint16_t value>
 struct EndpointMaxPacketSize
     : EndpointMaxPacketSizeBase
-    , usb_template_helpers::pack16<value> { } USB_PACKED;
+    , usb_template_helpers::pack16<value> {
+    static constexpr uint16_t wMaxPacketSize = value;
+} USB_PACKED;
 
 struct IntervalBase { } USB_PACKED;
 template<uint8_t value>
@@ -453,6 +546,49 @@ struct Interval : IntervalBase {
     uint8_t m_value = value;
 } USB_PACKED;
 
+/**
+  * Periodic bandwidth. Once an alternate setting holding isochronous or
+  * interrupt endpoints is selected, the host reserves room for them in
+  * the frames (microframes at high speed) they are polled in, and at most
+  * 90% of a full speed frame, 80% of a high speed microframe, can be
+  * reserved that way. Nothing tells when the host will poll an endpoint
+  * relative to the others, whatever their intervals are, so the worst
+  * case, where every periodic endpoint lands in the same frame, is what
+  * has to fit.
+  *
+  * The cost of a transaction, in bytes on the bus, is its payload with
+  * the worst case bit stuffing, plus the protocol overhead the USB 2.0
+  * specification gives for each transfer type and speed (5.6.3, 5.7.4).
+  * High speed endpoints may do up to 3 transactions per microframe.
+  *
+  * Each ConfigurationDescriptor checks its worst alternate settings
+  * against the budget of USB_DESCRIPTORS_SPEED, full speed unless
+  * defined otherwise, and reports what's left as periodicHeadroom<>().
+  */
+enum Speed {
+    FullSpeed,
+    HighSpeed,
+};
+#ifndef USB_DESCRIPTORS_SPEED
+#define USB_DESCRIPTORS_SPEED USB::FullSpeed
+#endif
+constexpr unsigned periodicBudget(Speed speed) {
+    return speed == HighSpeed ? 7500 * 8 / 10 : 1500 * 9 / 10;
+}
+constexpr unsigned periodicOverhead(Speed speed, uint8_t transferType) {
+    return
+        transferType == 1 ? (speed == HighSpeed ? 38 : 9) :
+        transferType == 3 ? (speed == HighSpeed ? 55 : 13) : 0;
+}
+constexpr unsigned periodicTransaction(Speed speed, uint8_t transferType, unsigned payload) {
+    return periodicOverhead(speed, transferType) ? periodicOverhead(speed, transferType) + (payload * 7 + 5) / 6 : 0;
+}
+constexpr unsigned periodicEndpointBytes(Speed speed, uint8_t transferType, uint16_t wMaxPacketSize) {
+    return
+        (speed == HighSpeed ? 1 + ((wMaxPacketSize >> 11) & 3) : 1) *
+        periodicTransaction(speed, transferType, wMaxPacketSize & 0x7ff);
+}
+
 struct EndpointDescriptorBase { } USB_PACKED;
 template<
     typename EndpointAddress,
@@ -473,6 +609,11 @@ struct EndpointDescriptor : EndpointDescriptorBase {
     EndpointAttributes m_bmAttributes;
     EndpointMaxPacketSize m_wMaxPacketSize;
     Interval m_bInterval;
+
+    template<Speed speed>
+    static constexpr unsigned periodicBytes() {
+        return periodicEndpointBytes(speed, EndpointAttributes::transferType, EndpointMaxPacketSize::wMaxPacketSize);
+    }
 } USB_PACKED;
 
 struct EndpointDescriptorListBase { } USB_PACKED;
@@ -481,6 +622,11 @@ struct EndpointDescriptorList
     : EndpointDescriptorListBase
     , usb_template_helpers::typed_indexed_tuple<EndpointDescriptorBase, types...> {
     static constexpr size_t bNumEndpoints = sizeof...(types);
+
+    template<Speed speed>
+    static constexpr unsigned periodicBytes() {
+        return usb_template_helpers::sum_values<sizeof...(types) + 1>({ types::template periodicBytes<speed>()..., 0 });
+    }
 } USB_PACKED;
 
 
@@ -619,7 +765,13 @@ struct InterfaceAlternateListBase { } USB_PACKED;
 template<typename... types>
 struct InterfaceAlternateList
     : InterfaceAlternateListBase
-    , usb_template_helpers::inner_tuple<types...> { } USB_PACKED;
+    , usb_template_helpers::inner_tuple<types...> {
+    // Only one alternate setting is selected at a time.
+    template<Speed speed>
+    static constexpr unsigned periodicBytes() {
+        return usb_template_helpers::max_values<sizeof...(types) + 1>({ types::template periodicBytes<speed>()..., 0 });
+    }
+} USB_PACKED;
 
 struct InterfaceDescriptorListBase { } USB_PACKED;
 template<typename... alternates>
@@ -627,6 +779,11 @@ struct InterfaceDescriptorList
     : InterfaceDescriptorListBase
     , usb_template_helpers::embedded_tuple<InterfaceDescriptorBase, alternates...> {
     static constexpr size_t bNumInterfaces = sizeof...(alternates);
+
+    template<Speed speed>
+    static constexpr unsigned periodicBytes() {
+        return usb_template_helpers::sum_values<sizeof...(alternates) + 1>({ alternates::template periodicBytes<speed>()..., 0 });
+    }
 } USB_PACKED;
 
 
@@ -669,6 +826,7 @@ struct ConfigurationDescriptor : ConfigurationDescriptorBase {
         static_assert(std::is_base_of<ConfigurationAttributesBase, ConfigurationAttributes>::value, "Wrong ConfigurationAttributes type");
         static_assert(std::is_base_of<MaxPowerBase, MaxPower>::value, "Wrong MaxPower type");
         static_assert(std::is_base_of<InterfaceDescriptorListBase, InterfaceDescriptorList>::value, "Wrong InterfaceDescriptorList type");
+        static_assert(periodicHeadroom<USB_DESCRIPTORS_SPEED>() >= 0, "Periodic endpoints exceed the bandwidth of a frame");
     }
     uint8_t m_bLength = 9;
     uint8_t m_bDescriptorType = 2;
@@ -683,6 +841,13 @@ struct ConfigurationDescriptor : ConfigurationDescriptorBase {
         ConfigurationDescriptor<ConfigurationAttributes, MaxPower, ConfigurationString, InterfaceDescriptorList>,
         m_interfaceDescriptors
     );
+
+    // Bytes per frame left to the other periodic transfers on the bus,
+    // with the most demanding alternate setting of each interface.
+    template<Speed speed>
+    static constexpr int periodicHeadroom() {
+        return static_cast<int>(periodicBudget(speed)) - static_cast<int>(InterfaceDescriptorList::template periodicBytes<speed>());
+    }
 } USB_PACKED;
 
 struct ConfigurationDescriptorListBase { } USB_PACKED;
@@ -692,6 +857,12 @@ struct ConfigurationDescriptorList
     , usb_template_helpers::typed_indexed_tuple<ConfigurationDescriptorBase, types...> {
     static constexpr size_t bNumConfigurations = sizeof...(types);
     static constexpr ptrdiff_t firstInterfaceOffset = usb_template_helpers::type_at_index<0, types...>::type::firstInterfaceOffset;
+
+    // That of the most demanding configuration.
+    template<Speed speed>
+    static constexpr int periodicHeadroom() {
+        return usb_template_helpers::min_values<sizeof...(types)>({ types::template periodicHeadroom<speed>()... });
+    }
 } USB_PACKED;
 
 
@@ -707,6 +878,8 @@ struct SpecificationNumber : SpecificationNumberBase, usb_template_helpers::pack
 struct USB1_0 : SpecificationNumber<0x100> { } USB_PACKED;
 struct USB1_1 : SpecificationNumber<0x110> { } USB_PACKED;
 struct USB2_0 : SpecificationNumber<0x200> { } USB_PACKED;
+// What hosts look for before asking for the BOSDescriptor.
+struct USB2_1 : SpecificationNumber<0x210> { } USB_PACKED;
 
 struct DeviceClassBase { } USB_PACKED;
 template<uint8_t value>
@@ -794,23 +967,108 @@ struct DeviceDescriptor {
     uint8_t m_bNumConfigurations = ConfigurationDescriptorList::bNumConfigurations;
     ConfigurationDescriptorList m_configurationDescriptors;
 
-    typename ConfigurationDescriptorList::offsets configurationOffsets;
-    // This method will return a pointer to a Configuration Descriptor, to
-    // reply to a USB host request.
-    constexpr const uint8_t * GetConfigurationDescriptor(size_t index) const {
-        return
-            (index > ConfigurationDescriptorList::bNumConfigurations) ? NULL :
-            (index <= 0) ? NULL :
-            reinterpret_cast<const uint8_t *>(&m_configurationDescriptors) + reinterpret_cast<const ptrdiff_t *>(&configurationOffsets)[index - 1];
+    using table = usb_template_helpers::descriptor_table<ConfigurationDescriptorList::bNumConfigurations>;
+    // Where the first Interface Descriptor starts within a Configuration
+    // Descriptor.
+    static constexpr ptrdiff_t firstInterfaceOffset = ConfigurationDescriptorList::firstInterfaceOffset;
+    // Periodic bandwidth left in a frame by the most demanding configuration.
+    template<Speed speed>
+    static constexpr int periodicHeadroom() {
+        return ConfigurationDescriptorList::template periodicHeadroom<speed>();
+    }
+
+    // This method will return the table of the Configuration Descriptors,
+    // indexed the way the host requests them, from 0. It is meant to be a
+    // constexpr of its own, so that it ends up in ROM.
+    constexpr table GetConfigurationTable() const {
+        return usb_template_helpers::make_descriptor_table(
+            m_configurationDescriptors,
+            typename usb_template_helpers::make_index_sequence<ConfigurationDescriptorList::bNumConfigurations>::type());
+    }
+} USB_PACKED;
+
+/**
+  * Finds, within a Configuration Descriptor, the first descriptor of the
+  * given type that belongs to an interface, in its alternate setting 0.
+  * Class descriptors, such as HID's, sit between the Interface Descriptor
+  * and its endpoints, but after whatever other optional descriptor comes
+  * first, so their offset is not a fixed one. Meant for the class requests
+  * that ask for them alone; returns NULL if there is none.
+  */
+inline const uint8_t * FindInterfaceDescriptor(const uint8_t * config, uint8_t interface, uint8_t type) {
+    if (!config) return NULL;
+    uint16_t total = config[2] | (config[3] << 8);
+    bool inside = false;
+    for (uint16_t i = config[0]; i + 2 <= total && config[i] >= 2 && i + config[i] <= total; i += config[i]) {
+        const uint8_t * desc = config + i;
+        if (desc[1] == 4)
+            inside = desc[2] == interface && desc[3] == 0;
+        else if (inside && desc[1] == type)
+            return desc;
+    }
+    return NULL;
+}
+
+
+/**
+  * Declaring BOSDescriptor, the Binary device Object Store. This is a top
+  * level descriptor of its own, that the host asks for with its own
+  * GET_DESCRIPTOR request, and only when bcdUSB is 2.01 or above, hence
+  * USB2_1. It holds a list of device capabilities, the PlatformCapability
+  * being the one through which operating systems find their own
+  * descriptors, such as the Microsoft OS 2.0 ones.
+  */
+struct DeviceCapabilityBase { } USB_PACKED;
+
+template<bool LPM = false>
+struct USB20ExtensionCapability : DeviceCapabilityBase {
+    uint8_t m_bLength = 7;
+    uint8_t m_bDescriptorType = 0x10;
+    uint8_t m_bDevCapabilityType = 2;
+    usb_template_helpers::pack32<LPM ? 0x02 : 0x00> m_bmAttributes;
+} USB_PACKED;
+
+// UUIDs are written {d1-d2-d3-d4-d5}, and stored the way Microsoft stores
+// GUIDs: the first three fields little endian, the last eight bytes in the
+// order they are written in.
+struct UUIDBase { } USB_PACKED;
+template<uint32_t d1, uint16_t d2, uint16_t d3, uint16_t d4, uint64_t d5>
+struct UUID : UUIDBase {
+    usb_template_helpers::pack32<d1> m_d1;
+    usb_template_helpers::pack16<d2> m_d2;
+    usb_template_helpers::pack16<d3> m_d3;
+    uint8_t m_d4[8] = {
+        static_cast<uint8_t>(d4 >> 8), static_cast<uint8_t>(d4),
+        static_cast<uint8_t>(d5 >> 40), static_cast<uint8_t>(d5 >> 32),
+        static_cast<uint8_t>(d5 >> 24), static_cast<uint8_t>(d5 >> 16),
+        static_cast<uint8_t>(d5 >> 8), static_cast<uint8_t>(d5),
+    };
+} USB_PACKED;
+
+template<typename UUID, typename CapabilityData>
+struct PlatformCapability : DeviceCapabilityBase {
+    constexpr PlatformCapability() {
+        static_assert(std::is_base_of<UUIDBase, UUID>::value, "Wrong UUID type");
     }
-    // This method will return a pointer to the first Interface Descriptor
-    // of a Configuration Descriptor.
-    constexpr const uint8_t * GetFirstInterfaceDescriptor(size_t index) const {
-        return
-            (index > ConfigurationDescriptorList::bNumConfigurations) ? NULL :
-            (index <= 0) ? NULL :
-            GetConfigurationDescriptor(index) + ConfigurationDescriptorList::firstInterfaceOffset;
+    uint8_t m_bLength = 20 + sizeof(CapabilityData);
+    uint8_t m_bDescriptorType = 0x10;
+    uint8_t m_bDevCapabilityType = 5;
+    uint8_t m_bReserved = 0;
+    UUID m_PlatformCapabilityUUID;
+    CapabilityData m_CapabilityData;
+} USB_PACKED;
+
+template<typename... capabilities>
+struct BOSDescriptor {
+    using capability_tuple = usb_template_helpers::typed_tuple<DeviceCapabilityBase, capabilities...>;
+    constexpr BOSDescriptor() {
+        static_assert(sizeof...(capabilities) > 0, "A BOSDescriptor needs at least one capability");
     }
+    uint8_t m_bLength = 5;
+    uint8_t m_bDescriptorType = 0x0f;
+    usb_template_helpers::pack16<5 + sizeof(capability_tuple)> m_wTotalLength;
+    uint8_t m_bNumDeviceCaps = sizeof...(capabilities);
+    capability_tuple m_capabilities;
 } USB_PACKED;
 
 /*
@@ -893,16 +1151,371 @@ struct DeviceReleaseNumber : DeviceReleaseNumberBase, usb_template_helpers::pack
     } USB_PACKED;
     } //namespace CDC
     namespace HID {
+    /**
+      * Declaring ReportDescriptor. Report descriptors are a bytecode of
+      * items rather than a structure, so each item is its own type, emitting
+      * its prefix and the smallest data that holds its value:
+      *
+      *   typedef USB::HID::ReportDescriptor<
+      *       USB::HID::UsagePage<USB::HID::GenericDesktop>,
+      *       USB::HID::Usage<0x02>,
+      *       USB::HID::Collection<USB::HID::Application,
+      *           USB::HID::ReportSize<8>,
+      *           USB::HID::ReportCount<2>,
+      *           USB::HID::Input<USB::HID::Data, USB::HID::Variable, USB::HID::Relative>
+      *       >
+      *   > descriptor;
+      *
+      * The items are also folded into the state a host parser would keep,
+      * so that the layout of each report is known at compilation time:
+      * Report<descriptor, InputReport> is then a packed report of the right
+      * size, that can be built in one go out of its elements, or accessed
+      * element by element. Push and Pop aren't supported.
+      */
+    enum ReportType {
+        InputReport = 1,
+        OutputReport = 2,
+        FeatureReport = 3,
+    };
+
+    enum UsagePageValue {
+        GenericDesktop = 0x01,
+        SimulationControls = 0x02,
+        KeyboardKeypad = 0x07,
+        LEDs = 0x08,
+        Button = 0x09,
+        Consumer = 0x0c,
+        VendorDefined = 0xff00,
+    };
+
+    enum CollectionType {
+        Physical = 0x00,
+        Application = 0x01,
+        Logical = 0x02,
+        ReportCollection = 0x03,
+        NamedArray = 0x04,
+        UsageSwitch = 0x05,
+        UsageModifier = 0x06,
+    };
+
+    // Flags of the Input, Output and Feature items; Volatile doesn't apply
+    // to Input.
+    enum MainItemFlag {
+        Data = 0x000,
+        Constant = 0x001,
+        Array = 0x000,
+        Variable = 0x002,
+        Absolute = 0x000,
+        Relative = 0x004,
+        NoWrap = 0x000,
+        Wrap = 0x008,
+        Linear = 0x000,
+        NonLinear = 0x010,
+        PreferredState = 0x000,
+        NoPreferred = 0x020,
+        NoNullPosition = 0x000,
+        NullState = 0x040,
+        NonVolatile = 0x000,
+        Volatile = 0x080,
+        BitField = 0x000,
+        BufferedBytes = 0x100,
+    };
+
+    constexpr size_t short_item_size(uint32_t value) {
+        return value <= 0xff ? 1 : value <= 0xffff ? 2 : 4;
+    }
+    constexpr size_t short_item_signed_size(int32_t value) {
+        return (value >= -128 && value <= 127) ? 1 : (value >= -32768 && value <= 32767) ? 2 : 4;
+    }
+
+    template<uint8_t prefix, size_t size>
+    struct ShortItemPrefix {
+        uint8_t m_bPrefix = prefix | (size == 4 ? 3 : size);
+    } USB_PACKED;
+
+    template<uint32_t value, size_t size>
+    struct ShortItemData;
+    template<uint32_t value>
+    struct ShortItemData<value, 0> { } USB_PACKED;
+    template<uint32_t value>
+    struct ShortItemData<value, 1> {
+        uint8_t m_data = value & 0xff;
+    } USB_PACKED;
+    template<uint32_t value>
+    struct ShortItemData<value, 2> : usb_template_helpers::pack16<value & 0xffff> { } USB_PACKED;
+    template<uint32_t value>
+    struct ShortItemData<value, 4> {
+        usb_template_helpers::pack16<value & 0xffff> m_lo;
+        usb_template_helpers::pack16<(value >> 16)> m_hi;
+    } USB_PACKED;
+
+    // The prefix holds the tag and type of the item; the size is added.
+    template<uint8_t prefix, uint32_t value, size_t size>
+    struct ShortItem
+        : ShortItemPrefix<prefix, size>
+        , ShortItemData<value, size> { } USB_PACKED;
+
+    /**
+      * The parser state: the global items that the layout depends on, and
+      * the fields that the main items declared so far.
+      */
+    template<ReportType reportType, uint8_t reportID, uint8_t size, uint16_t count, bool constant, bool isSigned>
+    struct ReportField {
+        static constexpr ReportType type = reportType;
+        static constexpr uint8_t id = reportID;
+        static constexpr uint8_t bSize = size;
+        static constexpr uint16_t bCount = count;
+        static constexpr bool bConstant = constant;
+        static constexpr bool bSigned = isSigned;
+    };
+
+    template<uint8_t size, uint16_t count, uint8_t reportID, bool isSigned, typename fields>
+    struct ReportState {
+        template<uint8_t value>
+        using with_size = ReportState<value, count, reportID, isSigned, fields>;
+        template<uint16_t value>
+        using with_count = ReportState<size, value, reportID, isSigned, fields>;
+        template<uint8_t value>
+        using with_id = ReportState<size, count, value, isSigned, fields>;
+        template<bool value>
+        using with_sign = ReportState<size, count, reportID, value, fields>;
+        template<ReportType type, bool constant>
+        using with_field = ReportState<size, count, reportID, isSigned,
+            typename fields::template append<ReportField<type, reportID, size, count, constant, isSigned>>>;
+        using field_list = fields;
+    };
+
+    // Items that don't change the layout pass the state along as is.
+    struct ReportItemBase {
+        template<typename state>
+        using next = state;
+    } USB_PACKED;
+
+    template<typename state, typename... items>
+    struct fold_report_items {
+        using type = state;
+    };
+    template<typename state, typename head, typename... tail>
+    struct fold_report_items<state, head, tail...>
+        : fold_report_items<typename head::template next<state>, tail...> { };
+
+    template<uint16_t page>
+    struct UsagePage : ReportItemBase, ShortItem<0x04, page, short_item_size(page)> { } USB_PACKED;
+    template<uint32_t usage>
+    struct Usage : ReportItemBase, ShortItem<0x08, usage, short_item_size(usage)> { } USB_PACKED;
+    template<uint32_t usage>
+    struct UsageMinimum : ReportItemBase, ShortItem<0x18, usage, short_item_size(usage)> { } USB_PACKED;
+    template<uint32_t usage>
+    struct UsageMaximum : ReportItemBase, ShortItem<0x28, usage, short_item_size(usage)> { } USB_PACKED;
+
+    // The elements are signed whenever their logical minimum is negative.
+    template<int32_t value>
+    struct LogicalMinimum : ReportItemBase, ShortItem<0x14, static_cast<uint32_t>(value), short_item_signed_size(value)> {
+        template<typename state>
+        using next = typename state::template with_sign<(value < 0)>;
+    } USB_PACKED;
+    template<int32_t value>
+    struct LogicalMaximum : ReportItemBase, ShortItem<0x24, static_cast<uint32_t>(value), short_item_signed_size(value)> { } USB_PACKED;
+    template<int32_t value>
+    struct PhysicalMinimum : ReportItemBase, ShortItem<0x34, static_cast<uint32_t>(value), short_item_signed_size(value)> { } USB_PACKED;
+    template<int32_t value>
+    struct PhysicalMaximum : ReportItemBase, ShortItem<0x44, static_cast<uint32_t>(value), short_item_signed_size(value)> { } USB_PACKED;
+
+    template<uint8_t value>
+    struct ReportSize : ReportItemBase, ShortItem<0x74, value, short_item_size(value)> {
+        constexpr ReportSize() {
+            static_assert(value >= 1 && value <= 32, "ReportSize must be 1 to 32 bits");
+        }
+        template<typename state>
+        using next = typename state::template with_size<value>;
+    } USB_PACKED;
+    template<uint16_t value>
+    struct ReportCount : ReportItemBase, ShortItem<0x94, value, short_item_size(value)> {
+        template<typename state>
+        using next = typename state::template with_count<value>;
+    } USB_PACKED;
+    template<uint8_t value>
+    struct ReportID : ReportItemBase, ShortItem<0x84, value, short_item_size(value)> {
+        constexpr ReportID() {
+            static_assert(value != 0, "Report ID 0 is reserved");
+        }
+        template<typename state>
+        using next = typename state::template with_id<value>;
+    } USB_PACKED;
+
+    template<ReportType type, uint8_t prefix, MainItemFlag... flags>
+    struct MainItem
+        : ReportItemBase
+        , ShortItem<
+            prefix,
+            usb_template_helpers::concat(static_cast<uint32_t>(0), Data, Data, flags...),
+            short_item_size(usb_template_helpers::concat(static_cast<uint32_t>(0), Data, Data, flags...))> {
+        template<typename state>
+        using next = typename state::template with_field<type, (usb_template_helpers::concat(static_cast<uint32_t>(0), Data, Data, flags...) & Constant) != 0>;
+    } USB_PACKED;
+    template<MainItemFlag... flags>
+    struct Input : MainItem<InputReport, 0x80, flags...> { } USB_PACKED;
+    template<MainItemFlag... flags>
+    struct Output : MainItem<OutputReport, 0x90, flags...> { } USB_PACKED;
+    template<MainItemFlag... flags>
+    struct Feature : MainItem<FeatureReport, 0xb0, flags...> { } USB_PACKED;
+
+    template<CollectionType type, typename... items>
+    struct Collection : ReportItemBase {
+        constexpr Collection() {
+            static_assert(sizeof...(items) >= 1, "Empty Collection");
+        }
+        ShortItem<0xa0, type, 1> m_begin;
+        usb_template_helpers::typed_tuple<ReportItemBase, items...> m_items;
+        ShortItem<0xc0, 0, 0> m_end;
+        template<typename state>
+        using next = typename fold_report_items<state, items...>::type;
+    } USB_PACKED;
+
+    struct ReportDescriptorBase { } USB_PACKED;
+    template<typename... items>
+    struct ReportDescriptor
+        : ReportDescriptorBase
+        , usb_template_helpers::typed_tuple<ReportItemBase, items...> {
+        constexpr ReportDescriptor() {
+            static_assert(sizeof...(items) >= 1, "Empty ReportDescriptor");
+        }
+        using fields = typename fold_report_items<
+            ReportState<0, 0, 0, false, usb_template_helpers::type_list<>>, items...
+        >::type::field_list;
+    } USB_PACKED;
+
+    /**
+      * Declaring Report. The elements of the fields of the given type and ID
+      * are laid out one after the other, LSB first, after the ID byte if
+      * there is one; constant fields are padding. The constructor takes one
+      * value per element, in order, and computes each byte at compilation
+      * time whenever the values are constants.
+      */
+    template<size_t offset, uint8_t size, bool isSigned>
+    struct ReportElement {
+        static constexpr size_t bOffset = offset;
+        static constexpr uint8_t bSize = size;
+        static constexpr bool bSigned = isSigned;
+        static constexpr uint32_t mask = size >= 32 ? 0xffffffff : (static_cast<uint32_t>(1) << (size & 31)) - 1;
+        template<size_t byte>
+        static constexpr uint8_t byte_of(uint32_t value) {
+            return
+                (offset + size <= byte * 8) || (offset >= byte * 8 + 8) ? 0 :
+                (offset >= byte * 8) ? static_cast<uint8_t>((value & mask) << ((offset - byte * 8) & 31)) :
+                static_cast<uint8_t>((value & mask) >> ((byte * 8 - offset) & 31));
+        }
+    };
+
+    template<typename elements, size_t offset, uint8_t size, uint16_t count, bool isSigned>
+    struct add_report_elements
+        : add_report_elements<typename elements::template append<ReportElement<offset, size, isSigned>>, offset + size, size, count - 1, isSigned> { };
+    template<typename elements, size_t offset, uint8_t size, bool isSigned>
+    struct add_report_elements<elements, offset, size, 0, isSigned> {
+        using type = elements;
+    };
+
+    template<ReportType type, uint8_t reportID, size_t offset, typename elements, typename fields>
+    struct report_layout;
+    template<ReportType type, uint8_t reportID, size_t offset, typename elements>
+    struct report_layout<type, reportID, offset, elements, usb_template_helpers::type_list<>> {
+        using element_list = elements;
+        static constexpr size_t bits = offset;
+    };
+    template<ReportType type, uint8_t reportID, size_t offset, typename elements, typename head, typename... tail>
+    struct report_layout<type, reportID, offset, elements, usb_template_helpers::type_list<head, tail...>>
+        : std::conditional<(head::type == type) && (head::id == reportID),
+            report_layout<
+                type, reportID, offset + head::bSize * head::bCount,
+                typename std::conditional<head::bConstant,
+                    add_report_elements<elements, offset, head::bSize, 0, head::bSigned>,
+                    add_report_elements<elements, offset, head::bSize, head::bCount, head::bSigned>
+                >::type::type,
+                usb_template_helpers::type_list<tail...>>,
+            report_layout<type, reportID, offset, elements, usb_template_helpers::type_list<tail...>>
+        >::type { };
+
+    template<size_t byte>
+    constexpr uint8_t pack_report_byte(usb_template_helpers::type_list<>) { return 0; }
+    template<size_t byte, typename head, typename... tail, typename... values>
+    constexpr uint8_t pack_report_byte(usb_template_helpers::type_list<head, tail...>, uint32_t value, values... rest) {
+        return head::template byte_of<byte>(value) | pack_report_byte<byte>(usb_template_helpers::type_list<tail...>(), rest...);
+    }
+
+    template<uint8_t reportID, typename elements, typename bytes>
+    struct ReportData;
+    template<uint8_t reportID, typename elements, size_t... bytes>
+    struct ReportData<reportID, elements, usb_template_helpers::index_sequence<bytes...>> {
+        constexpr ReportData() : m_data{ (bytes == 0 ? reportID : static_cast<uint8_t>(0))... } { }
+        template<typename... values>
+        constexpr ReportData(values... v)
+            : m_data{ static_cast<uint8_t>((bytes == 0 ? reportID : 0) | pack_report_byte<bytes>(elements(), v...))... } { }
+        uint8_t m_data[sizeof...(bytes)];
+    } USB_PACKED;
+
+    template<typename ReportDescriptor, ReportType type, uint8_t reportID = 0>
+    struct Report
+        : ReportData<
+            reportID,
+            typename report_layout<type, reportID, reportID ? 8 : 0, usb_template_helpers::type_list<>, typename ReportDescriptor::fields>::element_list,
+            typename usb_template_helpers::make_index_sequence<
+                (report_layout<type, reportID, reportID ? 8 : 0, usb_template_helpers::type_list<>, typename ReportDescriptor::fields>::bits + 7) / 8
+            >::type> {
+        using layout = report_layout<type, reportID, reportID ? 8 : 0, usb_template_helpers::type_list<>, typename ReportDescriptor::fields>;
+        using elements = typename layout::element_list;
+        static constexpr size_t bNumElements = elements::size;
+        static constexpr size_t wLength = (layout::bits + 7) / 8;
+
+        constexpr Report() {
+            static_assert(std::is_base_of<ReportDescriptorBase, ReportDescriptor>::value, "Wrong ReportDescriptor type");
+            static_assert(layout::bits > (reportID ? 8 : 0), "No such report in the ReportDescriptor");
+        }
+        template<typename... values, typename = typename std::enable_if<sizeof...(values) == elements::size>::type>
+        constexpr Report(values... v) : Report::ReportData(v...) { }
+
+        const uint8_t * data() const { return this->m_data; }
+
+        template<size_t index>
+        void set(uint32_t value) {
+            using element = typename usb_template_helpers::type_list_at<index, elements>::type;
+            value &= element::mask;
+            for (size_t bit = 0; bit < element::bSize; ) {
+                size_t pos = element::bOffset + bit;
+                size_t shift = pos & 7;
+                size_t n = element::bSize - bit < 8 - shift ? element::bSize - bit : 8 - shift;
+                uint8_t mask = ((1 << n) - 1) << shift;
+                this->m_data[pos >> 3] = (this->m_data[pos >> 3] & ~mask) | ((value >> bit) << shift & mask);
+                bit += n;
+            }
+        }
+        template<size_t index>
+        int32_t get() const {
+            using element = typename usb_template_helpers::type_list_at<index, elements>::type;
+            uint32_t value = 0;
+            for (size_t bit = 0; bit < element::bSize; ) {
+                size_t pos = element::bOffset + bit;
+                size_t shift = pos & 7;
+                size_t n = element::bSize - bit < 8 - shift ? element::bSize - bit : 8 - shift;
+                value |= static_cast<uint32_t>((this->m_data[pos >> 3] >> shift) & ((1 << n) - 1)) << bit;
+                bit += n;
+            }
+            if (element::bSigned && (value & ~(element::mask >> 1)))
+                value |= ~element::mask;
+            return static_cast<int32_t>(value);
+        }
+    } USB_PACKED;
+
     struct ReportDescriptorIndexBase { } USB_PACKED;
     template <
-      uint16_t reportsize //fix this
+      typename ReportDescriptor
     >
     struct ReportDescriptorIndex: ReportDescriptorIndexBase {
         constexpr ReportDescriptorIndex(size_t index) {
-            static_assert(std::is_base_of<ReportDescriptorIndexBase, ReportDescriptorIndex>::value, "Wrong ReportDescriptorIndex type");
+            static_assert(std::is_base_of<ReportDescriptorBase, ReportDescriptor>::value, "Wrong ReportDescriptor type");
+            static_assert(sizeof(ReportDescriptor) <= 0xffff, "ReportDescriptor too long");
         }
         uint8_t m_bDescriptorType = 0x22;
-        usb_template_helpers::pack16<reportsize> m_wDescriptorLength;
+        usb_template_helpers::pack16<sizeof(ReportDescriptor)> m_wDescriptorLength;
     } USB_PACKED;
 
     struct ReportDescriptorIndexListBase { } USB_PACKED;
@@ -972,6 +1585,391 @@ struct DeviceReleaseNumber : DeviceReleaseNumberBase, usb_template_helpers::pack
         ReportDescriptorIndexList m_reportDescriptorIndexList;
     } USB_PACKED;
     } //namespace HID
+    namespace Audio {
+    /**
+      * USB Audio Class 1.0. An audio function is made of one AudioControl
+      * interface, whose OptionalDescriptorList holds a ControlInterfaceHeader
+      * listing the terminals and units, followed by AudioStreaming
+      * interfaces. Each AudioStreaming interface has a zero bandwidth
+      * alternate setting 0, then one alternate setting per format, with
+      * a StreamingGeneral and a FormatTypeI as optional descriptors, and
+      * a StreamingEndpointDescriptor, optionally followed by its
+      * FeedbackEndpointDescriptor.
+      *
+      * The wMaxPacketSize of the streaming endpoints is computed out of the
+      * format: one extra sample frame per packet is accounted for, so that
+      * the host can speed up when following the feedback.
+      */
+    struct InterfaceSubClass_AudioControl : USB::InterfaceSubClass<0x01> { } USB_PACKED;
+    struct InterfaceSubClass_AudioStreaming : USB::InterfaceSubClass<0x02> { } USB_PACKED;
+    struct InterfaceSubClass_MIDIStreaming : USB::InterfaceSubClass<0x03> { } USB_PACKED;
+
+    enum TerminalType {
+        USBStreaming = 0x0101,
+        Microphone = 0x0201,
+        Speaker = 0x0301,
+        Headphones = 0x0302,
+        LineConnector = 0x0603,
+        SPDIFInterface = 0x0605,
+    };
+
+    enum ChannelConfig {
+        LeftFront = 0x0001,
+        RightFront = 0x0002,
+        CenterFront = 0x0004,
+        LowFrequencyEnhancement = 0x0008,
+        Mono = 0x0000,
+        Stereo = LeftFront | RightFront,
+    };
+
+    enum FeatureControl {
+        NoControl = 0x00,
+        Mute = 0x01,
+        Volume = 0x02,
+        Bass = 0x04,
+        Treble = 0x10,
+    };
+
+    enum FormatTag {
+        PCM = 0x0001,
+        PCM8 = 0x0002,
+        IEEEFloat = 0x0003,
+    };
+
+    /**
+      * Terminals and units of the AudioControl interface. Their IDs are
+      * explicit, since the topology is built by referencing them.
+      */
+    struct UnitBase { } USB_PACKED;
+    template<uint8_t terminalID, TerminalType terminalType, uint8_t nrChannels, uint16_t channelConfig, uint8_t assocTerminal = 0>
+    struct InputTerminal : UnitBase {
+        constexpr InputTerminal() {
+            static_assert(terminalID != 0, "Terminal ID 0 is reserved");
+        }
+        uint8_t m_bLength = 12;
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x02;
+        uint8_t m_bTerminalID = terminalID;
+        usb_template_helpers::pack16<terminalType> m_wTerminalType;
+        uint8_t m_bAssocTerminal = assocTerminal;
+        uint8_t m_bNrChannels = nrChannels;
+        usb_template_helpers::pack16<channelConfig> m_wChannelConfig;
+        uint8_t m_iChannelNames = 0;
+        uint8_t m_iTerminal = 0;
+    } USB_PACKED;
+
+    template<uint8_t terminalID, TerminalType terminalType, uint8_t sourceID, uint8_t assocTerminal = 0>
+    struct OutputTerminal : UnitBase {
+        constexpr OutputTerminal() {
+            static_assert(terminalID != 0, "Terminal ID 0 is reserved");
+        }
+        uint8_t m_bLength = 9;
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x03;
+        uint8_t m_bTerminalID = terminalID;
+        usb_template_helpers::pack16<terminalType> m_wTerminalType;
+        uint8_t m_bAssocTerminal = assocTerminal;
+        uint8_t m_bSourceID = sourceID;
+        uint8_t m_iTerminal = 0;
+    } USB_PACKED;
+
+    // The first control applies to the master channel, the following ones
+    // to each logical channel, in order.
+    template<uint8_t unitID, uint8_t sourceID, FeatureControl... controls>
+    struct FeatureUnit : UnitBase {
+        constexpr FeatureUnit() {
+            static_assert(unitID != 0, "Unit ID 0 is reserved");
+            static_assert(sizeof...(controls) >= 1, "A FeatureUnit needs at least the master channel controls");
+        }
+        uint8_t m_bLength = 7 + sizeof...(controls);
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x06;
+        uint8_t m_bUnitID = unitID;
+        uint8_t m_bSourceID = sourceID;
+        uint8_t m_bControlSize = 1;
+        uint8_t m_bmaControls[sizeof...(controls)] = { static_cast<uint8_t>(controls)... };
+        uint8_t m_iFeature = 0;
+    } USB_PACKED;
+
+    template<uint8_t... interfaces>
+    struct StreamingInterfaceList {
+        static constexpr size_t bInCollection = sizeof...(interfaces);
+        uint8_t m_baInterfaceNr[sizeof...(interfaces)] = { interfaces... };
+    } USB_PACKED;
+
+    // The class-specific AudioControl header, followed by the terminals and
+    // units; wTotalLength covers them all.
+    template<typename StreamingInterfaceList, typename... units>
+    struct ControlInterfaceHeader : USB::OptionalDescriptorBase {
+        uint8_t m_bLength = 8 + StreamingInterfaceList::bInCollection;
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x01;
+        usb_template_helpers::pack16<0x0100> m_bcdADC;
+        usb_template_helpers::pack16<8 + sizeof(StreamingInterfaceList) + sizeof(usb_template_helpers::typed_tuple<UnitBase, units...>)> m_wTotalLength;
+        uint8_t m_bInCollection = StreamingInterfaceList::bInCollection;
+        StreamingInterfaceList m_baInterfaceNr;
+        usb_template_helpers::typed_tuple<UnitBase, units...> m_units;
+    } USB_PACKED;
+
+    /**
+      * AudioStreaming interface descriptors.
+      */
+    template<uint8_t terminalLink, uint8_t delay = 1, FormatTag formatTag = PCM>
+    struct StreamingGeneral : USB::OptionalDescriptorBase {
+        uint8_t m_bLength = 7;
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x01;
+        uint8_t m_bTerminalLink = terminalLink;
+        uint8_t m_bDelay = delay;
+        usb_template_helpers::pack16<formatTag> m_wFormatTag;
+    } USB_PACKED;
+
+    template<size_t index, uint32_t rate>
+    struct SampleFrequency {
+        constexpr SampleFrequency() {
+            static_assert(rate > 0 && rate < (1 << 24), "Sample frequency out of range");
+        }
+        uint8_t m_tSamFreq[3] = { rate & 0xff, (rate >> 8) & 0xff, (rate >> 16) & 0xff };
+    } USB_PACKED;
+
+    template<typename indices, uint32_t... rates>
+    struct SampleFrequencyListInner;
+    template<size_t... indices, uint32_t... rates>
+    struct SampleFrequencyListInner<usb_template_helpers::index_sequence<indices...>, rates...> : SampleFrequency<indices, rates>... { } USB_PACKED;
+
+    template<uint32_t... rates>
+    struct SampleFrequencyList : SampleFrequencyListInner<typename usb_template_helpers::make_index_sequence<sizeof...(rates)>::type, rates...> { } USB_PACKED;
+
+    template<typename>
+    constexpr uint32_t max_rate() { return 0; }
+    template<typename dummy, uint32_t head, uint32_t... tail>
+    constexpr uint32_t max_rate() {
+        return head > max_rate<dummy, tail...>() ? head : max_rate<dummy, tail...>();
+    }
+
+    // Type I format (PCM) with a discrete list of sample frequencies.
+    template<uint8_t nrChannels, uint8_t subframeSize, uint8_t bitResolution, uint32_t... rates>
+    struct FormatTypeI : USB::OptionalDescriptorBase {
+        constexpr FormatTypeI() {
+            static_assert(sizeof...(rates) >= 1, "At least one sample frequency is needed");
+            static_assert(nrChannels >= 1, "At least one channel is needed");
+            static_assert(subframeSize >= 1 && subframeSize <= 4, "Subframes are 1 to 4 bytes");
+            static_assert(bitResolution <= subframeSize * 8, "Bit resolution doesn't fit in the subframe");
+        }
+        static constexpr uint32_t maxRate = max_rate<void, rates...>();
+        static constexpr uint16_t frameSize = nrChannels * subframeSize;
+        static constexpr uint16_t maxPacketSize = (maxRate / 1000 + 1) * frameSize;
+        static constexpr size_t bSamFreqType = sizeof...(rates);
+        uint8_t m_bLength = 8 + 3 * sizeof...(rates);
+        uint8_t m_bDescriptorType = 0x24;
+        uint8_t m_bDescriptorSubtype = 0x02;
+        uint8_t m_bFormatType = 0x01;
+        uint8_t m_bNrChannels = nrChannels;
+        uint8_t m_bSubFrameSize = subframeSize;
+        uint8_t m_bBitResolution = bitResolution;
+        uint8_t m_bSamFreqType = sizeof...(rates);
+        SampleFrequencyList<rates...> m_tSamFreq;
+    } USB_PACKED;
+
+    /**
+      * The isochronous data endpoint, and its class-specific descriptor.
+      * Both are emitted together, as the latter has to follow the former.
+      * With explicitFeedback, the FeedbackEndpointDescriptor must come right
+      * after this one in the EndpointDescriptorList, since bSynchAddress is
+      * derived from its position.
+      */
+    template<
+        typename EndpointAddress,
+        typename EndpointAttributes,
+        typename Format,
+        bool explicitFeedback = false,
+        typename Interval = USB::Interval<1>
+    >
+    struct StreamingEndpointDescriptor : USB::EndpointDescriptorBase {
+        constexpr StreamingEndpointDescriptor(size_t index)
+            : m_bEndpointAddress(index)
+            , m_bSynchAddress(explicitFeedback ? (USB::In | (index + 2)) : 0) {
+            static_assert(std::is_base_of<USB::EndpointAddressBase, EndpointAddress>::value, "Wrong EndpointAddress type");
+            static_assert(std::is_base_of<USB::EndpointAttributesBase, EndpointAttributes>::value, "Wrong EndpointAttributes type");
+            static_assert(std::is_base_of<USB::OptionalDescriptorBase, Format>::value, "Wrong Format type");
+            static_assert(std::is_base_of<USB::IntervalBase, Interval>::value, "Wrong Interval type");
+            static_assert(Format::maxPacketSize <= 1023, "Format doesn't fit in a full speed isochronous endpoint");
+        }
+        uint8_t m_bLength = 9;
+        uint8_t m_bDescriptorType = 5;
+        EndpointAddress m_bEndpointAddress;
+        EndpointAttributes m_bmAttributes;
+        usb_template_helpers::pack16<Format::maxPacketSize> m_wMaxPacketSize;
+        Interval m_bInterval;
+        uint8_t m_bRefresh = 0;
+        uint8_t m_bSynchAddress;
+        // Class-specific isochronous endpoint descriptor. The sampling
+        // frequency control is advertised when there is a choice.
+        uint8_t m_bCSLength = 7;
+        uint8_t m_bCSDescriptorType = 0x25;
+        uint8_t m_bCSDescriptorSubtype = 0x01;
+        uint8_t m_bmCSAttributes = Format::bSamFreqType > 1 ? 0x01 : 0x00;
+        uint8_t m_bLockDelayUnits = 0;
+        usb_template_helpers::pack16<0> m_wLockDelay;
+
+        template<USB::Speed speed>
+        static constexpr unsigned periodicBytes() {
+            return USB::periodicEndpointBytes(speed, EndpointAttributes::transferType, Format::maxPacketSize);
+        }
+    } USB_PACKED;
+
+    // Explicit feedback endpoint, carrying a 10.14 samples per frame value,
+    // polled every 2^refresh frames.
+    template<uint8_t refresh = 1>
+    struct FeedbackEndpointDescriptor : USB::EndpointDescriptorBase {
+        constexpr FeedbackEndpointDescriptor(size_t index) : m_bEndpointAddress(index) {
+            static_assert(refresh >= 1 && refresh <= 9, "Feedback refresh out of range");
+        }
+        uint8_t m_bLength = 9;
+        uint8_t m_bDescriptorType = 5;
+        USB::EndpointAddress<USB::In> m_bEndpointAddress;
+        USB::IsochronousEndpoint<USB::NoSynchronisation, USB::FeedbackEndpoint> m_bmAttributes;
+        usb_template_helpers::pack16<3> m_wMaxPacketSize;
+        uint8_t m_bInterval = 1;
+        uint8_t m_bRefresh = refresh;
+        uint8_t m_bSynchAddress = 0;
+
+        template<USB::Speed speed>
+        static constexpr unsigned periodicBytes() {
+            return USB::periodicEndpointBytes(speed, decltype(m_bmAttributes)::transferType, 3);
+        }
+    } USB_PACKED;
+    } //namespace Audio
+    namespace MSOS20 {
+    /**
+      * Microsoft OS 2.0 descriptors. Windows 8.1 and later look for their
+      * PlatformCapability in the BOSDescriptor, then fetch the whole
+      * DescriptorSet it announces with a single vendor request: bRequest
+      * is the vendor code of the capability, and wIndex is
+      * USB_MSOS20_DESCRIPTOR_INDEX. The set is what binds a driver, such
+      * as WinUSB, without an INF. A CompatibleID right in the set applies
+      * to the whole device; for a composite device, it goes in the
+      * FunctionSubset of the interfaces it applies to, itself inside the
+      * ConfigurationSubset of their configuration.
+      *
+      * The bConfigurationValue of a ConfigurationSubset is, despite its
+      * name, the index of the configuration: that's how Windows reads it.
+      *
+      * All of the lengths, including the one of the set in the capability,
+      * are computed.
+      */
+    enum WindowsVersion : uint32_t {
+        Windows8_1 = 0x06030000,
+    };
+
+    enum PropertyDataType {
+        PropertyString = 1,
+        PropertyExpandString = 2,
+        PropertyBinary = 3,
+        PropertyMultiString = 7,
+    };
+
+    struct DescriptorBase { } USB_PACKED;
+    template<typename... types>
+    using descriptor_tuple = usb_template_helpers::typed_tuple<DescriptorBase, types...>;
+
+    // Registry strings are little endian unicode, and null terminated; a
+    // multi string gets one more null at the end of its list.
+    template<size_t terminators, typename string>
+    struct WideString;
+    template<size_t terminators, char... C>
+    struct WideString<terminators, irqus::typestring<C...>> : USB::StringChecker<C...> {
+        static constexpr size_t size = (sizeof...(C) + terminators) * 2;
+        USB::StringChar m_chars[sizeof...(C) + terminators] = { { static_cast<uint8_t>(C), 0 }... };
+    } USB_PACKED;
+
+    template<typename ID, typename SubID = irqus::typestring<>>
+    struct CompatibleID;
+    template<char... ID, char... SubID>
+    struct CompatibleID<irqus::typestring<ID...>, irqus::typestring<SubID...>> : DescriptorBase {
+        constexpr CompatibleID() {
+            static_assert(sizeof...(ID) <= 8 && sizeof...(SubID) <= 8, "Compatible IDs are at most 8 characters long");
+        }
+        usb_template_helpers::pack16<20> m_wLength;
+        usb_template_helpers::pack16<3> m_wDescriptorType;
+        uint8_t m_CompatibleID[8] = { static_cast<uint8_t>(ID)... };
+        uint8_t m_SubCompatibleID[8] = { static_cast<uint8_t>(SubID)... };
+    } USB_PACKED;
+    using CompatibleID_WinUSB = CompatibleID<typestring_is("WINUSB")>;
+
+    template<PropertyDataType type, typename Name, typename Data>
+    struct RegistryProperty : DescriptorBase {
+        using name = WideString<1, Name>;
+        using data = WideString<type == PropertyMultiString ? 2 : 1, Data>;
+        usb_template_helpers::pack16<10 + name::size + data::size> m_wLength;
+        usb_template_helpers::pack16<4> m_wDescriptorType;
+        usb_template_helpers::pack16<type> m_wPropertyDataType;
+        usb_template_helpers::pack16<name::size> m_wPropertyNameLength;
+        name m_PropertyName;
+        usb_template_helpers::pack16<data::size> m_wPropertyDataLength;
+        data m_PropertyData;
+    } USB_PACKED;
+    // What applications open the WinUSB device by: one GUID, braces included.
+    template<typename GUID>
+    using DeviceInterfaceGUIDs = RegistryProperty<PropertyMultiString, typestring_is("DeviceInterfaceGUIDs"), GUID>;
+
+    template<uint8_t firstInterface, typename... features>
+    struct FunctionSubset : DescriptorBase {
+        constexpr FunctionSubset() {
+            static_assert(sizeof...(features) > 0, "Empty FunctionSubset");
+        }
+        usb_template_helpers::pack16<8> m_wLength;
+        usb_template_helpers::pack16<2> m_wDescriptorType;
+        uint8_t m_bFirstInterface = firstInterface;
+        uint8_t m_bReserved = 0;
+        usb_template_helpers::pack16<8 + sizeof(descriptor_tuple<features...>)> m_wSubsetLength;
+        descriptor_tuple<features...> m_features;
+    } USB_PACKED;
+
+    template<uint8_t configurationIndex, typename... functions>
+    struct ConfigurationSubset : DescriptorBase {
+        constexpr ConfigurationSubset() {
+            static_assert(sizeof...(functions) > 0, "Empty ConfigurationSubset");
+        }
+        usb_template_helpers::pack16<8> m_wLength;
+        usb_template_helpers::pack16<1> m_wDescriptorType;
+        uint8_t m_bConfigurationValue = configurationIndex;
+        uint8_t m_bReserved = 0;
+        usb_template_helpers::pack16<8 + sizeof(descriptor_tuple<functions...>)> m_wTotalLength;
+        descriptor_tuple<functions...> m_functions;
+    } USB_PACKED;
+
+    // Top level, meant to be instanciated next to the BOSDescriptor.
+    template<WindowsVersion version, typename... descriptors>
+    struct DescriptorSet {
+        static constexpr WindowsVersion windowsVersion = version;
+        constexpr DescriptorSet() {
+            static_assert(sizeof...(descriptors) > 0, "Empty DescriptorSet");
+        }
+        usb_template_helpers::pack16<10> m_wLength;
+        usb_template_helpers::pack16<0> m_wDescriptorType;
+        usb_template_helpers::pack32<version> m_dwWindowsVersion;
+        usb_template_helpers::pack16<10 + sizeof(descriptor_tuple<descriptors...>)> m_wTotalLength;
+        descriptor_tuple<descriptors...> m_descriptors;
+    } USB_PACKED;
+
+    template<WindowsVersion version, size_t setLength, uint8_t vendorCode>
+    struct PlatformCapabilityData {
+        usb_template_helpers::pack32<version> m_dwWindowsVersion;
+        usb_template_helpers::pack16<setLength> m_wMSOSDescriptorSetTotalLength;
+        uint8_t m_bMS_VendorCode = vendorCode;
+        uint8_t m_bAltEnumCode = 0;
+    } USB_PACKED;
+
+    // {D8DD60DF-4589-4CC7-9CD2-659D9E648A9F}
+    using PlatformUUID = USB::UUID<0xd8dd60df, 0x4589, 0x4cc7, 0x9cd2, 0x659d9e648a9f>;
+
+    template<uint8_t vendorCode, typename DescriptorSet>
+    struct PlatformCapability
+        : USB::PlatformCapability<
+            PlatformUUID,
+            PlatformCapabilityData<DescriptorSet::windowsVersion, sizeof(DescriptorSet), vendorCode>> { } USB_PACKED;
+    } //namespace MSOS20
 } // namespace USB
 
 #undef USB_PACKED